@@ -1,4 +1,5 @@
 #include "animationwindow.h"
+#include "perfhud.h"
 #include <QVBoxLayout>  // 添加垂直布局头文件
 #include <QPainter>
 #include <QRandomGenerator>
@@ -13,6 +14,7 @@ AnimationWindow::AnimationWindow(QWidget *parent) : QWidget(parent) {
     setMinimumSize(1440, 960);  // 设置最小大小，但允许用户调整窗口大小
     setAttribute(Qt::WA_OpaquePaintEvent);
     setMouseTracking(true);  // 启用鼠标跟踪
+    setFocusPolicy(Qt::StrongFocus);  // 接收 F3
     
     canvas = new CanvasWidget(this);
     canvas->setBackgroundColor(Qt::black); // 设置动画窗口画布背景
@@ -20,6 +22,8 @@ AnimationWindow::AnimationWindow(QWidget *parent) : QWidget(parent) {
     canvas->setLineStyle(Qt::DotLine);  // 使用点线样式
     canvas->setPenWidth(1);             // 固定线宽
     canvas->setMouseTransparent(true);  // 启用鼠标穿透
+    canvas->setRetainGeometry(false);   // 每帧重画的粒子不记入图元文档
+    canvas->setHistoryEnabled(false);   // 也不记撤销历史
     canvas->setAttribute(Qt::WA_TransparentForMouseEvents);  // 确保canvas不拦截鼠标事件
 
     backButton = new QPushButton("返回主界面", this);
@@ -37,8 +41,8 @@ AnimationWindow::AnimationWindow(QWidget *parent) : QWidget(parent) {
     // 创建切换算法按钮
     algoButton = new QPushButton("切换算法", this);
     connect(algoButton, &QPushButton::clicked, [this](){
-        ParticleEffect effects[] = {LineBresenham, LineMidpoint, Circle};
-        int next = (static_cast<int>(m_effect) + 1) % 3;
+        ParticleEffect effects[] = {LineBresenham, LineMidpoint, LineWu, Circle};
+        int next = (static_cast<int>(m_effect) + 1) % 4;
         setParticleEffect(effects[next]);
     });
 
@@ -87,34 +91,68 @@ AnimationWindow::~AnimationWindow() {
 }
 
 void AnimationWindow::paintEvent(QPaintEvent *event) {
-    QPainter painter(this);  // 必须创建QPainter实例
+    CANVAS_PERF_TIMER(renderTimer, ParticleRenderNanos);
+    PerfPainter painter(this);  // 必须创建QPainter实例
     
     // 清空并重置画布背景
     canvas->clearCanvas();
     
     // 绘制所有粒子轨迹（永久保留）
+    m_batch.clear();
     for (const auto& firework : m_fireworks) {
         for (const auto& p : firework) {
             if(m_effect == Circle) {
-                canvas->drawCircle(p.position().toPoint(), 
-                                 p.size()/2, 
-                                 p.color(),
-                                 qMax(1, p.size()/4));
+                m_batch.addCircle(p.position().toPoint(),
+                                  p.size()/2,
+                                  p.color().rgba(),
+                                  qMax(1, p.size()/4));
             } else {
-                canvas->drawLine(
-                    p.position().toPoint(),
-                    p.position().toPoint() + p.velocity().toPoint() * 3,
-                    p.color(),
-                    qMax(2, p.size()/2)
-                );
+                QPoint start = p.position().toPoint();
+                m_batch.addLine(start,
+                                start + p.velocity().toPoint() * 3,
+                                p.color().rgba(),
+                                qMax(2, p.size()/2));
             }
         }
     }
+    // 整帧图元一次性批量光栅化（直接写帧缓冲时分块并行）
+    canvas->drawBatch(m_batch);
     
     canvas->render(&painter);  // 正确使用QPainter指针
+
+#if CANVAS_PERF_COUNTERS
+    if (m_perfHud) {
+        using namespace Raster::Perf;
+        const Snapshot now = snapshot();
+        const Snapshot frame = now - m_perfLast;
+        m_perfLast = now;
+        int particles = 0;
+        for (const auto& firework : m_fireworks) particles += firework.size();
+
+        QStringList lines;
+        lines << QString("粒子  %1").arg(particles)
+              << QString("更新  %1   绘制  %2").arg(PerfHud::formatNanos(frame[ParticleUpdateNanos]),
+                                                PerfHud::formatNanos(frame[ParticleRenderNanos]))
+              << QString("画布 paintEvent  %1").arg(PerfHud::formatNanos(frame[PaintNanos]));
+        lines << PerfHud::rasterLines(frame);
+        lines << PerfHud::imageLine("canvasImage", canvas->getCanvasImage());
+        PerfHud::draw(painter, lines);
+    }
+#endif
+}
+
+void AnimationWindow::keyPressEvent(QKeyEvent *event) {
+    if (event->key() == Qt::Key_F3) {
+        m_perfHud = !m_perfHud;
+        m_perfLast = Raster::Perf::snapshot();
+        event->accept();
+        return;
+    }
+    QWidget::keyPressEvent(event);
 }
 
 void AnimationWindow::updateParticles() {
+    CANVAS_PERF_TIMER(updateTimer, ParticleUpdateNanos);
     // 更新现有粒子
     for (auto& firework : m_fireworks) {
         for (auto& p : firework) {
@@ -212,6 +250,10 @@ void AnimationWindow::setParticleEffect(ParticleEffect effect) {
         canvas->setLineAlgorithm(CanvasWidget::Midpoint);
         effectName = "中点线条";
         break;
+    case LineWu:
+        canvas->setLineAlgorithm(CanvasWidget::Wu);
+        effectName = "Wu反走样线条";
+        break;
     case Circle:
         effectName = "圆形粒子";
         break;
@@ -241,7 +283,8 @@ void AnimationWindow::mousePressEvent(QMouseEvent *event) {
 
 void AnimationWindow::updateAlgorithmDisplay() {
     CanvasWidget::LineAlgorithm algo = canvas->getLineAlgorithm();
-    QString algoName = (algo == CanvasWidget::Bresenham) ? "Bresenham" : "中点算法";
+    QString algoName = (algo == CanvasWidget::Bresenham) ? "Bresenham" :
+                       (algo == CanvasWidget::Midpoint) ? "中点算法" : "Wu反走样";
     algorithmLabel->setText("当前算法: " + algoName);
 }
 
@@ -254,7 +297,7 @@ void AnimationWindow::resizeEvent(QResizeEvent *event) {
 
 void AnimationWindow::clearCanvas() {
     // 仅清除画布区域
-    QPainter painter(this);
+    PerfPainter painter(this);
     painter.fillRect(canvas->geometry(), Qt::black); // 仅填充画布区域
     canvas->clearCanvas();
     update();
@@ -13,6 +13,7 @@
 enum ParticleEffect {
     LineBresenham,
     LineMidpoint,
+    LineWu,
     Circle
 };
 
@@ -40,6 +41,7 @@ protected:
     void paintEvent(QPaintEvent *event) override;
     void mousePressEvent(QMouseEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;  // F3 开关性能面板
 
 private slots:
     void updateParticles();
@@ -53,10 +55,13 @@ private:
     QTimer *m_timer;
     QList<Particle> m_particles;
     QList<QList<Particle>> m_fireworks;
+    Raster::RasterBatch m_batch; // 每帧复用的图元缓冲
     QColor randomColor() const;
     CanvasWidget *canvas;
     ParticleEffect m_effect = LineBresenham;
     ColorMode m_colorMode = SingleColorPerFirework;
+    bool m_perfHud = false;
+    Raster::Perf::Snapshot m_perfLast;   // 上一帧结束时的计数
     
 signals:
     void backToMain();
@@ -0,0 +1,171 @@
+#include "canvasraster.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+
+// 除了计时，还检查 drawMidpointArc 画出的像素：整圆与逐点画出的中点圆相同，
+// 圆弧只含圆上的点，并且按角度明确在弧内的点都画了、明确在弧外的都没画（端点附近留两个像素的余量）。
+// 不一致时返回非零
+
+// 改写前的圆弧实现（每步多次 atan2/fmod，并额外插值三个“中间点”），仅用于对比
+template <typename Plot>
+static void legacyMidpointArc(QPoint center, int radius, double startAngle, double endAngle, Plot plot) {
+    int x = radius;
+    int y = 0;
+    int p = 1 - radius;
+
+    startAngle = qDegreesToRadians(startAngle);
+    endAngle = qDegreesToRadians(endAngle);
+    if (endAngle < startAngle) endAngle += 2*M_PI;
+
+    auto inAngleRange = [](double angle, double start, double end) {
+        angle = fmod(angle, 2*M_PI);
+        if (angle < 0) angle += 2*M_PI;
+        return (start <= end) ? (angle >= start && angle <= end) : (angle >= start || angle <= end);
+    };
+
+    while (x >= y) {
+        double baseAngle = atan2(-y, x);
+        if (inAngleRange(baseAngle, startAngle, endAngle)) {
+            plot(center.x() + x, center.y() - y);
+        }
+
+        double symAngle = M_PI_2 - baseAngle;
+        if (inAngleRange(symAngle, startAngle, endAngle)) {
+            plot(center.x() + y, center.y() - x);
+        }
+
+        for (int i = 1; i <= 3; ++i) {
+            double ratio = i * 0.25;
+            int px = x - static_cast<int>(x * ratio);
+            int py = y + static_cast<int>(y * ratio);
+
+            if (px < 0 || py < 0) continue;
+
+            double midAngle = atan2(-py, px);
+            if (inAngleRange(midAngle, startAngle, endAngle)) {
+                plot(center.x() + px, center.y() - py);
+            }
+        }
+
+        y++;
+        if (p <= 0) {
+            p += 2 * y + 1;
+        } else {
+            x--;
+            p += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// 重复绘制若干次，返回每次的平均耗时（微秒）
+template <typename Fn>
+static double measure(int iterations, Fn fn) {
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+    return timer.nsecsElapsed() / 1000.0 / iterations;
+}
+
+// 中点圆的全部像素，不经过八分圆边界，作为参照
+static void referenceCircle(QImage &image, QPoint center, int radius) {
+    int x = radius;
+    int y = 0;
+    int p = 1 - radius;
+    while (x >= y) {
+        const QPoint points[8] = { { x, -y }, { y, -x }, { -y, -x }, { -x, -y },
+                                   { -x, y }, { -y, x }, { y, x }, { x, y } };
+        for (const QPoint &point : points) image.setPixel(center + point, 0xff000000u);
+        y++;
+        if (p <= 0) {
+            p += 2 * y + 1;
+        } else {
+            x--;
+            p += 2 * (y - x) + 1;
+        }
+    }
+}
+
+static int checkArcs() {
+    QRandomGenerator random(2024);
+    const int size = 2100;
+    const QPoint center(size / 2, size / 2);
+    QImage circle(size, size, QImage::Format_ARGB32);
+    QImage arc(size, size, QImage::Format_ARGB32);
+    int mismatches = 0;
+
+    for (int round = 0; round < 300; ++round) {
+        const int radius = 1 + random.bounded(1000);
+        circle.fill(Qt::transparent);
+        referenceCircle(circle, center, radius);
+
+        arc.fill(Qt::transparent);
+        {
+            SpanWriter writer(arc, Qt::black, 1);
+            Raster::drawMidpointArc(writer, center, radius, 0, 0, true, Qt::SolidLine);
+        }
+        if (arc != circle) ++mismatches;
+
+        const double start = random.bounded(720) - 360;
+        const double sweep = 1 + random.bounded(358);
+        arc.fill(Qt::transparent);
+        {
+            SpanWriter writer(arc, Qt::black, 1);
+            Raster::drawMidpointArc(writer, center, radius, start, start + sweep, false, Qt::SolidLine);
+        }
+        const double margin = qRadiansToDegrees(2.0 / radius);
+        const QRect bounds(center - QPoint(radius, radius), center + QPoint(radius, radius));
+        for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+            for (int x = bounds.left(); x <= bounds.right(); ++x) {
+                const bool drawn = arc.pixel(x, y) != 0;
+                if (circle.pixel(x, y) == 0) {
+                    if (drawn) ++mismatches;
+                    continue;
+                }
+                // 数学角度（逆时针，屏幕 y 轴向下），相对起点
+                double angle = qRadiansToDegrees(std::atan2(double(center.y() - y), double(x - center.x())));
+                angle = std::fmod(angle - start + 720.0, 360.0);
+                if (angle >= margin && angle <= sweep - margin && !drawn) ++mismatches;
+                if (angle >= sweep + margin && angle <= 360.0 - margin && drawn) ++mismatches;
+            }
+        }
+    }
+    return mismatches;
+}
+
+int main() {
+    const int mismatches = checkArcs();
+
+    const int radii[] = { 50, 200, 1000, 4000 };
+    QImage image(8200, 8200, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    const QPoint center(4100, 4100);
+
+    std::printf("%8s %14s %14s %14s %10s\n", "radius", "legacy(us)", "integer(us)", "direct(us)", "speedup");
+    for (int radius : radii) {
+        const int iterations = qMax(20, 200000 / radius);
+        long long sink = 0;
+
+        double legacy = measure(iterations, [&](int i) {
+            double start = (i * 37) % 360;
+            legacyMidpointArc(center, radius, start, start + 90, [&](int x, int y) { sink += x ^ y; });
+        });
+        double integer = measure(iterations, [&](int i) {
+            double start = (i * 37) % 360;
+            Raster::midpointArc(center, radius, start, start + 90, false, Qt::SolidLine,
+                                [&](int x, int y) { sink += x ^ y; });
+        });
+        double direct = measure(iterations, [&](int i) {
+            double start = (i * 37) % 360;
+            SpanWriter writer(image, Qt::black, 1);
+            Raster::drawMidpointArc(writer, center, radius, start, start + 90, false, Qt::DashLine);
+        });
+
+        std::printf("%8d %14.2f %14.2f %14.2f %9.1fx   (%lld)\n",
+                    radius, legacy, integer, direct, legacy / integer, sink & 1);
+    }
+    std::printf("mismatches: %d\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
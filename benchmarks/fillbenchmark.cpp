@@ -0,0 +1,131 @@
+#include "canvasraster.h"
+#include "colormatch.h"
+#include "tiledfloodfill.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+
+// 分块并行填充必须与 Raster::floodFill 逐像素相同，SIMD 匹配内核必须与逐像素的 matches() 相同；
+// 不一致时返回非零。另外比较精确匹配与两种容差在同一片区域上的填充耗时
+using Raster::ColorMatcher;
+
+// 几种相近和相差很远的颜色拼成的色块，再撒些散点，让四连通和八连通的结果不同
+static const QRgb Palette[] = { 0xff808080u, 0xff848286u, 0xff8a8a8au, 0xff202020u, 0x80808080u };
+
+static QImage randomImage(QRandomGenerator &random) {
+    QImage image(1 + random.bounded(400), 1 + random.bounded(300), QImage::Format_ARGB32);
+    image.fill(Palette[0]);
+    for (int n = random.bounded(40); n > 0; --n) {
+        const QRect rect = QRect(random.bounded(image.width()), random.bounded(image.height()),
+                                 1 + random.bounded(120), 1 + random.bounded(120)).intersected(image.rect());
+        const QRgb color = Palette[random.bounded(5)];
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            for (int x = rect.left(); x <= rect.right(); ++x) image.setPixel(x, y, color);
+        }
+    }
+    for (int n = image.width() * image.height() / 8; n > 0; --n) {
+        image.setPixel(random.bounded(image.width()), random.bounded(image.height()), Palette[random.bounded(5)]);
+    }
+    return image;
+}
+
+static int checkTiledFill(QRandomGenerator &random) {
+    const int tolerances[] = { 0, 8, 12 };
+    int mismatches = 0;
+    for (int round = 0; round < 200; ++round) {
+        const QImage image = randomImage(random);
+        const QPoint seed(random.bounded(image.width()), random.bounded(image.height()));
+        const Raster::Connectivity connectivity = round % 2 ? Raster::EightWay : Raster::FourWay;
+        const int tolerance = tolerances[random.bounded(3)];
+        const Raster::ToleranceMetric metric = random.bounded(2) ? Raster::Euclidean : Raster::PerChannel;
+        // 新颜色有时就在容差内，走访问标记的路径
+        const QRgb newColor = random.bounded(2) ? 0xffff0000u : 0xff828282u;
+
+        QImage expected = image;
+        Raster::floodFill(expected, seed, newColor, connectivity, tolerance, metric);
+
+        QImage tiled = image;
+        Raster::TiledFloodFill fill(tiled, seed, newColor, connectivity, tolerance, metric,
+                                    32 * (1 + random.bounded(4)));
+        fill.start(4);
+        fill.waitForFinished();
+        if (tiled != expected) ++mismatches;
+    }
+    return mismatches;
+}
+
+static int checkMatcher(QRandomGenerator &random) {
+    int mismatches = 0;
+    QVector<QRgb> line(300);
+    for (int round = 0; round < 2000; ++round) {
+        const QRgb reference = Palette[random.bounded(5)];
+        const int tolerance = random.bounded(4) == 0 ? 0 : random.bounded(511);
+        const ColorMatcher matcher(reference, tolerance, random.bounded(2) ? Raster::Euclidean : Raster::PerChannel);
+        // 参考色附近的像素，让匹配和不匹配的段交替出现
+        const int spread = 1 + random.bounded(64);
+        for (QRgb &pixel : line) {
+            QRgb value = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                const int channel = int((reference >> shift) & 0xff) + random.bounded(2 * spread + 1) - spread;
+                value |= QRgb(qBound(0, channel, 255)) << shift;
+            }
+            pixel = random.bounded(3) ? value : reference;
+        }
+
+        const int begin = random.bounded(line.size());
+        const int end = begin + random.bounded(line.size() - begin + 1);
+        int match = begin, mismatch = begin;
+        while (match < end && !matcher.matches(line[match])) ++match;
+        while (mismatch < end && matcher.matches(line[mismatch])) ++mismatch;
+        if (matcher.findMatch(line.constData(), begin, end) != match) ++mismatches;
+        if (matcher.findMismatch(line.constData(), begin, end) != mismatch) ++mismatches;
+
+        if (begin < end && matcher.matches(line[end - 1])) {
+            int left = end - 1;
+            while (left > begin && matcher.matches(line[left - 1])) --left;
+            if (matcher.extendLeft(line.constData(), end - 1, begin) != left) ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// 同一片区域按给定容差填充若干次，返回每次的平均耗时（毫秒）
+static double timeFill(const QImage &image, QPoint seed, int tolerance, Raster::ToleranceMetric metric) {
+    const int iterations = 5;
+    double total = 0;
+    for (int i = 0; i < iterations; ++i) {
+        QImage target = image.copy();   // 拷贝不计入填充时间
+        QElapsedTimer timer;
+        timer.start();
+        Raster::floodFill(target, seed, 0xffff0000u, Raster::FourWay, tolerance, metric);
+        total += timer.nsecsElapsed() / 1e6;
+    }
+    return total / iterations;
+}
+
+int main() {
+    QRandomGenerator random(2024);
+    const int fillMismatches = checkTiledFill(random);
+    const int matcherMismatches = checkMatcher(random);
+
+    // 白底上的黑框：三种模式填的都是框内同一片区域
+    const int size = 4000;
+    QImage canvas(size, size, QImage::Format_ARGB32);
+    canvas.fill(0xffffffffu);
+    for (int i = 0; i < size; ++i) {
+        canvas.setPixel(i, 100, 0xff000000u);
+        canvas.setPixel(i, size - 100, 0xff000000u);
+        canvas.setPixel(100, i, 0xff000000u);
+        canvas.setPixel(size - 100, i, 0xff000000u);
+    }
+    const QPoint seed(size / 2, size / 2);
+    const double exact = timeFill(canvas, seed, 0, Raster::PerChannel);
+    const double channel = timeFill(canvas, seed, 32, Raster::PerChannel);
+    const double distance = timeFill(canvas, seed, 32, Raster::Euclidean);
+
+    std::printf("kernel: %s\n", Raster::colorMatchKernel());
+    std::printf("%dx%d region: exact %.2f ms, per-channel %.2f ms (%.2fx), euclidean %.2f ms (%.2fx)\n",
+                size - 201, size - 201, exact, channel, channel / exact, distance, distance / exact);
+    std::printf("mismatches: tiled fill %d, color match %d\n", fillMismatches, matcherMismatches);
+    return fillMismatches == 0 && matcherMismatches == 0 ? 0 : 1;
+}
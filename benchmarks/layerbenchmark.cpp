@@ -0,0 +1,101 @@
+#include "layerstack.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+
+// SIMD 合成内核必须与标量实现逐像素一致，分块缓存必须与从头合成一致；不一致时返回非零
+using Raster::LayerStack;
+
+static void scribble(QImage &image, QRandomGenerator &random, const QRect &rect) {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            // 四分之一全透明，其余随机 alpha
+            const QRgb value = random.generate();
+            image.setPixel(x, y, random.bounded(4) == 0 ? value & 0x00ffffffu : value);
+        }
+    }
+}
+
+int main() {
+    QRandomGenerator random(2024);
+    int mismatches = 0;
+
+    // 各种长度、模式和不透明度下 SIMD 与标量结果相同
+    for (int round = 0; round < 2000; ++round) {
+        const int count = random.bounded(70);
+        QVector<QRgb> source(count), target(count);
+        for (QRgb &p : source) p = random.generate();
+        for (QRgb &p : target) {
+            const QRgb c = random.generate();
+            const int a = qAlpha(c);
+            p = qRgba(qRed(c) * a / 255, qGreen(c) * a / 255, qBlue(c) * a / 255, a);
+        }
+        const auto mode = Raster::BlendMode(random.bounded(4));
+        const int opacity = 1 + random.bounded(255);
+        QVector<QRgb> expected = target;
+        Raster::blendLayerSpanScalar(expected.data(), source.constData(), count, mode, opacity);
+        Raster::blendLayerSpan(target.data(), source.constData(), count, mode, opacity);
+        if (target != expected) ++mismatches;
+    }
+
+    // 局部改动后取回的合成结果与整幅从头合成的一致
+    const QRect window(0, 0, 700, 500);
+    LayerStack check(64);
+    check.setWindow(window);
+    QImage current(window.size(), QImage::Format_ARGB32);
+    Raster::TiledCanvas document;
+    scribble(current, random, current.rect());
+    for (int n = 1; n < 5; ++n) {
+        check.setCurrent(check.insert(n, QString()), current, document);
+        scribble(current, random, current.rect());
+        check.setBlendMode(n, Raster::BlendMode(n % 4));
+        check.setOpacity(n, 0.3 + 0.15 * n);
+    }
+    for (int step = 0; step < 20; ++step) {
+        const QRect rect = QRect(random.bounded(700), random.bounded(500), 1 + random.bounded(100),
+                                 1 + random.bounded(100)).intersected(current.rect());
+        scribble(current, random, rect);
+        check.invalidate(current, rect);
+        if (check.flattened(current, current.rect()) != check.flatten(current, window)) ++mismatches;
+    }
+
+    // 32 个整幅不透明度 0.5 的图层
+    const int size = 2048;
+    const int layers = 32;
+    LayerStack stack;
+    stack.setWindow(QRect(0, 0, size, size));
+    QImage canvas(size, size, QImage::Format_ARGB32);
+    Raster::TiledCanvas canvasDocument;
+    for (int n = 0; n < layers; ++n) {
+        if (n > 0) stack.setCurrent(stack.insert(n, QString()), canvas, canvasDocument);
+        canvas.fill(qRgba(n * 8, 255 - n * 8, 128, 200));
+        stack.setOpacity(n, 0.5);
+        stack.setBlendMode(n, Raster::BlendMode(n % 4));
+    }
+    QElapsedTimer timer;
+
+    timer.start();
+    stack.flattened(canvas, canvas.rect());
+    const double fullBuild = timer.nsecsElapsed() / 1e6;
+
+    const int frames = 200;
+    timer.restart();
+    for (int i = 0; i < frames; ++i) stack.flattened(canvas, canvas.rect());
+    const double cached = timer.nsecsElapsed() / 1e6 / frames;
+
+    // 当前层上一笔小改动之后，只重算被碰到的块
+    timer.restart();
+    for (int i = 0; i < frames; ++i) {
+        const QRect rect(random.bounded(size - 32), random.bounded(size - 32), 32, 32);
+        canvas.setPixel(rect.center(), 0xff000000u);
+        stack.invalidate(canvas, rect);
+        stack.flattened(canvas, canvas.rect());
+    }
+    const double strokeUpdate = timer.nsecsElapsed() / 1e6 / frames;
+
+    std::printf("kernel: %s\n", Raster::layerBlendKernel());
+    std::printf("%dx%d, %d layers: full composite %.2f ms, unchanged %.3f ms, after a small stroke %.3f ms\n",
+                size, size, layers, fullBuild, cached, strokeUpdate);
+    std::printf("mismatches: %d\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "mippyramid.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+
+// 缩略图必须与逐像素的 2×2 平均一致；不一致时返回非零
+using Raster::MipPyramid;
+
+static QImage referenceHalf(const QImage &source) {
+    QImage result((source.width() + 1) / 2, (source.height() + 1) / 2, QImage::Format_ARGB32);
+    for (int y = 0; y < result.height(); ++y) {
+        for (int x = 0; x < result.width(); ++x) {
+            const int x1 = qMin(2 * x + 1, source.width() - 1);
+            const int y1 = qMin(2 * y + 1, source.height() - 1);
+            const QRgb p[4] = { source.pixel(2 * x, 2 * y), source.pixel(x1, 2 * y),
+                                source.pixel(2 * x, y1), source.pixel(x1, y1) };
+            QRgb value = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                int sum = 2;
+                for (QRgb q : p) sum += (q >> shift) & 0xff;
+                value |= QRgb(sum >> 2) << shift;
+            }
+            result.setPixel(x, y, value);
+        }
+    }
+    return result;
+}
+
+static void scribble(QImage &image, QRandomGenerator &random, const QRect &rect) {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            image.setPixel(x, y, random.generate());
+        }
+    }
+}
+
+int main() {
+    QRandomGenerator random(2024);
+    int mismatches = 0;
+
+    // 奇数尺寸、各种块大小下，局部改动后取回的各级缩略图与从头算的一致
+    for (int round = 0; round < 50; ++round) {
+        QImage image(1 + random.bounded(700), 1 + random.bounded(500), QImage::Format_ARGB32);
+        scribble(image, random, image.rect());
+        MipPyramid pyramid(16 + random.bounded(200));
+        for (int step = 0; step < 10; ++step) {
+            const QRect rect = QRect(random.bounded(image.width()), random.bounded(image.height()),
+                                     1 + random.bounded(100), 1 + random.bounded(100)).intersected(image.rect());
+            scribble(image, random, rect);
+            pyramid.invalidate(image, rect);
+
+            const int level = 1 + random.bounded(int(MipPyramid::MaxLevel));
+            QImage expected = image;
+            for (int n = 0; n < level; ++n) expected = referenceHalf(expected);
+            if (pyramid.level(image, level, image.rect()) != expected) ++mismatches;
+        }
+    }
+
+    const int size = 8000;
+    QImage canvas(size, size, QImage::Format_ARGB32);
+    canvas.fill(0xffffffffu);
+    MipPyramid pyramid;
+    QElapsedTimer timer;
+
+    timer.start();
+    pyramid.level(canvas, 3, canvas.rect());
+    const double fullBuild = timer.nsecsElapsed() / 1e6;
+
+    // 一笔小改动之后，只补算被碰到的块
+    const int strokes = 200;
+    timer.restart();
+    for (int i = 0; i < strokes; ++i) {
+        const QRect rect(random.bounded(size - 32), random.bounded(size - 32), 32, 32);
+        canvas.setPixel(rect.center(), 0xff000000u);
+        pyramid.invalidate(canvas, rect);
+        pyramid.level(canvas, 3, canvas.rect());
+    }
+    const double strokeUpdate = timer.nsecsElapsed() / 1e6 / strokes;
+
+    std::printf("kernel: %s\n", Raster::boxFilterKernel());
+    std::printf("%dx%d, levels 1-3: full build %.2f ms, after a small stroke %.3f ms\n",
+                size, size, fullBuild, strokeUpdate);
+    std::printf("mismatches: %d\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "primitivestore.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+#include <cmath>
+
+// 网格索引与逐个比较包围盒的结果必须一致；不一致时返回非零
+using Raster::PrimitiveStore;
+
+static QVector<int> bruteQuery(const PrimitiveStore &store, const QRect &rect) {
+    QVector<int> result;
+    for (int index = 0; index < store.size(); ++index) {
+        if (store.isAlive(index) && store.bounds(index).intersects(rect)) result.append(index);
+    }
+    return result;
+}
+
+static QVector<int> bruteOutside(const PrimitiveStore &store, const QRect &rect) {
+    QVector<int> result;
+    for (int index = 0; index < store.size(); ++index) {
+        if (store.isAlive(index) && !store.bounds(index).intersects(rect)) result.append(index);
+    }
+    return result;
+}
+
+static int bruteHitTest(const PrimitiveStore &store, QPointF point, double tolerance) {
+    const int margin = int(std::ceil(tolerance));
+    const QRect area = QRect(point.toPoint(), QSize(1, 1)).adjusted(-margin, -margin, margin, margin);
+    for (int index = store.size() - 1; index >= 0; --index) {
+        if (!store.isAlive(index) || !store.bounds(index).intersects(area)) continue;
+        if (store.hits(index, point, tolerance)) return index;
+    }
+    return -1;
+}
+
+static void addRandom(PrimitiveStore &store, QRandomGenerator &random, int extent) {
+    const PrimitiveStore::Pen pen = { 0xff000000u, 1 + random.bounded(8), Qt::SolidLine, Raster::Bresenham };
+    const QPoint a(random.bounded(extent), random.bounded(extent));
+    const QPoint b = a + QPoint(random.bounded(-200, 200), random.bounded(-200, 200));
+    switch (random.bounded(6)) {
+    case 0:
+        store.addLine(a, b, pen);
+        break;
+    case 1:
+        store.addCircle(a, random.bounded(150), pen);
+        break;
+    case 2:
+        store.addArc(a, random.bounded(150), random.bounded(360), random.bounded(360), pen);
+        break;
+    default: {
+        QVector<QPoint> points;
+        const int count = 2 + random.bounded(8);
+        for (int k = 0; k < count; ++k) {
+            points.append(a + QPoint(random.bounded(-100, 100), random.bounded(-100, 100)));
+        }
+        if (random.bounded(3) == 0) {
+            store.addBezier(points, pen);
+        } else if (random.bounded(2) == 0) {
+            store.addPolygon(points, pen);
+        } else {
+            store.addPolyline(points, pen);
+        }
+        break;
+    }
+    }
+    // 偶尔加一个覆盖大片区域的图元，走大图元表
+    if (random.bounded(500) == 0) {
+        store.addLine(QPointF(0, 0), QPointF(extent, extent), pen);
+    }
+}
+
+int main() {
+    QRandomGenerator random(2024);
+    const int extent = 20000;
+    const int shapes = 50000;
+    PrimitiveStore store;
+    int mismatches = 0;
+
+    for (int i = 0; i < shapes; ++i) {
+        addRandom(store, random, extent);
+        if (random.bounded(10) == 0) store.remove(random.bounded(store.size()));
+        if (random.bounded(200) == 0) {
+            // 撤销再重做一段，索引要跟着进出
+            const int revision = store.revision();
+            store.setRevision(revision - random.bounded(50));
+            if (random.bounded(2) == 0) store.setRevision(revision);
+        }
+    }
+
+    const int queries = 2000;
+    QVector<QRect> rects;
+    QVector<QPointF> points;
+    for (int i = 0; i < queries; ++i) {
+        const QPoint corner(random.bounded(-500, extent), random.bounded(-500, extent));
+        rects.append(QRect(corner, QSize(1 + random.bounded(1500), 1 + random.bounded(1500))));
+        points.append(QPointF(random.bounded(extent), random.bounded(extent)));
+    }
+
+    QElapsedTimer timer;
+    long long sink = 0;
+    timer.start();
+    for (const QRect &rect : rects) sink += store.query(rect).size();
+    const double gridQuery = timer.nsecsElapsed() / 1000.0 / queries;
+    timer.restart();
+    for (const QRect &rect : rects) sink -= bruteQuery(store, rect).size();
+    const double bruteQueryTime = timer.nsecsElapsed() / 1000.0 / queries;
+
+    timer.restart();
+    for (const QPointF &point : points) sink += store.hitTest(point, 3.0);
+    const double gridHit = timer.nsecsElapsed() / 1000.0 / queries;
+    timer.restart();
+    for (const QPointF &point : points) sink -= bruteHitTest(store, point, 3.0);
+    const double bruteHit = timer.nsecsElapsed() / 1000.0 / queries;
+
+    for (int i = 0; i < queries; ++i) {
+        if (store.query(rects[i]) != bruteQuery(store, rects[i])) ++mismatches;
+        if (store.hitTest(points[i], 3.0) != bruteHitTest(store, points[i], 3.0)) ++mismatches;
+    }
+    for (int i = 0; i < queries; i += 50) {
+        if (store.queryOutside(rects[i]) != bruteOutside(store, rects[i])) ++mismatches;
+    }
+
+    std::printf("%d records, %d alive\n", store.size(), store.count());
+    std::printf("%12s %12s %12s %10s\n", "query", "grid(us)", "brute(us)", "speedup");
+    std::printf("%12s %12.2f %12.2f %9.1fx\n", "rect", gridQuery, bruteQueryTime, bruteQueryTime / gridQuery);
+    std::printf("%12s %12.2f %12.2f %9.1fx\n", "point", gridHit, bruteHit, bruteHit / gridHit);
+    std::printf("mismatches: %d   (%lld)\n", mismatches, sink);
+    return mismatches == 0 ? 0 : 1;
+}
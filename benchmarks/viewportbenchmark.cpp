@@ -0,0 +1,145 @@
+#include "viewportrenderer.h"
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <cstdio>
+
+// SIMD 缩放内核必须与标量实现逐像素一致，局部失效和平移后的视口必须与从头渲染的一致；不一致时返回非零
+using Raster::ViewportRenderer;
+
+static void scribble(QImage &image, QRandomGenerator &random, const QRect &rect) {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            // 四分之一全透明，其余随机 alpha
+            const QRgb value = random.generate();
+            image.setPixel(x, y, random.bounded(4) == 0 ? value & 0x00ffffffu : value);
+        }
+    }
+}
+
+int main() {
+    QRandomGenerator random(2024);
+    int mismatches = 0;
+
+    // 各种长度、权重和源格式下 SIMD 与标量结果相同
+    for (int round = 0; round < 2000; ++round) {
+        const int count = random.bounded(70);
+        const int width = count + 2;
+        const bool premultiplied = random.bounded(2);
+        QVector<QRgb> row0(width), row1(width);
+        for (QVector<QRgb> *row : { &row0, &row1 }) {
+            for (QRgb &p : *row) {
+                const QRgb c = random.generate();
+                const int a = random.bounded(4) == 0 ? 0 : qAlpha(c);
+                p = premultiplied ? qRgba(qRed(c) * a / 255, qGreen(c) * a / 255, qBlue(c) * a / 255, a)
+                                  : qRgba(qRed(c), qGreen(c), qBlue(c), a);
+            }
+        }
+        QVector<int> index(count), weight(count);
+        for (int i = 0; i < count; ++i) {
+            index[i] = random.bounded(width - 1);
+            weight[i] = random.bounded(257);
+        }
+        const QRgb background = random.generate();
+        const int fy = random.bounded(257);
+        QVector<QRgb> result(count), expected(count);
+        Raster::scaleRowNearest(result.data(), row0.constData(), index.constData(), count, premultiplied, background);
+        Raster::scaleRowNearestScalar(expected.data(), row0.constData(), index.constData(), count, premultiplied,
+                                      background);
+        if (result != expected) ++mismatches;
+        Raster::scaleRowBilinear(result.data(), row0.constData(), row1.constData(), fy, index.constData(),
+                                 weight.constData(), count, premultiplied, background);
+        Raster::scaleRowBilinearScalar(expected.data(), row0.constData(), row1.constData(), fy, index.constData(),
+                                       weight.constData(), count, premultiplied, background);
+        if (result != expected) ++mismatches;
+    }
+
+    // 局部改动并报告后，视口与新建的渲染器从头渲染的一致
+    QImage canvas(600, 400, QImage::Format_ARGB32);
+    scribble(canvas, random, canvas.rect());
+    const QSize viewSize(517, 389);
+    const QRect viewRect(QPoint(0, 0), viewSize);
+    for (double zoom : { 1.0, 3.0, 1.7, 0.8 }) {
+        const QPointF offset(-37.25, 12.5);
+        ViewportRenderer cached(32);
+        cached.render(canvas, 1, zoom, offset, viewSize, 0xffe0e0e0u, viewRect);
+        for (int step = 0; step < 20; ++step) {
+            const QRect rect = QRect(random.bounded(600), random.bounded(400), 1 + random.bounded(40),
+                                     1 + random.bounded(40)).intersected(canvas.rect());
+            scribble(canvas, random, rect);
+            cached.invalidate(rect);
+            ViewportRenderer fresh(32);
+            if (cached.render(canvas, 1, zoom, offset, viewSize, 0xffe0e0e0u, viewRect)
+                != fresh.render(canvas, 1, zoom, offset, viewSize, 0xffe0e0e0u, viewRect)) ++mismatches;
+        }
+    }
+
+    // 连续平移（含只露出一部分的重画）后，与从头渲染的一致
+    for (double zoom : { 1.0, 2.0, 1.37 }) {
+        QPointF offset(-50.5, -40.25);
+        ViewportRenderer panned(32);
+        for (int step = 0; step < 40; ++step) {
+            offset += QPointF(random.bounded(41) - 20, random.bounded(41) - 20);
+            const QRect area = step % 5 == 0 ? QRect(random.bounded(400), random.bounded(300), 60, 40) : viewRect;
+            const QImage &result = panned.render(canvas, 1, zoom, offset, viewSize, 0xffe0e0e0u, area);
+            ViewportRenderer fresh(32);
+            const QImage &expected = fresh.render(canvas, 1, zoom, offset, viewSize, 0xffe0e0e0u, viewRect);
+            const QRect checked = area.intersected(viewRect);
+            for (int y = checked.top(); y <= checked.bottom(); ++y) {
+                for (int x = checked.left(); x <= checked.right(); ++x) {
+                    if (result.pixel(x, y) != expected.pixel(x, y)) ++mismatches;
+                }
+            }
+        }
+    }
+
+    // 4096×4096 半透明画布，1920×1080 的视口
+    const int size = 4096;
+    QImage big(size, size, QImage::Format_ARGB32);
+    big.fill(qRgba(40, 90, 160, 128));
+    const QSize screen(1920, 1080);
+    const QRect screenRect(QPoint(0, 0), screen);
+    const int frames = 20;
+    QElapsedTimer timer;
+    std::printf("kernel: %s\n", Raster::viewportScalerKernel());
+    for (double zoom : { 1.0, 4.0, 2.5, 0.6 }) {
+        ViewportRenderer viewport;
+        timer.start();
+        for (int i = 0; i < frames; ++i) {
+            viewport.clear();
+            viewport.render(big, 1, zoom, QPointF(-100, -100), screen, 0xffffffffu, screenRect);
+        }
+        const double full = timer.nsecsElapsed() / 1e6 / frames;
+
+        // 缩放和内容都没变
+        timer.restart();
+        for (int i = 0; i < frames; ++i) {
+            viewport.render(big, 1, zoom, QPointF(-100, -100), screen, 0xffffffffu, screenRect);
+        }
+        const double unchanged = timer.nsecsElapsed() / 1e6 / frames;
+
+        // 一笔小改动只重画碰到的块
+        timer.restart();
+        for (int i = 0; i < frames; ++i) {
+            const QRect rect(random.bounded(1000), random.bounded(600), 16, 16);
+            big.setPixel(rect.center(), 0xff000000u);
+            viewport.invalidate(rect);
+            viewport.render(big, 1, zoom, QPointF(-100, -100), screen, 0xffffffffu, screenRect);
+        }
+        const double stroke = timer.nsecsElapsed() / 1e6 / frames;
+
+        // 中键拖动：每帧平移几个像素，只画新露出的条带
+        QPointF offset(-100, -100);
+        timer.restart();
+        for (int i = 0; i < frames; ++i) {
+            offset += QPointF(3, -2);
+            viewport.render(big, 1, zoom, offset, screen, 0xffffffffu, screenRect);
+        }
+        const double pan = timer.nsecsElapsed() / 1e6 / frames;
+
+        std::printf("zoom %.1f (%s): full viewport %.2f ms, unchanged %.3f ms, after a small stroke %.3f ms, "
+                    "pan step %.3f ms\n", zoom, viewport.filter() == ViewportRenderer::Nearest ? "nearest" : "bilinear",
+                    full, unchanged, stroke, pan);
+    }
+    std::printf("mismatches: %d\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,548 @@
+#include "canvasraster.h"
+#include "coverageblend.h"
+#include <QVarLengthArray>
+#include <QStack>
+#include <algorithm>
+
+namespace Raster {
+
+void drawBresenhamLine(SpanWriter &writer, QPoint p1, QPoint p2, Qt::PenStyle style) {
+    writer.setCounter(Perf::BresenhamPixels);
+    bresenhamLine(p1, p2, style, [&](int x, int y) { writer.plot(x, y); });
+}
+
+void drawMidpointLine(SpanWriter &writer, QPoint p1, QPoint p2, Qt::PenStyle style) {
+    writer.setCounter(Perf::MidpointPixels);
+    midpointLine(p1, p2, style, [&](int x, int y) { writer.plot(x, y); });
+}
+
+void drawBresenhamCircle(SpanWriter &writer, QPoint center, int radius, Qt::PenStyle style) {
+    writer.setCounter(Perf::CirclePixels);
+    bresenhamCircle(center, radius, style, [&](int x, int y) { writer.plot(x, y); });
+}
+
+void drawMidpointArc(SpanWriter &writer, QPoint center, int radius, double startAngle, double endAngle,
+                     bool isFullCircle, Qt::PenStyle style) {
+    writer.setCounter(Perf::ArcPixels);
+    midpointArc(center, radius, startAngle, endAngle, isFullCircle, style,
+                [&](int x, int y) { writer.plot(x, y); });
+}
+
+void drawFixedLine(SpanWriter &writer, QPointF p1, QPointF p2, Qt::PenStyle style, int firstStep, int lastStep) {
+    writer.setCounter(Perf::BresenhamPixels);   // 亚像素直线同样是 Bresenham 式的逐列步进
+    fixedLine(p1, p2, style, [&](int x, int y) { writer.plot(x, y); }, firstStep, lastStep);
+}
+
+void drawFixedArc(SpanWriter &writer, QPointF center, double radius, double startAngle, double endAngle,
+                  bool isFullCircle, Qt::PenStyle style) {
+    writer.setCounter(Perf::ArcPixels);
+    fixedArc(center, radius, startAngle, endAngle, isFullCircle, style,
+             [&](int x, int y) { writer.plot(x, y); });
+}
+
+const FixedOctant fixedOctants[8] = {
+    { false,  1, -1 },  // 0°~45°
+    { true,   1, -1 },  // 45°~90°
+    { true,  -1, -1 },  // 90°~135°
+    { false, -1, -1 },  // 135°~180°
+    { false, -1,  1 },  // 180°~225°
+    { true,  -1,  1 },  // 225°~270°
+    { true,   1,  1 },  // 270°~315°
+    { false,  1,  1 },  // 315°~360°
+};
+
+FixedArcRange fixedArcRange(double startAngle, double endAngle, bool isFullCircle) {
+    const double unit = 65536.0;
+    FixedArcRange range;
+    double sweep = endAngle - startAngle;
+    if (sweep < 0) sweep += 360.0;
+    range.full = isFullCircle || sweep >= 360.0;
+    range.major = sweep > 180.0;
+
+    double start = range.full ? 0.0 : std::fmod(startAngle, 360.0);
+    if (start < 0) start += 360.0;
+    const double end = start + sweep;
+    range.sx = qRound64(std::cos(qDegreesToRadians(start)) * unit);
+    range.sy = qRound64(std::sin(qDegreesToRadians(start)) * unit);
+    range.ex = qRound64(std::cos(qDegreesToRadians(end)) * unit);
+    range.ey = qRound64(std::sin(qDegreesToRadians(end)) * unit);
+    range.startOctant = qMin(7, static_cast<int>(start / 45.0));
+    return range;
+}
+
+int arcStepsPerOctant(int radius) {
+    int x = radius;
+    int y = 0;
+    int p = 1 - radius;
+    while (x >= y) {
+        y++;
+        if (p <= 0) {
+            p += 2 * y + 1;
+        } else {
+            x--;
+            p += 2 * (y - x) + 1;
+        }
+    }
+    return y;
+}
+
+// 八分圆内局部角度 phi（0°~45°）对应的步进变量 y
+static int octantStepForAngle(int radius, double phi, int stepsPerOctant) {
+    int y = qRound(radius * std::sin(qDegreesToRadians(phi)));
+    return qBound(0, y, stepsPerOctant - 1);
+}
+
+int arcOctantBounds(int radius, double startAngle, double endAngle, bool isFullCircle,
+                    int stepsPerOctant, ArcOctantBounds bounds[8]) {
+    const int lastStep = stepsPerOctant - 1;
+    for (int k = 0; k < 8; ++k) {
+        bounds[k].lo[0] = bounds[k].lo[1] = 1;
+        bounds[k].hi[0] = bounds[k].hi[1] = 0; // 空区间
+    }
+
+    double sweep = endAngle - startAngle;
+    if (sweep < 0) sweep += 360.0;
+    if (isFullCircle || sweep >= 360.0) {
+        for (int k = 0; k < 8; ++k) {
+            bounds[k].lo[0] = 0;
+            bounds[k].hi[0] = lastStep;
+        }
+        return 0;
+    }
+
+    double start = std::fmod(startAngle, 360.0);
+    if (start < 0) start += 360.0;
+    const double end = start + sweep; // 可能超过 360°，下面再按 -360° 平移一次
+
+    for (int k = 0; k < 8; ++k) {
+        const double octStart = 45.0 * k;
+        const double octEnd = octStart + 45.0;
+        int count = 0;
+        for (double shift : {0.0, -360.0}) {
+            double a0 = qMax(start + shift, octStart);
+            double a1 = qMin(end + shift, octEnd);
+            if (a0 > a1) continue;
+
+            // 局部角度：偶数八分圆从 octStart 起算，奇数八分圆从 octEnd 起算
+            double phi0 = (k & 1) ? octEnd - a1 : a0 - octStart;
+            double phi1 = (k & 1) ? octEnd - a0 : a1 - octStart;
+            bounds[k].lo[count] = phi0 <= 0.0 ? 0 : octantStepForAngle(radius, phi0, stepsPerOctant);
+            bounds[k].hi[count] = phi1 >= 45.0 ? lastStep : octantStepForAngle(radius, phi1, stepsPerOctant);
+            ++count;
+        }
+    }
+
+    // 起点在整圆步进序列中的位置
+    int startOctant = qMin(7, static_cast<int>(start / 45.0));
+    double phi = start - 45.0 * startOctant;
+    if (startOctant & 1) phi = 45.0 - phi;
+    int step = octantStepForAngle(radius, phi, stepsPerOctant);
+    return startOctant * stepsPerOctant + ((startOctant & 1) ? lastStep - step : step);
+}
+
+// 像素 [cell, cell+1) 与覆盖带 [band, band+width) 的重叠长度，换算成 0~255
+static inline quint8 bandCoverage(int cell, double band, int width) {
+    double overlap = qMin(cell + 1.0, band + width) - qMax(double(cell), band);
+    if (overlap <= 0.0) return 0;
+    if (overlap >= 1.0) return 255;
+    return static_cast<quint8>(overlap * 255.0 + 0.5);
+}
+
+void drawWuLine(QImage &image, QPointF p1, QPointF p2, QRgb color, int width,
+                Qt::PenStyle style, const QRect &clip) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    const QRect bounds = clip.isNull() ? image.rect() : clip.intersected(image.rect());
+    if (bounds.isEmpty()) return;
+
+    width = qMax(1, width);
+    uchar *bits = image.bits();
+    const qsizetype stride = image.bytesPerLine();
+
+    const bool steep = qAbs(p2.y() - p1.y()) > qAbs(p2.x() - p1.x());
+    // 主轴/次轴坐标：非陡峭时主轴为 x；端点可以是亚像素坐标，覆盖带直接按实际直线计算
+    const double major1 = steep ? p1.y() : p1.x();
+    const double minor1 = steep ? p1.x() : p1.y();
+    const double major2 = steep ? p2.y() : p2.x();
+    const double minor2 = steep ? p2.x() : p2.y();
+    const int majorLo = qRound(qMin(major1, major2)), majorHi = qRound(qMax(major1, major2));
+    const int majorStart = qRound(major1);
+    const double gradient = major1 == major2 ? 0.0 : (minor2 - minor1) / (major2 - major1);
+    // 覆盖带下沿：线中心向两侧各扩 width/2，宽度 1 时即 Wu 的 intery
+    const double bandOffset = minor1 - (width - 1) * 0.5;
+    auto bandAt = [&](int major) { return bandOffset + gradient * (major - major1); };
+    auto dashOn = [&](int major) { return dashVisible(style, abs(major - majorStart)); };
+
+    QVarLengthArray<quint8, 1024> coverage;
+    qint64 written = 0;
+
+    if (steep) {
+        // 主轴为 y：每行是一段宽 width+1 的连续像素
+        const int yStart = qMax(majorLo, bounds.top());
+        const int yEnd = qMin(majorHi, bounds.bottom());
+        for (int y = yStart; y <= yEnd; ++y) {
+            if (!dashOn(y)) continue;
+            const double band = bandAt(y);
+            const int x0 = qMax(int(std::floor(band)), bounds.left());
+            const int x1 = qMin(int(std::floor(band + width)), bounds.right());
+            if (x0 > x1) continue;
+
+            coverage.resize(x1 - x0 + 1);
+            for (int x = x0; x <= x1; ++x) {
+                coverage[x - x0] = bandCoverage(x, band, width);
+            }
+            QRgb *line = reinterpret_cast<QRgb *>(bits + y * stride);
+            blendCoverageSpan(line + x0, coverage.constData(), coverage.size(), color);
+            written += coverage.size();
+        }
+        CANVAS_PERF_ADD(WuPixels, written);
+        return;
+    }
+
+    // 主轴为 x：逐行求出该行被覆盖带扫过的 x 区间，得到连续的覆盖率段
+    const double bandMin = qMin(bandAt(majorLo), bandAt(majorHi));
+    const double bandMax = qMax(bandAt(majorLo), bandAt(majorHi)) + width;
+    const int yStart = qMax(int(std::floor(bandMin)), bounds.top());
+    const int yEnd = qMin(int(std::floor(bandMax)), bounds.bottom());
+    for (int y = yStart; y <= yEnd; ++y) {
+        int xa = majorLo, xb = majorHi;
+        if (gradient != 0.0) {
+            // band(x) ∈ (y - width, y + 1) 时该行有覆盖，多取一列由覆盖率函数兜底
+            double ta = major1 + (y - width - bandOffset) / gradient;
+            double tb = major1 + (y + 1 - bandOffset) / gradient;
+            if (ta > tb) std::swap(ta, tb);
+            xa = qMax(xa, int(std::floor(ta)) - 1);
+            xb = qMin(xb, int(std::ceil(tb)) + 1);
+        }
+        xa = qMax(xa, bounds.left());
+        xb = qMin(xb, bounds.right());
+        if (xa > xb) continue;
+
+        coverage.resize(xb - xa + 1);
+        for (int x = xa; x <= xb; ++x) {
+            coverage[x - xa] = dashOn(x) ? bandCoverage(y, bandAt(x), width) : 0;
+        }
+        QRgb *line = reinterpret_cast<QRgb *>(bits + y * stride);
+        blendCoverageSpan(line + xa, coverage.constData(), coverage.size(), color);
+        written += coverage.size();
+    }
+    CANVAS_PERF_ADD(WuPixels, written);
+}
+
+QRect segmentBounds(const LineSegment &segment) {
+    const int width = qMax(1, segment.width);
+    const int lo = (width - 1) / 2;
+    const int hi = width - 1 - lo;
+    return QRect(segment.p1, segment.p2).normalized().adjusted(-lo, -lo, hi, hi);
+}
+
+QRect drawSegments(QImage &image, const LineSegment *segments, int count,
+                   LineAlgorithm algorithm, Qt::PenStyle style) {
+    QRect dirty;
+    if (count <= 0) return dirty;
+
+    SpanWriter writer(image, QColor::fromRgba(segments[0].color), segments[0].width);
+    for (int i = 0; i < count; ++i) {
+        const LineSegment &segment = segments[i];
+        if (algorithm == Wu) {
+            writer.flush();
+            drawWuLine(image, segment.p1, segment.p2, segment.color, segment.width, style);
+            dirty |= segmentBounds(segment).adjusted(-1, -1, 1, 1);
+            continue;
+        }
+        writer.setPen(segment.color, segment.width);
+        if (algorithm == Bresenham) {
+            drawBresenhamLine(writer, segment.p1, segment.p2, style);
+        } else {
+            drawMidpointLine(writer, segment.p1, segment.p2, style);
+        }
+        dirty |= segmentBounds(segment);
+    }
+    return dirty.intersected(image.rect());
+}
+
+// 扫描线段式泛洪填充（Smith）：栈里存的是"待扫描的一段行区间"而不是单个像素。
+// 弹出后在区间内找出可填的像素，向左右扩展成完整的段并整段填充，
+// 再把上下两行对应的区间（八连通时左右各多一列）压栈。内存与段数成正比。
+// 段的查找和扩展交给 FillScanner（SIMD 颜色匹配）。
+QRect floodFill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity,
+                int tolerance, ToleranceMetric metric) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    if (!image.rect().contains(seedPoint)) return QRect();
+
+    const int width = image.width();
+    const int height = image.height();
+    uchar *bits = image.bits();
+    const qsizetype stride = image.bytesPerLine();
+    auto scanLine = [&](int y) { return reinterpret_cast<QRgb *>(bits + y * stride); };
+
+    const ColorMatcher matcher(scanLine(seedPoint.y())[seedPoint.x()], tolerance, metric);
+    // 新颜色本身也匹配时，需要访问标记防止重复填充
+    QVector<quint32> visited;
+    if (matcher.matches(newColor)) {
+        if (tolerance <= 0) return QRect();
+        visited.fill(0, FillScanner::visitedWords(width, height));
+    }
+    FillScanner scanner(matcher, visited.isEmpty() ? nullptr : visited.data(), width);
+
+    const int reach = connectivity == EightWay ? 1 : 0;
+    struct Span {
+        int y;
+        int x0, x1;
+    };
+    QVector<Span> stack;
+    stack.append({ seedPoint.y(), seedPoint.x(), seedPoint.x() });
+    int left0 = width, right0 = -1, top0 = height, bottom0 = -1;
+
+    while (!stack.isEmpty()) {
+        const Span span = stack.last();
+        stack.removeLast();
+        QRgb *line = scanLine(span.y);
+
+        int x = scanner.findFillable(line, span.y, span.x0, span.x1 + 1);
+        while (x <= span.x1) {
+            const int left = scanner.runStart(line, span.y, x, 0);
+            const int right = scanner.runEnd(line, span.y, x, width) - 1;
+            std::fill(line + left, line + right + 1, newColor);
+            scanner.markFilled(span.y, left, right);
+            left0 = qMin(left0, left);
+            right0 = qMax(right0, right);
+            top0 = qMin(top0, span.y);
+            bottom0 = qMax(bottom0, span.y);
+
+            const int x0 = qMax(0, left - reach);
+            const int x1 = qMin(width - 1, right + reach);
+            if (span.y > 0) stack.append({ span.y - 1, x0, x1 });
+            if (span.y < height - 1) stack.append({ span.y + 1, x0, x1 });
+            // right + 1 已不可填
+            x = scanner.findFillable(line, span.y, right + 2, span.x1 + 1);
+        }
+    }
+    return right0 < 0 ? QRect() : QRect(QPoint(left0, top0), QPoint(right0, bottom0));
+}
+
+QImage maskedLayer(const QImage &image, QRgb keyColor) {
+    QImage layer = image.convertToFormat(QImage::Format_ARGB32);
+    for (int y = 0; y < layer.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(layer.scanLine(y));
+        for (int x = 0; x < layer.width(); ++x) {
+            const QRgb pixel = line[x];
+            line[x] = (pixel == keyColor || qAlpha(pixel) == 0) ? 0u : qPremultiply(pixel);
+        }
+    }
+    // 像素已经是预乘值，只改格式标记
+    layer.reinterpretAsFormat(QImage::Format_ARGB32_Premultiplied);
+    return layer;
+}
+
+int computeOutCode(const QPoint &p, const QRect &clip) {
+    int code = Inside;
+
+    if (p.x() < clip.left()) code |= Left;
+    if (p.x() > clip.right()) code |= Right;
+    if (p.y() < clip.top()) code |= Top;
+    if (p.y() > clip.bottom()) code |= Bottom;
+
+    return code;
+}
+
+bool cohenSutherlandClip(QLine &line, const QRect &clip) {
+    QPoint p1 = line.p1();
+    QPoint p2 = line.p2();
+
+    int outcode1 = computeOutCode(p1, clip);
+    int outcode2 = computeOutCode(p2, clip);
+    bool accept = false;
+
+    while (true) {
+        if (!(outcode1 | outcode2)) { // 完全在窗口内
+            accept = true;
+            break;
+        } else if (outcode1 & outcode2) { // 完全在窗口外
+            break;
+        } else {
+            QPoint p;
+            int outcodeOut = outcode1 ? outcode1 : outcode2;
+
+            if (outcodeOut & Top) {
+                p.setX(p1.x() + (p2.x() - p1.x()) * (clip.top() - p1.y()) / (p2.y() - p1.y()));
+                p.setY(clip.top());
+            } else if (outcodeOut & Bottom) {
+                p.setX(p1.x() + (p2.x() - p1.x()) * (clip.bottom() - p1.y()) / (p2.y() - p1.y()));
+                p.setY(clip.bottom());
+            } else if (outcodeOut & Right) {
+                p.setY(p1.y() + (p2.y() - p1.y()) * (clip.right() - p1.x()) / (p2.x() - p1.x()));
+                p.setX(clip.right());
+            } else if (outcodeOut & Left) {
+                p.setY(p1.y() + (p2.y() - p1.y()) * (clip.left() - p1.x()) / (p2.x() - p1.x()));
+                p.setX(clip.left());
+            }
+
+            if (outcodeOut == outcode1) {
+                p1 = p;
+                outcode1 = computeOutCode(p1, clip);
+            } else {
+                p2 = p;
+                outcode2 = computeOutCode(p2, clip);
+            }
+        }
+    }
+    if (accept) {
+        line.setP1(p1);
+        line.setP2(p2);
+    }
+    return accept;
+}
+
+void midpointSubdivisionClip(const QLine &line, const QRect &clip, QVector<QLine> &out) {
+    QStack<QLine> stack;
+    stack.push(line);
+
+    while (!stack.isEmpty()) {
+        QLine current = stack.pop();
+        int code1 = computeOutCode(current.p1(), clip);
+        int code2 = computeOutCode(current.p2(), clip);
+
+        if (!(code1 | code2)) { // 完全可见
+            out.append(current);
+        } else if (!(code1 & code2)) { // 部分可见
+            QPoint mid((current.p1().x() + current.p2().x()) / 2,
+                       (current.p1().y() + current.p2().y()) / 2);
+            // 已无法再细分时停止，避免端点在窗口外时死循环
+            if (mid == current.p1() || mid == current.p2()) continue;
+            stack.push(QLine(mid, current.p2()));
+            stack.push(QLine(current.p1(), mid));
+        }
+    }
+}
+
+// 辅助函数：判断点是否在边界内侧
+static bool inside(const QPoint& p, int edge, int xmin, int ymin, int xmax, int ymax) {
+    switch (edge) {
+    case 0: return p.x() >= xmin; // left
+    case 1: return p.y() <= ymax; // bottom
+    case 2: return p.x() <= xmax; // right
+    case 3: return p.y() >= ymin; // top
+    }
+    return false;
+}
+
+// 计算线段与边界的交点
+static QPoint computeIntersection(QPoint p1, QPoint p2, int edge,
+                                  int xmin, int ymin, int xmax, int ymax) {
+    // 处理垂直线段
+    if (p1.x() == p2.x()) {
+        if (edge == 0 || edge == 2) { // 左右边界
+            return QPoint(); // 无效交点
+        }
+        // 处理水平边界
+        int y = (edge == 1) ? ymax : ymin;
+        return QPoint(p1.x(), y);
+    }
+
+    // 处理水平线段
+    if (p1.y() == p2.y()) {
+        if (edge == 1 || edge == 3) { // 上下边界
+            return QPoint(); // 无效交点
+        }
+        // 处理垂直边界
+        int x = (edge == 0) ? xmin : xmax;
+        return QPoint(x, p1.y());
+    }
+
+    double m = (p2.y() - p1.y()) / static_cast<double>(p2.x() - p1.x());
+
+    double x = 0, y = 0;
+
+    switch (edge) {
+    case 0: // left
+        x = xmin;
+        y = m * (xmin - p1.x()) + p1.y();
+        break;
+    case 1: // bottom
+        y = ymax;
+        x = (ymax - p1.y()) / m + p1.x();
+        break;
+    case 2: // right
+        x = xmax;
+        y = m * (xmax - p1.x()) + p1.y();
+        break;
+    case 3: // top
+        y = ymin;
+        x = (ymin - p1.y()) / m + p1.x();
+        break;
+    }
+
+    // 检查交点是否在线段范围内
+    if (x < qMin(p1.x(), p2.x()) || x > qMax(p1.x(), p2.x()) ||
+        y < qMin(p1.y(), p2.y()) || y > qMax(p1.y(), p2.y())) {
+        return QPoint(); // 无效交点
+    }
+
+    return QPoint(qRound(x), qRound(y));
+}
+
+QVector<QPoint> sutherlandHodgmanClip(const QVector<QPoint> &polygon, const QRect &clip) {
+    if (polygon.size() < 3) return QVector<QPoint>(); // 忽略无效多边形
+
+    int xmin = clip.left();
+    int ymin = clip.top();
+    int xmax = clip.right();
+    int ymax = clip.bottom();
+
+    QVector<QPoint> outputList = polygon;
+
+    for (int edge = 0; edge < 4; edge++) {
+        QVector<QPoint> inputList = outputList;
+        outputList.clear();
+
+        if (inputList.isEmpty()) break;
+
+        QPoint s = inputList.last();
+        for (const QPoint& p : inputList) {
+            if (inside(p, edge, xmin, ymin, xmax, ymax)) {
+                if (!inside(s, edge, xmin, ymin, xmax, ymax)) {
+                    QPoint intersect = computeIntersection(s, p, edge, xmin, ymin, xmax, ymax);
+                    if (!intersect.isNull()) {
+                        outputList.append(intersect);
+                    }
+                }
+                outputList.append(p);
+            } else if (inside(s, edge, xmin, ymin, xmax, ymax)) {
+                QPoint intersect = computeIntersection(s, p, edge, xmin, ymin, xmax, ymax);
+                if (!intersect.isNull()) {
+                    outputList.append(intersect);
+                }
+            }
+            s = p;
+        }
+    }
+
+    return outputList;
+}
+
+// 实现de Casteljau算法
+QPoint deCasteljau(const QVector<QPoint> &points, double t) {
+    QVector<QPoint> temp = points;
+    while (temp.size() > 1) {
+        QVector<QPoint> newLevel;
+        for (int i = 0; i < temp.size() - 1; ++i) {
+            int x = (1 - t) * temp[i].x() + t * temp[i + 1].x();
+            int y = (1 - t) * temp[i].y() + t * temp[i + 1].y();
+            newLevel.append(QPoint(x, y));
+        }
+        temp = newLevel;
+    }
+    return temp.first();
+}
+
+QVector<QPoint> bezierPolyline(const QVector<QPoint> &controlPoints, double step) {
+    QVector<QPoint> points;
+    if (controlPoints.size() < 2) return points;
+
+    for (double t = 0; t <= 1.0; t += step) {
+        points.append(deCasteljau(controlPoints, t));
+    }
+    return points;
+}
+
+} // namespace Raster
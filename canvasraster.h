@@ -0,0 +1,496 @@
+#ifndef CANVASRASTER_H
+#define CANVASRASTER_H
+
+#include <QImage>
+#include <QColor>
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QLine>
+#include <QVector>
+#include <QtMath>
+#include <cmath>
+#include <climits>
+#include "spanwriter.h"
+#include "colormatch.h"
+#include "perfcounters.h"
+
+/**
+ * canvas_raster：与界面无关的光栅化/几何算法。
+ * 只依赖 QtCore/QtGui，可在非 GUI 线程、工作进程或基准测试中直接调用。
+ * 逐像素算法以模板形式提供，plot(x, y) 回调既可以接 SpanWriter，也可以接 QPainter。
+ */
+namespace Raster {
+
+enum Connectivity { FourWay, EightWay };
+enum LineAlgorithm { Bresenham, Midpoint, Wu };
+
+// 批量绘制用的线段：连续存放，每段自带颜色和宽度
+struct LineSegment {
+    QPoint p1;
+    QPoint p2;
+    QRgb color;
+    int width;
+};
+
+// Cohen-Sutherland 区域编码
+enum OutCode {
+    Inside = 0, // 0000
+    Left = 1,   // 0001
+    Right = 2,  // 0010
+    Bottom = 4, // 0100
+    Top = 8     // 1000
+};
+
+// 根据线型和步进计数判断当前像素是否需要绘制
+inline bool dashVisible(Qt::PenStyle style, int dashCounter) {
+    if (style == Qt::DashLine) {
+        return dashCounter % 20 < 10;
+    } else if (style == Qt::DotLine) {
+        return dashCounter % 4 < 1;
+    }
+    return true;
+}
+
+// 整数直线第 step 步的位置和误差项，与从起点逐步递推的结果相同。
+// 主轴每步都走，次轴走过的步数是 ceil((2·step·d次 - d主) / (2·d主))，即 step·d次/d主 向下舍入一半
+inline void bresenhamSeek(int dx, int dy, int sx, int sy, int step, int &x, int &y, int &err) {
+    const bool xMajor = dx >= dy;
+    const qint64 major = xMajor ? dx : dy;
+    const qint64 minor = xMajor ? dy : dx;
+    const qint64 num = 2 * qint64(step) * minor - major;
+    const qint64 minorSteps = num <= 0 ? 0 : (num + 2 * major - 1) / (2 * major);
+    const qint64 xs = xMajor ? step : minorSteps;
+    const qint64 ys = xMajor ? minorSteps : step;
+    x += static_cast<int>(sx * xs);
+    y += static_cast<int>(sy * ys);
+    err = static_cast<int>(dx - dy - xs * dy + ys * dx);
+}
+
+// Bresenham 直线步进，逐像素回调 plot(x, y)。
+// 只画第 firstStep..lastStep 步（分块光栅化时每块只走穿过本块的一段），虚线计数仍从起点算起
+template <typename Plot>
+void bresenhamLine(QPoint p1, QPoint p2, Qt::PenStyle style, Plot plot,
+                   int firstStep = 0, int lastStep = INT_MAX) {
+    int x1 = p1.x(), y1 = p1.y();
+    int x2 = p2.x(), y2 = p2.y();
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
+    int err = dx - dy;
+
+    const int last = qMin(lastStep, qMax(dx, dy));
+    firstStep = qMax(0, firstStep);
+    if (firstStep > last) return;
+    if (firstStep > 0) {
+        bresenhamSeek(dx, dy, sx, sy, firstStep, x1, y1, err);
+    }
+
+    for (int dashCounter = firstStep;; ++dashCounter) { // 虚线计数器
+        if (dashVisible(style, dashCounter)) {
+            plot(x1, y1);
+        }
+
+        if (dashCounter == last) break;
+        int e2 = 2 * err;
+        if (e2 > -dy) {
+            err -= dy;
+            x1 += sx;
+        }
+        if (e2 < dx) {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+// 中点算法直线步进，逐像素回调 plot(x, y)
+template <typename Plot>
+void midpointLine(QPoint p1, QPoint p2, Qt::PenStyle style, Plot plot) {
+    int x1 = p1.x(), y1 = p1.y();
+    int x2 = p2.x(), y2 = p2.y();
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
+    int err = dx - dy;
+
+    int dashCounter = 0;
+
+    while (true) {
+        if (dashVisible(style, dashCounter)) {
+            plot(x1, y1);
+        }
+        dashCounter++;
+
+        if (x1 == x2 && y1 == y2) break;
+        int e2 = 2 * err;
+        if (e2 > -dy) {
+            err -= dy;
+            x1 += sx;
+        }
+        if (e2 < dx) {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+// 圆弧在某个八分圆内的可见范围：以中点算法的步进变量 y 表示，最多两段
+struct ArcOctantBounds {
+    int lo[2];
+    int hi[2];
+};
+
+// 预先计算圆弧的八分圆边界（只在这里用到三角函数），
+// 返回起点在整圆步进序列中的位置，供虚线计数使用
+int arcOctantBounds(int radius, double startAngle, double endAngle, bool isFullCircle,
+                    int stepsPerOctant, ArcOctantBounds bounds[8]);
+
+// 中点算法在一个八分圆内的步数（y 从 0 开始，直到 x < y）
+int arcStepsPerOctant(int radius);
+
+/**
+ * 中点画圆/圆弧，角度单位为度（数学坐标，逆时针）。
+ * 八分圆与端点边界预先算好，内循环只有整数比较；
+ * 虚线计数按圆弧上的实际顺序累计，从 startAngle 处开始。
+ */
+template <typename Plot>
+void midpointArc(QPoint center, int radius, double startAngle, double endAngle,
+                 bool isFullCircle, Qt::PenStyle style, Plot plot) {
+    if (radius <= 0) {
+        plot(center.x(), center.y());
+        return;
+    }
+
+    const int n = arcStepsPerOctant(radius);
+    const int cycle = 8 * n;
+    ArcOctantBounds bounds[8];
+    const int startIndex = arcOctantBounds(radius, startAngle, endAngle, isFullCircle, n, bounds);
+    const bool dashed = style == Qt::DashLine || style == Qt::DotLine;
+
+    auto visible = [&](int octant, int y) {
+        const ArcOctantBounds &b = bounds[octant];
+        if (!((y >= b.lo[0] && y <= b.hi[0]) || (y >= b.lo[1] && y <= b.hi[1]))) return false;
+        if (!dashed) return true;
+        // 偶数八分圆随 y 逆时针前进，奇数八分圆相反
+        int index = octant * n + ((octant & 1) ? n - 1 - y : y);
+        int dashCounter = index - startIndex;
+        if (dashCounter < 0) dashCounter += cycle;
+        return dashVisible(style, dashCounter);
+    };
+
+    int x = radius;
+    int y = 0;
+    int p = 1 - radius;
+
+    while (x >= y) {
+        // 八个对称点，按数学角度 0°→360° 的八分圆顺序（屏幕 y 轴向下）
+        if (visible(0, y)) plot(center.x() + x, center.y() - y);
+        if (visible(1, y)) plot(center.x() + y, center.y() - x);
+        if (visible(2, y)) plot(center.x() - y, center.y() - x);
+        if (visible(3, y)) plot(center.x() - x, center.y() - y);
+        if (visible(4, y)) plot(center.x() - x, center.y() + y);
+        if (visible(5, y)) plot(center.x() - y, center.y() + x);
+        if (visible(6, y)) plot(center.x() + y, center.y() + x);
+        if (visible(7, y)) plot(center.x() + x, center.y() + y);
+
+        y++;
+        if (p <= 0) {
+            p += 2 * y + 1;
+        } else {
+            x--;
+            p += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// 带虚线的 Bresenham 画圆（动画窗口的圆形粒子）
+template <typename Plot>
+void bresenhamCircle(QPoint center, int radius, Qt::PenStyle style, Plot plot) {
+    int x = 0;
+    int y = radius;
+    int d = 3 - 2 * radius;
+
+    int dashCounter = 0;
+
+    while (x <= y) {
+        if (dashVisible(style, dashCounter)) {
+            plot(center.x() + x, center.y() + y);
+            plot(center.x() - x, center.y() + y);
+            plot(center.x() + x, center.y() - y);
+            plot(center.x() - x, center.y() - y);
+            plot(center.x() + y, center.y() + x);
+            plot(center.x() - y, center.y() + x);
+            plot(center.x() + y, center.y() - x);
+            plot(center.x() - y, center.y() - x);
+        }
+        dashCounter++;
+
+        if (d < 0) {
+            d += 4 * x + 6;
+        } else {
+            d += 4 * (x - y) + 10;
+            y--;
+        }
+        x++;
+    }
+}
+
+// ---- 24.8 定点亚像素光栅化 ----
+// 缩放绘制时鼠标位置落在像素之间，先取整再画会丢掉 1/zoom 像素的精度。
+// 下面的版本直接接受 QPointF：坐标与半径转成 24.8 定点数，只在准备阶段做一次乘除，
+// 内循环只有整数加减和比较。像素中心位于整数坐标，端点都是整数时退回上面的整数算法，逐像素一致。
+
+typedef qint32 Fixed;
+enum { FixedShift = 8, FixedOne = 1 << FixedShift };
+
+inline Fixed toFixed(double v) {
+    return static_cast<Fixed>(std::floor(v * FixedOne + 0.5));
+}
+
+// 四舍五入到像素（右移为算术移位，即向下取整）
+inline int fixedRound(Fixed v) {
+    return (v + FixedOne / 2) >> FixedShift;
+}
+
+inline bool fixedIsIntegral(Fixed v) {
+    return (v & (FixedOne - 1)) == 0;
+}
+
+/**
+ * 亚像素直线：沿主轴逐列步进，次轴取直线在该列中心处精确值的四舍五入。
+ * 余数以 256·|dA| 为分母递推，即中点判别式的定点形式。firstStep/lastStep 同 bresenhamLine。
+ */
+template <typename Plot>
+void fixedLine(QPointF p1, QPointF p2, Qt::PenStyle style, Plot plot,
+               int firstStep = 0, int lastStep = INT_MAX) {
+    const Fixed x1 = toFixed(p1.x()), y1 = toFixed(p1.y());
+    const Fixed x2 = toFixed(p2.x()), y2 = toFixed(p2.y());
+    if (fixedIsIntegral(x1) && fixedIsIntegral(y1) && fixedIsIntegral(x2) && fixedIsIntegral(y2)) {
+        bresenhamLine(QPoint(x1 >> FixedShift, y1 >> FixedShift),
+                      QPoint(x2 >> FixedShift, y2 >> FixedShift), style, plot, firstStep, lastStep);
+        return;
+    }
+
+    const bool steep = qAbs(y2 - y1) > qAbs(x2 - x1);
+    // 主轴 a、次轴 b
+    const Fixed a1 = steep ? y1 : x1, b1 = steep ? x1 : y1;
+    const Fixed a2 = steep ? y2 : x2;
+    const qint64 dA = qint64(a2) - a1;
+    const qint64 dB = qint64(steep ? x2 - x1 : y2 - y1);
+    auto plotAxes = [&](int a, int b) {
+        if (steep) plot(b, a); else plot(a, b);
+    };
+
+    int a = fixedRound(a1);
+    if (dA == 0) {
+        if (firstStep <= 0 && lastStep >= 0) plotAxes(a, fixedRound(b1));
+        return;
+    }
+    const int sa = dA > 0 ? 1 : -1;
+    const int steps = qMin(lastStep, qAbs(fixedRound(a2) - a));
+    firstStep = qMax(0, firstStep);
+    if (firstStep > steps) return;
+
+    // 第 a 列：round(b) = floor(N / D)，N = (b1 + 128)·|dA| + (256a - a1)·dB·sa，D = 256·|dA|；
+    // 每走一步 N 增加 inc，从第 firstStep 步开始时直接算出该列的 N
+    const qint64 D = qint64(FixedOne) * qAbs(dA);
+    const qint64 inc = qint64(FixedOne) * dB;  // |inc| <= D
+    const qint64 N = (qint64(b1) + FixedOne / 2) * qAbs(dA) + (qint64(a) * FixedOne - a1) * dB * sa
+                     + qint64(firstStep) * inc;
+    a += sa * firstStep;
+    int b = static_cast<int>(N >= 0 ? N / D : -((-N + D - 1) / D));
+    qint64 rem = N - qint64(b) * D;            // [0, D)
+
+    for (int i = firstStep; i <= steps; ++i) {
+        if (dashVisible(style, i)) {
+            plotAxes(a, b);
+        }
+        a += sa;
+        rem += inc;
+        if (rem >= D) {
+            rem -= D;
+            ++b;
+        } else if (rem < 0) {
+            rem += D;
+            --b;
+        }
+    }
+}
+
+/**
+ * 规范八分圆：圆心 (cx, cy) 为定点数，从 j = ceil(cy) 的行开始向 j 增大方向逐行步进，
+ * 每行取 i = round(cx + sqrt(r² - v²))，像素越过 45° 对角线（v > u）时停止。
+ * 判别式 F = (u - 128)² + v² - r²（单位 1/65536 像素²）只做整数增量更新。
+ */
+template <typename Visit>
+void fixedOctantWalk(Fixed cx, Fixed cy, Fixed r, Visit visit) {
+    int j = (cy + FixedOne - 1) >> FixedShift;
+    qint64 v = qint64(j) * FixedOne - cy;
+    int i = fixedRound(cx + r);
+    qint64 u = qint64(i) * FixedOne - cx;
+    qint64 f = (u - FixedOne / 2) * (u - FixedOne / 2) + v * v - qint64(r) * r;
+
+    for (int step = 0;; ++step) {
+        // i - 0.5 在圆外时左移一列
+        while (f > 0 && u >= v) {
+            f += -2 * FixedOne * (u - FixedOne / 2) + qint64(FixedOne) * FixedOne;
+            u -= FixedOne;
+            --i;
+        }
+        if (v > u) break;
+        visit(i, j, step);
+        f += 2 * FixedOne * v + qint64(FixedOne) * FixedOne;
+        v += FixedOne;
+        ++j;
+    }
+}
+
+// 八个八分圆到规范八分圆的映射，按数学角度 0°→360° 排列（屏幕 y 轴向下）：
+// swap 为真时 x = sx·j, y = sy·i，否则 x = sx·i, y = sy·j
+struct FixedOctant {
+    bool swap;
+    int sx;
+    int sy;
+};
+extern const FixedOctant fixedOctants[8];
+
+// 圆弧的起止方向（定点单位向量，数学坐标）与扫过角度，供整数叉积判断
+struct FixedArcRange {
+    qint64 sx, sy;
+    qint64 ex, ey;
+    bool full;
+    bool major;       // 扫过角度 > 180°
+    int startOctant;
+};
+FixedArcRange fixedArcRange(double startAngle, double endAngle, bool isFullCircle);
+
+/**
+ * 亚像素圆/圆弧：圆心和半径为浮点，角度单位为度。
+ * 圆弧范围用像素相对圆心的向量与起止方向的叉积判断，内循环不调用三角函数；
+ * 虚线先数出每个八分圆的步数，再按圆弧上的实际顺序从 startAngle 处计数，与 midpointArc 一致。
+ */
+template <typename Plot>
+void fixedArc(QPointF center, double radius, double startAngle, double endAngle,
+              bool isFullCircle, Qt::PenStyle style, Plot plot) {
+    const Fixed cx = toFixed(center.x()), cy = toFixed(center.y());
+    const Fixed r = toFixed(qMax(0.0, radius));
+    if (fixedIsIntegral(cx) && fixedIsIntegral(cy) && fixedIsIntegral(r)) {
+        midpointArc(QPoint(cx >> FixedShift, cy >> FixedShift), r >> FixedShift,
+                    startAngle, endAngle, isFullCircle, style, plot);
+        return;
+    }
+    if (r < FixedOne / 2) {
+        plot(fixedRound(cx), fixedRound(cy));
+        return;
+    }
+
+    const FixedArcRange range = fixedArcRange(startAngle, endAngle, isFullCircle);
+    auto toScreen = [&](const FixedOctant &o, int i, int j, int &x, int &y) {
+        x = o.sx * (o.swap ? j : i);
+        y = o.sy * (o.swap ? i : j);
+    };
+    auto canonicalCenter = [&](const FixedOctant &o, Fixed &ccx, Fixed &ccy) {
+        ccx = o.swap ? o.sy * cy : o.sx * cx;
+        ccy = o.swap ? o.sx * cx : o.sy * cy;
+    };
+    // 像素相对圆心的向量（数学坐标，y 向上）与方向 (dx, dy) 的叉积
+    auto cross = [&](int x, int y, qint64 dx, qint64 dy) {
+        const qint64 u = qint64(x) * FixedOne - cx;
+        const qint64 v = cy - qint64(y) * FixedOne;
+        return u * dy - v * dx;
+    };
+    auto inRange = [&](int x, int y) {
+        if (range.full) return true;
+        const qint64 fromStart = cross(x, y, range.sx, range.sy);  // <= 0：在起始方向逆时针一侧
+        const qint64 toEnd = cross(x, y, range.ex, range.ey);      // >= 0：在终止方向顺时针一侧
+        return range.major ? !(fromStart > 0 && toEnd < 0) : (fromStart <= 0 && toEnd >= 0);
+    };
+
+    const bool dashed = style == Qt::DashLine || style == Qt::DotLine;
+    int offsets[8] = {0};
+    int counts[8] = {0};
+    int cycle = 0;
+    int startIndex = 0;
+    if (dashed) {
+        // 第一遍只数步数，并找出起始方向在步进序列中的位置
+        for (int k = 0; k < 8; ++k) {
+            Fixed ccx, ccy;
+            canonicalCenter(fixedOctants[k], ccx, ccy);
+            int before = 0;
+            fixedOctantWalk(ccx, ccy, r, [&](int i, int j, int) {
+                ++counts[k];
+                if (k == range.startOctant) {
+                    int x, y;
+                    toScreen(fixedOctants[k], i, j, x, y);
+                    if (cross(x, y, range.sx, range.sy) > 0) ++before;
+                }
+            });
+            offsets[k] = cycle;
+            cycle += counts[k];
+            if (k == range.startOctant) startIndex = offsets[k] + before;
+        }
+    }
+
+    for (int k = 0; k < 8; ++k) {
+        const FixedOctant &o = fixedOctants[k];
+        Fixed ccx, ccy;
+        canonicalCenter(o, ccx, ccy);
+        fixedOctantWalk(ccx, ccy, r, [&](int i, int j, int step) {
+            int x, y;
+            toScreen(o, i, j, x, y);
+            if (!inRange(x, y)) return;
+            if (dashed) {
+                // 偶数八分圆随步进逆时针前进，奇数八分圆相反
+                int dashCounter = offsets[k] + ((k & 1) ? counts[k] - 1 - step : step) - startIndex;
+                if (dashCounter < 0) dashCounter += cycle;
+                if (!dashVisible(style, dashCounter)) return;
+            }
+            plot(x, y);
+        });
+    }
+}
+
+// 直接写入图像的便捷封装
+void drawBresenhamLine(SpanWriter &writer, QPoint p1, QPoint p2, Qt::PenStyle style);
+void drawMidpointLine(SpanWriter &writer, QPoint p1, QPoint p2, Qt::PenStyle style);
+void drawBresenhamCircle(SpanWriter &writer, QPoint center, int radius, Qt::PenStyle style);
+void drawMidpointArc(SpanWriter &writer, QPoint center, int radius, double startAngle, double endAngle,
+                     bool isFullCircle, Qt::PenStyle style);
+void drawFixedLine(SpanWriter &writer, QPointF p1, QPointF p2, Qt::PenStyle style,
+                   int firstStep = 0, int lastStep = INT_MAX);
+void drawFixedArc(SpanWriter &writer, QPointF center, double radius, double startAngle, double endAngle,
+                  bool isFullCircle, Qt::PenStyle style);
+
+// Xiaolin Wu 反走样直线：按行生成 8 位覆盖率，再用 SIMD 内核混合到 ARGB32；
+// width > 1 时覆盖带沿次轴方向加宽，端点可为亚像素坐标。clip 为空时裁剪到整幅图像
+void drawWuLine(QImage &image, QPointF p1, QPointF p2, QRgb color, int width,
+                Qt::PenStyle style, const QRect &clip = QRect());
+
+// 一次性光栅化一组线段（只取一次图像缓冲），返回受影响的区域
+QRect drawSegments(QImage &image, const LineSegment *segments, int count,
+                   LineAlgorithm algorithm, Qt::PenStyle style);
+QRect segmentBounds(const LineSegment &segment);
+
+// 扫描线段泛洪填充，原地修改 ARGB32/RGB32 图像；容差为 0 时按完整的 32 位像素值匹配。
+// 返回被改动像素的外接矩形
+QRect floodFill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity,
+               int tolerance = 0, ToleranceMetric metric = PerChannel);
+
+// 浮动选区图层：keyColor 和全透明的像素清成透明，其余转成预乘格式，
+// 之后一次 SourceOver 的 drawImage 就按遮罩合成，不必逐像素判断
+QImage maskedLayer(const QImage &image, QRgb keyColor);
+
+// 线段裁剪
+int computeOutCode(const QPoint &p, const QRect &clip);
+bool cohenSutherlandClip(QLine &line, const QRect &clip);
+void midpointSubdivisionClip(const QLine &line, const QRect &clip, QVector<QLine> &out);
+
+// Sutherland-Hodgman 多边形裁剪，返回顶点少于 3 个时表示完全被裁掉
+QVector<QPoint> sutherlandHodgmanClip(const QVector<QPoint> &polygon, const QRect &clip);
+
+// Bezier 曲线
+QPoint deCasteljau(const QVector<QPoint> &points, double t);
+QVector<QPoint> bezierPolyline(const QVector<QPoint> &controlPoints, double step = 0.01);
+
+} // namespace Raster
+
+#endif // CANVASRASTER_H
@@ -1,8 +1,10 @@
 #include "canvaswidget.h"
+#include "perfhud.h"
 #include <QPainterPath>
 #include<cmath>
 #include <QQueue>
 #include <QStack>
+#include <QKeySequence>
 
 CanvasWidget::CanvasWidget(QWidget *parent) :
     QWidget(parent),
@@ -38,8 +40,27 @@ CanvasWidget::CanvasWidget(QWidget *parent) :
     setFocusPolicy(Qt::StrongFocus);
     canvasImage = QImage(800, 600, QImage::Format_ARGB32);
     canvasImage.fill(Qt::transparent);
-    originalCanvas = canvasImage.copy();
+    undoHistory.reset(canvasImage, primitives.revision(), documentOrigin);
+    undoHistory.setLayer(canvasImage, layers.layer(0).id);
+    primitives.setLayer(layers.layer(0).id);
+    layers.setName(0, "背景");
+    layers.setWindow(QRect(documentOrigin, canvasImage.size()));
     setMouseTracking(true);
+
+    fillTimer = new QTimer(this);
+    fillTimer->setInterval(30);
+    connect(fillTimer, &QTimer::timeout, this, &CanvasWidget::pollFloodFill);
+
+    // 渲染线程每出一帧，转到界面线程取帧
+    renderThread.setFrameReady([this] {
+        QMetaObject::invokeMethod(this, [this] { pollRender(); }, Qt::QueuedConnection);
+    });
+}
+
+CanvasWidget::~CanvasWidget() {
+    finishRender();
+    finishFloodFill(false);
+    syncTileFile();
 }
 
 void CanvasWidget::setPenColor(QColor color) {
@@ -51,8 +72,16 @@ void CanvasWidget::setPenWidth(int width) {
 }
 
 void CanvasWidget::clearCanvas() {
+    finishRender();
+    finishFloodFill(true);
+    commitHistory();
+    originalCanvas = QImage(); // 落下的选区已不在画布上
     canvasImage.fill(Qt::transparent); // 仅清除绘制内容
-    update();
+    document.clear();
+    layers.clear();   // 其他层的内容也清掉，图层本身保留
+    markCanvasDirty(canvasImage.rect());
+    primitives.removeAll();
+    update(); // 整个画布都变了，整个控件重画
 }
 
 void CanvasWidget::setDrawingMode(int mode) {
@@ -67,32 +96,43 @@ void CanvasWidget::setLineStyle(Qt::PenStyle style) {
 }
 
 void CanvasWidget::paintEvent(QPaintEvent *event) {
-    QPainter painter(this);
+    CANVAS_PERF_TIMER(paintTimer, PaintNanos);
+    PerfPainter painter(this);
     painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    // 只重画需要更新的区域；窗口坐标下先设好裁剪，后面所有绘制都被限制在里面
+    const QRect exposed = event->rect();
+    painter.setClipRect(exposed);
+    const QRect exposedImage = mapRectToImage(exposed);
 
     // 应用变换
     painter.translate(m_zoomOffset);
     painter.scale(m_zoomFactor, m_zoomFactor);
     painter.translate(-m_canvasOffset);
 
-    // 1. 绘制背景色
-    painter.fillRect(rect(), backgroundColor);
-    // 2. 绘制画布内容
-    painter.drawImage(m_canvasOffset, canvasImage);
-
-    // 如果正在移动，绘制预览
-    if ((selectionMode == 1 || selectionMode == 2) && isMoving && !selectionImage.isNull()) {
+    // 1-2. 背景和画布内容：视口缓存里只重算露出范围内失效的块，按窗口像素 1:1 贴上，
+    // 放大整数倍时最近邻、其余双线性，都由 ViewportRenderer 的 SIMD 内核完成
+    const QRect source = exposedImage.intersected(canvasImage.rect());
+    const int mipLevel = Raster::MipPyramid::levelFor(m_zoomFactor);
+    const int scale = 1 << mipLevel;
+    // 缩小查看时从最接近的缩略图取样，双线性只需再缩小不到一半；插值会取到相邻的一个缩略图像素
+    const QRect sampledArea = source.isEmpty() ? source : source.adjusted(-scale, -scale, scale, scale);
+    // 多个图层时画合成结果，只重算取样范围里失效的块
+    const QImage &shown = displayImage(sampledArea.intersected(canvasImage.rect()));
+    const QImage &sampled = mipLevel > 0 ? mipPyramid.level(shown, mipLevel, sampledArea) : shown;
+    const qreal ratio = devicePixelRatioF();
+    const QRectF deviceExposed(exposed.x() * ratio, exposed.y() * ratio,
+                               exposed.width() * ratio, exposed.height() * ratio);
+    const QImage &view = viewport.render(sampled, scale, m_zoomFactor * ratio, m_zoomOffset * ratio, size() * ratio,
+                                         backgroundColor.rgb(), deviceExposed.toAlignedRect());
+    painter.save();
+    painter.resetTransform();
+    painter.drawImage(QRectF(exposed), view, deviceExposed);
+    painter.restore();
+
+    // 浮动的选区：白色和透明像素已在遮罩里去掉，一次合成
+    if ((selectionMode == 1 || selectionMode == 2) && selectionFloating && !selectionImage.isNull()) {
         painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        // 在预览时也只显示非白色和非透明像素
-        for(int y = 0; y < selectionImage.height(); ++y) {
-            for(int x = 0; x < selectionImage.width(); ++x) {
-                QColor pixelColor = selectionImage.pixelColor(x, y);
-                if(pixelColor != Qt::white && pixelColor.alpha() > 0) {
-                    painter.setPen(pixelColor);
-                    painter.drawPoint(selectionRect.x() + x, selectionRect.y() + y);
-                }
-            }
-        }
+        painter.drawImage(selectionRect.topLeft(), selectionImage);
     }
 
     // 绘制选择框
@@ -179,30 +219,16 @@ void CanvasWidget::paintEvent(QPaintEvent *event) {
         painter.drawRect(clipRect);
     }
 
-    // 绘制裁剪后的线段
-    painter.setPen(QPen(Qt::green, 2));
-    for (const QLine& line : clippedLines) {
-        painter.drawLine(mapFromCanvas(line.p1()), mapFromCanvas(line.p2()));
-    }
-
-    // 绘制裁剪后的多边形
-    painter.setPen(QPen(Qt::blue, 2));
-    for (const auto& poly : clippedPolygons) {
-        QVector<QPoint> windowPoints;
-        for (const QPoint& p : poly) {
-            windowPoints.append(mapFromCanvas(p));
-        }
-        painter.drawPolygon(windowPoints.data(), windowPoints.size());
-    }
-
-    // 绘制原始多边形（应用画布偏移）
-    painter.setPen(QPen(QColor(255,0,0,100), 2));
-    for (const auto& poly : allPolygons) {
-        QVector<QPoint> windowPoints;
-        for (const QPoint& p : poly) {
-            windowPoints.append(mapFromCanvas(p));
-        }
-        painter.drawPolygon(windowPoints.data(), windowPoints.size());
+    // 裁剪后的线段、多边形和原始多边形：从缓存的叠加层里取露出的部分，代价与图形个数无关
+    if (!clippedLines.isEmpty() || !clippedPolygons.isEmpty() || !allPolygons.isEmpty()) {
+        const QImage &overlay = overlayLayer(painter.worldTransform());
+        const qreal ratio = overlay.devicePixelRatio();
+        painter.save();
+        painter.resetTransform();
+        painter.drawImage(QRectF(exposed), overlay,
+                          QRectF(exposed.x() * ratio, exposed.y() * ratio,
+                                 exposed.width() * ratio, exposed.height() * ratio));
+        painter.restore();
     }
 
     // 绘制旋转预览
@@ -231,7 +257,7 @@ void CanvasWidget::paintEvent(QPaintEvent *event) {
 
     // 绘制可调整的贝塞尔曲线
     if (isAdjustingCurve && !controlPoints.isEmpty()) {
-        QPainter previewPainter(this);
+        PerfPainter previewPainter(this);
         previewPainter.setRenderHint(QPainter::Antialiasing);
 
         // 绘制原始图像
@@ -258,6 +284,63 @@ void CanvasWidget::paintEvent(QPaintEvent *event) {
         previewPainter.setPen(curvePen);
         drawBezierCurve(previewPainter);
     }
+
+#if CANVAS_PERF_COUNTERS
+    if (perfHudVisible) {
+        // 只刷新面板自己的那次重绘不算一帧，计数留到下一帧
+        if (!perfHudRect.contains(exposed)) {
+            updatePerfLines();
+        }
+        painter.resetTransform();
+        const QRect panel = PerfHud::draw(painter, perfLines);
+        if (!exposed.contains(panel)) {
+            update(panel | perfHudRect); // 局部重绘没盖住面板时补一次，让数字跟上
+        }
+        perfHudRect = panel;
+    }
+#endif
+}
+
+void CanvasWidget::updatePerfLines() {
+    const Raster::Perf::Snapshot now = Raster::Perf::snapshot();
+    const Raster::Perf::Snapshot frame = now - perfLast;
+    perfLast = now;
+
+    perfLines.clear();
+    perfLines << QString("paintEvent  %1").arg(PerfHud::formatNanos(frame[Raster::Perf::PaintNanos]));
+    perfLines << PerfHud::rasterLines(frame);
+    perfLines << PerfHud::imageLine("canvasImage", canvasImage)
+              << PerfHud::imageLine("originalCanvas", originalCanvas)
+              << PerfHud::imageLine("preTransformImage", preTransformImage)
+              << PerfHud::imageLine("scaleOriginal", scaleOriginal)
+              << PerfHud::imageLine("curvePreviewImage", curvePreviewImage)
+              << PerfHud::imageLine("selectionImage", selectionImage)
+              << PerfHud::imageLine("overlayCache", overlayCache);
+    perfLines << QString("document: %1 tiles, %2").arg(document.tileCount())
+                                                  .arg(PerfHud::formatBytes(document.memoryUsage()));
+    if (document.isMapped()) {
+        perfLines << QString("tile file: %1x%2, %3 mapped").arg(document.fileImageSize().width())
+                                                           .arg(document.fileImageSize().height())
+                                                           .arg(PerfHud::formatBytes(document.mappedBytes()));
+    }
+    perfLines << QString("layers: %1, current %2, %3 (%4)").arg(layers.count())
+                                                           .arg(layers.current() + 1)
+                                                           .arg(PerfHud::formatBytes(layers.memoryUsage()))
+                                                           .arg(Raster::layerBlendKernel());
+    perfLines << QString("render thread: %1 queued").arg(renderPosted - renderAdopted);
+    perfLines << QString("mip pyramid: %1").arg(PerfHud::formatBytes(mipPyramid.memoryUsage()));
+    perfLines << QString("viewport: %1, %2 (%3)").arg(viewport.filter() == Raster::ViewportRenderer::Nearest
+                                                          ? "nearest" : "bilinear")
+                                                 .arg(PerfHud::formatBytes(viewport.memoryUsage()))
+                                                 .arg(Raster::viewportScalerKernel());
+    perfLines << QString("undo history: %1").arg(PerfHud::formatBytes(undoHistory.memoryUsage()));
+}
+
+void CanvasWidget::setPerfHudVisible(bool visible) {
+    perfHudVisible = visible;
+    perfLast = Raster::Perf::snapshot();
+    perfLines.clear();
+    update();
 }
 
 QPointF CanvasWidget::mapToImage(const QPoint& pos) const {
@@ -270,6 +353,104 @@ QPointF CanvasWidget::mapFromImage(const QPointF& imagePos) const {
     return (imagePos - m_canvasOffset) * m_zoomFactor + m_zoomOffset;
 }
 
+QRect CanvasWidget::mapRectFromImage(const QRect& imageRect) const {
+    if (imageRect.isEmpty()) return QRect();
+    QRectF widgetRect(mapFromImage(imageRect.topLeft()),
+                      mapFromImage(imageRect.bottomRight() + QPoint(1, 1)));
+    // 多留一个像素，覆盖平滑缩放时的插值边缘
+    return widgetRect.normalized().toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+QRect CanvasWidget::mapRectToImage(const QRect& widgetRect) const {
+    if (widgetRect.isEmpty()) return QRect();
+    QRectF imageRect(mapToImage(widgetRect.topLeft()),
+                     mapToImage(widgetRect.bottomRight() + QPoint(1, 1)));
+    // 同样多留一个像素，平滑缩放时边缘像素也参与插值
+    return imageRect.normalized().toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+void CanvasWidget::updatePreview(const QRect& imageRect) {
+    // 旧预览所在区域要擦掉，新预览所在区域要画上
+    const QRect damage = previewDamage | imageRect;
+    previewDamage = imageRect;
+    update(mapRectFromImage(damage));
+}
+
+QRect CanvasWidget::previewBounds() const {
+    QRect shape;
+    switch (drawingMode) {
+    case 1: // 直线
+        shape = QRect(startPoint, currentPoint).normalized();
+        break;
+    case 2: // 圆
+    case 8: { // 圆弧（按整圆算）
+        const int radius = qCeil(QLineF(startPoint, currentPoint).length());
+        shape = QRect(startPoint - QPoint(radius, radius), startPoint + QPoint(radius, radius));
+        break;
+    }
+    case 4: // 多边形：已有顶点、当前点和闭合提示线
+        shape = QPolygon(polygonPoints).boundingRect() | QRect(currentPoint, QSize(1, 1))
+                | QRect(firstVertex, QSize(1, 1));
+        break;
+    default:
+        return QRect();
+    }
+    return strokeBounds(shape);
+}
+
+QRect CanvasWidget::curvePreviewBounds() const {
+    // 曲线在控制多边形的凸包内；控制点画成半径 5 的圆
+    const int margin = qMax(penWidth / 2, 6) + 2;
+    return QPolygon(controlPoints).boundingRect().adjusted(-margin, -margin, margin, margin);
+}
+
+const QImage &CanvasWidget::overlayLayer(const QTransform &transform) {
+    // 缩放、平移或窗口大小变了，缓存里的位置就不对了
+    const qreal ratio = devicePixelRatioF();
+    if (overlayCache.isNull() || overlayTransform != transform
+        || overlayCache.size() != size() * ratio || overlayCache.devicePixelRatio() != ratio) {
+        overlayTransform = transform;
+        overlayCache = QImage(size() * ratio, QImage::Format_ARGB32_Premultiplied);
+        overlayCache.setDevicePixelRatio(ratio);
+        overlayCache.fill(Qt::transparent);
+
+        PerfPainter painter(&overlayCache);
+        painter.setTransform(transform);
+
+        // 绘制裁剪后的线段
+        painter.setPen(QPen(Qt::green, 2));
+        for (const QLine& line : clippedLines) {
+            painter.drawLine(mapFromCanvas(line.p1()), mapFromCanvas(line.p2()));
+        }
+
+        // 绘制裁剪后的多边形
+        QVector<QPoint> windowPoints;
+        painter.setPen(QPen(Qt::blue, 2));
+        for (const auto& poly : clippedPolygons) {
+            windowPoints.resize(0);
+            for (const QPoint& p : poly) {
+                windowPoints.append(mapFromCanvas(p));
+            }
+            painter.drawPolygon(windowPoints.data(), windowPoints.size());
+        }
+
+        // 绘制原始多边形（应用画布偏移）
+        painter.setPen(QPen(QColor(255,0,0,100), 2));
+        for (const auto& poly : allPolygons) {
+            windowPoints.resize(0);
+            for (const QPoint& p : poly) {
+                windowPoints.append(mapFromCanvas(p));
+            }
+            painter.drawPolygon(windowPoints.data(), windowPoints.size());
+        }
+    }
+    return overlayCache;
+}
+
+void CanvasWidget::invalidateOverlay() {
+    overlayCache = QImage();
+}
+
 QPoint CanvasWidget::mapToCanvas(const QPoint& pos) const {
     return mapToImage(pos).toPoint();
 }
@@ -279,6 +460,15 @@ QPoint CanvasWidget::mapFromCanvas(const QPoint& canvasPos) const {
 }
 
 void CanvasWidget::mousePressEvent(QMouseEvent *event) {
+    if (event->button() == Qt::MiddleButton) {
+        // 平移视图不改画布，后台填充时也照常拖动
+        m_lastDragPos = event->pos();
+        setCursor(Qt::ClosedHandCursor);
+        event->accept();
+        return;
+    }
+    beginEdit();   // 渲染线程还没画完时等它画完并取回，这次按下接着在结果上编辑
+    previewDamage = QRect();
     if (isAdjustingCurve) {
         if (event->button() == Qt::LeftButton) {
             QPoint clickPos = mapToImage(event->pos()).toPoint();
@@ -291,13 +481,9 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             }
         } else if (event->button() == Qt::RightButton) {
             // 右键结束调整并确认
-            QPainter painter(&canvasImage);
-            painter.setRenderHint(QPainter::Antialiasing);
-            painter.setPen(QPen(penColor, penWidth, lineStyle));
-            drawBezierCurve(painter);
+            commitBezierCurve();
 
             isAdjustingCurve = false;
-            controlPoints.clear();
             update();
             event->accept();
         }
@@ -334,7 +520,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         if (event->button() == Qt::LeftButton) {
             rotateCenter = mapToImage(event->pos()).toPoint();
             isRotating = true;
-            preTransformImage = canvasImage.copy();
+            preTransformImage = canvasImage; // 浅拷贝即可，画布改写时自己分离
 
             // 计算初始角度
             QPoint initPos = mapToImage(event->pos()).toPoint();
@@ -349,11 +535,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         }
         return;
     }
-    if (event->button() == Qt::MiddleButton) {
-        m_lastDragPos = event->pos();
-        setCursor(Qt::ClosedHandCursor);
-        event->accept();
-    } else if (drawingMode == 5) { // 填充模式
+    if (drawingMode == 5) { // 填充模式
         if (event->button() == Qt::LeftButton) {
             QPointF imagePos = mapToImage(event->pos());
             QPoint point = imagePos.toPoint();
@@ -384,10 +566,12 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         } else if (event->button() == Qt::RightButton && drawing) {
             // 右键完成多边形绘制
             if (polygonPoints.size() >= 3) {
-                QPainter painter(&canvasImage);
+                PerfPainter painter(&canvasImage);
                 painter.setRenderHint(QPainter::Antialiasing);
                 painter.setPen(QPen(penColor, penWidth, lineStyle));
                 painter.drawPolygon(polygonPoints.data(), polygonPoints.size());
+                markCanvasDirty(strokeBounds(QPolygon(polygonPoints).boundingRect()));
+                primitives.addPolygon(polygonPoints, painterPen());
             }
             drawing = false;
             polygonPoints.clear();
@@ -411,12 +595,10 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
                 selectionMode = 2;
                 isMoving = true;
                 selectionOffset = clickPos - selectionRect.topLeft();
-                // 保存当前画布状态
-                if (originalCanvas.isNull()) {
-                    originalCanvas = canvasImage.copy();
-                }
+                liftSelection();
             } else {
-                // 开始新的选择
+                // 开始新的选择，上一个还浮着的选区先落到画布上
+                commitSelection();
                 isSelecting = true;
                 selectionRect = QRect();
                 selectionImage = QImage();
@@ -430,10 +612,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             if (selectionRect.contains(clickPos)) {
                 isMoving = true;
                 selectionOffset = clickPos - selectionRect.topLeft();
-                // 恢复到原始画布状态
-                if (!originalCanvas.isNull()) {
-                    canvasImage = originalCanvas.copy();
-                }
+                liftSelection();
             }
         }
     } else if (event->button() == Qt::LeftButton) {
@@ -445,7 +624,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             if (controlPoints.size() >= 2) {
                 // 右键确认进入调整模式
                 isAdjustingCurve = true;
-                curvePreviewImage = canvasImage.copy(); // 保存当前画布状态
+                curvePreviewImage = canvasImage; // 保存当前画布状态
                 update();
             } else {
                 // 控制点不足时清空重新开始
@@ -455,34 +634,188 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         }
         QPointF imagePos = mapToImage(event->pos());
         startPoint = imagePos.toPoint();
+        startPointF = subpixelPoint(imagePos);
         currentPoint = startPoint; // 初始化当前点
         if (event->button() == Qt::LeftButton) {
             drawing = true;
+            if (drawingMode == 0 || drawingMode == 3) {
+                strokePoints = { startPoint - m_canvasOffset };
+            }
         }
     }
 }
 
 void CanvasWidget::resizeEvent(QResizeEvent *event) {
-    if (width() > canvasImage.width() || height() > canvasImage.height()) {
-        // 创建一个新的 QImage 并填充背景色
-        QImage newImage(width(), height(), QImage::Format_ARGB32);
-        newImage.fill(Qt::white);
+    QWidget::resizeEvent(event);
+    // 窗口变大时只把窗口移到/扩到视图所在的块，原有像素留在文档分块里，不再整幅重新分配拷贝
+    ensureViewCovered();
+}
 
-        // 把原来的画布内容拷贝到新的 QImage 上
-        QPainter painter(&newImage);
-        painter.drawImage(0, 0, canvasImage);
+void CanvasWidget::ensureViewCovered() {
+    const QRect view = mapRectToImage(rect()).adjusted(1, 1, -1, -1); // 不要 mapRectToImage 多留的那圈
+    if (view.isEmpty() || canvasImage.rect().contains(view)) return;
+    // 交互中的快照和预览都按当前窗口的画布坐标保存，等这次交互结束后再换；
+    // 后台填充和渲染线程还在写画布时也推迟，它们结束时会再调用这里
+    if (drawing || isSelecting || isMoving || isRotating || isScaling || isAdjustingCurve || isDraggingClipRect) return;
+    if (fillJob || renderBusy()) return;
+    commitHistory();
+
+    // 视图越出窗口的方向多留一块，并按块对齐，继续小幅平移时不必马上再换
+    const int margin = document.tileSize();
+    const QRect current(documentOrigin, canvasImage.size());
+    QRect wanted = view.translated(documentOrigin);
+    if (wanted.left() < current.left()) wanted.setLeft(wanted.left() - margin);
+    if (wanted.top() < current.top()) wanted.setTop(wanted.top() - margin);
+    if (wanted.right() > current.right()) wanted.setRight(wanted.right() + margin);
+    if (wanted.bottom() > current.bottom()) wanted.setBottom(wanted.bottom() + margin);
+    const QRect window = document.alignedRect(wanted);
+
+    // 旧窗口写回分块（整块空白的不分配），新窗口从分块取出
+    flushWindow();
+    canvasImage = document.take(window);
+    windowKey = canvasImage.cacheKey();
+    const QPoint delta = window.topLeft() - documentOrigin;
+    documentOrigin = window.topLeft();
+    layers.setWindow(window);   // 其他层的窗口跟着换
+    mipPyramid.clear();
+    translateContent(-delta);
+    m_zoomOffset += QPointF(delta) * m_zoomFactor; // 同一文档点仍画在窗口的同一位置
+    // 视口里已经画好的像素不变，只有原来落在旧窗口外面的部分要重算
+    viewport.rebase(current.translated(-documentOrigin), QPointF(delta) * m_zoomFactor * devicePixelRatioF());
+
+    // 整幅画布的快照坐标对不上了；选区底下那一块（originalCanvas）只跟着 selectionRect 走，仍然可用
+    preTransformImage = QImage();
+    curvePreviewImage = QImage();
+    undoHistory.moveWindow(canvasImage, documentOrigin); // 历史按文档坐标记录，只是换个窗口
+    invalidateOverlay();
+    update();
+}
 
-        // 更新画布
-        canvasImage = newImage;
+void CanvasWidget::translateContent(QPoint delta) {
+    if (delta.isNull()) return;
+    primitives.translate(delta);
+    startPoint += delta;
+    endPoint += delta;
+    currentPoint += delta;
+    startPointF += QPointF(delta);
+    firstVertex += delta;
+    clipStartPoint += delta;
+    selectionStartPoint += delta;
+    rotateCenter += delta;
+    for (QVector<QPoint> *points : { &polygonPoints, &controlPoints, &strokePoints }) {
+        for (QPoint &point : *points) point += delta;
     }
-    QWidget::resizeEvent(event);
+    for (QVector<QVector<QPoint>> *polygons : { &allPolygons, &clippedPolygons }) {
+        for (QVector<QPoint> &polygon : *polygons) {
+            for (QPoint &point : polygon) point += delta;
+        }
+    }
+    for (QLine &line : clippedLines) line.translate(delta);
+    for (QLine &line : originalLines) line.translate(delta);
+    clipWindow.translate(delta);
+    clipRect.translate(delta);
+    selectionRect.translate(delta);
+    scaleRect.translate(delta);
+    previewDamage.translate(delta);
+}
+
+void CanvasWidget::flushWindow() {
+    // 窗口没改过、又完全在映射文件里（没有从堆上取走的块）时不必写回，免得弄脏没动过的页
+    const QRect window(documentOrigin, canvasImage.size());
+    if (canvasImage.cacheKey() == windowKey && document.mappedRect().contains(window)) return;
+    document.write(canvasImage, documentOrigin, canvasImage.rect());
+    windowKey = canvasImage.cacheKey();
+}
+
+void CanvasWidget::syncTileFile() {
+    beginEdit();
+    if (document.isMapped()) {
+        flushWindow();
+        document.syncFile();   // 画到文件范围外面的块也存进文件
+    }
+    layers.syncFiles();   // 映射文件所在的层不是当前层时
+}
+
+bool CanvasWidget::openTileFile(const QString &fileName) {
+    finishRender();
+    finishFloodFill(false);
+    commitSelection();
+    syncTileFile(); // 上一个映射文件里的改动先写回
+    if (!document.openFile(fileName)) return false;
+    resetDocumentWindow();
+    return true;
+}
+
+bool CanvasWidget::importTileFile(const QString &imageFile, const QString &fileName) {
+    finishRender();
+    finishFloodFill(false);
+    commitSelection();
+    syncTileFile();
+    if (!document.importImage(imageFile, fileName)) return false;
+    resetDocumentWindow();
+    return true;
+}
+
+void CanvasWidget::resetDocumentWindow() {
+    primitives.clear();
+    allPolygons.clear();
+    clippedPolygons.clear();
+    clippedLines.clear();
+    originalLines.clear();
+    polygonPoints.clear();
+    controlPoints.clear();
+    selectionRect = QRect();
+    selectionImage = QImage();
+    selectionFloating = false;
+    clipRect = QRect();
+    scaleRect = QRect();
+    scaleOriginal = QImage();
+    originalCanvas = QImage();
+    preTransformImage = QImage();
+    curvePreviewImage = QImage();
+
+    // 从文档原点开始看，窗口只取视图覆盖的块；映射文件打开后只有这些块被读到
+    m_zoomFactor = 1.0;
+    m_zoomOffset = QPointF(0, 0);
+    documentOrigin = QPoint(0, 0);
+    canvasImage = document.take(document.alignedRect(QRect(QPoint(0, 0), size().expandedTo(QSize(1, 1)))));
+    windowKey = canvasImage.cacheKey();
+    undoHistory.reset(canvasImage, primitives.revision(), documentOrigin);
+    // 打开的文件成为唯一的一层
+    layers.reset();
+    layers.setName(0, "背景");
+    layers.setWindow(QRect(documentOrigin, canvasImage.size()));
+    mipPyramid.clear();
+    viewport.clear();
+    invalidateOverlay();
+    update();
+    emit layersChanged();
+    emit imageModified();
+}
+
+QRect CanvasWidget::documentBounds() const {
+    return document.bounds() | QRect(documentOrigin, canvasImage.size()) | layers.bounds();
+}
+
+QImage CanvasWidget::documentImage() const {
+    // 窗口里的像素以 canvasImage 为准，盖在分块内容上面
+    const QRect window(documentOrigin, canvasImage.size());
+    const QRect area = documentBounds();
+    QImage image = document.read(area);
+    PerfPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(window.topLeft() - area.topLeft(), canvasImage);
+    painter.end();
+    // 多个图层时再和其他层一起按各自的属性合成
+    return layers.isSingle() ? image : layers.flatten(image, area);
 }
 
 void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
     if (isAdjustingCurve && selectedPointIndex != -1) {
         QPoint newPos = mapToImage(event->pos()).toPoint();
+        if (previewDamage.isNull()) previewDamage = curvePreviewBounds();
         controlPoints[selectedPointIndex] = newPos;
-        update();
+        updatePreview(curvePreviewBounds());
         return;
     }
 
@@ -494,7 +827,7 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
                           abs(startPoint.x() - currentPoint.x()),
                           abs(startPoint.y() - currentPoint.y()))
                         .intersected(canvasImage.rect());
-        update();
+        updatePreview(scaleRect.adjusted(-1, -1, 1, 1));
         return;
     }
     if (transformMode == Rotate && isRotating) {
@@ -505,53 +838,41 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
         double newAngle = qRadiansToDegrees(atan2(delta.y(), delta.x()));
         currentAngle = newAngle - initialAngle;
 
-        update();
+        update(); // 旋转预览重画整幅画布，损坏区域本来就是整个视图
         return;
     }
     if (event->buttons() & Qt::MiddleButton) {
         QPoint delta = event->pos() - m_lastDragPos;
         m_zoomOffset += delta;
         m_lastDragPos = event->pos();
+        ensureViewCovered(); // 平移没有边界，移出窗口时换到新位置
+        // 视口缓存按平移量挪动已画好的像素，paintEvent 里只缩放新露出的条带
         update();
         event->accept();
         return;
     } else if (isDraggingClipRect && drawingMode == 6) { // 裁剪模式
         QPoint currentPoint = mapToImage(event->pos()).toPoint();
         clipRect.setBottomRight(currentPoint);
-        update(); // 触发重绘
+        updatePreview(clipRect.normalized().adjusted(-1, -1, 1, 1)); // 只重画新旧两个橡皮筋框
     } else if (selectionMode == 1 && isSelecting) {
         // 绘制选择框
         QPoint currentPoint = mapToImage(event->pos()).toPoint();
         selectionRect.setBottomRight(currentPoint);
-        update();
+        updatePreview(selectionRect.normalized().adjusted(-1, -1, 1, 1));
     } else if ((selectionMode == 1 || selectionMode == 2) && isMoving) {
-        // 恢复到原始画布状态
-        canvasImage = originalCanvas.copy();
-
-        // 移动选择框时，更新位置并绘制内容
+        // 移动中选区只是浮在画布上的图层，画布本身不动
         QPoint newPos = mapToImage(event->pos()).toPoint() - selectionOffset;
+        if (previewDamage.isNull()) previewDamage = selectionRect.adjusted(-1, -1, 1, 1);
         selectionRect.moveTo(newPos);
-
-        // 在新位置绘制选区内容
-        QPainter painter(&canvasImage);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        for(int y = 0; y < selectionImage.height(); ++y) {
-            for(int x = 0; x < selectionImage.width(); ++x) {
-                QColor pixelColor = selectionImage.pixelColor(x, y);
-                if(pixelColor != Qt::white && pixelColor.alpha() > 0) {
-                    painter.setPen(pixelColor);
-                    painter.drawPoint(selectionRect.x() + x, selectionRect.y() + y);
-                }
-            }
-        }
-        update();
+        updatePreview(selectionRect.adjusted(-1, -1, 1, 1)); // 看得见的变化只在选区的旧位置和新位置
     } else if (drawing) {
         QPointF imagePos = mapToImage(event->pos());
         currentPoint = imagePos.toPoint();
+        QRect damage; // 实时笔画改动的区域
 
         // 自由绘制模式实时绘制
         if (drawingMode == 0) {
-            QPainter painter(&canvasImage);
+            PerfPainter painter(&canvasImage);
             painter.setRenderHint(QPainter::Antialiasing);
             QPen pen(penColor, penWidth, lineStyle, Qt::RoundCap, Qt::RoundJoin);
             if(lineStyle != Qt::SolidLine) {
@@ -561,12 +882,18 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
             }
             painter.setPen(pen);
             painter.drawLine(startPoint - m_canvasOffset, currentPoint - m_canvasOffset);
+            damage = strokeBounds(QRect(startPoint, currentPoint).normalized().translated(-m_canvasOffset));
+            markCanvasDirty(damage);
+            strokePoints.append(currentPoint - m_canvasOffset);
             startPoint = currentPoint;
         }
         else if (drawingMode == 3) { // 橡皮擦实时擦除
-            QPainter painter(&canvasImage);
+            PerfPainter painter(&canvasImage);
             painter.setPen(QPen(backgroundColor, penWidth, Qt::SolidLine, Qt::RoundCap));
             painter.drawLine(startPoint - m_canvasOffset, currentPoint - m_canvasOffset);
+            damage = strokeBounds(QRect(startPoint, currentPoint).normalized().translated(-m_canvasOffset));
+            markCanvasDirty(damage);
+            strokePoints.append(currentPoint - m_canvasOffset);
             startPoint = currentPoint;
         }
 
@@ -578,7 +905,11 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
             }
         }
 
-        update();  // 触发重绘更新预览
+        if (drawingMode == 0 || drawingMode == 3) {
+            update(mapRectFromImage(damage));
+        } else {
+            updatePreview(previewBounds()); // 橡皮筋预览：擦掉旧形状，画上新形状
+        }
     }
 }
 
@@ -595,17 +926,23 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
     if (transformMode == Rotate && event->button() == Qt::LeftButton) {
         isRotating = false;
 
-        // 应用旋转并累积角度
-        QPainter painter(&canvasImage);
-        painter.setRenderHint(QPainter::SmoothPixmapTransform);
-        painter.translate(rotateCenter);
-        painter.rotate(rotateAngle + currentAngle);  // 应用累积角度
-        painter.translate(-rotateCenter);
-        painter.drawImage(0, 0, preTransformImage);
+        // 应用旋转并累积角度：整幅平滑变换在渲染线程上做，画完前界面照常显示原画布
+        const QImage source = preTransformImage;
+        const QPoint center = rotateCenter;
+        const double angle = rotateAngle + currentAngle;  // 应用累积角度
+        postRender([source, center, angle](QImage &image) {
+            PerfPainter painter(&image);
+            painter.setRenderHint(QPainter::SmoothPixmapTransform);
+            painter.translate(center);
+            painter.rotate(angle);
+            painter.translate(-center);
+            painter.drawImage(0, 0, source);
+            return image.rect();
+        });
 
         // 保存状态
         rotateAngle += currentAngle;  // 累积旋转角度
-        preTransformImage = canvasImage.copy();
+        preTransformImage = QImage(); // 下次按下时重新取
         update();
         return;
     }
@@ -625,7 +962,7 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
         if (QLineF(currentPoint, firstVertex).length() < CLOSE_DISTANCE &&
             polygonPoints.size() >= 3) {
             // 完成多边形绘制
-            QPainter painter(&canvasImage);
+            PerfPainter painter(&canvasImage);
             painter.setRenderHint(QPainter::Antialiasing);
             painter.setPen(QPen(penColor, penWidth, lineStyle));
             // 转换为图像坐标系
@@ -634,7 +971,10 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
                 imagePoints.append(mapToCanvas(p));
             }
             painter.drawPolygon(imagePoints.data(), imagePoints.size());
+            markCanvasDirty(strokeBounds(QPolygon(imagePoints).boundingRect()));
+            primitives.addPolygon(imagePoints, painterPen());
             allPolygons.append(imagePoints);
+            invalidateOverlay();
             drawing = false;
             polygonPoints.clear();
             update();
@@ -643,82 +983,133 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
         isSelecting = false;
         selectionRect = selectionRect.normalized();
 
+        if (selectionRect.width() <= 3 && selectionRect.height() <= 3) {
+            // 单击而不是拖框：选中点到的图元（按图元包围盒）
+            const int hit = primitives.hitTest(selectionRect.center() - m_canvasOffset);
+            selectionRect = hit >= 0 ? primitives.bounds(hit).translated(m_canvasOffset).intersected(canvasImage.rect())
+                                     : QRect();
+        }
+
         if (!selectionRect.isNull()) {
-            // 保存选择区域的图像
-            selectionImage = canvasImage.copy(selectionRect);
+            // 保存选择区域的图像，遮罩只在这里算一次：非白色且不透明的像素
+            selectionImage = Raster::maskedLayer(canvasImage.copy(selectionRect), qRgb(255, 255, 255));
 
             // 新增代码：清除原位置的选区内容
-            QPainter painter(&canvasImage);
+            PerfPainter painter(&canvasImage);
             painter.setCompositionMode(QPainter::CompositionMode_Source);
-            painter.fillRect(selectionRect, backgroundColor);
+            // 只有最底下一层露出背景色，上面的层挖空后透出下面的层
+            painter.fillRect(selectionRect, layers.current() == 0 ? backgroundColor : QColor(Qt::transparent));
+            markCanvasDirty(selectionRect);
 
-            // 保存原始画布状态（此时已清除选区内容）
-            originalCanvas = canvasImage.copy();
+            // 原始画布状态（此时已清除选区内容）在选区落下时再记
+            originalCanvas = QImage();
+            selectionFloating = true;
         }
         update();
     } else if ((selectionMode == 1 || selectionMode == 2) && isMoving) {
         isMoving = false;
-        update();
+        commitSelection(); // 移动结束才写进画布
+        update(mapRectFromImage(selectionRect.adjusted(-1, -1, 1, 1)));
     } else {
         if (drawing) {
             drawing = false;
             // 处理圆弧模式的最终绘制
             if (drawingMode == 8) { // 圆弧模式
-                QPointF imagePos = mapToImage(event->pos());
+                QPointF imagePos = subpixelPoint(mapToImage(event->pos()));
                 endPoint = imagePos.toPoint();
 
-                QPainter painter(&canvasImage);
-                painter.setRenderHint(QPainter::Antialiasing);
                 int radius = static_cast<int>(sqrt(pow(endPoint.x() - startPoint.x(), 2) +
                                                    pow(endPoint.y() - startPoint.y(), 2)));
                 // 计算动态角度
-                double dx = endPoint.x() - startPoint.x();
-                double dy = endPoint.y() - startPoint.y();
+                double dx = imagePos.x() - startPointF.x();
+                double dy = imagePos.y() - startPointF.y();
                 double startAngle = qRadiansToDegrees(atan2(-dy, dx));
                 double endAngle = startAngle + 90; // 固定90度圆弧
 
-                drawMidpointArc(painter, startPoint - m_canvasOffset, radius, startAngle, endAngle);
+                if (rasterBackend == DirectBackend) {
+                    Raster::RasterBatch batch;
+                    batch.addArc(startPointF - m_canvasOffset, subpixelRadius(radius, imagePos), startAngle, endAngle,
+                                 penColor.rgba(), penWidth);
+                    rasterizeBatch(batch);
+                    primitives.addArc(startPointF - m_canvasOffset, subpixelRadius(radius, imagePos), startAngle, endAngle,
+                                      currentPen(static_cast<Raster::LineAlgorithm>(lineAlgorithm)));
+                } else {
+                    PerfPainter painter(&canvasImage);
+                    painter.setRenderHint(QPainter::Antialiasing);
+                    drawMidpointArc(painter, startPoint - m_canvasOffset, radius, startAngle, endAngle);
+                    primitives.addArc(startPoint - m_canvasOffset, radius, startAngle, endAngle,
+                                      currentPen(static_cast<Raster::LineAlgorithm>(lineAlgorithm)));
+                }
+                const QPoint center = startPoint - m_canvasOffset;
+                markCanvasDirty(strokeBounds(QRect(center - QPoint(radius, radius), center + QPoint(radius, radius))));
             }
             // 自由绘制模式不需要额外处理，因为已经实时绘制
             if (drawingMode == 1 || drawingMode == 2 || drawingMode == 3) {
                 // 处理其他模式的最终绘制
-                QPointF imagePos = mapToImage(event->pos());
+                QPointF imagePos = subpixelPoint(mapToImage(event->pos()));
                 endPoint = imagePos.toPoint();
 
-                QPainter painter(&canvasImage);
+                PerfPainter painter(&canvasImage);
                 painter.setRenderHint(QPainter::Antialiasing, true);
 
+                QRect strokeRect = QRect(startPoint, endPoint).normalized().translated(-m_canvasOffset);
                 switch (drawingMode) {
                 case 1: // 直线
-                    if (lineAlgorithm == Bresenham) {
+                    if (rasterBackend == DirectBackend) {
+                        painter.end(); // 直接写扫描线前先结束 QPainter
+                        Raster::RasterBatch batch;
+                        batch.addLine(startPointF - m_canvasOffset, imagePos - m_canvasOffset, penColor.rgba(), penWidth);
+                        rasterizeBatch(batch);
+                    } else if (lineAlgorithm == Wu) {
+                        // 对照用：QPainter 的通用反走样路径，与 drawLine() 一致
+                        painter.setPen(QPen(penColor, penWidth, lineStyle));
+                        painter.drawLine(QLineF(startPointF, imagePos).translated(-m_canvasOffset));
+                    } else if (lineAlgorithm == Bresenham) {
                         drawBresenhamLine(painter, startPoint - m_canvasOffset, endPoint - m_canvasOffset);
                     } else if (lineAlgorithm == Midpoint) {
                         drawMidpointLine(painter, startPoint - m_canvasOffset, endPoint - m_canvasOffset);
                     }
+                    primitives.addLine(startPointF - m_canvasOffset, imagePos - m_canvasOffset,
+                                       linePen(penColor.rgba(), penWidth));
                     break;
                 case 2: { // 圆
                     int radius = static_cast<int>(sqrt(pow(endPoint.x() - startPoint.x(), 2) +
                                                        pow(endPoint.y() - startPoint.y(), 2)));
-                    drawMidpointArc(painter, startPoint - m_canvasOffset, radius, 0, 0, true);
+                    const QPoint center = startPoint - m_canvasOffset;
+                    strokeRect = QRect(center - QPoint(radius, radius), center + QPoint(radius, radius));
+                    const Raster::PrimitiveStore::Pen pen = currentPen(static_cast<Raster::LineAlgorithm>(lineAlgorithm));
+                    if (rasterBackend == DirectBackend) {
+                        painter.end();
+                        Raster::RasterBatch batch;
+                        batch.addArc(startPointF - m_canvasOffset, subpixelRadius(radius, imagePos), 0, 360,
+                                     penColor.rgba(), penWidth);
+                        rasterizeBatch(batch);
+                        primitives.addCircle(startPointF - m_canvasOffset, subpixelRadius(radius, imagePos), pen);
+                    } else {
+                        drawMidpointArc(painter, startPoint - m_canvasOffset, radius, 0, 0, true);
+                        primitives.addCircle(center, radius, pen);
+                    }
                     break;
                 }
                 case 3: // 橡皮擦
                     painter.setPen(QPen(backgroundColor, penWidth, Qt::SolidLine, Qt::RoundCap));
                     painter.drawLine(startPoint - m_canvasOffset, endPoint - m_canvasOffset);
+                    strokePoints.append(endPoint - m_canvasOffset);
+                    primitives.addPolyline(strokePoints, { backgroundColor.rgba(), penWidth, Qt::SolidLine, Raster::Bresenham,
+                                                           Raster::PrimitiveStore::Painter, Qt::RoundCap });
                     break;
                 }
+                markCanvasDirty(strokeBounds(strokeRect));
+            }
+            if (drawingMode == 0 && strokePoints.size() >= 2) {
+                primitives.addPolyline(strokePoints, painterPen(Qt::RoundCap)); // 自由笔迹是 QPainter 反走样画的
             }
+            strokePoints.clear();
             update();
         }
         if (event->button() == Qt::RightButton && drawingMode == 7 && controlPoints.size() >= 2) {
-            // 右键完成Bezier曲线绘制并保存到画布
-            QPainter painter(&canvasImage);
-            painter.setRenderHint(QPainter::Antialiasing);
-            painter.setPen(QPen(penColor, penWidth, lineStyle));
-            drawBezierCurve(painter);
-
-            // 清除控制点
-            controlPoints.clear();
+            // 右键完成Bezier曲线绘制并保存到画布（清除控制点）
+            commitBezierCurve();
             update();
         }
     }
@@ -729,44 +1120,13 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
 }
 
 void CanvasWidget::drawBresenhamLine(QPainter &painter, QPoint p1, QPoint p2) {
-    int x1 = p1.x(), y1 = p1.y();
-    int x2 = p2.x(), y2 = p2.y();
-    int dx = abs(x2 - x1), dy = abs(y2 - y1);
-    int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
-    int err = dx - dy;
-
-    int dashCounter = 0; // 虚线计数器
-    int dashLength = (lineStyle == Qt::DashLine) ? 10 : 
-                    (lineStyle == Qt::DotLine) ? 2 : 0;
-
-    while (true) {
-        bool drawPixel = true;
-        if (lineStyle != Qt::SolidLine) {
-            int cyclePos = dashCounter % (dashLength * 2);
-            if (lineStyle == Qt::DashLine) {
-                drawPixel = (cyclePos < dashLength);
-            }
-            else if (lineStyle == Qt::DotLine) {
-                drawPixel = (cyclePos < 1);
-            }
-        }
-
-        if (drawPixel) {
-            painter.drawPoint(x1, y1);
-        }
-        dashCounter++;
+    auto drawPoint = [&](int x, int y) { painter.drawPoint(x, y); };
+    Raster::Perf::CountedPlot<decltype(drawPoint)> counted(Raster::Perf::BresenhamPixels, drawPoint);
+    Raster::bresenhamLine(p1, p2, lineStyle, [&](int x, int y) { counted(x, y); });
+}
 
-        if (x1 == x2 && y1 == y2) break;
-        int e2 = 2 * err;
-        if (e2 > -dy) {
-            err -= dy;
-            x1 += sx;
-        }
-        if (e2 < dx) {
-            err += dx;
-            y1 += sy;
-        }
-    }
+void CanvasWidget::drawBresenhamLine(SpanWriter &writer, QPoint p1, QPoint p2) {
+    Raster::drawBresenhamLine(writer, p1, p2, lineStyle);
 }
 
 void CanvasWidget::drawMidpointArc(QPainter &painter, QPoint center, int radius,
@@ -774,130 +1134,48 @@ void CanvasWidget::drawMidpointArc(QPainter &painter, QPoint center, int radius,
     QPen pen(penColor, penWidth, lineStyle);
     painter.setPen(pen);
 
-    int x = radius;
-    int y = 0;
-    int p = 1 - radius;
-
-    if (isFullCircle) {
-        while (x >= y) {
-            // 绘制八个对称点
-            painter.drawPoint(center.x() + x, center.y() - y);
-            painter.drawPoint(center.x() + y, center.y() - x);
-            painter.drawPoint(center.x() - y, center.y() - x);
-            painter.drawPoint(center.x() - x, center.y() - y);
-            painter.drawPoint(center.x() - x, center.y() + y);
-            painter.drawPoint(center.x() - y, center.y() + x);
-            painter.drawPoint(center.x() + y, center.y() + x);
-            painter.drawPoint(center.x() + x, center.y() + y);
-
-            y++;
-            if (p <= 0) {
-                p += 2 * y + 1;
-            } else {
-                x--;
-                p += 2 * (y - x) + 1;
-            }
-        }
-    } else {
-        startAngle = qDegreesToRadians(startAngle);
-        endAngle = qDegreesToRadians(endAngle);
-        if (endAngle < startAngle) endAngle += 2*M_PI;
-
-        auto inAngleRange = [](double angle, double start, double end) {
-            angle = fmod(angle, 2*M_PI);
-            if (angle < 0) angle += 2*M_PI;
-            return (start <= end) ? (angle >= start && angle <= end) : (angle >= start || angle <= end);
-        };
-
-        while (x >= y) {
-            // 绘制第一象限的两个关键点及其邻近点
-            double baseAngle = atan2(-y, x);
-
-            // 主点 (x,y)
-            if (inAngleRange(baseAngle, startAngle, endAngle)) {
-                painter.drawPoint(center.x() + x, center.y() - y);
-            }
-
-            // 对称点 (y,x)
-            double symAngle = M_PI_2 - baseAngle;
-            if (inAngleRange(symAngle, startAngle, endAngle)) {
-                painter.drawPoint(center.x() + y, center.y() - x);
-            }
-
-            // 添加中间点提高连续性
-            for (int i = 1; i <= 3; ++i) {
-                double ratio = i * 0.25;
-                int px = x - static_cast<int>(x * ratio);
-                int py = y + static_cast<int>(y * ratio);
-
-                if (px < 0 || py < 0) continue;
-
-                double midAngle = atan2(-py, px);
-                if (inAngleRange(midAngle, startAngle, endAngle)) {
-                    painter.drawPoint(center.x() + px, center.y() - py);
-                }
-            }
-
-            // 原始算法步进
-            y++;
-            if (p <= 0) {
-                p += 2 * y + 1;
-            } else {
-                x--;
-                p += 2 * (y - x) + 1;
-            }
-        }
-    }
-}
-
-// 辅助函数：绘制单个圆弧点
-void CanvasWidget::drawArcPoint(QPainter &painter, QPoint center,
-                                int x, int y, int dashCounter, int dashLength) {
-    bool drawPixel = true;
-
-    if(lineStyle != Qt::SolidLine) {
-        int cyclePos = dashCounter % (dashLength * 2);
-        if(lineStyle == Qt::DashLine) {
-            drawPixel = (cyclePos < dashLength);
-        }
-        else if(lineStyle == Qt::DotLine) {
-            drawPixel = (cyclePos < 1);
-        }
-    }
-
-    if(drawPixel) {
-        painter.drawPoint(center.x() + x, center.y() - y);
-    }
+    // 先收集像素，再一次性 drawPoints，避免逐点经过画笔状态机
+    QVector<QPoint> points;
+    Raster::midpointArc(center, radius, startAngle, endAngle, isFullCircle, lineStyle,
+                        [&](int x, int y) { points.append(QPoint(x, y)); });
+    painter.drawPoints(points.constData(), points.size());
+    CANVAS_PERF_ADD(ArcPixels, points.size());
 }
 
 void CanvasWidget::wheelEvent(QWheelEvent *event) {
     if (transformMode == Scale && scaleOriginal.size().isValid()) {
+        beginEdit();
         // 计算缩放增量
         double delta = event->angleDelta().y() > 0 ? 0.1 : -0.1;
         scaleFactor = qMax(0.1, scaleFactor + delta);
 
-        // 生成缩放后的图像
-        QImage scaled = scaleOriginal.scaled(
-            scaleOriginal.size() * scaleFactor,
-            Qt::KeepAspectRatio,
-            Qt::SmoothTransformation
-            );
-
-        // 计算绘制位置（居中显示）
-        QPoint drawPos = scaleRect.center() - QPoint(scaled.width()/2, scaled.height()/2);
-
-        // 应用缩放
-        QPainter painter(&canvasImage);
-        painter.setRenderHint(QPainter::SmoothPixmapTransform);
-
-        // 保存原始选区外内容
-        QImage originalBackground = canvasImage.copy();
-
-        // 清除选区内容为背景色
-        painter.fillRect(scaleRect, backgroundColor);
-
-        // 绘制缩放后的图像（保持居中）
-        painter.drawImage(drawPos, scaled);
+        // 平滑缩放放到渲染线程上做，连续滚动时命令依次排队，界面线程不等
+        const QImage original = scaleOriginal;
+        const QRect area = scaleRect;
+        const double factor = scaleFactor;
+        const QColor background = backgroundColor;
+        postRender([original, area, factor, background](QImage &image) {
+            // 生成缩放后的图像
+            QImage scaled = original.scaled(
+                original.size() * factor,
+                Qt::KeepAspectRatio,
+                Qt::SmoothTransformation
+                );
+
+            // 计算绘制位置（居中显示）
+            QPoint drawPos = area.center() - QPoint(scaled.width()/2, scaled.height()/2);
+
+            // 应用缩放
+            PerfPainter painter(&image);
+            painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+            // 清除选区内容为背景色
+            painter.fillRect(area, background);
+
+            // 绘制缩放后的图像（保持居中）
+            painter.drawImage(drawPos, scaled);
+            return area | QRect(drawPos, scaled.size());
+        });
 
         update();
         event->accept();
@@ -919,6 +1197,7 @@ void CanvasWidget::wheelEvent(QWheelEvent *event) {
         QPointF newScreenPos = mapFromImage(scenePos);
         m_zoomOffset += (mousePos - newScreenPos);
 
+        ensureViewCovered();
         update();
         event->accept();
     } else {
@@ -928,149 +1207,346 @@ void CanvasWidget::wheelEvent(QWheelEvent *event) {
 
 void CanvasWidget::setZoom(double factor) {
     m_zoomFactor = qBound(0.2, factor, 5.0);
+    ensureViewCovered();
     update();
 }
 
 void CanvasWidget::resetZoom() {
     m_zoomFactor = 1.0;
-    m_zoomOffset = QPointF(0, 0);
+    m_zoomOffset = QPointF(documentOrigin); // 回到文档原点
     m_canvasOffset = QPoint(0, 0);
+    ensureViewCovered();
     update();
 }
 
 // 添加非递归的泛洪填充算法
+// 达到这个像素数的画布改用后台分块填充
+static const qint64 ParallelFillMinPixels = qint64(2048) * 2048;
+
 void CanvasWidget::floodFill(QPoint seedPoint) {
-    QImage image = canvasImage.convertToFormat(QImage::Format_RGB32);
-    QRgb oldColor = image.pixel(seedPoint);
-    QRgb newColor = penColor.rgb();
-
-    if (oldColor == newColor) return;
-
-    QQueue<QPoint> queue;
-    queue.enqueue(seedPoint);
-
-    const int dx8[] = { -1, 0, 1, -1, 1, -1, 0, 1 };
-    const int dy8[] = { -1, -1, -1, 0, 0, 1, 1, 1 };
-    const int dx4[] = { -1, 0, 1, 0 };
-    const int dy4[] = { 0, -1, 0, 1 };
-
-    const int* dx = fillConnectivity == EightWay ? dx8 : dx4;
-    const int* dy = fillConnectivity == EightWay ? dy8 : dy4;
-    const int count = fillConnectivity == EightWay ? 8 : 4;
-
-    while (!queue.isEmpty()) {
-        QPoint p = queue.dequeue();
-        if (image.rect().contains(p) && image.pixel(p) == oldColor) {
-            image.setPixel(p, newColor);
-            for (int i = 0; i < count; ++i) {
-                QPoint np(p.x() + dx[i], p.y() + dy[i]);
-                if (image.rect().contains(np) && image.pixel(np) == oldColor) {
-                    queue.enqueue(np);
-                }
-            }
+    originalCanvas = QImage(); // 填充可能改到落下的选区，不能再按旧的底图拿起
+    if (fillSampleMerged && !layers.isSingle()) {
+        mergedFloodFill(seedPoint);
+        return;
+    }
+    const Raster::Connectivity connectivity = fillConnectivity == EightWay ? Raster::EightWay : Raster::FourWay;
+    const bool useLabels = labelFill && fillTolerance == 0;
+    // 标签已算好时只重写种子所在的分量，标签缓存自己维护改动
+    QRect labelDirty;
+    if (useLabels && labelCache.fill(canvasImage, seedPoint, penColor.rgb(), connectivity, &labelDirty)) {
+        markCanvasDirty(labelDirty);
+        return;
+    }
+    if (parallelFill && qint64(canvasImage.width()) * canvasImage.height() >= ParallelFillMinPixels) {
+        finishFloodFill(false);
+        // 填充线程一取缓冲 canvasImage 就分离出自己的一份，界面在这之前共享的 fillView 上显示进度
+        fillView = canvasImage;
+        fillJob.reset(new Raster::TiledFloodFill(canvasImage, seedPoint, penColor.rgb(), connectivity,
+                                                 fillTolerance, fillMetric));
+        fillJobDirty = QRect();
+        fillJob->start();
+        fillTimer->start();
+        return;
+    }
+    // 直接在 ARGB32 画布上原地填充，不再整幅转换格式
+    markCanvasDirty(Raster::floodFill(canvasImage, seedPoint, penColor.rgb(), connectivity, fillTolerance, fillMetric));
+    if (useLabels) {
+        labelCache.prepare(canvasImage, connectivity); // 后台算好标签，下一次点击直接用
+    }
+}
+
+void CanvasWidget::mergedFloodFill(QPoint seedPoint) {
+    if (!canvasImage.rect().contains(seedPoint)) return;
+    const Raster::Connectivity connectivity = fillConnectivity == EightWay ? Raster::EightWay : Raster::FourWay;
+    // 在合成结果的拷贝上用标记色填，变了的像素就是区域。标记色每个通道都和种子颜色相差至少 128，
+    // 除非容差大到连标记色也匹配，区域里不会有本来就是标记色的像素
+    const QImage merged = displayImage(canvasImage.rect()).convertToFormat(QImage::Format_ARGB32);
+    const QRgb seed = merged.pixel(seedPoint);
+    auto opposite = [](int channel) { return channel < 128 ? 255 : 0; };
+    const QRgb marker = qRgba(opposite(qRed(seed)), opposite(qGreen(seed)), opposite(qBlue(seed)), opposite(qAlpha(seed)));
+    QImage region = merged;
+    const QRect dirty = Raster::floodFill(region, seedPoint, marker, connectivity, fillTolerance, fillMetric);
+
+    const QRgb color = penColor.rgb();
+    for (int y = dirty.top(); y <= dirty.bottom(); ++y) {
+        const QRgb *before = reinterpret_cast<const QRgb *>(merged.constScanLine(y));
+        const QRgb *after = reinterpret_cast<const QRgb *>(region.constScanLine(y));
+        QRgb *line = reinterpret_cast<QRgb *>(canvasImage.scanLine(y));
+        for (int x = dirty.left(); x <= dirty.right(); ++x) {
+            if (after[x] != before[x]) line[x] = color;
         }
     }
+    markCanvasDirty(dirty);
+}
 
-    canvasImage = image.convertToFormat(QImage::Format_ARGB32);
+void CanvasWidget::pollFloodFill() {
+    if (!fillJob) {
+        fillTimer->stop();
+        return;
+    }
+    const QRect dirty = fillJob->takeProgress(fillView);
+    if (!dirty.isEmpty()) {
+        fillJobDirty |= dirty;
+        invalidateDisplay(dirty);
+        update(mapRectFromImage(dirty));
+    }
+    if (fillJob->isFinished()) {
+        finishFloodFill(false);
+        ensureViewCovered(); // 填充期间推迟的窗口换位
+    }
 }
 
-void CanvasWidget::setFillConnectivity(Connectivity conn) {
-    fillConnectivity = conn;
+void CanvasWidget::finishFloodFill(bool cancel) {
+    if (!fillJob) return;
+    if (cancel) {
+        fillJob->cancel(); // 工作线程退出后会把已填的段恢复成原来的像素
+    }
+    fillJob->waitForFinished();
+    const QRect dirty = fillJob->takeDirtyRect();
+    const bool modified = !fillJob->wasCanceled();
+    fillJob.reset();
+    fillView = QImage();
+    fillTimer->stop();
+
+    // 显示换回 canvasImage；取消时已显示的进度也要重画
+    fillJobDirty |= dirty;
+    markCanvasDirty(fillJobDirty);
+    if (!fillJobDirty.isEmpty()) {
+        update(mapRectFromImage(fillJobDirty));
+    }
+    if (modified) {
+        emit imageModified();
+    }
 }
 
-enum ClipAlgorithm { CohenSutherland, MidpointSubdivision };
-void CanvasWidget::setClipAlgorithm(ClipAlgorithm algo) {
-    clipAlgorithm = algo;
+void CanvasWidget::postRender(Raster::RenderThread::Command command) {
+    // 空闲时从当前画布开始新的一批，否则接着渲染线程上还没取回的结果画
+    renderPosted = renderThread.post(renderBusy() ? QImage() : canvasImage, std::move(command));
+}
+
+void CanvasWidget::pollRender() {
+    Raster::RenderThread::Frame frame;
+    if (!renderThread.takeFrame(frame) || frame.sequence <= renderAdopted) return;
+    // 画完的帧直接换成画布，paintEvent 照常只贴 canvasImage；改动区域是这一批累计的
+    canvasImage = frame.image;
+    renderAdopted = frame.sequence;
+    markCanvasDirty(frame.dirty);
+    update(mapRectFromImage(frame.dirty));
+    if (!renderBusy()) {
+        renderThread.release(); // 渲染线程不再持有画布，之后界面线程改写时不必复制
+        emit imageModified();
+        ensureViewCovered();    // 渲染期间推迟的窗口换位
+    }
+}
+
+void CanvasWidget::finishRender() {
+    if (!renderBusy()) return;
+    renderThread.waitFor(renderPosted);
+    pollRender();
 }
 
-QRect clipWindow; // 裁剪窗口
-ClipAlgorithm clipAlgorithm = CohenSutherland;
-QVector<QLine> clippedLines; // 存储裁剪后的线段
+void CanvasWidget::setParallelFill(bool enabled) {
+    parallelFill = enabled;
+}
 
-// Cohen-Sutherland算法的区域编码
-const int INSIDE = 0; // 0000
-const int LEFT = 1;   // 0001
-const int RIGHT = 2;  // 0010
-const int BOTTOM = 4; // 0100
-const int TOP = 8;    // 1000
+void CanvasWidget::setLabelFill(bool enabled) {
+    labelFill = enabled;
+    if (!enabled) {
+        labelCache.clear();
+    }
+}
 
-int CanvasWidget::computeOutCode(const QPoint &p) const {
-    int code = INSIDE;
+void CanvasWidget::beginEdit() {
+    // 渲染线程画完的帧会整幅换掉 canvasImage，先取回再改，界面线程的改动才不会被覆盖
+    finishRender();
+    finishFloodFill(false);
+    commitHistory(); // 上一次操作到此结束，记成一步
+}
 
-    if (p.x() < clipRect.left()) code |= LEFT;
-    if (p.x() > clipRect.right()) code |= RIGHT;
-    if (p.y() < clipRect.top()) code |= TOP;
-    if (p.y() > clipRect.bottom()) code |= BOTTOM;
+void CanvasWidget::markCanvasDirty(const QRect &imageRect) {
+    if (imageRect.isEmpty()) return;
+    labelCache.invalidate(canvasImage, imageRect);
+    invalidateDisplay(imageRect);
+    if (historyEnabled) undoHistory.markDirty(imageRect);
+}
 
-    return code;
+void CanvasWidget::invalidateDisplay(const QRect &imageRect) {
+    layers.invalidate(shownCanvas(), imageRect);
+    // 多个图层时缩略图由合成结果生成，重算了哪些块由 displayImage() 报告
+    if (layers.isSingle()) mipPyramid.invalidate(shownCanvas(), imageRect);
+    viewport.invalidate(imageRect);
 }
 
-bool CanvasWidget::cohenSutherlandClip(QLine &line) {
-    QPoint p1 = line.p1();
-    QPoint p2 = line.p2();
+const QImage &CanvasWidget::displayImage(const QRect &area) {
+    if (layers.isSingle()) return shownCanvas();
+    QRect refreshed;
+    const QImage &flat = layers.flattened(shownCanvas(), area, &refreshed);
+    // 重算过的块可能来自别的层的改动，缩略图和视口缓存都要跟着重取
+    mipPyramid.invalidate(flat, refreshed);
+    viewport.invalidate(refreshed);
+    return flat;
+}
 
-    int outcode1 = computeOutCode(p1);
-    int outcode2 = computeOutCode(p2);
-    bool accept = false;
+void CanvasWidget::applyLayerChange() {
+    // 显示的图像可能在 canvasImage 和合成结果之间切换，缩略图整体重建
+    mipPyramid.clear();
+    viewport.clear();
+    update();
+    emit layersChanged();
+}
 
-    while (true) {
-        if (!(outcode1 | outcode2)) { // 完全在窗口内
-            accept = true;
-            break;
-        } else if (outcode1 & outcode2) { // 完全在窗口外
-            break;
-        } else {
-            QPoint p;
-            int outcodeOut = outcode1 ? outcode1 : outcode2;
-
-            if (outcodeOut & TOP) {
-                p.setX(p1.x() + (p2.x() - p1.x()) * (clipWindow.top() - p1.y()) / (p2.y() - p1.y()));
-                p.setY(clipWindow.top());
-            } else if (outcodeOut & BOTTOM) {
-                p.setX(p1.x() + (p2.x() - p1.x()) * (clipWindow.bottom() - p1.y()) / (p2.y() - p1.y()));
-                p.setY(clipWindow.bottom());
-            } else if (outcodeOut & RIGHT) {
-                p.setY(p1.y() + (p2.y() - p1.y()) * (clipWindow.right() - p1.x()) / (p2.x() - p1.x()));
-                p.setX(clipWindow.right());
-            } else if (outcodeOut & LEFT) {
-                p.setY(p1.y() + (p2.y() - p1.y()) * (clipWindow.left() - p1.x()) / (p2.x() - p1.x()));
-                p.setX(clipWindow.left());
-            }
+int CanvasWidget::addLayer() {
+    const int index = layers.insert(layers.current() + 1, QString("图层 %1").arg(layers.count() + 1));
+    setCurrentLayer(index);
+    return index;
+}
 
-            if (outcodeOut == outcode1) {
-                p1 = p;
-                outcode1 = computeOutCode(p1);
-            } else {
-                p2 = p;
-                outcode2 = computeOutCode(p2);
-            }
-        }
-    }
-    if (accept) {
-        line.setP1(p1);
-        line.setP2(p2);
+void CanvasWidget::removeLayer(int index) {
+    if (layers.count() <= 1 || index < 0 || index >= layers.count()) return;
+    beginEdit();
+    const int id = layers.layer(index).id;
+    dropLayer(index);
+    // 删掉的层留在 layers 里，撤销这一步时放回
+    if (historyEnabled) {
+        undoHistory.commitEvent(id, primitives.revision());
+    } else {
+        layers.discardRemoved();
     }
-    return accept;
 }
 
-void CanvasWidget::midpointSubdivisionClip(QLine line) {
-    QStack<QLine> stack;
-    stack.push(line);
+void CanvasWidget::dropLayer(int index) {
+    if (index == layers.current()) setCurrentLayer(index > 0 ? index - 1 : 1);
+    layers.remove(index);
+    applyLayerChange();
+}
 
-    while (!stack.isEmpty()) {
-        QLine current = stack.pop();
-        int code1 = computeOutCode(current.p1());
-        int code2 = computeOutCode(current.p2());
+void CanvasWidget::setCurrentLayer(int index) {
+    if (index == layers.current() || index < 0 || index >= layers.count()) return;
+    beginEdit();
+    commitSelection();
+    commitHistory(); // 落下的选区记在原来那一层
+    layers.setCurrent(index, canvasImage, document);
+    windowKey = 0; // 换进来的窗口不一定和分块文件一致，下次同步时写回
+
+    // 按旧的当前层保存的快照不能再用
+    originalCanvas = QImage();
+    preTransformImage = QImage();
+    curvePreviewImage = QImage();
+    selectionRect = QRect();
+    selectionImage = QImage();
+    labelCache.clear();
+    const int id = layers.layer(index).id;
+    undoHistory.setLayer(canvasImage, id); // 历史保留，之后的步骤记在新的一层
+    primitives.setLayer(id);
+    applyLayerChange();
+}
 
-        if (!(code1 | code2)) { // 完全可见
-            clippedLines.append(current);
-        } else if (!(code1 & code2)) { // 部分可见
-            QPoint mid((current.p1().x() + current.p2().x()) / 2,
-                       (current.p1().y() + current.p2().y()) / 2);
-            stack.push(QLine(mid, current.p2()));
-            stack.push(QLine(current.p1(), mid));
-        }
+void CanvasWidget::showHistoryLayer(int layer) {
+    if (layer < 0 || layer == undoHistory.layer()) return;
+    setCurrentLayer(layers.indexOf(layer));
+}
+
+void CanvasWidget::setLayerOpacity(int index, double opacity) {
+    layers.setOpacity(index, opacity);
+    applyLayerChange();
+}
+
+void CanvasWidget::setLayerVisible(int index, bool visible) {
+    layers.setVisible(index, visible);
+    applyLayerChange();
+}
+
+void CanvasWidget::setLayerBlendMode(int index, Raster::BlendMode mode) {
+    layers.setBlendMode(index, mode);
+    applyLayerChange();
+}
+
+void CanvasWidget::setFillSampleMerged(bool enabled) {
+    fillSampleMerged = enabled;
+}
+
+void CanvasWidget::undo() {
+    if (fillJob) {
+        finishFloodFill(true); // 还没填完的填充直接回滚，不进历史
+        return;
+    }
+    finishRender();
+    commitHistory();
+    showHistoryLayer(undoHistory.undoLayer()); // 这一步画在别的层上时先换过去
+    originalCanvas = QImage(); // 撤销后的画布与记下的选区底图对不上
+    const QRect rect = undoHistory.undo(canvasImage, &document);   // 窗口外的块直接写回文档
+    primitives.setRevision(undoHistory.tag()); // 图元文档回到同一步
+    if (undoHistory.event() && layers.restore(undoHistory.event())) {
+        applyLayerChange(); // 撤销删除图层
+        emit imageModified();
     }
+    if (rect.isEmpty()) return;
+    labelCache.invalidate(canvasImage, rect);
+    invalidateDisplay(rect);
+    update(mapRectFromImage(rect));
+    emit imageModified();
+}
+
+void CanvasWidget::redo() {
+    if (fillJob) {
+        finishFloodFill(true);
+        return;
+    }
+    finishRender();
+    commitHistory();
+    showHistoryLayer(undoHistory.redoLayer());
+    originalCanvas = QImage();
+    const QRect rect = undoHistory.redo(canvasImage, &document);
+    primitives.setRevision(undoHistory.tag());
+    if (undoHistory.event() && layers.indexOf(undoHistory.event()) >= 0) {
+        dropLayer(layers.indexOf(undoHistory.event())); // 重做删除图层
+        emit imageModified();
+    }
+    if (rect.isEmpty()) return;
+    labelCache.invalidate(canvasImage, rect);
+    invalidateDisplay(rect);
+    update(mapRectFromImage(rect));
+    emit imageModified();
+}
+
+void CanvasWidget::commitHistory() {
+    if (!historyEnabled) return;
+    undoHistory.commit(canvasImage, primitives.revision());
+}
+
+Raster::PrimitiveStore::Pen CanvasWidget::currentPen(Raster::LineAlgorithm algorithm) const {
+    return { penColor.rgba(), penWidth, lineStyle, algorithm };
+}
+
+Raster::PrimitiveStore::Pen CanvasWidget::painterPen(Qt::PenCapStyle cap) const {
+    // algorithm 只在改用扫描线光栅化时参考
+    return { penColor.rgba(), penWidth, lineStyle, Raster::Wu, Raster::PrimitiveStore::PainterAntialiased, cap };
+}
+
+Raster::PrimitiveStore::Pen CanvasWidget::linePen(QRgb color, int width) const {
+    // QPainter 后端的 Wu 直线和多边形边是 QPainter 反走样画的，其余按所选算法
+    const bool painter = rasterBackend != DirectBackend && lineAlgorithm == Wu;
+    return { color, width, lineStyle, static_cast<Raster::LineAlgorithm>(lineAlgorithm),
+             painter ? Raster::PrimitiveStore::PainterAntialiased : Raster::PrimitiveStore::Scanline };
+}
+
+QRect CanvasWidget::strokeBounds(const QRect &shape) const {
+    // 画笔宽度和反走样各留一圈余量
+    const int margin = penWidth / 2 + 2;
+    return shape.adjusted(-margin, -margin, margin, margin);
+}
+
+void CanvasWidget::setFillConnectivity(Connectivity conn) {
+    fillConnectivity = conn;
+}
+
+void CanvasWidget::setFillTolerance(int tolerance, Raster::ToleranceMetric metric) {
+    fillTolerance = qMax(0, tolerance);
+    fillMetric = metric;
+}
+
+void CanvasWidget::setClipAlgorithm(ClipAlgorithm algo) {
+    clipAlgorithm = algo;
 }
 
 void CanvasWidget::processClipping() {
@@ -1078,26 +1554,25 @@ void CanvasWidget::processClipping() {
     clippedLines.clear();
     clippedPolygons.clear();
 
-    // 处理线段裁剪（原有逻辑）
-    originalLines = getDrawnLines();
+    // 处理线段裁剪（原有逻辑）；只取包围盒与裁剪框相交的线段，框外的线段本来也不会留下
+    originalLines = primitives.lines(clipRect);
     foreach (QLine line, originalLines) {
         if (clipAlgorithm == CohenSutherland) {
             QLine clipped = line;
-            if (cohenSutherlandClip(clipped)) {
+            if (Raster::cohenSutherlandClip(clipped, clipRect)) {
                 clippedLines.append(clipped);
             }
         } else {
-            midpointSubdivisionClip(line);
+            Raster::midpointSubdivisionClip(line, clipRect, clippedLines);
         }
     }
 
     // 处理多边形裁剪（新增逻辑）
-    if (!allPolygons.isEmpty()) {
-        clipPolygons();
-    }
+    clipPolygons();
+    invalidateOverlay();
 
     // 清除裁剪框外的内容（原有逻辑）
-    QPainter painter(&canvasImage);
+    PerfPainter painter(&canvasImage);
     painter.setCompositionMode(QPainter::CompositionMode_Source);
     painter.setPen(Qt::NoPen);
     painter.setBrush(backgroundColor);
@@ -1105,63 +1580,98 @@ void CanvasWidget::processClipping() {
     QRegion outsideRegion = QRegion(canvasImage.rect()).subtracted(QRegion(clipRect));
     painter.setClipRegion(outsideRegion);
     painter.drawRect(canvasImage.rect());
+    markCanvasDirty(canvasImage.rect());
 
     // 保留裁剪框
     update();
 }
 
 QVector<QLine> CanvasWidget::getDrawnLines() {
-    // 这里需要实现获取已绘制线段的逻辑
-    // 例如，可以维护一个 QVector<QLine> 的成员变量来存储所有绘制的线段
-    return QVector<QLine>(); // 返回空的 QVector 作为占位符
+    return primitives.lines();
+}
+
+void CanvasWidget::setRetainGeometry(bool enabled) {
+    retainGeometry = enabled;
+}
+
+void CanvasWidget::setHistoryEnabled(bool enabled) {
+    if (enabled == historyEnabled) return;
+    historyEnabled = enabled;
+    undoHistory.reset(canvasImage, primitives.revision(), documentOrigin);
+    layers.discardRemoved(); // 删掉的层再也撤销不回来了
 }
 
 void CanvasWidget::drawMidpointLine(QPainter &painter, QPoint p1, QPoint p2) {
-    int x1 = p1.x(), y1 = p1.y();
-    int x2 = p2.x(), y2 = p2.y();
-    int dx = abs(x2 - x1), dy = abs(y2 - y1);
-    int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
-    int err = dx - dy;
-
-    int dashCounter = 0;
-    int dashLength = (lineStyle == Qt::DashLine) ? 10 : 
-                    (lineStyle == Qt::DotLine) ? 2 : 0;
-
-    while (true) {
-        bool drawPixel = true;
-        if (lineStyle != Qt::SolidLine) {
-            int cyclePos = dashCounter % (dashLength * 2);
-            if (lineStyle == Qt::DashLine) {
-                drawPixel = (cyclePos < dashLength);
-            }
-            else if (lineStyle == Qt::DotLine) {
-                drawPixel = (cyclePos < 1);
-            }
-        }
+    auto drawPoint = [&](int x, int y) { painter.drawPoint(x, y); };
+    Raster::Perf::CountedPlot<decltype(drawPoint)> counted(Raster::Perf::MidpointPixels, drawPoint);
+    Raster::midpointLine(p1, p2, lineStyle, [&](int x, int y) { counted(x, y); });
+}
 
-        if (drawPixel) {
-            painter.drawPoint(x1, y1);
-        }
-        dashCounter++;
+void CanvasWidget::drawMidpointLine(SpanWriter &writer, QPoint p1, QPoint p2) {
+    Raster::drawMidpointLine(writer, p1, p2, lineStyle);
+}
 
-        if (x1 == x2 && y1 == y2) break;
-        int e2 = 2 * err;
-        if (e2 > -dy) {
-            err -= dy;
-            x1 += sx;
-        }
-        if (e2 < dx) {
-            err += dx;
-            y1 += sy;
-        }
-    }
+void CanvasWidget::drawWuLine(QPoint p1, QPoint p2, const QColor &color, int width) {
+    Raster::drawWuLine(canvasImage, p1, p2, color.rgba(), width, lineStyle);
 }
 
 void CanvasWidget::setLineAlgorithm(LineAlgorithm algo) {
     lineAlgorithm = algo;
 }
 
+void CanvasWidget::setRasterBackend(RasterBackend backend) {
+    rasterBackend = backend;
+}
+
+QPointF CanvasWidget::subpixelPoint(const QPointF &imagePos) const {
+    // 1:1 或缩小时鼠标精度不到一个画布像素，视图偏移的小数部分不能变成端点的小数，取整后走整数算法
+    return m_zoomFactor > 1.0 ? imagePos : QPointF(imagePos.toPoint());
+}
+
+double CanvasWidget::subpixelRadius(int radius, const QPointF &imagePos) const {
+    // 放大时一个画布像素跨多个屏幕像素，半径保留小数；否则与预览一致取整
+    return m_zoomFactor > 1.0 ? QLineF(startPointF, imagePos).length() : radius;
+}
+
+void CanvasWidget::setParallelRaster(bool enabled) {
+    parallelRaster = enabled;
+}
+
+QRect CanvasWidget::rasterizeBatch(const Raster::RasterBatch &batch) {
+    const Raster::LineAlgorithm algorithm = static_cast<Raster::LineAlgorithm>(lineAlgorithm);
+    if (parallelRaster) {
+        return tileRasterizer.draw(canvasImage, batch, algorithm, lineStyle);
+    }
+    return Raster::drawBatch(canvasImage, batch, algorithm, lineStyle);
+}
+
+void CanvasWidget::commitSelection() {
+    if (!selectionFloating) return;
+    selectionFloating = false;
+    if (selectionImage.isNull() || selectionRect.isNull()) return;
+    originalCanvas = canvasImage.copy(selectionRect); // 只记选区盖住的那一块，再次移动时写回
+    PerfPainter painter(&canvasImage);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.drawImage(selectionRect.topLeft(), selectionImage);
+    painter.end();
+    markCanvasDirty(selectionRect.intersected(canvasImage.rect()));
+}
+
+void CanvasWidget::liftSelection() {
+    if (selectionFloating || originalCanvas.isNull()) return;
+    // 把上次落下的选区从画布上拿起来，只有选区所在的区域变了
+    PerfPainter painter(&canvasImage);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(selectionRect.topLeft(), originalCanvas);
+    painter.end();
+    originalCanvas = QImage();
+    markCanvasDirty(selectionRect.intersected(canvasImage.rect()));
+    selectionFloating = true;
+}
+
 void CanvasWidget::setSelectionMode(bool enabled) {
+    beginEdit();
+    commitSelection(); // 退出或重新进入前，浮着的选区先落到画布上
     if (enabled && selectionMode == 0) {
         // 从其他模式进入选择模式
         selectionMode = 1;
@@ -1182,48 +1692,49 @@ void CanvasWidget::setSelectionMode(bool enabled) {
     update();
 }
 
-// 实现de Casteljau算法
-QPoint CanvasWidget::deCasteljau(const QVector<QPoint> &points, double t) {
-    // 正确实现de Casteljau算法
-    QVector<QPoint> temp = points;
-    while (temp.size() > 1) {
-        QVector<QPoint> newLevel;
-        for (int i = 0; i < temp.size() - 1; ++i) {
-            int x = (1 - t) * temp[i].x() + t * temp[i + 1].x();
-            int y = (1 - t) * temp[i].y() + t * temp[i + 1].y();
-            newLevel.append(QPoint(x, y));
-        }
-        temp = newLevel;
+// 绘制Bezier曲线（de Casteljau算法）
+void CanvasWidget::commitBezierCurve() {
+    if (controlPoints.size() >= 2) {
+        // 反走样折线在渲染线程上画，只用按值捕获的数据
+        const QVector<QPoint> points = Raster::bezierPolyline(controlPoints);
+        const QPen pen(penColor, penWidth, lineStyle);
+        const QRect dirty = strokeBounds(QPolygon(controlPoints).boundingRect());
+        postRender([points, pen, dirty](QImage &image) {
+            PerfPainter painter(&image);
+            painter.setRenderHint(QPainter::Antialiasing);
+            painter.setPen(pen);
+            painter.drawPolyline(points.data(), points.size());
+            return dirty;
+        });
+        primitives.addBezier(controlPoints, painterPen());
     }
-    return temp.first();
+    controlPoints.clear();
 }
 
-// 绘制Bezier曲线
 void CanvasWidget::drawBezierCurve(QPainter &painter) {
     if (controlPoints.size() < 2) return;
 
-    // 使用de Casteljau算法
-    QVector<QPoint> points;
-    const double step = 0.01; // 更精细的步长
-    for (double t = 0; t <= 1.0; t += step) {
-        points.append(deCasteljau(controlPoints, t));
-    }
-
+    QVector<QPoint> points = Raster::bezierPolyline(controlPoints);
     painter.drawPolyline(points.data(), points.size());
 }
 
 // 实现保存函数
 bool CanvasWidget::saveImage(const QString &fileName, const char *format) {
-    // 创建一个与画布大小相同的临时图像
-    QImage image(canvasImage.size(), QImage::Format_ARGB32);
+    finishRender();
+    finishFloodFill(false);
+    // 保存文档里画过的全部范围（至少是当前窗口）
+    const QImage content = documentImage();
+    QImage image(content.size(), QImage::Format_ARGB32);
     image.fill(Qt::white);
 
-    // 将当前画布内容绘制到临时图像上
-    QPainter painter(&image);
-    painter.drawImage(0, 0, canvasImage);
+    // 将画布内容绘制到临时图像上
+    PerfPainter painter(&image);
+    painter.drawImage(0, 0, content);
 
     // 如果当前正在绘制Bezier曲线，也将其绘制到图像上
     if (drawingMode == 7 && !controlPoints.isEmpty()) {
+        // 控制点是画布坐标，换到保存范围的坐标
+        painter.translate(documentOrigin - documentBounds().topLeft());
         painter.setPen(QPen(penColor, penWidth, lineStyle));
         drawBezierCurve(painter);
     }
@@ -1235,126 +1746,64 @@ bool CanvasWidget::saveImage(const QString &fileName, const char *format) {
 void CanvasWidget::clipPolygons() {
     clippedPolygons.clear();
 
-    if (clipRect.isEmpty() || allPolygons.isEmpty()) return;
+    if (clipRect.isEmpty()) return;
 
     // 使用图像坐标系进行裁剪计算
     QRect imageClipRect = QRect(
                               mapToCanvas(clipRect.topLeft()),
                               mapToCanvas(clipRect.bottomRight())
                               ).normalized();
+    const QVector<QVector<QPoint>> polygons = primitives.polygons(imageClipRect);
 
-    int xmin = imageClipRect.left();
-    int ymin = imageClipRect.top();
-    int xmax = imageClipRect.right();
-    int ymax = imageClipRect.bottom();
-
-    for (const auto& polygon : allPolygons) {
-        if (polygon.size() < 3) continue; // 忽略无效多边形
-
-        QVector<QPoint> outputList = polygon;
-
-        for (int edge = 0; edge < 4; edge++) {
-            QVector<QPoint> inputList = outputList;
-            outputList.clear();
-
-            if (inputList.isEmpty()) break;
-
-            QPoint s = inputList.last();
-            for (const QPoint& p : inputList) {
-                if (inside(p, edge, xmin, ymin, xmax, ymax)) {
-                    if (!inside(s, edge, xmin, ymin, xmax, ymax)) {
-                        QPoint intersect = computeIntersection(s, p, edge, xmin, ymin, xmax, ymax);
-                        if (!intersect.isNull()) {
-                            outputList.append(computeIntersection(s, p, edge, xmin, ymin, xmax, ymax));
-                        }
-                    }
-                    outputList.append(p);
-                } else if (inside(s, edge, xmin, ymin, xmax, ymax)) {
-                    QPoint intersect = computeIntersection(s, p, edge, xmin, ymin, xmax, ymax);
-                    if (!intersect.isNull()) {
-                        outputList.append(computeIntersection(s, p, edge, xmin, ymin, xmax, ymax));
-                    }
-                }
-                s = p;
-            }
-        }
-
+    for (const auto& polygon : polygons) {
+        QVector<QPoint> outputList = Raster::sutherlandHodgmanClip(polygon, imageClipRect);
         if (outputList.size() >= 3) { // 只保留有效多边形
             clippedPolygons.append(outputList);
         }
     }
 }
 
-// 辅助函数：判断点是否在边界内侧
-bool CanvasWidget::inside(const QPoint& p, int edge, int xmin, int ymin, int xmax, int ymax) {
-    switch (edge) {
-    case 0: return p.x() >= xmin; // left
-    case 1: return p.y() <= ymax; // bottom
-    case 2: return p.x() <= xmax; // right
-    case 3: return p.y() >= ymin; // top
+void CanvasWidget::clipPrimitives(const QRect &clip) {
+    // 完全在框外的图元删除；直线和多边形换成裁剪后的几何，其余图元保留原样。两类都由网格给出。
+    // 框外的像素只在窗口里清掉了，窗口外的分块原样保留，所以只动整个落在窗口里的图元，
+    // 伸出窗口的图元在窗口外还有像素，记录保留
+    const QRect window = canvasImage.rect();
+    const QVector<int> candidates = primitives.query(clip);
+    for (int index : primitives.queryOutside(clip)) {
+        if (window.contains(primitives.bounds(index))) primitives.remove(index);
     }
-    return false;
-}
 
-// 计算线段与边界的交点
-QPoint CanvasWidget::computeIntersection(QPoint p1, QPoint p2, int edge,
-                                         int xmin, int ymin, int xmax, int ymax) {
-    // 处理垂直线段
-    if (qFuzzyCompare(static_cast<double>(p1.x()), static_cast<double>(p2.x()))) {
-        if (edge == 0 || edge == 2) { // 左右边界
-            return QPoint(); // 无效交点
-        }
-        // 处理水平边界
-        double y = (edge == 1) ? ymax : ymin;
-        return QPoint(p1.x(), y);
-    }
+    for (int index : candidates) {
+        if (clip.contains(primitives.bounds(index)) || !window.contains(primitives.bounds(index))) continue;
 
-    // 处理水平线段
-    if (qFuzzyCompare(static_cast<double>(p1.y()), static_cast<double>(p2.y()))) {
-        if (edge == 1 || edge == 3) { // 上下边界
-            return QPoint(); // 无效交点
+        const Raster::PrimitiveStore::Pen pen = primitives.pen(index);
+        if (primitives.kind(index) == Raster::PrimitiveStore::Line) {
+            const QLine line(primitives.p1(index).toPoint(), primitives.p2(index).toPoint());
+            QVector<QLine> pieces;
+            if (clipAlgorithm == CohenSutherland) {
+                QLine clipped = line;
+                if (Raster::cohenSutherlandClip(clipped, clip)) pieces.append(clipped);
+            } else {
+                Raster::midpointSubdivisionClip(line, clip, pieces);
+            }
+            primitives.remove(index);
+            for (const QLine &piece : pieces) {
+                primitives.addLine(piece.p1(), piece.p2(), pen);
+            }
+        } else if (primitives.kind(index) == Raster::PrimitiveStore::Polygon) {
+            const QVector<QPoint> clipped = Raster::sutherlandHodgmanClip(primitives.pointList(index), clip);
+            primitives.remove(index);
+            if (clipped.size() >= 3) {
+                primitives.addPolygon(clipped, pen);
+            }
         }
-        // 处理垂直边界
-        double x = (edge == 0) ? xmin : xmax;
-        return QPoint(x, p1.y());
-    }
-
-    double m = (p2.y() - p1.y()) / static_cast<double>(p2.x() - p1.x());
-
-    double x, y;
-
-    switch (edge) {
-    case 0: // left
-        x = xmin;
-        y = m * (xmin - p1.x()) + p1.y();
-        break;
-    case 1: // bottom
-        y = ymax;
-        x = (ymax - p1.y()) / m + p1.x();
-        break;
-    case 2: // right
-        x = xmax;
-        y = m * (xmax - p1.x()) + p1.y();
-        break;
-    case 3: // top
-        y = ymin;
-        x = (ymin - p1.y()) / m + p1.x();
-        break;
     }
-
-    // 检查交点是否在线段范围内
-    if (x < qMin(p1.x(), p2.x()) || x > qMax(p1.x(), p2.x()) ||
-        y < qMin(p1.y(), p2.y()) || y > qMax(p1.y(), p2.y())) {
-        return QPoint(); // 无效交点
-    }
-
-    return QPoint(round(x), round(y));
 }
 
 void CanvasWidget::confirmClipping() {
     if (!clipRect.isValid()) return;
 
-    QPainter painter(&canvasImage);
+    PerfPainter painter(&canvasImage);
 
     // 转换为图像坐标系（考虑画布偏移）
     QRect imageClipRect = QRect(
@@ -1386,44 +1835,70 @@ void CanvasWidget::confirmClipping() {
 
     // 保留原始图像内容
     painter.drawImage(imageClipRect, canvasImage.copy(imageClipRect));
+    markCanvasDirty(canvasImage.rect());
+    clipPrimitives(imageClipRect);
 
     // 重置状态
     clipRect = QRect();
     clippedLines.clear();
     clippedPolygons.clear();
     allPolygons.clear();
+    invalidateOverlay();
 
     update();
     emit clippingConfirmed();
 }
 
 void CanvasWidget::keyPressEvent(QKeyEvent *event) {
+    if (event->matches(QKeySequence::Undo)) {
+        undo();
+        event->accept();
+        return;
+    }
+    if (event->matches(QKeySequence::Redo)
+        || (event->key() == Qt::Key_Y && event->modifiers() == Qt::ControlModifier)) {
+        redo();
+        event->accept();
+        return;
+    }
+    if (event->key() == Qt::Key_F3) {
+        setPerfHudVisible(!perfHudVisible);
+        event->accept();
+        return;
+    }
+    if (event->key() == Qt::Key_Escape && fillJob) {
+        finishFloodFill(true); // 取消后台填充
+        event->accept();
+        return;
+    }
+    const bool confirm = event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter;
+    if (confirm) {
+        // 确认裁剪或曲线会改画布；其他按键不必等后台填充
+        beginEdit();
+    }
+
     // 优先处理裁剪确认
-    if ((event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter) && !clipRect.isNull()) {
+    if (confirm && !clipRect.isNull()) {
         confirmClipping();
         event->accept();
         return;
     }
 
     // 处理贝塞尔曲线模式
-    if (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter) {
+    if (confirm) {
         if (drawingMode == 7) {  // 仅在贝塞尔曲线模式下处理
             if (!isAdjustingCurve && controlPoints.size() >= 2) {
                 // 进入调整模式
                 isAdjustingCurve = true;
-                curvePreviewImage = canvasImage.copy();
+                curvePreviewImage = canvasImage;
                 update();
                 event->accept();
             } else if (isAdjustingCurve) {
                 // 确认最终曲线
-                QPainter painter(&canvasImage);
-                painter.setRenderHint(QPainter::Antialiasing);
-                painter.setPen(QPen(penColor, penWidth, lineStyle));
-                drawBezierCurve(painter);
+                commitBezierCurve();
 
                 // 重置状态
                 isAdjustingCurve = false;
-                controlPoints.clear();
                 update();
                 event->accept();
             }
@@ -1431,7 +1906,7 @@ void CanvasWidget::keyPressEvent(QKeyEvent *event) {
         }
     }
 
-    // 处理ESC键（仅影响调整模式）
+    // 处理ESC键（退出调整模式）
     if (event->key() == Qt::Key_Escape) {
         if (isAdjustingCurve) {
             // 取消曲线调整
@@ -1451,6 +1926,8 @@ void CanvasWidget::keyPressEvent(QKeyEvent *event) {
 
 // 新增函数：设置变换模式
 void CanvasWidget::setTransformMode(TransformMode mode) {
+    beginEdit();
+    commitSelection();
     transformMode = mode;
     selectionMode = 0; // 退出选择模式
     drawingMode = -1;  // 退出其他绘制模式
@@ -1461,72 +1938,216 @@ void CanvasWidget::setTransformMode(TransformMode mode) {
 }
 
 void CanvasWidget::drawLine(const QPoint &start, const QPoint &end, const QColor &color, int width) {
-    QPainter painter(&canvasImage);
-    painter.setPen(QPen(color, width, lineStyle));
-    
-    // 根据当前算法设置进行绘制
-    switch (lineAlgorithm) {
-    case Bresenham:
-        drawBresenhamLine(painter, start, end);
-        break;
-    case Midpoint:
-        drawMidpointLine(painter, start, end);
-        break;
+    beginEdit();
+    if (lineAlgorithm == Wu) {
+        if (rasterBackend == DirectBackend) {
+            // 覆盖率由 SIMD 内核直接混合进 canvasImage
+            drawWuLine(start, end, color, width);
+        } else {
+            // 对照用：QPainter 的通用反走样路径
+            PerfPainter painter(&canvasImage);
+            painter.setRenderHint(QPainter::Antialiasing);
+            painter.setPen(QPen(color, width, lineStyle));
+            painter.drawLine(start, end);
+        }
+    } else if (rasterBackend == DirectBackend) {
+        // 直接写入 canvasImage 扫描线，不经过 QPainter
+        SpanWriter writer(canvasImage, color, width);
+        switch (lineAlgorithm) {
+        case Bresenham:
+            drawBresenhamLine(writer, start, end);
+            break;
+        case Midpoint:
+            drawMidpointLine(writer, start, end);
+            break;
+        case Wu:
+            break;
+        }
+    } else {
+        PerfPainter painter(&canvasImage);
+        painter.setPen(QPen(color, width, lineStyle));
+
+        // 根据当前算法设置进行绘制
+        switch (lineAlgorithm) {
+        case Bresenham:
+            drawBresenhamLine(painter, start, end);
+            break;
+        case Midpoint:
+            drawMidpointLine(painter, start, end);
+            break;
+        case Wu:
+            break;
+        }
     }
-    
-    update();
+
+    const QRect dirty = QRect(start, end).normalized().adjusted(-width, -width, width, width);
+    markCanvasDirty(dirty);
+    if (retainGeometry) {
+        primitives.addLine(start, end, linePen(color.rgba(), width));
+    }
+    update(mapRectFromImage(dirty));
 }
 
-void CanvasWidget::setMouseTransparent(bool enable) {
-    setAttribute(Qt::WA_TransparentForMouseEvents, enable);
-    setMouseTracking(!enable);  // 仅在需要时启用鼠标追踪
+void CanvasWidget::drawLines(const Raster::LineSegment *segments, int count) {
+    if (count <= 0) return;
+    beginEdit();
+
+    QRect dirty;
+    if (rasterBackend == DirectBackend && parallelRaster) {
+        lineBatch.clear();
+        for (int i = 0; i < count; ++i) {
+            lineBatch.addLine(segments[i].p1, segments[i].p2, segments[i].color, segments[i].width);
+        }
+        dirty = rasterizeBatch(lineBatch);
+    } else if (rasterBackend == DirectBackend) {
+        dirty = Raster::drawSegments(canvasImage, segments, count,
+                                     static_cast<Raster::LineAlgorithm>(lineAlgorithm), lineStyle);
+    } else {
+        PerfPainter painter(&canvasImage);
+        painter.setRenderHint(QPainter::Antialiasing, lineAlgorithm == Wu);
+        for (int i = 0; i < count; ++i) {
+            const Raster::LineSegment &segment = segments[i];
+            painter.setPen(QPen(QColor::fromRgba(segment.color), segment.width, lineStyle));
+            if (lineAlgorithm == Bresenham) {
+                drawBresenhamLine(painter, segment.p1, segment.p2);
+            } else if (lineAlgorithm == Midpoint) {
+                drawMidpointLine(painter, segment.p1, segment.p2);
+            } else {
+                painter.drawLine(segment.p1, segment.p2);
+            }
+            dirty |= Raster::segmentBounds(segment).adjusted(-1, -1, 1, 1);
+        }
+    }
+
+    markCanvasDirty(dirty);
+    if (retainGeometry) {
+        for (int i = 0; i < count; ++i) {
+            primitives.addLine(segments[i].p1, segments[i].p2, linePen(segments[i].color, segments[i].width));
+        }
+    }
+    update(mapRectFromImage(dirty));
 }
 
-void CanvasWidget::drawCircle(const QPoint &center, int radius, const QColor &color, int width) {
-    QPainter painter(&canvasImage);
-    painter.setPen(QPen(color, width));
-    
-    int x = 0;
-    int y = radius;
-    int d = 3 - 2 * radius;
-
-    int dashCounter = 0;
-    int dashLength = (lineStyle == Qt::DashLine) ? 10 : 
-                    (lineStyle == Qt::DotLine) ? 2 : 0;
-
-    while (x <= y) {
-        bool drawPixel = true;
-        if (lineStyle != Qt::SolidLine) {
-            int cyclePos = dashCounter % (dashLength * 2);
-            if (lineStyle == Qt::DashLine) {
-                drawPixel = (cyclePos < dashLength);
+void CanvasWidget::drawLines(const QVector<Raster::LineSegment> &segments) {
+    drawLines(segments.constData(), segments.size());
+}
+
+void CanvasWidget::drawBatch(const Raster::RasterBatch &batch) {
+    if (batch.isEmpty()) return;
+    beginEdit();
+
+    QRect dirty;
+    if (rasterBackend == DirectBackend) {
+        dirty = rasterizeBatch(batch);
+    } else {
+        PerfPainter painter(&canvasImage);
+        painter.setRenderHint(QPainter::Antialiasing, lineAlgorithm == Wu);
+        // 逐点画时每个 drawPoint 就是一个像素，按图元种类分别计数
+        auto drawPoint = [&](int x, int y) { painter.drawPoint(x, y); };
+        Raster::Perf::CountedPlot<decltype(drawPoint)> linePoint(Raster::Perf::BresenhamPixels, drawPoint);
+        Raster::Perf::CountedPlot<decltype(drawPoint)> circlePoint(Raster::Perf::CirclePixels, drawPoint);
+        Raster::Perf::CountedPlot<decltype(drawPoint)> arcPoint(Raster::Perf::ArcPixels, drawPoint);
+        auto drawEdge = [&](QPointF p1, QPointF p2) {
+            if (lineAlgorithm == Wu) {
+                painter.drawLine(QLineF(p1, p2));
+            } else {
+                Raster::fixedLine(p1, p2, lineStyle, [&](int x, int y) { linePoint(x, y); });
             }
-            else if (lineStyle == Qt::DotLine) {
-                drawPixel = (cyclePos < 1);
+        };
+
+        for (int i = 0; i < batch.size(); ++i) {
+            const Raster::Primitive &primitive = batch.at(i);
+            painter.setPen(QPen(QColor::fromRgba(primitive.color), primitive.width, lineStyle));
+            switch (primitive.type) {
+            case Raster::Primitive::Line:
+                drawEdge(primitive.p1, primitive.p2);
+                break;
+            case Raster::Primitive::Circle:
+                Raster::bresenhamCircle(primitive.p1.toPoint(), qRound(primitive.radius), lineStyle,
+                                        [&](int x, int y) { circlePoint(x, y); });
+                break;
+            case Raster::Primitive::Arc:
+                Raster::fixedArc(primitive.p1, primitive.radius, primitive.startAngle, primitive.endAngle,
+                                 qAbs(primitive.endAngle - primitive.startAngle) >= 360.0, lineStyle,
+                                 [&](int x, int y) { arcPoint(x, y); });
+                break;
+            case Raster::Primitive::Polygon: {
+                const QPoint *points = batch.points().constData() + primitive.pointOffset;
+                for (int k = 0; k < primitive.pointCount; ++k) {
+                    drawEdge(points[k], points[(k + 1) % primitive.pointCount]);
+                }
+                break;
             }
+            }
+            dirty |= batch.bounds(i);
         }
+    }
 
-        if (drawPixel) {
-            painter.drawPoint(center.x() + x, center.y() + y);
-            painter.drawPoint(center.x() - x, center.y() + y);
-            painter.drawPoint(center.x() + x, center.y() - y);
-            painter.drawPoint(center.x() - x, center.y() - y);
-            painter.drawPoint(center.x() + y, center.y() + x);
-            painter.drawPoint(center.x() - y, center.y() + x);
-            painter.drawPoint(center.x() + y, center.y() - x);
-            painter.drawPoint(center.x() - y, center.y() - x);
+    markCanvasDirty(dirty);
+    if (retainGeometry) {
+        retainBatch(batch);
+    }
+    update(mapRectFromImage(dirty));
+}
+
+void CanvasWidget::retainBatch(const Raster::RasterBatch &batch) {
+    const Raster::LineAlgorithm algorithm = static_cast<Raster::LineAlgorithm>(lineAlgorithm);
+    for (int i = 0; i < batch.size(); ++i) {
+        const Raster::Primitive &primitive = batch.at(i);
+        const Raster::PrimitiveStore::Pen pen = { primitive.color, primitive.width, lineStyle, algorithm };
+        switch (primitive.type) {
+        case Raster::Primitive::Line:
+            primitives.addLine(primitive.p1, primitive.p2, linePen(primitive.color, primitive.width));
+            break;
+        case Raster::Primitive::Circle:
+            primitives.addCircle(primitive.p1, primitive.radius, pen);
+            break;
+        case Raster::Primitive::Arc:
+            primitives.addArc(primitive.p1, primitive.radius, primitive.startAngle, primitive.endAngle, pen);
+            break;
+        case Raster::Primitive::Polygon: {
+            const QPoint *points = batch.points().constData() + primitive.pointOffset;
+            primitives.addPolygon(QVector<QPoint>(points, points + primitive.pointCount),
+                                  linePen(primitive.color, primitive.width));
+            break;
+        }
         }
-        dashCounter++;
+    }
+}
 
-        if (d < 0) {
-            d += 4 * x + 6;
-        } else {
-            d += 4 * (x - y) + 10;
-            y--;
+void CanvasWidget::setMouseTransparent(bool enable) {
+    setAttribute(Qt::WA_TransparentForMouseEvents, enable);
+    setMouseTracking(!enable);  // 仅在需要时启用鼠标追踪
+}
+
+void CanvasWidget::drawCircle(const QPoint &center, int radius, const QColor &color, int width) {
+    beginEdit();
+    if (rasterBackend == DirectBackend) {
+        Raster::RasterBatch batch;
+        batch.addCircle(center, radius, color.rgba(), width);
+        const QRect dirty = rasterizeBatch(batch);
+        markCanvasDirty(dirty);
+        if (retainGeometry) {
+            retainBatch(batch);
         }
-        x++;
+        update(mapRectFromImage(dirty));
+        return;
     }
-    update();
+
+    PerfPainter painter(&canvasImage);
+    painter.setPen(QPen(color, width));
+
+    auto drawPoint = [&](int x, int y) { painter.drawPoint(x, y); };
+    Raster::Perf::CountedPlot<decltype(drawPoint)> counted(Raster::Perf::CirclePixels, drawPoint);
+    Raster::bresenhamCircle(center, radius, lineStyle, [&](int x, int y) { counted(x, y); });
+    const QRect dirty = QRect(center - QPoint(radius, radius), center + QPoint(radius, radius))
+                            .adjusted(-width, -width, width, width);
+    markCanvasDirty(dirty);
+    if (retainGeometry) {
+        primitives.addCircle(center, radius, { color.rgba(), width, lineStyle,
+                                               static_cast<Raster::LineAlgorithm>(lineAlgorithm) });
+    }
+    update(mapRectFromImage(dirty));
 }
 
 void CanvasWidget::setBackgroundColor(const QColor& color) {
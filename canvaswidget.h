@@ -4,6 +4,21 @@
 #include <QWidget>
 #include <QPainter>
 #include <QMouseEvent>
+#include "spanwriter.h"
+#include "canvasraster.h"
+#include "rasterbatch.h"
+#include "tiledfloodfill.h"
+#include "labelcache.h"
+#include "mippyramid.h"
+#include "undohistory.h"
+#include "primitivestore.h"
+#include "tiledcanvas.h"
+#include "renderthread.h"
+#include "layerstack.h"
+#include "viewportrenderer.h"
+#include <QTimer>
+#include <QScopedPointer>
+#include <QStringList>
 
 class CanvasWidget : public QWidget {
     Q_OBJECT
@@ -11,18 +26,21 @@ class CanvasWidget : public QWidget {
 public:
     enum Connectivity { FourWay, EightWay };  // 枚举必须首先声明
     enum ClipAlgorithm { CohenSutherland, MidpointSubdivision };
-    enum LineAlgorithm { Bresenham, Midpoint };
+    enum LineAlgorithm { Bresenham, Midpoint, Wu }; // Wu: 反走样直线
     enum TransformMode { None, Rotate, Scale }; // 变换模式
+    enum RasterBackend { PainterBackend, DirectBackend }; // 直线光栅化后端：QPainter逐点 / 直接写扫描线
     /**
      * 在Bezier曲线模式下，右键点击可以完成曲线绘制并将其保存到画布上
      */
     explicit CanvasWidget(QWidget *parent = nullptr);
+    ~CanvasWidget() override;
     void setPenColor(QColor color);
     void setPenWidth(int width);
     void clearCanvas();
     void setDrawingMode(int mode);
     void setLineStyle(Qt::PenStyle style);
     void setFillConnectivity(Connectivity conn);
+    void setFillTolerance(int tolerance, Raster::ToleranceMetric metric = Raster::PerChannel);
     void setClipAlgorithm(ClipAlgorithm algo);
     void setLineAlgorithm(LineAlgorithm algo);
     void setSelectionMode(bool enabled);
@@ -31,16 +49,51 @@ public:
     void resetZoom();
     QPoint mapToCanvas(const QPoint& pos) const;
     QPoint mapFromCanvas(const QPoint& canvasPos) const;
-    QVector<QLine> getDrawnLines();  // 添加获取已绘制线段的函数声明
+    QVector<QLine> getDrawnLines();  // 图元文档中所有存活的直线（图像坐标）
+    const Raster::PrimitiveStore &primitiveStore() const { return primitives; }
+    void setRetainGeometry(bool enabled); // drawLine/drawLines/drawBatch/drawCircle 是否记入图元文档
     int selectionMode = 0; // 0: normal, 1: select, 2: move
     bool saveImage(const QString &fileName, const char *format = nullptr);
+    bool openTileFile(const QString &fileName);   // 把分块文件映射为画布（超大图），只读入视图覆盖的块
+    bool importTileFile(const QString &imageFile, const QString &fileName); // 图像先转存为分块文件再映射
+    bool isFileBacked() const { return document.isMapped(); }
+    void syncTileFile();   // 窗口里的改动经映射写回分块文件
     void setTransformMode(TransformMode mode);
     void drawLine(const QPoint &start, const QPoint &end, const QColor &color, int width);
+    void drawLines(const Raster::LineSegment *segments, int count); // 批量绘制：一次取图像缓冲、一次局部刷新
+    void drawLines(const QVector<Raster::LineSegment> &segments);
+    void drawBatch(const Raster::RasterBatch &batch); // 线/圆/弧/多边形批量绘制，按加入顺序
     void setMouseTransparent(bool enable);
     LineAlgorithm getLineAlgorithm() const { return lineAlgorithm; }
-    QImage& getCanvasImage() { return canvasImage; }
+    void setRasterBackend(RasterBackend backend);
+    RasterBackend getRasterBackend() const { return rasterBackend; }
+    void setParallelRaster(bool enabled); // 直接写帧缓冲时按 64×64 分块多线程光栅化
+    bool isParallelRaster() const { return parallelRaster; }
+    void setParallelFill(bool enabled); // 大画布上的填充改为后台分块并行，Esc 取消
+    bool isFilling() const { return !fillJob.isNull(); }
+    void setLabelFill(bool enabled); // 精确填充时缓存连通分量标签，连续填充只与区域大小相关
+    void undo();   // Ctrl+Z；后台填充进行中时等同于取消填充
+    void redo();   // Ctrl+Y / Ctrl+Shift+Z
+    bool canUndo() const { return undoHistory.canUndo(); }
+    bool canRedo() const { return undoHistory.canRedo(); }
+    void setHistoryBudget(qint64 bytes) { undoHistory.setMemoryBudget(bytes); } // 撤销历史占用内存上限
+    void setHistoryEnabled(bool enabled); // 每帧整幅重画的画布（动画窗口）关掉，各入口就不再逐帧提交
+    QImage& getCanvasImage() { beginEdit(); return canvasImage; }
     void drawCircle(const QPoint &center, int radius, const QColor &color, int width);
     void setBackgroundColor(const QColor& color); // 仅声明
+    void setPerfHudVisible(bool visible); // 左上角的性能面板（F3 切换）
+    bool isPerfHudVisible() const { return perfHudVisible; }
+    // 图层：所有工具都画在当前层上，显示、保存和合并取样的填充用各可见层合成的结果
+    int layerCount() const { return layers.count(); }
+    int currentLayer() const { return layers.current(); }
+    const Raster::LayerStack::Layer &layer(int index) const { return layers.layer(index); }
+    int addLayer();                     // 在当前层上面新建空白层并切换过去，返回它的位置
+    void removeLayer(int index);        // 至少保留一层，可以撤销
+    void setCurrentLayer(int index);    // 撤销历史各层共用，切换后照样保留
+    void setLayerOpacity(int index, double opacity);
+    void setLayerVisible(int index, bool visible);
+    void setLayerBlendMode(int index, Raster::BlendMode mode);
+    void setFillSampleMerged(bool enabled); // 填充按合成结果的颜色找区域，颜色仍填在当前层
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -52,12 +105,22 @@ protected:
     void keyPressEvent(QKeyEvent *event) override;  // 添加键盘事件处理
 
 private:
-    QImage canvasImage;
-    QImage originalCanvas;  // 用于存储原始画布状态
+    QImage canvasImage;     // 文档中覆盖当前视图的一块窗口，所有工具都在这上面画（画布坐标）
+    Raster::TiledCanvas document;   // 无界画布的全部像素，稀疏分块；窗口里那部分以 canvasImage 为准
+    QPoint documentOrigin;          // canvasImage 左上角在文档中的坐标：文档坐标 = 画布坐标 + documentOrigin
+    void ensureViewCovered();       // 视图移出窗口时把窗口换到视图所在的位置
+    void translateContent(QPoint delta);   // 按画布坐标保存的状态整体平移（窗口换位置时用）
+    QRect documentBounds() const;   // 文档里所有层画过的范围连同当前窗口（文档坐标）
+    QImage documentImage() const;   // documentBounds() 范围内各层合成的结果（保存用）
+    qint64 windowKey = 0;           // 窗口取出时的 cacheKey，不变说明没改过
+    void flushWindow();             // 窗口像素写回文档
+    void resetDocumentWindow();     // 换了文档后回到原点，清掉按旧文档坐标保存的状态
+    QImage originalCanvas;  // 选区落下前 selectionRect 那一块画布，再次拿起选区时写回
     QColor penColor;
     int penWidth;
     bool drawing;
     QPoint startPoint, endPoint, currentPoint;
+    QPointF startPointF; // 按下时的亚像素位置，只有放大绘制时才带小数
     int drawingMode;  // 0:自由绘制,1:直线,2:圆,3:橡皮擦,4:多边形,5:填充,6:裁剪,7:选择
     Qt::PenStyle lineStyle = Qt::SolidLine;
     QColor backgroundColor = Qt::white; // 默认白色背景
@@ -70,6 +133,8 @@ private:
     QPoint firstVertex;
     const int CLOSE_DISTANCE = 20;
     Connectivity fillConnectivity = EightWay;
+    int fillTolerance = 0;                                  // 0 为精确匹配
+    Raster::ToleranceMetric fillMetric = Raster::PerChannel;
     QRect clipWindow;
     QVector<QLine> clippedLines;
     ClipAlgorithm clipAlgorithm = CohenSutherland;
@@ -77,35 +142,92 @@ private:
     bool isDraggingClipRect = false; // 是否正在拖动裁剪框
     QPoint clipStartPoint; // 裁剪框的起始点
     LineAlgorithm lineAlgorithm = Bresenham; // 默认直线算法
+    RasterBackend rasterBackend = DirectBackend; // 默认直接写帧缓冲
+    bool parallelRaster = true; // 分块并行光栅化，结果与单线程逐像素相同
+    Raster::TileRasterizer tileRasterizer;
+    Raster::RasterBatch lineBatch; // drawLines 复用的批量缓冲
     QRect selectionRect; // 选择框
     bool isDraggingSelection = false; // 是否正在拖动选择框
     QPoint selectionStartPoint; // 选择框的起始点
-    QImage selectionImage; // 存储选择的图像
+    QImage selectionImage; // 存储选择的图像（预乘格式，白色和透明像素已按遮罩清掉）
+    bool selectionFloating = false; // 选区是否浮在画布之上、尚未写进 canvasImage
+    void commitSelection();         // 把浮动的选区合成到画布
+    void liftSelection();           // 把已落下的选区重新拿起来（恢复底下的画布）
     bool isSelecting = false; // 是否正在选择
     bool isMoving = false; // 是否正在移动
     QPoint selectionOffset; // 移动时的偏移量
     QVector<QPoint> controlPoints; // 存储控制点
     QVector<QVector<QPoint>> allPolygons;     // 存储所有已绘多边形
     QVector<QVector<QPoint>> clippedPolygons; // 存储裁剪后的多边形
+    QImage overlayCache;                      // 上面三类叠加图形画好的图层（窗口坐标）
+    QTransform overlayTransform;              // 缓存对应的视图变换
+    const QImage &overlayLayer(const QTransform &transform); // 变换或窗口大小变了才重画
+    void invalidateOverlay();                 // 叠加图形列表改动后调用
     QVector<QLine> originalLines;             // 存储原始线段
     void floodFill(QPoint seedPoint);  // 函数声明
-    bool inside(const QPoint& p, int edge, int xmin, int ymin, int xmax, int ymax);
-    QPoint computeIntersection(QPoint p1, QPoint p2, int edge, 
-                              int xmin, int ymin, int xmax, int ymax);
+    void mergedFloodFill(QPoint seedPoint);         // 按合成结果找区域，填到当前层
+    bool fillSampleMerged = false;
+    bool parallelFill = true;
+    QScopedPointer<Raster::TiledFloodFill> fillJob; // 正在后台进行的分块填充
+    QTimer *fillTimer;                              // 轮询填充进度，按块局部刷新
+    void pollFloodFill();
+    void finishFloodFill(bool cancel);              // 取消或等待后台填充结束
+    QRect fillJobDirty;                             // 后台填充累计改动的范围
+    QImage fillView;                                // 填充期间显示的画布：工作线程只写 canvasImage，这份由界面线程按进度补画
+    const QImage &shownCanvas() const { return fillJob ? fillView : canvasImage; }
+    void beginEdit();                               // 改画布的入口先调用：等后台还在写画布的操作结束，提交上一步
+    Raster::RenderThread renderThread;              // 旋转/缩放/曲线提交在这个线程上画，画完的帧再换进 canvasImage
+    quint64 renderPosted = 0;                       // 最后投递的命令序号
+    quint64 renderAdopted = 0;                      // 已换进画布的帧对应的序号
+    bool renderBusy() const { return renderAdopted != renderPosted; }
+    void postRender(Raster::RenderThread::Command command);
+    void pollRender();                              // 取渲染线程最新的帧
+    void finishRender();                            // 等已投递的命令画完并换进画布
+    void commitBezierCurve();                       // 把当前控制点的曲线画到画布并记入图元文档
+    bool labelFill = true;
+    Raster::LabelCache labelCache;                  // 按连通分量填充用的标签
+    Raster::MipPyramid mipPyramid;                  // 缩小查看用的多级缩略图（多个图层时对应合成结果）
+    Raster::LayerStack layers;                      // 当前层以外的图层和分块缓存的合成结果
+    Raster::ViewportRenderer viewport;              // 缩放到窗口像素的画布，缩放和内容不变时直接贴
+    const QImage &displayImage(const QRect &area);  // 要显示的画布：只有一层时就是 canvasImage，否则是合成结果
+    void invalidateDisplay(const QRect &imageRect); // 当前层像素改动后让合成结果和缩略图失效
+    void applyLayerChange();                        // 图层属性或结构变了之后调用
+    void dropLayer(int index);                      // 删掉一层（当前层先换到相邻的），不记历史
+    void showHistoryLayer(int layer);               // 撤销/重做的那一步在 layer（图层 id）上时先切过去
+    Raster::UndoHistory undoHistory;                // 分块写时复制的撤销历史，下一个改画布的入口开始时提交
+    bool historyEnabled = true;
+    Raster::PrimitiveStore primitives;              // 提交过的图元几何，随撤销历史一起回退
+    bool retainGeometry = true;
+    QVector<QPoint> strokePoints;                   // 正在画的自由笔迹/橡皮擦轨迹（图像坐标）
+    void commitHistory();                           // 提交撤销步骤，带上图元文档的修订号
+    Raster::PrimitiveStore::Pen currentPen(Raster::LineAlgorithm algorithm) const;
+    Raster::PrimitiveStore::Pen painterPen(Qt::PenCapStyle cap = Qt::SquareCap) const; // QPainter 反走样画的工具
+    Raster::PrimitiveStore::Pen linePen(QRgb color, int width) const;   // 直线和多边形按当前后端和算法记录
+    void markCanvasDirty(const QRect &imageRect);   // canvasImage 像素改动后调用（图像坐标）
+    QRect strokeBounds(const QRect &shape) const;   // 形状外接矩形加上画笔宽度
 
     QPointF mapToImage(const QPoint& pos) const;
     QPointF mapFromImage(const QPointF& imagePos) const;
+    QRect mapRectFromImage(const QRect& imageRect) const; // 画布矩形 -> 窗口矩形（用于局部刷新）
+    QRect mapRectToImage(const QRect& widgetRect) const;  // 窗口矩形 -> 画布矩形（paintEvent 只画露出部分）
+    QRect previewDamage;                                  // 上一帧交互预览占的画布区域
+    void updatePreview(const QRect& imageRect);           // 重画旧预览和新预览所在区域
+    QRect previewBounds() const;                          // 直线/圆/圆弧/多边形橡皮筋预览的范围
+    QRect curvePreviewBounds() const;                     // 调整中的贝塞尔曲线及控制点的范围
     void drawBresenhamLine(QPainter &painter, QPoint p1, QPoint p2);
     void drawMidpointLine(QPainter &painter, QPoint p1, QPoint p2); // 添加中点算法声明
+    void drawBresenhamLine(SpanWriter &writer, QPoint p1, QPoint p2);
+    void drawMidpointLine(SpanWriter &writer, QPoint p1, QPoint p2);
+    void drawWuLine(QPoint p1, QPoint p2, const QColor &color, int width); // 直接混合到 canvasImage
     void drawMidpointArc(QPainter &painter, QPoint center, int radius, 
                         double startAngle, double endAngle, bool isFullCircle = false);
-    int computeOutCode(const QPoint &p) const;
-    bool cohenSutherlandClip(QLine &line);
-    void midpointSubdivisionClip(QLine line);
+    QRect rasterizeBatch(const Raster::RasterBatch &batch); // 直接写 canvasImage，返回受影响区域
+    QPointF subpixelPoint(const QPointF &imagePos) const;
+    double subpixelRadius(int radius, const QPointF &imagePos) const;
     void processClipping();
+    void clipPrimitives(const QRect &clip);         // 确认裁剪后让图元文档与画布一致
+    void retainBatch(const Raster::RasterBatch &batch);
     void drawBezierCurve(QPainter &painter);
-    QPoint deCasteljau(const QVector<QPoint> &points, double t);
-    void drawArcPoint(QPainter &painter, QPoint center, int x, int y, int dashCounter, int dashLength);
     void clipPolygons(); // 多边形裁剪函数
 
     TransformMode transformMode = None;
@@ -125,9 +247,16 @@ private:
     int selectedPointIndex = -1;   // 当前选中的控制点索引
     QImage curvePreviewImage;      // 曲线预览临时图像
 
+    bool perfHudVisible = false;
+    QRect perfHudRect;                   // 上次画面板的位置（窗口坐标）
+    Raster::Perf::Snapshot perfLast;     // 上一帧结束时的计数
+    QStringList perfLines;
+    void updatePerfLines();
+
 signals:
     void imageModified();
     void clippingConfirmed();
+    void layersChanged();   // 图层增删、切换或属性变化
 
 public slots:
     void confirmClipping();
@@ -0,0 +1,191 @@
+#include "colormatch.h"
+#include <QtAlgorithms>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CANVAS_MATCH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANVAS_MATCH_SSE2
+#endif
+
+namespace Raster {
+
+#if defined(CANVAS_MATCH_AVX2)
+static const int BlockSize = 8;
+#elif defined(CANVAS_MATCH_SSE2)
+static const int BlockSize = 4;
+#else
+static const int BlockSize = 1;
+#endif
+static const quint32 FullMask = (1u << BlockSize) - 1;
+
+ColorMatcher::ColorMatcher(QRgb reference, int tolerance, ToleranceMetric metric) :
+    m_reference(reference),
+    m_mode(tolerance <= 0 ? Exact : (metric == Euclidean ? Distance : Channel)),
+    m_tolerance(qBound(0, tolerance, metric == Euclidean ? 510 : 255))
+{
+}
+
+bool ColorMatcher::matches(QRgb pixel) const {
+    switch (m_mode) {
+    case Exact:
+        return pixel == m_reference;
+    case Channel:
+        return qAbs(qRed(pixel) - qRed(m_reference)) <= m_tolerance
+            && qAbs(qGreen(pixel) - qGreen(m_reference)) <= m_tolerance
+            && qAbs(qBlue(pixel) - qBlue(m_reference)) <= m_tolerance
+            && qAbs(qAlpha(pixel) - qAlpha(m_reference)) <= m_tolerance;
+    case Distance: {
+        const int dr = qRed(pixel) - qRed(m_reference);
+        const int dg = qGreen(pixel) - qGreen(m_reference);
+        const int db = qBlue(pixel) - qBlue(m_reference);
+        const int da = qAlpha(pixel) - qAlpha(m_reference);
+        return dr * dr + dg * dg + db * db + da * da <= m_tolerance * m_tolerance;
+    }
+    }
+    return false;
+}
+
+#if defined(CANVAS_MATCH_AVX2)
+
+quint32 ColorMatcher::matchBlock(const QRgb *p) const {
+    const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i ref = _mm256_set1_epi32(static_cast<int>(m_reference));
+    if (m_mode == Exact) {
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(px, ref)));
+    }
+
+    // 逐字节绝对差
+    const __m256i diff = _mm256_or_si256(_mm256_subs_epu8(px, ref), _mm256_subs_epu8(ref, px));
+    if (m_mode == Channel) {
+        const __m256i tol = _mm256_set1_epi8(static_cast<char>(m_tolerance));
+        const __m256i ok = _mm256_cmpeq_epi8(_mm256_max_epu8(diff, tol), tol);
+        const __m256i all = _mm256_cmpeq_epi32(ok, _mm256_set1_epi32(-1));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(all));
+    }
+
+    // 平方和：madd 得到 (b²+g², r²+a²)，再把相邻两项相加（每个 128 位通道内顺序不变）
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(diff, zero), _mm256_unpacklo_epi8(diff, zero));
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(diff, zero), _mm256_unpackhi_epi8(diff, zero));
+    const __m256 a = _mm256_castsi256_ps(lo), b = _mm256_castsi256_ps(hi);
+    const __m256i sum = _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+                                         _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    const __m256i far = _mm256_cmpgt_epi32(sum, _mm256_set1_epi32(m_tolerance * m_tolerance));
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(far)) & FullMask;
+}
+
+const char *colorMatchKernel() {
+    return "AVX2";
+}
+
+#elif defined(CANVAS_MATCH_SSE2)
+
+quint32 ColorMatcher::matchBlock(const QRgb *p) const {
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i ref = _mm_set1_epi32(static_cast<int>(m_reference));
+    if (m_mode == Exact) {
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(px, ref)));
+    }
+
+    // 逐字节绝对差
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(px, ref), _mm_subs_epu8(ref, px));
+    if (m_mode == Channel) {
+        const __m128i tol = _mm_set1_epi8(static_cast<char>(m_tolerance));
+        const __m128i ok = _mm_cmpeq_epi8(_mm_max_epu8(diff, tol), tol);
+        const __m128i all = _mm_cmpeq_epi32(ok, _mm_set1_epi32(-1));
+        return _mm_movemask_ps(_mm_castsi128_ps(all));
+    }
+
+    // 平方和：madd 得到 (b²+g², r²+a²)，再把相邻两项相加
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(diff, zero), _mm_unpacklo_epi8(diff, zero));
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(diff, zero), _mm_unpackhi_epi8(diff, zero));
+    const __m128 a = _mm_castsi128_ps(lo), b = _mm_castsi128_ps(hi);
+    const __m128i sum = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    const __m128i far = _mm_cmpgt_epi32(sum, _mm_set1_epi32(m_tolerance * m_tolerance));
+    return ~_mm_movemask_ps(_mm_castsi128_ps(far)) & FullMask;
+}
+
+const char *colorMatchKernel() {
+    return "SSE2";
+}
+
+#else
+
+quint32 ColorMatcher::matchBlock(const QRgb *p) const {
+    return matches(*p) ? 1u : 0u;
+}
+
+const char *colorMatchKernel() {
+    return "scalar";
+}
+
+#endif
+
+int ColorMatcher::findMatch(const QRgb *line, int x, int end) const {
+    for (; x + BlockSize <= end; x += BlockSize) {
+        const quint32 mask = matchBlock(line + x);
+        if (mask) return x + qCountTrailingZeroBits(mask);
+    }
+    while (x < end && !matches(line[x])) ++x;
+    return x;
+}
+
+int ColorMatcher::findMismatch(const QRgb *line, int x, int end) const {
+    for (; x + BlockSize <= end; x += BlockSize) {
+        const quint32 mask = ~matchBlock(line + x) & FullMask;
+        if (mask) return x + qCountTrailingZeroBits(mask);
+    }
+    while (x < end && matches(line[x])) ++x;
+    return x;
+}
+
+int ColorMatcher::extendLeft(const QRgb *line, int x, int begin) const {
+    // x 已知匹配；每次检查 [x - BlockSize, x) 这一组
+    for (; x - BlockSize >= begin; x -= BlockSize) {
+        const quint32 mask = ~matchBlock(line + x - BlockSize) & FullMask;
+        if (mask) return x - BlockSize + (31 - qCountLeadingZeroBits(mask)) + 1;
+    }
+    while (x > begin && matches(line[x - 1])) --x;
+    return x;
+}
+
+int FillScanner::findFillable(const QRgb *line, int y, int x, int end) const {
+    if (!m_visited) return m_matcher.findMatch(line, x, end);
+    while (x < end && !fillable(line, y, x)) ++x;
+    return x;
+}
+
+int FillScanner::runEnd(const QRgb *line, int y, int x, int end) const {
+    if (!m_visited) return m_matcher.findMismatch(line, x, end);
+    while (x < end && fillable(line, y, x)) ++x;
+    return x;
+}
+
+int FillScanner::runStart(const QRgb *line, int y, int x, int begin) const {
+    if (!m_visited) return m_matcher.extendLeft(line, x, begin);
+    while (x > begin && fillable(line, y, x - 1)) --x;
+    return x;
+}
+
+void FillScanner::markFilled(int y, int x0, int x1) {
+    if (!m_visited) return;
+    quint32 *row = m_visited + qsizetype(y) * m_words;
+    const int first = x0 / 32;
+    const int last = x1 / 32;
+    const quint32 head = ~0u << (x0 % 32);
+    const quint32 tail = ~0u >> (31 - x1 % 32);
+    if (first == last) {
+        row[first] |= head & tail;
+        return;
+    }
+    row[first] |= head;
+    std::fill(row + first + 1, row + last, ~0u);
+    row[last] |= tail;
+}
+
+} // namespace Raster
@@ -0,0 +1,74 @@
+#ifndef COLORMATCH_H
+#define COLORMATCH_H
+
+#include <QtGlobal>
+#include <QColor>
+
+namespace Raster {
+
+// 填充容差的度量方式：逐通道（每个通道之差都不超过容差）或 RGBA 欧氏距离
+enum ToleranceMetric { PerChannel, Euclidean };
+
+/**
+ * 判断像素是否"接近"参考色。容差为 0 时即 32 位精确相等。
+ * 成段查找由编译期选择的 SIMD 内核完成：AVX2 一次判断 8 个像素，SSE2 一次 4 个，
+ * 得到位掩码后用前导/后缀零计数定位段边界，开启容差不比精确匹配慢。
+ */
+class ColorMatcher {
+public:
+    ColorMatcher(QRgb reference, int tolerance = 0, ToleranceMetric metric = PerChannel);
+
+    bool matches(QRgb pixel) const;
+
+    // [x, end) 内第一个匹配的位置，没有则返回 end
+    int findMatch(const QRgb *line, int x, int end) const;
+    // [x, end) 内第一个不匹配的位置，没有则返回 end
+    int findMismatch(const QRgb *line, int x, int end) const;
+    // 从 x 向左延伸：返回最小的 l >= begin，使 [l, x] 全部匹配（要求 line[x] 匹配）
+    int extendLeft(const QRgb *line, int x, int begin) const;
+
+    QRgb reference() const { return m_reference; }
+
+private:
+    enum Mode { Exact, Channel, Distance };
+    quint32 matchBlock(const QRgb *p) const;   // 一组像素的匹配位掩码
+
+    QRgb m_reference;
+    Mode m_mode;
+    int m_tolerance;
+};
+
+// 当前编译进来的匹配内核名称："AVX2" / "SSE2" / "scalar"
+const char *colorMatchKernel();
+
+/**
+ * 扫描线填充在一行内的查找操作。
+ * 新颜色本身不在容差内时，填过的像素自然不再匹配，直接用 SIMD 查找；
+ * 否则需要额外的访问标记防止重复填充，走标量路径。访问标记每像素一位，
+ * 每行从 32 位字的边界开始，由调用方按 visitedWords() 分配并清零。
+ */
+class FillScanner {
+public:
+    FillScanner(const ColorMatcher &matcher, quint32 *visited, int width) :
+        m_matcher(matcher), m_visited(visited), m_words((width + 31) / 32) {}
+
+    static qsizetype visitedWords(int width, int height) { return qsizetype((width + 31) / 32) * height; }
+
+    int findFillable(const QRgb *line, int y, int x, int end) const;
+    int runEnd(const QRgb *line, int y, int x, int end) const;       // 第一个不可填的位置
+    int runStart(const QRgb *line, int y, int x, int begin) const;   // 向左延伸到的最左位置
+    void markFilled(int y, int x0, int x1);
+
+private:
+    bool fillable(const QRgb *line, int y, int x) const {
+        return m_matcher.matches(line[x]) && !(m_visited[qsizetype(y) * m_words + x / 32] & (1u << (x % 32)));
+    }
+
+    const ColorMatcher &m_matcher;
+    quint32 *m_visited;
+    int m_words;   // 每行的字数
+};
+
+} // namespace Raster
+
+#endif // COLORMATCH_H
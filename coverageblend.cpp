@@ -0,0 +1,156 @@
+#include "coverageblend.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANVAS_COVERAGE_SSE2
+#endif
+
+namespace Raster {
+
+// 在浮点下完成：预乘 -> SourceOver -> 反预乘，与 SIMD 版本逐像素一致
+void blendCoverageSpanScalar(QRgb *dst, const quint8 *coverage, int count, QRgb color) {
+    const float alphaScale = qAlpha(color) / (255.0f * 255.0f);
+    const float sr = qRed(color), sg = qGreen(color), sb = qBlue(color);
+
+    for (int i = 0; i < count; ++i) {
+        if (!coverage[i]) continue;
+        const QRgb d = dst[i];
+        const float sa = coverage[i] * alphaScale;
+        const float t = qAlpha(d) * (1.0f / 255.0f) * (1.0f - sa);
+        const float oa = sa + t;
+        const float inv = oa > 0.0f ? 1.0f / oa : 0.0f;
+
+        dst[i] = qRgba(int((sr * sa + qRed(d) * t) * inv + 0.5f),
+                       int((sg * sa + qGreen(d) * t) * inv + 0.5f),
+                       int((sb * sa + qBlue(d) * t) * inv + 0.5f),
+                       int(oa * 255.0f + 0.5f));
+    }
+}
+
+#if defined(__AVX2__)
+
+void blendCoverageSpan(QRgb *dst, const quint8 *coverage, int count, QRgb color) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 inv255 = _mm256_set1_ps(1.0f / 255.0f);
+    const __m256 c255 = _mm256_set1_ps(255.0f);
+    const __m256 alphaScale = _mm256_set1_ps(qAlpha(color) / (255.0f * 255.0f));
+    const __m256 sr = _mm256_set1_ps(qRed(color));
+    const __m256 sg = _mm256_set1_ps(qGreen(color));
+    const __m256 sb = _mm256_set1_ps(qBlue(color));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        quint64 cov8;
+        std::memcpy(&cov8, coverage + i, sizeof(cov8));
+        if (!cov8) continue; // 整组覆盖率为 0，不动目标像素
+
+        const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        const __m256 cov = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<long long>(cov8))));
+        const __m256 sa = _mm256_mul_ps(cov, alphaScale);
+
+        const __m256 db = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+        const __m256 dg = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+        const __m256 dr = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+        const __m256 da = _mm256_cvtepi32_ps(_mm256_srli_epi32(px, 24));
+
+        const __m256 t = _mm256_mul_ps(_mm256_mul_ps(da, inv255), _mm256_sub_ps(one, sa));
+        const __m256 oa = _mm256_add_ps(sa, t);
+        const __m256 nonZero = _mm256_cmp_ps(oa, _mm256_setzero_ps(), _CMP_GT_OQ);
+        const __m256 inv = _mm256_and_ps(_mm256_div_ps(one, oa), nonZero);
+
+        auto channel = [&](__m256 s, __m256 d) {
+            __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(s, sa), _mm256_mul_ps(d, t)), inv);
+            return _mm256_cvttps_epi32(_mm256_add_ps(v, half));
+        };
+        __m256i out = channel(sb, db);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(channel(sg, dg), 8));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(channel(sr, dr), 16));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(
+                  _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(oa, c255), half)), 24));
+
+        // 覆盖率为 0 的像素保持原值
+        const __m256i keep = _mm256_cmpeq_epi32(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<long long>(cov8))),
+                                                _mm256_setzero_si256());
+        out = _mm256_blendv_epi8(out, px, keep);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), out);
+    }
+    blendCoverageSpanScalar(dst + i, coverage + i, count - i, color);
+}
+
+const char *coverageBlendKernel() {
+    return "AVX2";
+}
+
+#elif defined(CANVAS_COVERAGE_SSE2)
+
+void blendCoverageSpan(QRgb *dst, const quint8 *coverage, int count, QRgb color) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 inv255 = _mm_set1_ps(1.0f / 255.0f);
+    const __m128 c255 = _mm_set1_ps(255.0f);
+    const __m128 alphaScale = _mm_set1_ps(qAlpha(color) / (255.0f * 255.0f));
+    const __m128 sr = _mm_set1_ps(qRed(color));
+    const __m128 sg = _mm_set1_ps(qGreen(color));
+    const __m128 sb = _mm_set1_ps(qBlue(color));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        quint32 cov4;
+        std::memcpy(&cov4, coverage + i, sizeof(cov4));
+        if (!cov4) continue; // 整组覆盖率为 0，不动目标像素
+
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i covi = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(cov4)), zero), zero);
+        const __m128 sa = _mm_mul_ps(_mm_cvtepi32_ps(covi), alphaScale);
+
+        const __m128 db = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+        const __m128 dg = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+        const __m128 dr = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+        const __m128 da = _mm_cvtepi32_ps(_mm_srli_epi32(px, 24));
+
+        const __m128 t = _mm_mul_ps(_mm_mul_ps(da, inv255), _mm_sub_ps(one, sa));
+        const __m128 oa = _mm_add_ps(sa, t);
+        const __m128 nonZero = _mm_cmpgt_ps(oa, _mm_setzero_ps());
+        const __m128 inv = _mm_and_ps(_mm_div_ps(one, oa), nonZero);
+
+        auto channel = [&](__m128 s, __m128 d) {
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(s, sa), _mm_mul_ps(d, t)), inv);
+            return _mm_cvttps_epi32(_mm_add_ps(v, half));
+        };
+        __m128i out = channel(sb, db);
+        out = _mm_or_si128(out, _mm_slli_epi32(channel(sg, dg), 8));
+        out = _mm_or_si128(out, _mm_slli_epi32(channel(sr, dr), 16));
+        out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(oa, c255), half)), 24));
+
+        // 覆盖率为 0 的像素保持原值
+        const __m128i keep = _mm_cmpeq_epi32(covi, zero);
+        out = _mm_or_si128(_mm_and_si128(keep, px), _mm_andnot_si128(keep, out));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+    blendCoverageSpanScalar(dst + i, coverage + i, count - i, color);
+}
+
+const char *coverageBlendKernel() {
+    return "SSE2";
+}
+
+#else
+
+void blendCoverageSpan(QRgb *dst, const quint8 *coverage, int count, QRgb color) {
+    blendCoverageSpanScalar(dst, coverage, count, color);
+}
+
+const char *coverageBlendKernel() {
+    return "scalar";
+}
+
+#endif
+
+} // namespace Raster
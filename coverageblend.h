@@ -0,0 +1,24 @@
+#ifndef COVERAGEBLEND_H
+#define COVERAGEBLEND_H
+
+#include <QtGlobal>
+#include <QColor>
+
+namespace Raster {
+
+/**
+ * 把一段 8 位覆盖率按 SourceOver 混合到非预乘 ARGB32 像素上：
+ * 有效 alpha = color 的 alpha × coverage / 255。
+ * 编译期选择 AVX2（8 像素/次）、SSE2（4 像素/次）或标量实现。
+ */
+void blendCoverageSpan(QRgb *dst, const quint8 *coverage, int count, QRgb color);
+
+// 标量参考实现，同时用于 SIMD 的尾部像素
+void blendCoverageSpanScalar(QRgb *dst, const quint8 *coverage, int count, QRgb color);
+
+// 当前编译进来的内核名称："AVX2" / "SSE2" / "scalar"
+const char *coverageBlendKernel();
+
+} // namespace Raster
+
+#endif // COVERAGEBLEND_H
@@ -0,0 +1,441 @@
+#include "labelcache.h"
+#include "colormatch.h"
+#include <QThread>
+#include <QPair>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace Raster {
+
+// 一次后台补算：界面线程拷出要算的块，工作线程各自领取
+struct LabelCache::Job {
+    int reach = 0;
+    QVector<int> tiles;
+    QVector<uint> versions;
+    QVector<QRect> rects;
+    QVector<QImage> pixels;    // 各块像素的拷贝，工作线程不碰画布本身
+    QVector<TileLabels> results;
+    std::atomic<int> next{0};
+    std::atomic<int> running{0};
+};
+
+LabelCache::LabelCache(int tileSize) :
+    m_tileSize(qMax(16, tileSize))
+{
+}
+
+LabelCache::~LabelCache() {
+    m_pool.waitForDone();
+}
+
+QRect LabelCache::tileRect(int tile) const {
+    return QRect((tile % m_tilesX) * m_tileSize, (tile / m_tilesX) * m_tileSize, m_tileSize, m_tileSize)
+        .intersected(QRect(QPoint(0, 0), m_size));
+}
+
+void LabelCache::clear() {
+    for (LabelMap &map : m_maps) {
+        map.job.reset();   // 还在跑的任务自己持有数据，结果直接丢弃
+        map.tiles.clear();
+        map.tiles.resize(m_tilesX * m_tilesY);
+        map.version.fill(0, m_tilesX * m_tilesY);
+        map.valid.fill(false, m_tilesX * m_tilesY);
+        map.linked.fill(false, m_tilesX * m_tilesY);
+        map.invalidCount = m_tilesX * m_tilesY;
+    }
+}
+
+void LabelCache::syncImage(const QImage &image) {
+    if (image.size() != m_size) {
+        m_size = image.size();
+        m_tilesX = (m_size.width() + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (m_size.height() + m_tileSize - 1) / m_tileSize;
+        clear();
+    } else if ((image.cacheKey() >> 32) != (m_imageKey >> 32)) {
+        // 缓冲整个换过又没有报告，不知道改了哪里，整体失效；
+        // 同一缓冲上的原地改写都经 invalidate() 报告过，低 32 位的变化不用管
+        for (LabelMap &map : m_maps) invalidateTiles(map, image.rect());
+    }
+    m_imageKey = image.cacheKey();
+}
+
+void LabelCache::invalidateTiles(LabelMap &map, const QRect &rect) {
+    const QRect area = rect.intersected(QRect(QPoint(0, 0), m_size));
+    if (area.isEmpty()) return;
+    for (int ty = area.top() / m_tileSize; ty <= area.bottom() / m_tileSize; ++ty) {
+        for (int tx = area.left() / m_tileSize; tx <= area.right() / m_tileSize; ++tx) {
+            const int tile = ty * m_tilesX + tx;
+            ++map.version[tile];
+            if (map.valid[tile]) {
+                map.valid[tile] = false;
+                ++map.invalidCount;
+            }
+            unlink(map, tile);
+        }
+    }
+}
+
+void LabelCache::unlink(LabelMap &map, int tile) {
+    // 块的标签或颜色变了，它自己和八个相邻块记的 links 都要重建
+    const int tx = tile % m_tilesX;
+    const int ty = tile / m_tilesX;
+    for (int y = qMax(0, ty - 1); y <= qMin(m_tilesY - 1, ty + 1); ++y) {
+        for (int x = qMax(0, tx - 1); x <= qMin(m_tilesX - 1, tx + 1); ++x) {
+            map.linked[y * m_tilesX + x] = false;
+        }
+    }
+}
+
+void LabelCache::invalidate(const QImage &image, const QRect &rect) {
+    if (image.size() != m_size) {
+        syncImage(image);
+        return;
+    }
+    // fill() 写完后已记下新的 cacheKey，随后调用方再报告同一次改动时不必丢标签
+    if (image.cacheKey() == m_imageKey) return;
+    for (LabelMap &map : m_maps) invalidateTiles(map, rect);
+    m_imageKey = image.cacheKey();
+}
+
+// image 的左上角位于画布的 origin；rect 和得到的段都是画布坐标
+void LabelCache::labelTile(const QImage &image, const QPoint &origin, const QRect &rect, int reach,
+                           TileLabels &labels) {
+    labels.runs.resize(0);
+    labels.rowStart.resize(0);
+    QVector<QRgb> runColor;
+
+    // 每行切成同色段，并与上一行相接的同色段合并
+    QVector<int> parent;
+    auto findRun = [&](int run) {
+        while (parent[run] != run) {
+            parent[run] = parent[parent[run]];
+            run = parent[run];
+        }
+        return run;
+    };
+    const int left = rect.left() - origin.x();
+    const int right = rect.right() - origin.x();
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y - origin.y()));
+        const int previous = labels.rowStart.isEmpty() ? 0 : labels.rowStart.last();
+        const int current = labels.runs.size();
+        labels.rowStart.append(current);
+
+        for (int x = left; x <= right;) {
+            const int end = ColorMatcher(line[x]).findMismatch(line, x + 1, right + 1);
+            labels.runs.append({ y, x + origin.x(), end - 1 + origin.x(), -1 });
+            runColor.append(line[x]);
+            parent.append(parent.size());
+            x = end;
+        }
+
+        int j = previous;
+        for (int i = current; i < labels.runs.size(); ++i) {
+            const Run &run = labels.runs[i];
+            while (j < current && labels.runs[j].x1 < run.x0 - reach) ++j;
+            for (int k = j; k < current && labels.runs[k].x0 <= run.x1 + reach; ++k) {
+                if (runColor[k] != runColor[i]) continue;
+                const int a = findRun(k), b = findRun(i);
+                if (a != b) parent[b] = a;
+            }
+        }
+    }
+    labels.rowStart.append(labels.runs.size());
+
+    // 根编号压缩成连续的分量编号
+    QVector<int> component(labels.runs.size(), -1);
+    labels.color.resize(0);
+    for (int i = 0; i < labels.runs.size(); ++i) {
+        const int root = findRun(i);
+        if (component[root] < 0) {
+            component[root] = labels.color.size();
+            labels.color.append(runColor[root]);
+        }
+        labels.runs[i].component = component[root];
+    }
+
+    const int count = labels.color.size();
+    labels.parent.resize(count);
+    std::iota(labels.parent.begin(), labels.parent.end(), 0);
+    labels.next = labels.parent;
+    labels.mark.fill(0, count);
+    labels.links.resize(0);
+    labels.linkStart.resize(0);
+    labels.componentStart.fill(0, count + 1);
+    for (const Run &run : labels.runs) ++labels.componentStart[run.component + 1];
+    std::partial_sum(labels.componentStart.begin(), labels.componentStart.end(), labels.componentStart.begin());
+    labels.componentRuns.resize(labels.runs.size());
+    QVector<int> cursor = labels.componentStart;
+    for (int i = 0; i < labels.runs.size(); ++i) {
+        labels.componentRuns[cursor[labels.runs[i].component]++] = i;
+    }
+
+    const int rows = rect.height();
+    labels.edges[TopEdge].resize(rect.width());
+    labels.edges[BottomEdge].resize(rect.width());
+    labels.edges[LeftEdge].resize(rows);
+    labels.edges[RightEdge].resize(rows);
+    for (int i = labels.rowStart[0]; i < labels.rowStart[1]; ++i) {
+        const Run &run = labels.runs[i];
+        std::fill(labels.edges[TopEdge].begin() + run.x0 - rect.left(),
+                  labels.edges[TopEdge].begin() + run.x1 - rect.left() + 1, run.component);
+    }
+    for (int i = labels.rowStart[rows - 1]; i < labels.rowStart[rows]; ++i) {
+        const Run &run = labels.runs[i];
+        std::fill(labels.edges[BottomEdge].begin() + run.x0 - rect.left(),
+                  labels.edges[BottomEdge].begin() + run.x1 - rect.left() + 1, run.component);
+    }
+    for (int row = 0; row < rows; ++row) {
+        labels.edges[LeftEdge][row] = labels.runs[labels.rowStart[row]].component;
+        labels.edges[RightEdge][row] = labels.runs[labels.rowStart[row + 1] - 1].component;
+    }
+}
+
+int LabelCache::localFind(TileLabels &labels, int component) {
+    while (labels.parent[component] != component) {
+        labels.parent[component] = labels.parent[labels.parent[component]];
+        component = labels.parent[component];
+    }
+    return component;
+}
+
+void LabelCache::localUnite(TileLabels &labels, int a, int b) {
+    a = localFind(labels, a);
+    b = localFind(labels, b);
+    if (a == b) return;
+    labels.parent[b] = a;
+    std::swap(labels.next[a], labels.next[b]);   // 两个成员环接成一个
+}
+
+void LabelCache::linkTile(LabelMap &map, int tile, int reach) {
+    TileLabels &labels = map.tiles[tile];
+    labels.links.resize(0);
+
+    // 两个块的边缘分量同色就记一对；相邻像素多半属于同一对分量，连续重复的先跳过
+    auto connect = [&](int component, int other, int theirs) {
+        TileLabels &neighbour = map.tiles[other];
+        if (labels.color[localFind(labels, component)] != neighbour.color[localFind(neighbour, theirs)]) return;
+        if (!labels.links.isEmpty()) {
+            const Link &last = labels.links.last();
+            if (last.component == component && last.tile == other && last.other == theirs) return;
+        }
+        labels.links.append({ component, other, theirs });
+    };
+    auto side = [&](Edge mine, int other, Edge theirs) {
+        const QVector<int> &a = labels.edges[mine];
+        const QVector<int> &b = map.tiles[other].edges[theirs];
+        for (int i = 0; i < a.size(); ++i) {
+            for (int j = qMax(0, i - reach); j <= qMin(int(b.size()) - 1, i + reach); ++j) {
+                connect(a[i], other, b[j]);
+            }
+        }
+    };
+
+    const int tx = tile % m_tilesX;
+    const int ty = tile / m_tilesX;
+    if (tx > 0) side(LeftEdge, tile - 1, RightEdge);
+    if (tx + 1 < m_tilesX) side(RightEdge, tile + 1, LeftEdge);
+    if (ty > 0) side(TopEdge, tile - m_tilesX, BottomEdge);
+    if (ty + 1 < m_tilesY) side(BottomEdge, tile + m_tilesX, TopEdge);
+    // 八连通还要看对角相邻的块
+    if (reach) {
+        auto corner = [&](Edge mine, bool first, int other, Edge theirs) {
+            const QVector<int> &a = labels.edges[mine];
+            const QVector<int> &b = map.tiles[other].edges[theirs];
+            connect(first ? a.first() : a.last(), other, first ? b.last() : b.first());
+        };
+        if (tx > 0 && ty > 0) corner(TopEdge, true, tile - m_tilesX - 1, BottomEdge);
+        if (tx + 1 < m_tilesX && ty > 0) corner(TopEdge, false, tile - m_tilesX + 1, BottomEdge);
+        if (tx > 0 && ty + 1 < m_tilesY) corner(BottomEdge, true, tile + m_tilesX - 1, TopEdge);
+        if (tx + 1 < m_tilesX && ty + 1 < m_tilesY) corner(BottomEdge, false, tile + m_tilesX + 1, TopEdge);
+    }
+
+    std::sort(labels.links.begin(), labels.links.end(), [](const Link &a, const Link &b) {
+        return std::tie(a.component, a.tile, a.other) < std::tie(b.component, b.tile, b.other);
+    });
+    labels.links.erase(std::unique(labels.links.begin(), labels.links.end(), [](const Link &a, const Link &b) {
+        return a.component == b.component && a.tile == b.tile && a.other == b.other;
+    }), labels.links.end());
+    labels.linkStart.fill(0, labels.color.size() + 1);
+    for (const Link &link : labels.links) ++labels.linkStart[link.component + 1];
+    std::partial_sum(labels.linkStart.begin(), labels.linkStart.end(), labels.linkStart.begin());
+    map.linked[tile] = true;
+}
+
+void LabelCache::collect(LabelMap &map) {
+    if (!map.job || map.job->running.load() > 0) return;
+    Job &job = *map.job;
+    for (int i = 0; i < job.tiles.size(); ++i) {
+        const int tile = job.tiles[i];
+        if (map.valid[tile] || map.version[tile] != job.versions[i]) continue;   // 计算期间又被改过
+        map.tiles[tile] = std::move(job.results[i]);
+        map.valid[tile] = true;
+        --map.invalidCount;
+    }
+    map.job.reset();
+}
+
+void LabelCache::prepare(const QImage &image, Connectivity connectivity) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    syncImage(image);
+    LabelMap &map = m_maps[connectivity == EightWay ? 1 : 0];
+    collect(map);
+    if (map.job || map.invalidCount == 0) return;
+
+    QSharedPointer<Job> job(new Job);
+    job->reach = connectivity == EightWay ? 1 : 0;
+    for (int tile = 0; tile < map.tiles.size(); ++tile) {
+        if (map.valid[tile]) continue;
+        const QRect rect = tileRect(tile);
+        job->tiles.append(tile);
+        job->versions.append(map.version[tile]);
+        job->rects.append(rect);
+        job->pixels.append(image.copy(rect));
+    }
+    job->results.resize(job->tiles.size());
+
+    const int workers = qMax(1, qMin(QThread::idealThreadCount(), int(job->tiles.size())));
+    job->running = workers;
+    map.job = job;
+    for (int i = 0; i < workers; ++i) {
+        m_pool.start([job]() {
+            for (int k = job->next.fetch_add(1); k < job->tiles.size(); k = job->next.fetch_add(1)) {
+                labelTile(job->pixels[k], job->rects[k].topLeft(), job->rects[k], job->reach, job->results[k]);
+                job->pixels[k] = QImage();
+            }
+            job->running.fetch_sub(1);
+        });
+    }
+}
+
+// 块内 y 行 [x0, x1] 里颜色为 color 的分量并入 component；rect 是块的范围
+void LabelCache::uniteNeighbours(TileLabels &labels, const QRect &rect, int component, int y, int x0, int x1,
+                                 QRgb color) {
+    if (y < rect.top() || y > rect.bottom()) return;
+    x0 = qMax(rect.left(), x0);
+    x1 = qMin(rect.right(), x1);
+    if (x0 > x1) return;
+    const int row = y - rect.top();
+    auto begin = labels.runs.begin() + labels.rowStart[row];
+    auto end = labels.runs.begin() + labels.rowStart[row + 1];
+    auto it = std::lower_bound(begin, end, x0, [](const Run &run, int x) { return run.x1 < x; });
+    for (; it != end && it->x0 <= x1; ++it) {
+        if (labels.color[localFind(labels, it->component)] == color) localUnite(labels, component, it->component);
+    }
+}
+
+bool LabelCache::fill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity, QRect *dirty) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    if (dirty) *dirty = QRect();
+    if (!image.rect().contains(seedPoint)) return false;
+
+    syncImage(image);
+    const int reach = connectivity == EightWay ? 1 : 0;
+    LabelMap &map = m_maps[reach];
+    if (map.job) {
+        m_pool.waitForDone();
+        collect(map);
+    }
+    if (map.invalidCount > 0) {
+        // 少量失效的块（通常是刚画过的笔画）当场补算；缺得太多就交给普通填充，之后在后台补
+        if (map.invalidCount * 4 > map.tiles.size()) return false;
+        for (int tile = 0; tile < map.tiles.size(); ++tile) {
+            if (map.valid[tile]) continue;
+            labelTile(image, QPoint(0, 0), tileRect(tile), reach, map.tiles[tile]);
+            map.valid[tile] = true;
+        }
+        map.invalidCount = 0;
+    }
+    // 补算过或被填过的块和它们的相邻块重建 links
+    for (int tile = 0; tile < map.tiles.size(); ++tile) {
+        if (!map.linked[tile]) linkTile(map, tile, reach);
+    }
+
+    // 种子所在的段和分量
+    const int seedTile = (seedPoint.y() / m_tileSize) * m_tilesX + seedPoint.x() / m_tileSize;
+    TileLabels &seedLabels = map.tiles[seedTile];
+    const int row = seedPoint.y() % m_tileSize;
+    auto it = std::upper_bound(seedLabels.runs.begin() + seedLabels.rowStart[row],
+                               seedLabels.runs.begin() + seedLabels.rowStart[row + 1], seedPoint.x(),
+                               [](int x, const Run &run) { return x < run.x0; }) - 1;
+    const QRgb oldColor = seedLabels.color[localFind(seedLabels, it->component)];
+    Q_ASSERT(oldColor == image.pixel(seedPoint));
+    if (oldColor == newColor) return true;
+
+    // 从种子的分量出发，块内沿合并环、块间沿 links 找到整个区域，members 兼作队列
+    const uint stamp = ++map.stamp;
+    QVector<QPair<int, int>> members;   // 块、块内分量
+    auto visit = [&](int tile, int component) {
+        TileLabels &labels = map.tiles[tile];
+        if (labels.mark[component] == stamp) return;
+        for (int c = component;;) {
+            labels.mark[c] = stamp;
+            members.append(qMakePair(tile, c));
+            c = labels.next[c];
+            if (c == component) break;
+        }
+    };
+    visit(seedTile, it->component);
+    for (int i = 0; i < members.size(); ++i) {
+        const TileLabels &labels = map.tiles[members[i].first];
+        const int component = members[i].second;
+        for (int k = labels.linkStart[component]; k < labels.linkStart[component + 1]; ++k) {
+            visit(labels.links[k].tile, labels.links[k].other);
+        }
+    }
+
+    uchar *bits = image.bits();
+    const qsizetype stride = image.bytesPerLine();
+    int left = m_size.width(), right = -1, top = m_size.height(), bottom = -1;
+    QVector<int> touched;
+    for (const QPair<int, int> &member : members) {
+        const int tile = member.first;
+        const int component = member.second;
+        TileLabels &labels = map.tiles[tile];
+        labels.color[localFind(labels, component)] = newColor;
+        if (touched.isEmpty() || touched.last() != tile) touched.append(tile);
+        for (int k = labels.componentStart[component]; k < labels.componentStart[component + 1]; ++k) {
+            const Run &run = labels.runs[labels.componentRuns[k]];
+            QRgb *line = reinterpret_cast<QRgb *>(bits + run.y * stride);
+            std::fill(line + run.x0, line + run.x1 + 1, newColor);
+            left = qMin(left, run.x0);
+            right = qMax(right, run.x1);
+            top = qMin(top, run.y);
+            bottom = qMax(bottom, run.y);
+        }
+    }
+
+    // 填完后与块内四周的新颜色分量连成一片，跨块的由重建的 links 接上；
+    // 同色的旧分量不可能相邻，否则早已属于同一分量
+    for (const QPair<int, int> &member : members) {
+        const int tile = member.first;
+        const int component = member.second;
+        TileLabels &labels = map.tiles[tile];
+        const QRect rect = tileRect(tile);
+        for (int k = labels.componentStart[component]; k < labels.componentStart[component + 1]; ++k) {
+            const Run run = labels.runs[labels.componentRuns[k]];
+            uniteNeighbours(labels, rect, component, run.y, run.x0 - 1, run.x0 - 1, newColor);
+            uniteNeighbours(labels, rect, component, run.y, run.x1 + 1, run.x1 + 1, newColor);
+            uniteNeighbours(labels, rect, component, run.y - 1, run.x0 - reach, run.x1 + reach, newColor);
+            uniteNeighbours(labels, rect, component, run.y + 1, run.x0 - reach, run.x1 + reach, newColor);
+        }
+    }
+
+    // 被填的块颜色变了，它们和相邻块的 links 下次填充前重建；
+    // 另一种连通方式的分量会被拆开，只能让涉及的块失效
+    LabelMap &other = m_maps[1 - reach];
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (int tile : touched) {
+        unlink(map, tile);
+        invalidateTiles(other, tileRect(tile));
+    }
+    m_imageKey = image.cacheKey();
+
+    if (dirty) *dirty = QRect(QPoint(left, top), QPoint(right, bottom));
+    return true;
+}
+
+} // namespace Raster
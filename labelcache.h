@@ -0,0 +1,98 @@
+#ifndef LABELCACHE_H
+#define LABELCACHE_H
+
+#include <QImage>
+#include <QVector>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include "canvasraster.h"
+
+namespace Raster {
+
+/**
+ * 画布连通分量的标签缓存，对同一幅线稿连续填充时每次只与被填区域的大小有关。
+ * 画布切成 tileSize×tileSize 的块：块内把同色的行程（段）用并查集合并成块内分量，
+ * 每块再记下与相邻块边缘同色相接的分量对（links）。四连通和八连通各有一份标签。
+ * 填充时从种子的分量出发沿 links 找到整个区域，不维护全局的并查集。
+ *
+ * 标签按需在后台线程计算。笔画改动像素后只让覆盖到的块失效，下次用到时补算这些块，
+ * 并重建它们和相邻块的 links。填充时直接按标签重写该分量的所有段，
+ * 再就地把它与块内相邻的新颜色分量合并，标签不必重算。
+ * 原地改写画布都要经 invalidate() 报告；只有整个缓冲被换掉又没有报告时才整体失效。
+ * 只处理容差为 0 的精确匹配；所有方法都只能在界面线程调用。
+ */
+class LabelCache {
+public:
+    explicit LabelCache(int tileSize = 128);
+    ~LabelCache();
+
+    // image 在 rect（图像坐标）内的像素已被改动
+    void invalidate(const QImage &image, const QRect &rect);
+    void clear();
+    // 在后台补算缺失的块，立即返回
+    void prepare(const QImage &image, Connectivity connectivity);
+    // 标签可用时按标签填充，返回 true 并给出改动范围；否则返回 false，由调用方做普通填充
+    bool fill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity, QRect *dirty = nullptr);
+
+private:
+    struct Run {
+        int y;
+        int x0, x1;
+        int component;   // 块内分量编号
+    };
+    enum Edge { TopEdge, BottomEdge, LeftEdge, RightEdge };
+    struct Link {
+        int component;   // 本块的分量
+        int tile;        // 相邻的块
+        int other;       // 相邻块里与之同色相接的分量
+    };
+    struct TileLabels {
+        QVector<Run> runs;             // 按行、行内按 x 排序
+        QVector<int> rowStart;         // 每行第一段的下标，多一项作结尾
+        QVector<int> componentStart;   // 每个分量在 componentRuns 中的起点，多一项作结尾
+        QVector<int> componentRuns;    // 按分量分组的段下标
+        QVector<int> parent;           // 块内分量的并查集（填充后相邻同色分量会合并）
+        QVector<int> next;             // 块内合并过的分量串成环
+        QVector<QRgb> color;           // 分量颜色，只在根上有效
+        QVector<int> edges[4];         // 四条边上每个像素所属的分量
+        QVector<Link> links;           // 按本块分量排序
+        QVector<int> linkStart;        // 每个分量在 links 中的起点，多一项作结尾
+        QVector<uint> mark;            // 填充时的访问标记
+    };
+    struct Job;
+    struct LabelMap {
+        QVector<TileLabels> tiles;
+        QVector<uint> version;   // 块每失效一次加一，用来丢弃过期的后台结果
+        QVector<bool> valid;
+        QVector<bool> linked;    // 块的 links 与它和相邻块当前的标签、颜色一致
+        int invalidCount = 0;
+        uint stamp = 0;          // 上一次填充用的访问标记
+        QSharedPointer<Job> job;
+    };
+
+    static void labelTile(const QImage &image, const QPoint &origin, const QRect &rect, int reach,
+                          TileLabels &labels);
+    static int localFind(TileLabels &labels, int component);
+    static void localUnite(TileLabels &labels, int a, int b);
+
+    void syncImage(const QImage &image);
+    void invalidateTiles(LabelMap &map, const QRect &rect);
+    void unlink(LabelMap &map, int tile);
+    void linkTile(LabelMap &map, int tile, int reach);
+    void collect(LabelMap &map);
+    void uniteNeighbours(TileLabels &labels, const QRect &rect, int component, int y, int x0, int x1,
+                         QRgb color);
+    QRect tileRect(int tile) const;
+
+    int m_tileSize;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+    QSize m_size;
+    qint64 m_imageKey = 0;   // 最近一次得知的图像版本；高 32 位（缓冲的序号）对不上说明缓冲被换过
+    LabelMap m_maps[2];      // FourWay、EightWay
+    QThreadPool m_pool;
+};
+
+} // namespace Raster
+
+#endif // LABELCACHE_H
@@ -0,0 +1,475 @@
+#include "layerstack.h"
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CANVAS_LAYER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANVAS_LAYER_SSE2
+#endif
+
+namespace Raster {
+
+// a·b/255，四舍五入；a·b 不超过 255·255，16 位整数里也不会溢出
+static inline int mul255(int a, int b) {
+    const int x = a * b + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void blendLayerSpanScalar(QRgb *dst, const QRgb *src, int count, BlendMode mode, int opacity) {
+    for (int i = 0; i < count; ++i) {
+        const QRgb sp = src[i];
+        const int sa = mul255(qAlpha(sp), opacity);
+        if (!sa) continue;   // 源全透明时各模式的结果都是 dst
+        const int s[4] = { mul255(qBlue(sp), sa), mul255(qGreen(sp), sa), mul255(qRed(sp), sa), sa };
+        const QRgb dp = dst[i];
+        const int d[4] = { qBlue(dp), qGreen(dp), qRed(dp), qAlpha(dp) };
+        int r[4];
+        for (int c = 0; c < 4; ++c) {
+            switch (mode) {
+            case NormalBlend:
+                r[c] = s[c] + mul255(d[c], 255 - sa);
+                break;
+            case MultiplyBlend:
+                r[c] = mul255(s[c], d[c]) + mul255(s[c], 255 - d[3]) + mul255(d[c], 255 - sa);
+                break;
+            case ScreenBlend:
+                r[c] = s[c] + d[c] - mul255(s[c], d[c]);
+                break;
+            case AdditiveBlend:
+                r[c] = s[c] + d[c];
+                break;
+            }
+            r[c] = qMin(r[c], 255);
+        }
+        dst[i] = qRgba(r[2], r[1], r[0], r[3]);
+    }
+}
+
+#if defined(CANVAS_LAYER_AVX2)
+
+template <BlendMode Mode>
+static void blendSpan(QRgb *dst, const QRgb *src, int count, int opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i alpha255 = _mm256_set1_epi64x(0x00ff000000000000ll);   // 每个像素的 alpha 通道置 255
+    const __m256i alphaBits = _mm256_set1_epi32(int(0xff000000u));
+    const __m256i op = _mm256_set1_epi16(short(opacity));
+    auto mul = [&](__m256i a, __m256i b) {
+        const __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(a, b), c128);
+        return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    };
+    auto alphaOf = [](__m256i v) {
+        return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    };
+    // 16 位通道，每 128 位两个像素；结果超过 255 的由 packus 饱和
+    auto blend = [&](__m256i s, __m256i d) {
+        const __m256i sa = mul(alphaOf(s), op);
+        s = mul(_mm256_or_si256(s, alpha255), sa);   // 预乘并乘上不透明度，alpha 通道得到 sa
+        switch (Mode) {
+        case NormalBlend:
+            return _mm256_add_epi16(s, mul(d, _mm256_sub_epi16(c255, sa)));
+        case MultiplyBlend:
+            return _mm256_add_epi16(_mm256_add_epi16(mul(s, d), mul(s, _mm256_sub_epi16(c255, alphaOf(d)))),
+                                    mul(d, _mm256_sub_epi16(c255, sa)));
+        case ScreenBlend:
+            return _mm256_sub_epi16(_mm256_add_epi16(s, d), mul(s, d));
+        case AdditiveBlend:
+            return _mm256_add_epi16(s, d);
+        }
+        return d;
+    };
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i sp = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        if (_mm256_testz_si256(sp, alphaBits)) continue;   // 整组全透明
+        const __m256i dp = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        const __m256i lo = blend(_mm256_unpacklo_epi8(sp, zero), _mm256_unpacklo_epi8(dp, zero));
+        const __m256i hi = blend(_mm256_unpackhi_epi8(sp, zero), _mm256_unpackhi_epi8(dp, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    blendLayerSpanScalar(dst + i, src + i, count - i, Mode, opacity);
+}
+
+const char *layerBlendKernel() {
+    return "AVX2";
+}
+
+#elif defined(CANVAS_LAYER_SSE2)
+
+template <BlendMode Mode>
+static void blendSpan(QRgb *dst, const QRgb *src, int count, int opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i alpha255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);   // 每个像素的 alpha 通道置 255
+    const __m128i alphaBits = _mm_set1_epi32(int(0xff000000u));
+    const __m128i op = _mm_set1_epi16(short(opacity));
+    auto mul = [&](__m128i a, __m128i b) {
+        const __m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), c128);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    };
+    auto alphaOf = [](__m128i v) {
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    };
+    // 16 位通道，一次两个像素；结果超过 255 的由 packus 饱和
+    auto blend = [&](__m128i s, __m128i d) {
+        const __m128i sa = mul(alphaOf(s), op);
+        s = mul(_mm_or_si128(s, alpha255), sa);   // 预乘并乘上不透明度，alpha 通道得到 sa
+        switch (Mode) {
+        case NormalBlend:
+            return _mm_add_epi16(s, mul(d, _mm_sub_epi16(c255, sa)));
+        case MultiplyBlend:
+            return _mm_add_epi16(_mm_add_epi16(mul(s, d), mul(s, _mm_sub_epi16(c255, alphaOf(d)))),
+                                 mul(d, _mm_sub_epi16(c255, sa)));
+        case ScreenBlend:
+            return _mm_sub_epi16(_mm_add_epi16(s, d), mul(s, d));
+        case AdditiveBlend:
+            return _mm_add_epi16(s, d);
+        }
+        return d;
+    };
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i sp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        // 整组全透明
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(sp, alphaBits), zero)) == 0xffff) continue;
+        const __m128i dp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i lo = blend(_mm_unpacklo_epi8(sp, zero), _mm_unpacklo_epi8(dp, zero));
+        const __m128i hi = blend(_mm_unpackhi_epi8(sp, zero), _mm_unpackhi_epi8(dp, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blendLayerSpanScalar(dst + i, src + i, count - i, Mode, opacity);
+}
+
+const char *layerBlendKernel() {
+    return "SSE2";
+}
+
+#else
+
+template <BlendMode Mode>
+static void blendSpan(QRgb *dst, const QRgb *src, int count, int opacity) {
+    blendLayerSpanScalar(dst, src, count, Mode, opacity);
+}
+
+const char *layerBlendKernel() {
+    return "scalar";
+}
+
+#endif
+
+void blendLayerSpan(QRgb *dst, const QRgb *src, int count, BlendMode mode, int opacity) {
+    if (opacity <= 0 || count <= 0) return;
+    opacity = qMin(opacity, 255);
+    // 模式在整行外面分派，内层循环里没有分支
+    switch (mode) {
+    case NormalBlend:
+        blendSpan<NormalBlend>(dst, src, count, opacity);
+        break;
+    case MultiplyBlend:
+        blendSpan<MultiplyBlend>(dst, src, count, opacity);
+        break;
+    case ScreenBlend:
+        blendSpan<ScreenBlend>(dst, src, count, opacity);
+        break;
+    case AdditiveBlend:
+        blendSpan<AdditiveBlend>(dst, src, count, opacity);
+        break;
+    }
+}
+
+LayerStack::LayerStack(int tileSize) :
+    m_tileSize(qMax(16, tileSize))
+{
+    m_slots.append(new Slot);
+    m_slots.first()->layer.id = m_nextId++;
+}
+
+LayerStack::~LayerStack() {
+    qDeleteAll(m_slots);
+    discardRemoved();
+}
+
+int LayerStack::indexOf(int id) const {
+    for (int i = 0; i < m_slots.size(); ++i) {
+        if (m_slots[i]->layer.id == id) return i;
+    }
+    return -1;
+}
+
+bool LayerStack::isSingle() const {
+    const Layer &only = m_slots.first()->layer;
+    return m_slots.size() == 1 && only.visible && only.opacity >= 1.0;
+}
+
+void LayerStack::setName(int index, const QString &name) {
+    m_slots[index]->layer.name = name;
+}
+
+void LayerStack::setOpacity(int index, double opacity) {
+    opacity = qBound(0.0, opacity, 1.0);
+    if (m_slots[index]->layer.opacity == opacity) return;
+    m_slots[index]->layer.opacity = opacity;
+    invalidateAll();
+}
+
+void LayerStack::setVisible(int index, bool visible) {
+    if (m_slots[index]->layer.visible == visible) return;
+    m_slots[index]->layer.visible = visible;
+    invalidateAll();
+}
+
+void LayerStack::setBlendMode(int index, BlendMode mode) {
+    if (m_slots[index]->layer.mode == mode) return;
+    m_slots[index]->layer.mode = mode;
+    invalidateAll();
+}
+
+int LayerStack::insert(int index, const QString &name) {
+    index = qBound(0, index, m_slots.size());
+    Slot *slot = new Slot;
+    slot->layer.id = m_nextId++;
+    slot->layer.name = name;
+    m_slots.insert(index, slot);
+    if (index <= m_current) ++m_current;
+    invalidateAll();
+    return index;
+}
+
+void LayerStack::remove(int index) {
+    Q_ASSERT(index != m_current);
+    if (index == m_current || index < 0 || index >= m_slots.size()) return;
+    // 窗口里的像素写回分块后留着，撤销删除时原样放回
+    Slot *slot = m_slots.takeAt(index);
+    if (!slot->window.isNull()) slot->document.write(slot->window, m_window.topLeft(), slot->window.rect());
+    slot->window = QImage();
+    m_removed.append(qMakePair(index, slot));
+    if (index < m_current) --m_current;
+    if (m_slots.size() == 1) m_flat = QImage();   // 只剩一层时不再合成
+    invalidateAll();
+}
+
+bool LayerStack::restore(int id) {
+    for (int i = m_removed.size() - 1; i >= 0; --i) {
+        if (m_removed[i].second->layer.id != id) continue;
+        const int index = qBound(0, m_removed[i].first, m_slots.size());
+        Slot *slot = m_removed.takeAt(i).second;
+        // 删除之后窗口可能换过位置
+        slot->window = slot->document.bounds().intersects(m_window) ? slot->document.take(m_window) : QImage();
+        m_slots.insert(index, slot);
+        if (index <= m_current) ++m_current;
+        invalidateAll();
+        return true;
+    }
+    return false;
+}
+
+void LayerStack::discardRemoved() {
+    for (const QPair<int, Slot *> &removed : m_removed) delete removed.second;
+    m_removed.clear();
+}
+
+void LayerStack::move(int from, int to) {
+    if (from == to) return;
+    m_slots.move(from, to);
+    if (m_current == from) {
+        m_current = to;
+    } else if (from < m_current && to >= m_current) {
+        --m_current;
+    } else if (from > m_current && to <= m_current) {
+        ++m_current;
+    }
+    invalidateAll();
+}
+
+void LayerStack::setCurrent(int index, QImage &window, TiledCanvas &document) {
+    if (index == m_current || index < 0 || index >= m_slots.size()) return;
+    // 调用方手里的当前层放回它的位置
+    Slot *out = m_slots[m_current];
+    out->window = window;
+    out->document.swap(document);
+    // 新的当前层交给调用方，窗口范围内全是背景时给一张空白窗口
+    Slot *in = m_slots[index];
+    window = in->window.isNull() ? in->document.take(m_window) : in->window;
+    in->window = QImage();
+    document.swap(in->document);
+    m_current = index;
+    invalidateAll();
+}
+
+void LayerStack::setWindow(const QRect &window) {
+    if (window == m_window) return;
+    for (int i = 0; i < m_slots.size(); ++i) {
+        if (i == m_current) continue;
+        Slot *slot = m_slots[i];
+        if (!slot->window.isNull()) slot->document.write(slot->window, m_window.topLeft(), slot->window.rect());
+        slot->window = slot->document.bounds().intersects(window) ? slot->document.take(window) : QImage();
+    }
+    m_window = window;
+    invalidateAll();
+}
+
+QRect LayerStack::bounds() const {
+    QRect result;
+    for (int i = 0; i < m_slots.size(); ++i) {
+        if (i == m_current) continue;
+        result |= m_slots[i]->document.bounds();
+        if (!m_slots[i]->window.isNull()) result |= m_window;
+    }
+    return result;
+}
+
+void LayerStack::clear() {
+    for (int i = 0; i < m_slots.size(); ++i) {
+        if (i == m_current) continue;
+        m_slots[i]->document.clear();
+        m_slots[i]->window = QImage();
+    }
+    invalidateAll();
+}
+
+void LayerStack::reset() {
+    Slot *current = m_slots.takeAt(m_current);
+    qDeleteAll(m_slots);
+    m_slots.clear();
+    discardRemoved();
+    const int id = current->layer.id;
+    current->layer = Layer();
+    current->layer.id = id;
+    m_slots.append(current);
+    m_current = 0;
+    m_flat = QImage();
+    invalidateAll();
+}
+
+void LayerStack::syncFiles() {
+    for (int i = 0; i < m_slots.size(); ++i) {
+        Slot *slot = m_slots[i];
+        if (i == m_current || !slot->document.isMapped() || slot->window.isNull()) continue;
+        slot->document.write(slot->window, m_window.topLeft(), slot->window.rect());
+        slot->document.syncFile();
+    }
+}
+
+void LayerStack::syncImage(const QImage &current) {
+    if (current.size() != m_size) {
+        m_size = current.size();
+        m_tilesX = (m_size.width() + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (m_size.height() + m_tileSize - 1) / m_tileSize;
+        m_valid.fill(false, m_tilesX * m_tilesY);
+    } else if (current.cacheKey() != m_currentKey) {
+        // 上次之后有没报告过的改动，不知道改了哪里，整体失效
+        invalidateAll();
+    }
+    m_currentKey = current.cacheKey();
+}
+
+void LayerStack::invalidateAll() {
+    m_valid.fill(false);
+}
+
+void LayerStack::invalidate(const QImage &current, const QRect &rect) {
+    if (current.size() != m_size) {
+        syncImage(current);
+        return;
+    }
+    const QRect area = rect.intersected(QRect(QPoint(0, 0), m_size));
+    if (!area.isEmpty()) {
+        for (int ty = area.top() / m_tileSize; ty <= area.bottom() / m_tileSize; ++ty) {
+            for (int tx = area.left() / m_tileSize; tx <= area.right() / m_tileSize; ++tx) {
+                m_valid[ty * m_tilesX + tx] = false;
+            }
+        }
+    }
+    m_currentKey = current.cacheKey();
+}
+
+void LayerStack::blendInto(QImage &target, const QImage &source, const QRect &rect, const Layer &layer) {
+    const int opacity = qRound(layer.opacity * 255);
+    if (!layer.visible || opacity <= 0 || source.isNull()) return;
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        blendLayerSpan(reinterpret_cast<QRgb *>(target.scanLine(y)) + rect.left(),
+                       reinterpret_cast<const QRgb *>(source.constScanLine(y)) + rect.left(),
+                       rect.width(), layer.mode, opacity);
+    }
+}
+
+void LayerStack::composeTile(const QImage &current, const QRect &rect) {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(m_flat.scanLine(y));
+        std::fill(line + rect.left(), line + rect.right() + 1, QRgb(0));
+    }
+    for (int i = 0; i < m_slots.size(); ++i) {
+        blendInto(m_flat, i == m_current ? current : m_slots[i]->window, rect, m_slots[i]->layer);
+    }
+}
+
+const QImage &LayerStack::flattened(const QImage &current, const QRect &area, QRect *refreshed) {
+    syncImage(current);
+    if (m_flat.size() != m_size) {
+        m_flat = QImage(m_size, QImage::Format_ARGB32_Premultiplied);
+        invalidateAll();
+    }
+    QRect done;
+    const QRect rect = area.intersected(current.rect());
+    if (!rect.isEmpty()) {
+        for (int ty = rect.top() / m_tileSize; ty <= rect.bottom() / m_tileSize; ++ty) {
+            for (int tx = rect.left() / m_tileSize; tx <= rect.right() / m_tileSize; ++tx) {
+                if (m_valid[ty * m_tilesX + tx]) continue;
+                const QRect tile = QRect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize)
+                                       .intersected(current.rect());
+                composeTile(current, tile);
+                m_valid[ty * m_tilesX + tx] = true;
+                done |= tile;
+            }
+        }
+    }
+    if (refreshed) *refreshed = done;
+    return m_flat;
+}
+
+QImage LayerStack::flatten(const QImage &current, const QRect &area) const {
+    QImage result(area.size(), QImage::Format_ARGB32_Premultiplied);
+    if (result.isNull()) return result;
+    result.fill(0);
+    for (int i = 0; i < m_slots.size(); ++i) {
+        const Slot *slot = m_slots[i];
+        if (i == m_current) {
+            blendInto(result, current, result.rect(), slot->layer);
+            continue;
+        }
+        if (!slot->layer.visible || !(slot->document.bounds() | (slot->window.isNull() ? QRect() : m_window))
+                                         .intersects(area)) {
+            continue;
+        }
+        // 这一层在 area 内的像素：分块里的，再盖上窗口里的
+        QImage pixels = slot->document.read(area);
+        if (!slot->window.isNull()) {
+            const QRect part = m_window.intersected(area);
+            for (int y = part.top(); y <= part.bottom(); ++y) {
+                const QRgb *from = reinterpret_cast<const QRgb *>(slot->window.constScanLine(y - m_window.top()))
+                                   + (part.left() - m_window.left());
+                std::copy(from, from + part.width(),
+                          reinterpret_cast<QRgb *>(pixels.scanLine(y - area.top())) + (part.left() - area.left()));
+            }
+        }
+        blendInto(result, pixels, result.rect(), slot->layer);
+    }
+    return result;
+}
+
+qint64 LayerStack::memoryUsage() const {
+    qint64 bytes = m_flat.sizeInBytes();
+    for (const Slot *slot : m_slots) {
+        bytes += slot->window.sizeInBytes() + slot->document.memoryUsage();
+    }
+    for (const QPair<int, Slot *> &removed : m_removed) bytes += removed.second->document.memoryUsage();
+    return bytes;
+}
+
+} // namespace Raster
@@ -0,0 +1,125 @@
+#ifndef LAYERSTACK_H
+#define LAYERSTACK_H
+
+#include <QImage>
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include "tiledcanvas.h"
+
+namespace Raster {
+
+enum BlendMode { NormalBlend, MultiplyBlend, ScreenBlend, AdditiveBlend };
+
+/**
+ * 把一行非预乘 ARGB32 的图层像素按 mode 合成到预乘 ARGB32 的 dst 上，opacity 为 0..255。
+ * 源像素在寄存器里乘上 alpha 和不透明度，之后按预乘公式逐通道计算（alpha 通道同一公式）：
+ *   正常  s + d·(1-sa)        正片叠底  s·d + s·(1-da) + d·(1-sa)
+ *   滤色  s + d - s·d         相加      min(1, s + d)
+ * 编译期选择 AVX2（8 像素/次）、SSE2（4 像素/次）或标量实现，结果逐像素相同。
+ */
+void blendLayerSpan(QRgb *dst, const QRgb *src, int count, BlendMode mode, int opacity);
+
+// 标量参考实现，同时用于 SIMD 的尾部像素
+void blendLayerSpanScalar(QRgb *dst, const QRgb *src, int count, BlendMode mode, int opacity);
+
+// 当前编译进来的内核名称："AVX2" / "SSE2" / "scalar"
+const char *layerBlendKernel();
+
+/**
+ * 图层栈：每层有名字、不透明度、可见性和混合模式，从下往上合成。
+ *
+ * 当前层的像素由调用方持有（CanvasWidget 的 canvasImage 窗口和 document 分块），所有绘图工具照常在上面画；
+ * 其他层的窗口图像和分块放在这里，setCurrent() 时两边交换。所有层共用同一个窗口范围（文档坐标）。
+ *
+ * 合成结果按 tileSize×tileSize 分块缓存（窗口坐标，预乘 ARGB32）。当前层改动后用 invalidate() 报告，
+ * 图层属性、顺序或窗口变了整体失效；flattened() 只重算请求范围内失效的块，
+ * 没有改动时多少层都只是取缓存。和 MipPyramid 一样用 cacheKey 发现没报告过的改动。
+ */
+class LayerStack {
+public:
+    struct Layer {
+        int id = 0;          // 创建时分配，移动、删除后撤销都不变；撤销历史和图元用它认层
+        QString name;
+        double opacity = 1.0;
+        bool visible = true;
+        BlendMode mode = NormalBlend;
+    };
+
+    explicit LayerStack(int tileSize = 128);
+    ~LayerStack();
+
+    int count() const { return m_slots.size(); }
+    int current() const { return m_current; }
+    const Layer &layer(int index) const { return m_slots[index]->layer; }
+    int indexOf(int id) const;   // 没有这一层（或已删除）时返回 -1
+    // 只有当前一层且不透明、可见时合成结果就是当前层本身，调用方可以直接画它
+    bool isSingle() const;
+
+    void setName(int index, const QString &name);
+    void setOpacity(int index, double opacity);
+    void setVisible(int index, bool visible);
+    void setBlendMode(int index, BlendMode mode);
+
+    int insert(int index, const QString &name);   // 插入一个空白层，返回它的位置；当前层不变
+    void remove(int index);                       // 不能删除当前层；删掉的层留着，restore() 可以放回
+    bool restore(int id);                         // 把删掉的 id 层放回原来的位置
+    void discardRemoved();                        // 释放删掉的层，之后不能再 restore()
+    void move(int from, int to);
+    // 切换当前层：window/document 是调用方手里当前层的像素，换成 index 层的
+    void setCurrent(int index, QImage &window, TiledCanvas &document);
+
+    QRect window() const { return m_window; }
+    void setWindow(const QRect &window);   // 其他层的窗口换到 window（文档坐标），之外的像素留在各自的分块里
+    QRect bounds() const;                  // 其他层画过的范围（文档坐标），没有时为空矩形
+    void clear();                          // 其他层的像素全部清掉，层本身保留
+    void reset();                          // 只留下当前层，属性恢复默认，删掉的层一并释放
+    void syncFiles();                      // 其他层里映射到文件的分块把窗口里的像素连同文件外的块写回文件
+
+    // current 在 rect（窗口坐标）内的像素已被改动
+    void invalidate(const QImage &current, const QRect &rect);
+
+    /**
+     * 合成结果（预乘 ARGB32，窗口坐标，大小与 current 相同），area 内的块保证是最新的。
+     * refreshed 不为空时返回这次重算过的范围。返回的图像由本对象持有，下一次调用前有效。
+     */
+    const QImage &flattened(const QImage &current, const QRect &area, QRect *refreshed = nullptr);
+
+    // 合成文档里 area（文档坐标）范围的所有可见层，current 是当前层在 area 内的像素（保存用）
+    QImage flatten(const QImage &current, const QRect &area) const;
+
+    qint64 memoryUsage() const;   // 其他层（包括删掉待恢复的）的窗口和分块以及合成缓存占用的字节数
+
+private:
+    struct Slot {
+        Layer layer;
+        QImage window;          // 窗口里的像素；空图表示窗口范围内全是背景。当前层的留空
+        TiledCanvas document;   // 窗口之外的像素
+    };
+
+    void syncImage(const QImage &current);
+    void invalidateAll();
+    void composeTile(const QImage &current, const QRect &rect);
+    // source 与 target 坐标相同，把 source 在 rect 内的像素按 layer 的属性合成到 target 上
+    static void blendInto(QImage &target, const QImage &source, const QRect &rect, const Layer &layer);
+
+    QList<Slot *> m_slots;   // 从下往上
+    int m_current = 0;
+    int m_nextId = 1;
+    QList<QPair<int, Slot *>> m_removed;   // 删掉的层和它当时的位置，像素都在 document 里
+    QRect m_window;
+
+    int m_tileSize;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+    QSize m_size;
+    QImage m_flat;           // 第一次合成时才分配
+    QVector<bool> m_valid;   // 每块的合成结果是否最新
+    qint64 m_currentKey = 0;
+
+    Q_DISABLE_COPY(LayerStack)
+};
+
+} // namespace Raster
+
+#endif // LAYERSTACK_H
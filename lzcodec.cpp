@@ -0,0 +1,119 @@
+#include "lzcodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Raster {
+
+static const int MinMatch = 4;
+static const int HashBits = 12;
+static const int MaxOffset = 65535;
+static const int LastLiterals = 5;   // 结尾几个字节总是按字面量输出
+
+static inline quint32 read32(const uchar *p) {
+    quint32 value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline int hashSequence(quint32 sequence) {
+    return int((sequence * 2654435761u) >> (32 - HashBits));
+}
+
+// 令牌的半字节放不下时，剩余长度按 255 一字节累加
+static void writeLength(QByteArray &out, int length) {
+    for (; length >= 255; length -= 255) out.append(char(255));
+    out.append(char(length));
+}
+
+QByteArray lzCompress(const char *data, int size) {
+    const uchar *src = reinterpret_cast<const uchar *>(data);
+    QByteArray out;
+    out.reserve(size / 4 + 16);
+
+    int table[1 << HashBits];
+    std::fill(table, table + (1 << HashBits), -1);
+
+    int anchor = 0;   // 尚未输出的字面量起点
+    int pos = 0;
+    const int matchLimit = size - LastLiterals;
+    while (pos + MinMatch <= matchLimit) {
+        const quint32 sequence = read32(src + pos);
+        const int hash = hashSequence(sequence);
+        const int candidate = table[hash];
+        table[hash] = pos;
+        if (candidate < 0 || pos - candidate > MaxOffset || read32(src + candidate) != sequence) {
+            // 连续找不到匹配时加大步长，不可压缩的数据很快扫过去
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        int length = MinMatch;
+        while (pos + length < matchLimit && src[candidate + length] == src[pos + length]) ++length;
+
+        const int literals = pos - anchor;
+        const int matchCode = length - MinMatch;
+        out.append(char((qMin(literals, 15) << 4) | qMin(matchCode, 15)));
+        if (literals >= 15) writeLength(out, literals - 15);
+        out.append(reinterpret_cast<const char *>(src + anchor), literals);
+        const int offset = pos - candidate;
+        out.append(char(offset & 0xff));
+        out.append(char(offset >> 8));
+        if (matchCode >= 15) writeLength(out, matchCode - 15);
+
+        pos += length;
+        anchor = pos;
+    }
+
+    // 最后一个令牌只有字面量，解压读到输入末尾即结束
+    const int literals = size - anchor;
+    out.append(char(qMin(literals, 15) << 4));
+    if (literals >= 15) writeLength(out, literals - 15);
+    out.append(reinterpret_cast<const char *>(src + anchor), literals);
+    return out;
+}
+
+bool lzDecompress(const QByteArray &compressed, char *out, int size) {
+    const uchar *ip = reinterpret_cast<const uchar *>(compressed.constData());
+    const uchar *const end = ip + compressed.size();
+    uchar *op = reinterpret_cast<uchar *>(out);
+    uchar *const begin = op;
+    uchar *const outEnd = op + size;
+
+    auto readLength = [&](int length) {
+        for (int extra = 255; extra == 255 && ip < end; length += extra) {
+            extra = *ip++;
+        }
+        return length;
+    };
+
+    while (ip < end) {
+        const int token = *ip++;
+        int literals = token >> 4;
+        if (literals == 15) literals = readLength(literals);
+        if (literals > end - ip || literals > outEnd - op) return false;
+        std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) break;
+
+        if (end - ip < 2) return false;
+        const int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int length = token & 15;
+        if (length == 15) length = readLength(length);
+        length += MinMatch;
+        if (offset == 0 || offset > op - begin || length > outEnd - op) return false;
+
+        const uchar *match = op - offset;
+        if (offset >= length) {
+            std::memcpy(op, match, length);
+        } else {
+            // 重叠拷贝（例如纯色块）必须逐字节向前复制
+            for (int i = 0; i < length; ++i) op[i] = match[i];
+        }
+        op += length;
+    }
+    return op == outEnd;
+}
+
+} // namespace Raster
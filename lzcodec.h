@@ -0,0 +1,20 @@
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+#include <QByteArray>
+
+namespace Raster {
+
+/**
+ * LZ4 风格的块压缩：哈希表贪心找 4 字节以上的匹配，输出"字面量长度/匹配长度"令牌序列。
+ * 压缩率不如 zlib，但解压只有内存拷贝，撤销历史里的画布块可以随时解开。
+ * 格式只在本程序内部使用，不与 LZ4 兼容。
+ */
+QByteArray lzCompress(const char *data, int size);
+
+// 解压到 out，size 必须等于原始长度；数据损坏时返回 false
+bool lzDecompress(const QByteArray &compressed, char *out, int size);
+
+} // namespace Raster
+
+#endif // LZCODEC_H
@@ -6,6 +6,9 @@
 #include <QMessageBox>
 #include <QHBoxLayout>
 #include <QDebug>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QSignalBlocker>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent) {
@@ -56,6 +59,7 @@ void MainWindow::setupUI() {
     modeComboBox->addItem("自由绘制");
     modeComboBox->addItem("直线-Bresenham");
     modeComboBox->addItem("直线-中点");
+    modeComboBox->addItem("直线-Wu反走样");
     modeComboBox->addItem("圆");
     modeComboBox->addItem("多边形");
     modeComboBox->addItem("Bezier曲线");
@@ -83,6 +87,22 @@ void MainWindow::setupUI() {
         canvas->setDrawingMode(5 ? 5 : -1);  // 切换模式
     });
 
+    // 填充容差：0 为精确匹配
+    QSpinBox *toleranceSpinBox = new QSpinBox(this);
+    toleranceSpinBox->setRange(0, 255);
+    toleranceSpinBox->setPrefix("容差 ");
+    QComboBox *metricComboBox = new QComboBox(this);
+    metricComboBox->addItem("逐通道", QVariant::fromValue(int(Raster::PerChannel)));
+    metricComboBox->addItem("欧氏距离", QVariant::fromValue(int(Raster::Euclidean)));
+    auto applyTolerance = [=]() {
+        const auto metric = Raster::ToleranceMetric(metricComboBox->currentData().toInt());
+        // RGBA 欧氏距离最大为 2×255
+        toleranceSpinBox->setMaximum(metric == Raster::Euclidean ? 510 : 255);
+        canvas->setFillTolerance(toleranceSpinBox->value(), metric);
+    };
+    connect(toleranceSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, applyTolerance);
+    connect(metricComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), this, applyTolerance);
+
     // 添加裁剪模式和算法选择
     QComboBox *clipCombo = new QComboBox(this);
     clipCombo->addItem("裁剪模式 - Cohen-Sutherland", QVariant::fromValue(CanvasWidget::CohenSutherland));
@@ -109,6 +129,20 @@ void MainWindow::setupUI() {
     QPushButton *saveButton = new QPushButton("保存", this);
     connect(saveButton, &QPushButton::clicked, this, &MainWindow::saveCanvas);
 
+    // 添加导出按钮：分块文件打开的画布也能另存为 PNG/JPEG
+    QPushButton *exportButton = new QPushButton("导出", this);
+    connect(exportButton, &QPushButton::clicked, this, &MainWindow::exportCanvas);
+
+    // 添加打开按钮（超大图按分块文件映射打开）
+    QPushButton *openButton = new QPushButton("打开", this);
+    connect(openButton, &QPushButton::clicked, this, &MainWindow::openCanvas);
+
+    // 添加撤销/重做按钮（画布获得焦点时也可用 Ctrl+Z / Ctrl+Y）
+    QPushButton *undoButton = new QPushButton("撤销", this);
+    connect(undoButton, &QPushButton::clicked, canvas, &CanvasWidget::undo);
+    QPushButton *redoButton = new QPushButton("重做", this);
+    connect(redoButton, &QPushButton::clicked, canvas, &CanvasWidget::redo);
+
     // 添加旋转按钮
     QPushButton *rotateButton = new QPushButton("旋转", this);
     connect(rotateButton, &QPushButton::clicked, this, [this]() {
@@ -121,24 +155,86 @@ void MainWindow::setupUI() {
         canvas->setTransformMode(CanvasWidget::Scale);
     });
 
+    // 图层：当前层、新建/删除、混合模式、不透明度、可见性，以及填充是否按合成结果取样
+    QComboBox *layerCombo = new QComboBox(this);
+    QPushButton *addLayerButton = new QPushButton("新建图层", this);
+    QPushButton *removeLayerButton = new QPushButton("删除图层", this);
+    QComboBox *blendCombo = new QComboBox(this);
+    blendCombo->addItem("正常", QVariant::fromValue(int(Raster::NormalBlend)));
+    blendCombo->addItem("正片叠底", QVariant::fromValue(int(Raster::MultiplyBlend)));
+    blendCombo->addItem("滤色", QVariant::fromValue(int(Raster::ScreenBlend)));
+    blendCombo->addItem("相加", QVariant::fromValue(int(Raster::AdditiveBlend)));
+    QSpinBox *opacitySpinBox = new QSpinBox(this);
+    opacitySpinBox->setRange(0, 100);
+    opacitySpinBox->setPrefix("不透明度 ");
+    opacitySpinBox->setSuffix("%");
+    QCheckBox *visibleCheckBox = new QCheckBox("可见", this);
+    QCheckBox *mergedCheckBox = new QCheckBox("合并取样", this);
+
+    // 画布的图层变了之后同步控件，期间不回发信号
+    auto refreshLayers = [=]() {
+        const QSignalBlocker blockLayers(layerCombo), blockBlend(blendCombo),
+                             blockOpacity(opacitySpinBox), blockVisible(visibleCheckBox);
+        layerCombo->clear();
+        for (int i = 0; i < canvas->layerCount(); ++i) layerCombo->addItem(canvas->layer(i).name);
+        const int current = canvas->currentLayer();
+        const Raster::LayerStack::Layer &layer = canvas->layer(current);
+        layerCombo->setCurrentIndex(current);
+        blendCombo->setCurrentIndex(blendCombo->findData(QVariant::fromValue(int(layer.mode))));
+        opacitySpinBox->setValue(qRound(layer.opacity * 100));
+        visibleCheckBox->setChecked(layer.visible);
+        removeLayerButton->setEnabled(canvas->layerCount() > 1);
+    };
+    refreshLayers();
+    connect(canvas, &CanvasWidget::layersChanged, this, refreshLayers);
+    connect(layerCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), canvas, &CanvasWidget::setCurrentLayer);
+    connect(addLayerButton, &QPushButton::clicked, canvas, &CanvasWidget::addLayer);
+    connect(removeLayerButton, &QPushButton::clicked, this, [this]() {
+        canvas->removeLayer(canvas->currentLayer());
+    });
+    connect(blendCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [=]() {
+        canvas->setLayerBlendMode(canvas->currentLayer(), Raster::BlendMode(blendCombo->currentData().toInt()));
+    });
+    connect(opacitySpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int value) {
+        canvas->setLayerOpacity(canvas->currentLayer(), value / 100.0);
+    });
+    connect(visibleCheckBox, &QCheckBox::toggled, this, [this](bool checked) {
+        canvas->setLayerVisible(canvas->currentLayer(), checked);
+    });
+    connect(mergedCheckBox, &QCheckBox::toggled, canvas, &CanvasWidget::setFillSampleMerged);
+
     // 创建播放按钮
     playButton = new QPushButton("播放", this);  // 使用更直观的文本
     playButton->setToolTip("打开动画演示窗口");
 
     // 在工具栏添加按钮
+    toolBar->addWidget(openButton);
     toolBar->addWidget(saveButton);
+    toolBar->addWidget(exportButton);
     toolBar->addWidget(colorButton);
     toolBar->addWidget(clearButton);
+    toolBar->addWidget(undoButton);
+    toolBar->addWidget(redoButton);
     toolBar->addWidget(penWidthButton);
     toolBar->addWidget(modeComboBox);
     toolBar->addWidget(lineStyleComboBox);
     toolBar->addWidget(eraserButton);
     toolBar->addWidget(fillButton);
+    toolBar->addWidget(toleranceSpinBox);
+    toolBar->addWidget(metricComboBox);
     toolBar->addWidget(clipCombo);
     toolBar->addWidget(selectButton);
     toolBar->addWidget(rotateButton);
     toolBar->addWidget(scaleButton);
     toolBar->addSeparator();
+    toolBar->addWidget(layerCombo);
+    toolBar->addWidget(addLayerButton);
+    toolBar->addWidget(removeLayerButton);
+    toolBar->addWidget(blendCombo);
+    toolBar->addWidget(opacitySpinBox);
+    toolBar->addWidget(visibleCheckBox);
+    toolBar->addWidget(mergedCheckBox);
+    toolBar->addSeparator();
     toolBar->addWidget(playButton);
 
     setCentralWidget(centralWidget);
@@ -277,13 +373,15 @@ void MainWindow::setLineStyle(int index) {
 
 
 void MainWindow::setDrawingMode(int index) {
-    int modeMap[] = {0, 1, 1, 2, 4, 7, 8};
-    if (index >= 0 && index < 7) {
+    int modeMap[] = {0, 1, 1, 1, 2, 4, 7, 8};
+    if (index >= 0 && index < 8) {
         canvas->setDrawingMode(modeMap[index]);
         if (index == 1) {
             canvas->setLineAlgorithm(CanvasWidget::Bresenham);
         } else if (index == 2) {
             canvas->setLineAlgorithm(CanvasWidget::Midpoint);
+        } else if (index == 3) {
+            canvas->setLineAlgorithm(CanvasWidget::Wu);
         }
     }
 }
@@ -298,6 +396,15 @@ void MainWindow::selectEraser() {
 }
 
 void MainWindow::saveCanvas() {
+    if (canvas->isFileBacked()) {
+        // 分块文件本身就是文档，写回改动即可；要另存为普通图像用"导出"
+        canvas->syncTileFile();
+        return;
+    }
+    exportCanvas();
+}
+
+void MainWindow::exportCanvas() {
     QString fileName = QFileDialog::getSaveFileName(this,
         tr("保存图像"), "",
         tr("PNG 文件 (*.png);;JPEG 文件 (*.jpg *.jpeg);;BMP 文件 (*.bmp);;所有文件 (*)"));
@@ -308,3 +415,21 @@ void MainWindow::saveCanvas() {
         }
     }
 }
+
+void MainWindow::openCanvas() {
+    QString fileName = QFileDialog::getOpenFileName(this,
+        tr("打开图像"), "",
+        tr("分块画布 (*.ctiles);;图像文件 (*.png *.jpg *.jpeg *.bmp);;所有文件 (*)"));
+
+    if (fileName.isEmpty()) return;
+    bool ok;
+    if (fileName.endsWith(".ctiles", Qt::CaseInsensitive)) {
+        ok = canvas->openTileFile(fileName);
+    } else {
+        // 普通图像先在旁边转存一份分块文件，以后直接打开它
+        ok = canvas->importTileFile(fileName, fileName + ".ctiles");
+    }
+    if (!ok) {
+        QMessageBox::warning(this, tr("打开失败"), tr("无法打开图像文件。"));
+    }
+}
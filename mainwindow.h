@@ -23,6 +23,8 @@ private slots:
     void setLineStyle(int index);
     void selectEraser();
     void saveCanvas();
+    void exportCanvas();
+    void openCanvas();
 
 private:
     CanvasWidget *canvas;
@@ -0,0 +1,214 @@
+#include "mippyramid.h"
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CANVAS_MIP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANVAS_MIP_SSE2
+#endif
+
+namespace Raster {
+
+static inline QRgb average4(QRgb a, QRgb b, QRgb c, QRgb d) {
+    // 每个通道 4 个 8 位数之和放得进 10 位，按字节交错分两组一起算
+    const quint64 lo = 0x00ff00ffu;
+    const quint64 even = (a & lo) + (b & lo) + (c & lo) + (d & lo) + 0x00020002u;
+    const quint64 odd = ((a >> 8) & lo) + ((b >> 8) & lo) + ((c >> 8) & lo) + ((d >> 8) & lo) + 0x00020002u;
+    return QRgb(((even >> 2) & lo) | (((odd >> 2) & lo) << 8));
+}
+
+#if defined(CANVAS_MIP_AVX2)
+
+void boxDownsample(const QRgb *row0, const QRgb *row1, QRgb *dst, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi16(2);
+    // 8 个源像素（每个 128 位通道 4 个）-> 每通道两个水平和，16 位
+    auto pairSums = [&](const QRgb *p) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const __m256i lo = _mm256_unpacklo_epi8(v, zero);   // p0 p1 | p4 p5
+        const __m256i hi = _mm256_unpackhi_epi8(v, zero);   // p2 p3 | p6 p7
+        return _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+    };
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const QRgb *a = row0 + 2 * i;
+        const QRgb *b = row1 + 2 * i;
+        const __m256i first = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(pairSums(a), pairSums(b)), round), 2);          // q0 q1 | q2 q3
+        const __m256i second = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_add_epi16(pairSums(a + 8), pairSums(b + 8)), round), 2);  // q4 q5 | q6 q7
+        // packus 按 128 位通道打包，得到 q0 q1 q4 q5 | q2 q3 q6 q7，再换回顺序
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second),
+                                                        _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+    }
+    for (; i < count; ++i) {
+        dst[i] = average4(row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1]);
+    }
+}
+
+const char *boxFilterKernel() {
+    return "AVX2";
+}
+
+#elif defined(CANVAS_MIP_SSE2)
+
+void boxDownsample(const QRgb *row0, const QRgb *row1, QRgb *dst, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    // 4 个源像素 -> 两个水平和，每通道 16 位
+    auto pairSums = [&](const QRgb *p) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);   // p0 p1
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);   // p2 p3
+        return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    };
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const QRgb *a = row0 + 2 * i;
+        const QRgb *b = row1 + 2 * i;
+        const __m128i first = _mm_srli_epi16(
+            _mm_add_epi16(_mm_add_epi16(pairSums(a), pairSums(b)), round), 2);          // q0 q1
+        const __m128i second = _mm_srli_epi16(
+            _mm_add_epi16(_mm_add_epi16(pairSums(a + 4), pairSums(b + 4)), round), 2);  // q2 q3
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(first, second));
+    }
+    for (; i < count; ++i) {
+        dst[i] = average4(row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1]);
+    }
+}
+
+const char *boxFilterKernel() {
+    return "SSE2";
+}
+
+#else
+
+void boxDownsample(const QRgb *row0, const QRgb *row1, QRgb *dst, int count) {
+    for (int i = 0; i < count; ++i) {
+        dst[i] = average4(row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1]);
+    }
+}
+
+const char *boxFilterKernel() {
+    return "scalar";
+}
+
+#endif
+
+MipPyramid::MipPyramid(int tileSize) :
+    // 块边长取 2^MaxLevel 的倍数，每一级的块边界都落在整像素上
+    m_tileSize(qMax(1 << MaxLevel, tileSize) & ~((1 << MaxLevel) - 1))
+{
+}
+
+int MipPyramid::levelFor(double zoom) {
+    if (zoom >= 1.0 || zoom <= 0.0) return 0;
+    return qMin(int(MaxLevel), int(std::floor(std::log2(1.0 / zoom) + 1e-9)));
+}
+
+void MipPyramid::clear() {
+    for (int n = 0; n < MaxLevel; ++n) {
+        m_levels[n] = QImage();
+        m_valid[n].clear();
+    }
+    m_size = QSize();
+    m_tilesX = m_tilesY = 0;
+}
+
+void MipPyramid::syncImage(const QImage &image) {
+    if (image.size() != m_size || image.format() != m_format) {
+        clear();
+        m_size = image.size();
+        m_format = image.format();
+        m_tilesX = (m_size.width() + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (m_size.height() + m_tileSize - 1) / m_tileSize;
+        // 各级图像和块状态等第一次用到时再分配
+    } else if (image.cacheKey() != m_imageKey) {
+        // 上次之后有没报告过的改动，不知道改了哪里，整体失效
+        invalidateTiles(image.rect());
+    }
+    m_imageKey = image.cacheKey();
+}
+
+void MipPyramid::invalidateTiles(const QRect &rect) {
+    const QRect area = rect.intersected(QRect(QPoint(0, 0), m_size));
+    if (area.isEmpty()) return;
+    for (int n = 0; n < MaxLevel; ++n) {
+        if (m_valid[n].isEmpty()) continue;
+        for (int ty = area.top() / m_tileSize; ty <= area.bottom() / m_tileSize; ++ty) {
+            for (int tx = area.left() / m_tileSize; tx <= area.right() / m_tileSize; ++tx) {
+                m_valid[n][ty * m_tilesX + tx] = false;
+            }
+        }
+    }
+}
+
+void MipPyramid::invalidate(const QImage &image, const QRect &rect) {
+    if (image.size() != m_size || image.format() != m_format) {
+        syncImage(image);
+        return;
+    }
+    invalidateTiles(rect);
+    m_imageKey = image.cacheKey();
+}
+
+void MipPyramid::updateTile(const QImage &image, int level, int tile) {
+    // 上一级的同一块先补齐
+    if (level > 1 && !m_valid[level - 2][tile]) updateTile(image, level - 1, tile);
+
+    const QImage &source = level == 1 ? image : m_levels[level - 2];
+    QImage &target = m_levels[level - 1];
+    const int tileSize = m_tileSize >> level;
+    const int x0 = (tile % m_tilesX) * tileSize;
+    const int y0 = (tile / m_tilesX) * tileSize;
+    const int x1 = qMin(x0 + tileSize, target.width());
+    const int y1 = qMin(y0 + tileSize, target.height());
+    // 源图宽或高为奇数时，最后一列/行没有配对，与自己平均
+    const int pairs = qMin(x1, source.width() / 2) - x0;
+
+    for (int y = y0; y < y1; ++y) {
+        const QRgb *row0 = reinterpret_cast<const QRgb *>(source.constScanLine(2 * y));
+        const QRgb *row1 = reinterpret_cast<const QRgb *>(source.constScanLine(qMin(2 * y + 1, source.height() - 1)));
+        QRgb *dst = reinterpret_cast<QRgb *>(target.scanLine(y));
+        if (pairs > 0) boxDownsample(row0 + 2 * x0, row1 + 2 * x0, dst + x0, pairs);
+        for (int x = x0 + qMax(0, pairs); x < x1; ++x) {
+            const int left = qMin(2 * x, source.width() - 1);
+            dst[x] = average4(row0[left], row0[left], row1[left], row1[left]);
+        }
+    }
+    m_valid[level - 1][tile] = true;
+}
+
+qint64 MipPyramid::memoryUsage() const {
+    qint64 bytes = 0;
+    for (const QImage &image : m_levels) bytes += image.sizeInBytes();
+    return bytes;
+}
+
+const QImage &MipPyramid::level(const QImage &image, int level, const QRect &area) {
+    level = qBound(1, level, int(MaxLevel));
+    syncImage(image);
+    for (int n = 1; n <= level; ++n) {
+        if (!m_levels[n - 1].isNull()) continue;
+        const int scale = 1 << n;
+        m_levels[n - 1] = QImage((m_size.width() + scale - 1) / scale, (m_size.height() + scale - 1) / scale,
+                                 m_format);
+        m_valid[n - 1].fill(false, m_tilesX * m_tilesY);
+    }
+
+    const QRect region = area.intersected(QRect(QPoint(0, 0), m_size));
+    if (region.isEmpty()) return m_levels[level - 1];
+    QVector<bool> &valid = m_valid[level - 1];
+    for (int ty = region.top() / m_tileSize; ty <= region.bottom() / m_tileSize; ++ty) {
+        for (int tx = region.left() / m_tileSize; tx <= region.right() / m_tileSize; ++tx) {
+            const int tile = ty * m_tilesX + tx;
+            if (!valid[tile]) updateTile(image, level, tile);
+        }
+    }
+    return m_levels[level - 1];
+}
+
+} // namespace Raster
@@ -0,0 +1,62 @@
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include <QImage>
+#include <QVector>
+
+namespace Raster {
+
+/**
+ * 缩小查看用的多级缩略图（1/2、1/4、1/8、1/16）。第 n 级的每个像素是第 n-1 级 2×2 个像素的平均，
+ * 由编译期选择的 SIMD 盒式滤波内核生成（AVX2 一次出 8 个像素，SSE2 一次 4 个）。
+ *
+ * 画布按 tileSize×tileSize（原图坐标）分块，各级用同一套块编号：第 n 级的块正好对应原图同一块。
+ * 改动像素后只让覆盖到的块失效；取某一级时只补算请求范围内失效的块，没看到的部分留到看到时再算。
+ * 和 LabelCache 一样用 cacheKey 发现没报告过的改动，此时整体失效。
+ * 各级与原图格式相同，预乘的图（例如图层合成结果）也按预乘值平均。
+ */
+class MipPyramid {
+public:
+    enum { MaxLevel = 4 };
+
+    explicit MipPyramid(int tileSize = 128);
+
+    // 缩放倍数对应的级别：取不小于 zoom 的最小一级（2^-n >= zoom），再交给平滑缩放缩小不到一半
+    static int levelFor(double zoom);
+
+    // image 在 rect（原图坐标）内的像素已被改动
+    void invalidate(const QImage &image, const QRect &rect);
+    void clear();
+
+    /**
+     * 第 level 级（1..MaxLevel）的缩略图，area（原图坐标）内的块保证是最新的。
+     * 返回的图像由本对象持有，下一次调用前有效。
+     */
+    const QImage &level(const QImage &image, int level, const QRect &area);
+
+    qint64 memoryUsage() const;   // 各级图像占用的字节数
+
+private:
+    void syncImage(const QImage &image);
+    void invalidateTiles(const QRect &rect);
+    void updateTile(const QImage &image, int level, int tile);
+
+    int m_tileSize;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+    QSize m_size;
+    QImage::Format m_format = QImage::Format_Invalid;
+    qint64 m_imageKey = 0;
+    QImage m_levels[MaxLevel];          // 第 n 级存在 m_levels[n - 1]
+    QVector<bool> m_valid[MaxLevel];    // 每级每块是否最新
+};
+
+// 两行像素按 2×2 求平均：dst[i] = (row0[2i] + row0[2i+1] + row1[2i] + row1[2i+1] + 2) / 4，逐通道
+void boxDownsample(const QRgb *row0, const QRgb *row1, QRgb *dst, int count);
+
+// 当前编译进来的盒式滤波内核名称："AVX2" / "SSE2" / "scalar"
+const char *boxFilterKernel();
+
+} // namespace Raster
+
+#endif // MIPPYRAMID_H
@@ -0,0 +1,75 @@
+#include "perfcounters.h"
+#include <QMutex>
+#include <QVector>
+
+namespace Raster {
+namespace Perf {
+
+namespace {
+
+struct Registry {
+    QMutex mutex;
+    QVector<ThreadCounters *> threads;
+    qint64 retired[CounterCount] = {};   // 已退出线程留下的累计
+};
+
+Registry &registry() {
+    static Registry instance;
+    return instance;
+}
+
+} // namespace
+
+const char *counterName(Counter counter) {
+    static const char *const names[CounterCount] = {
+        "paint", "Bresenham", "Midpoint", "Arc", "Circle", "Wu",
+        "QPainter", "particle update", "particle render"
+    };
+    return counter >= 0 && counter < CounterCount ? names[counter] : "";
+}
+
+ThreadCounters::ThreadCounters() {
+    for (std::atomic<qint64> &value : this->value) value.store(0, std::memory_order_relaxed);
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    r.threads.append(this);
+}
+
+ThreadCounters::~ThreadCounters() {
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (int counter = 0; counter < CounterCount; ++counter) {
+        r.retired[counter] += value[counter].load(std::memory_order_relaxed);
+    }
+    r.threads.removeOne(this);
+}
+
+ThreadCounters &threadCounters() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+Snapshot Snapshot::operator-(const Snapshot &other) const {
+    Snapshot result;
+    for (int counter = 0; counter < CounterCount; ++counter) {
+        result.value[counter] = value[counter] - other.value[counter];
+    }
+    return result;
+}
+
+Snapshot snapshot() {
+    Snapshot result;
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (int counter = 0; counter < CounterCount; ++counter) {
+        qint64 sum = r.retired[counter];
+        for (const ThreadCounters *thread : r.threads) {
+            sum += thread->value[counter].load(std::memory_order_relaxed);
+        }
+        result.value[counter] = sum;
+    }
+    return result;
+}
+
+} // namespace Perf
+} // namespace Raster
@@ -0,0 +1,97 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <atomic>
+
+// CMake 选项 CANVAS_PERF_COUNTERS=OFF 时下面的计数全部编译成空操作
+#ifndef CANVAS_PERF_COUNTERS
+#define CANVAS_PERF_COUNTERS 1
+#endif
+
+namespace Raster {
+namespace Perf {
+
+enum Counter {
+    PaintNanos,            // paintEvent 耗时
+    BresenhamPixels,       // 各光栅化算法写出的像素数（SpanWriter 写出时按像素计，分块重走不重复计）
+    MidpointPixels,
+    ArcPixels,
+    CirclePixels,
+    WuPixels,              // Wu 反走样直线混合的像素数
+    PainterCount,          // 创建的 QPainter 个数
+    ParticleUpdateNanos,   // 粒子状态更新耗时
+    ParticleRenderNanos,   // 粒子光栅化与绘制耗时
+    CounterCount
+};
+
+const char *counterName(Counter counter);
+
+/**
+ * 每个线程一组计数器，只有本线程写，写入是普通的加法（relaxed 原子读写，不加锁）。
+ * 读取时把所有线程（含已退出线程留下的累计）加起来；只有线程创建、退出和读取时才加锁。
+ */
+struct ThreadCounters {
+    ThreadCounters();
+    ~ThreadCounters();
+    std::atomic<qint64> value[CounterCount];
+};
+ThreadCounters &threadCounters();
+
+inline void add(Counter counter, qint64 amount) {
+    std::atomic<qint64> &value = threadCounters().value[counter];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// 所有线程的累计值；两次快照相减就是这段时间（例如一帧）的增量
+struct Snapshot {
+    qint64 value[CounterCount] = {};
+    qint64 operator[](Counter counter) const { return value[counter]; }
+    Snapshot operator-(const Snapshot &other) const;
+};
+Snapshot snapshot();
+
+// 作用域计时，析构时把经过的纳秒数记到 counter
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Counter counter) : m_counter(counter) { m_timer.start(); }
+    ~ScopedTimer() { add(m_counter, m_timer.nsecsElapsed()); }
+
+private:
+    Counter m_counter;
+    QElapsedTimer m_timer;
+};
+
+// 包在逐点画的 plot 回调（如 QPainter::drawPoint）外面数像素，析构时一次记入
+template <typename Plot>
+class CountedPlot {
+public:
+    CountedPlot(Counter counter, Plot &plot) : m_plot(plot), m_counter(counter) {}
+#if CANVAS_PERF_COUNTERS
+    ~CountedPlot() { if (m_count) add(m_counter, m_count); }
+    void operator()(int x, int y) { m_plot(x, y); ++m_count; }
+#else
+    void operator()(int x, int y) { m_plot(x, y); }
+#endif
+
+private:
+    Plot &m_plot;
+    Counter m_counter;
+#if CANVAS_PERF_COUNTERS
+    qint64 m_count = 0;
+#endif
+};
+
+} // namespace Perf
+} // namespace Raster
+
+#if CANVAS_PERF_COUNTERS
+#define CANVAS_PERF_ADD(counter, amount) ::Raster::Perf::add(::Raster::Perf::counter, (amount))
+#define CANVAS_PERF_TIMER(name, counter) ::Raster::Perf::ScopedTimer name(::Raster::Perf::counter)
+#else
+#define CANVAS_PERF_ADD(counter, amount) ((void)(amount))
+#define CANVAS_PERF_TIMER(name, counter) ((void)0)
+#endif
+
+#endif // PERFCOUNTERS_H
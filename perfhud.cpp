@@ -0,0 +1,63 @@
+#include "perfhud.h"
+#include <QFontDatabase>
+
+namespace PerfHud {
+
+static const int Margin = 8;
+static const int Padding = 6;
+
+QString formatNanos(qint64 nanos) {
+    return QString::number(nanos / 1e6, 'f', 2) + " ms";
+}
+
+QString formatBytes(qint64 bytes) {
+    if (bytes < 1024) return QString::number(bytes) + " B";
+    if (bytes < 1024 * 1024) return QString::number(bytes / 1024.0, 'f', 1) + " KB";
+    return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MB";
+}
+
+QString imageLine(const char *name, const QImage &image) {
+    if (image.isNull()) return QString("%1: -").arg(name);
+    QString line = QString("%1: %2x%3  %4").arg(name).arg(image.width()).arg(image.height())
+                       .arg(formatBytes(image.sizeInBytes()));
+    // 隐式共享的图像不另占内存
+    if (!image.isDetached()) line += "  (共享)";
+    return line;
+}
+
+QStringList rasterLines(const Raster::Perf::Snapshot &frame) {
+    using namespace Raster::Perf;
+    QStringList lines;
+    lines << QString("像素  %1 %2  %3 %4  %5 %6  %7 %8  %9 %10")
+                 .arg(counterName(BresenhamPixels)).arg(frame[BresenhamPixels])
+                 .arg(counterName(MidpointPixels)).arg(frame[MidpointPixels])
+                 .arg(counterName(ArcPixels)).arg(frame[ArcPixels])
+                 .arg(counterName(CirclePixels)).arg(frame[CirclePixels])
+                 .arg(counterName(WuPixels)).arg(frame[WuPixels]);
+    lines << QString("QPainter  %1").arg(frame[PainterCount]);
+    return lines;
+}
+
+QRect panelRect(const QFontMetrics &metrics, const QStringList &lines) {
+    int width = 0;
+    for (const QString &line : lines) width = qMax(width, metrics.horizontalAdvance(line));
+    return QRect(Margin, Margin, width + 2 * Padding, lines.size() * metrics.height() + 2 * Padding);
+}
+
+QRect draw(QPainter &painter, const QStringList &lines) {
+    painter.save();
+    painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    const QFontMetrics metrics = painter.fontMetrics();
+    const QRect panel = panelRect(metrics, lines);
+    painter.fillRect(panel, QColor(0, 0, 0, 160));
+    painter.setPen(QColor(120, 255, 120));
+    int y = panel.top() + Padding + metrics.ascent();
+    for (const QString &line : lines) {
+        painter.drawText(panel.left() + Padding, y, line);
+        y += metrics.height();
+    }
+    painter.restore();
+    return panel;
+}
+
+} // namespace PerfHud
@@ -0,0 +1,37 @@
+#ifndef PERFHUD_H
+#define PERFHUD_H
+
+#include <QPainter>
+#include <QStringList>
+#include "perfcounters.h"
+
+#if CANVAS_PERF_COUNTERS
+// 创建时记一次 QPainter 个数，其余与 QPainter 完全相同
+class PerfPainter : public QPainter {
+public:
+    explicit PerfPainter(QPaintDevice *device) : QPainter(device) {
+        CANVAS_PERF_ADD(PainterCount, 1);
+    }
+};
+#else
+typedef QPainter PerfPainter;
+#endif
+
+/**
+ * 性能面板：CanvasWidget 和 AnimationWindow 按 F3 开关，左上角显示上一帧的计数。
+ * 计数在 Raster::Perf 里按线程累加；这里只负责把两帧之间的增量排成文字画出来。
+ */
+namespace PerfHud {
+
+QString formatNanos(qint64 nanos);             // "1.23 ms"
+QString formatBytes(qint64 bytes);             // "12.0 MB"
+QString imageLine(const char *name, const QImage &image);   // 图像尺寸和占用，与别的图像共享数据时注明
+QStringList rasterLines(const Raster::Perf::Snapshot &frame);  // 各算法像素数和 QPainter 个数
+
+QRect panelRect(const QFontMetrics &metrics, const QStringList &lines);
+// 在 painter 当前设备的左上角画半透明面板；调用方先把变换复位
+QRect draw(QPainter &painter, const QStringList &lines);
+
+} // namespace PerfHud
+
+#endif // PERFHUD_H
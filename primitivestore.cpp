@@ -0,0 +1,427 @@
+#include "primitivestore.h"
+#include <QPolygon>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+namespace Raster {
+
+// 浮点范围向外取整到像素
+static QRect pixelBounds(double left, double top, double right, double bottom) {
+    return QRect(QPoint(int(std::floor(left)), int(std::floor(top))),
+                 QPoint(int(std::ceil(right)), int(std::ceil(bottom))));
+}
+
+static QRect circleBounds(QPointF center, double radius) {
+    const double r = qMax(0.0, radius);
+    return pixelBounds(center.x() - r, center.y() - r, center.x() + r, center.y() + r);
+}
+
+int PrimitiveStore::append(Kind kind, const Pen &pen, const QRect &shape) {
+    discardRedo();
+    const int index = size();
+    const int width = qMax(1, pen.width);
+    // 画笔宽度和反走样各留一圈余量
+    const int margin = width / 2 + 2;
+
+    m_kind.append(kind);
+    m_style.append(quint8(pen.style));
+    m_algorithm.append(quint8(pen.algorithm));
+    m_renderer.append(pen.renderer);
+    m_cap.append(quint8(pen.cap));
+    m_alive.append(true);
+    m_color.append(pen.color);
+    m_width.append(width);
+    m_p1.append(QPointF());
+    m_p2.append(QPointF());
+    m_radius.append(0);
+    m_startAngle.append(0);
+    m_endAngle.append(0);
+    m_pointOffset.append(m_points.size());
+    m_pointCount.append(0);
+    m_bounds.append(shape.adjusted(-margin, -margin, margin, margin));
+    m_layer.append(m_currentLayer);
+
+    ++m_aliveCount;
+    m_index.insert(index, m_bounds[index]);
+    record(index, false);
+    return index;
+}
+
+int PrimitiveStore::addLine(QPointF p1, QPointF p2, const Pen &pen) {
+    const int index = append(Line, pen, pixelBounds(qMin(p1.x(), p2.x()), qMin(p1.y(), p2.y()),
+                                                    qMax(p1.x(), p2.x()), qMax(p1.y(), p2.y())));
+    m_p1[index] = p1;
+    m_p2[index] = p2;
+    return index;
+}
+
+int PrimitiveStore::addCircle(QPointF center, double radius, const Pen &pen) {
+    const int index = append(Circle, pen, circleBounds(center, radius));
+    m_p1[index] = center;
+    m_radius[index] = float(radius);
+    return index;
+}
+
+int PrimitiveStore::addArc(QPointF center, double radius, double startAngle, double endAngle, const Pen &pen) {
+    // 包围盒取整圆，弧只占其中一部分
+    const int index = append(Arc, pen, circleBounds(center, radius));
+    m_p1[index] = center;
+    m_radius[index] = float(radius);
+    m_startAngle[index] = float(startAngle);
+    m_endAngle[index] = float(endAngle);
+    return index;
+}
+
+int PrimitiveStore::appendPoints(Kind kind, const QVector<QPoint> &points, const Pen &pen) {
+    // 贝塞尔曲线在控制多边形的凸包内，控制点的包围盒也就包住了曲线
+    const int index = append(kind, pen, QPolygon(points).boundingRect());
+    m_pointCount[index] = points.size();
+    m_points += points;
+    return index;
+}
+
+int PrimitiveStore::addBezier(const QVector<QPoint> &controlPoints, const Pen &pen) {
+    return appendPoints(Bezier, controlPoints, pen);
+}
+
+int PrimitiveStore::addPolygon(const QVector<QPoint> &points, const Pen &pen) {
+    return appendPoints(Polygon, points, pen);
+}
+
+int PrimitiveStore::addPolyline(const QVector<QPoint> &points, const Pen &pen) {
+    return appendPoints(Polyline, points, pen);
+}
+
+void PrimitiveStore::remove(int index) {
+    if (index < 0 || index >= size() || !m_alive[index]) return;
+    discardRedo();
+    setAlive(index, false);
+    record(index, true);
+}
+
+void PrimitiveStore::removeAll() {
+    for (int index = 0; index < size(); ++index) {
+        if (m_alive[index]) remove(index);
+    }
+}
+
+void PrimitiveStore::clear() {
+    m_kind.clear();
+    m_style.clear();
+    m_algorithm.clear();
+    m_renderer.clear();
+    m_cap.clear();
+    m_alive.clear();
+    m_color.clear();
+    m_width.clear();
+    m_p1.clear();
+    m_p2.clear();
+    m_radius.clear();
+    m_startAngle.clear();
+    m_endAngle.clear();
+    m_pointOffset.clear();
+    m_pointCount.clear();
+    m_bounds.clear();
+    m_layer.clear();
+    m_points.clear();
+    m_journal.clear();
+    m_revision = 0;
+    m_aliveCount = 0;
+    m_index.clear();
+}
+
+void PrimitiveStore::translate(QPoint delta) {
+    if (delta.isNull()) return;
+    const QPointF offset(delta);
+    for (int index = 0; index < size(); ++index) {
+        m_p1[index] += offset;
+        m_p2[index] += offset;
+        m_bounds[index].translate(delta);
+    }
+    for (QPoint &point : m_points) point += delta;
+    m_index.clear();
+    for (int index = 0; index < size(); ++index) {
+        if (m_alive[index]) m_index.insert(index, m_bounds[index]);
+    }
+}
+
+void PrimitiveStore::setLayer(int layer) {
+    m_currentLayer = layer;
+}
+
+void PrimitiveStore::setAlive(int index, bool alive) {
+    m_alive[index] = alive;
+    m_aliveCount += alive ? 1 : -1;
+    if (alive) {
+        m_index.insert(index, m_bounds[index]);
+    } else {
+        m_index.remove(index);
+    }
+}
+
+void PrimitiveStore::record(int index, bool removed) {
+    m_journal.append(index * 2 + (removed ? 1 : 0));
+    m_revision = m_journal.size();
+}
+
+void PrimitiveStore::setRevision(int revision) {
+    revision = qBound(0, revision, m_journal.size());
+    // 日志项：新增时 alive 置位，删除时清除；回退就反过来
+    while (m_revision > revision) {
+        const int entry = m_journal[--m_revision];
+        setAlive(entry >> 1, entry & 1);
+    }
+    while (m_revision < revision) {
+        const int entry = m_journal[m_revision++];
+        setAlive(entry >> 1, !(entry & 1));
+    }
+}
+
+void PrimitiveStore::discardRedo() {
+    if (m_revision == m_journal.size()) return;
+
+    // 记录按加入顺序追加，被丢弃的新增一定是末尾的一段；它们此时都已回退成未存活
+    int first = size();
+    for (int i = m_revision; i < m_journal.size(); ++i) {
+        if (!(m_journal[i] & 1)) first = qMin(first, m_journal[i] >> 1);
+    }
+    m_journal.resize(m_revision);
+    if (first == size()) return;
+
+    m_points.resize(m_pointOffset[first]);
+    m_kind.resize(first);
+    m_style.resize(first);
+    m_algorithm.resize(first);
+    m_renderer.resize(first);
+    m_cap.resize(first);
+    m_alive.resize(first);
+    m_color.resize(first);
+    m_width.resize(first);
+    m_p1.resize(first);
+    m_p2.resize(first);
+    m_radius.resize(first);
+    m_startAngle.resize(first);
+    m_endAngle.resize(first);
+    m_pointOffset.resize(first);
+    m_pointCount.resize(first);
+    m_bounds.resize(first);
+    m_layer.resize(first);
+}
+
+PrimitiveStore::Pen PrimitiveStore::pen(int index) const {
+    return { m_color[index], m_width[index], Qt::PenStyle(m_style[index]), LineAlgorithm(m_algorithm[index]),
+             Renderer(m_renderer[index]), Qt::PenCapStyle(m_cap[index]) };
+}
+
+QVector<QPoint> PrimitiveStore::pointList(int index) const {
+    const QPoint *first = points(index);
+    return QVector<QPoint>(first, first + pointCount(index));
+}
+
+QVector<int> PrimitiveStore::onLayer(QVector<int> indices) const {
+    indices.erase(std::remove_if(indices.begin(), indices.end(),
+                                 [this](int index) { return m_layer[index] != m_currentLayer; }),
+                  indices.end());
+    return indices;
+}
+
+QVector<int> PrimitiveStore::query(const QRect &rect) const {
+    return onLayer(m_index.query(rect));
+}
+
+QVector<int> PrimitiveStore::queryOutside(const QRect &rect) const {
+    return onLayer(m_index.queryOutside(rect));
+}
+
+QVector<int> PrimitiveStore::candidates(const QRect &area) const {
+    if (!area.isNull()) return query(area);
+    QVector<int> result;
+    for (int index = 0; index < size(); ++index) {
+        if (m_alive[index] && m_layer[index] == m_currentLayer) result.append(index);
+    }
+    return result;
+}
+
+QVector<QLine> PrimitiveStore::lines(const QRect &area) const {
+    QVector<QLine> result;
+    for (int index : candidates(area)) {
+        if (m_kind[index] == Line) {
+            result.append(QLine(m_p1[index].toPoint(), m_p2[index].toPoint()));
+        }
+    }
+    return result;
+}
+
+QVector<QVector<QPoint>> PrimitiveStore::polygons(const QRect &area) const {
+    QVector<QVector<QPoint>> result;
+    for (int index : candidates(area)) {
+        if (m_kind[index] == Polygon) {
+            result.append(pointList(index));
+        }
+    }
+    return result;
+}
+
+static double segmentDistance(QPointF point, QPointF a, QPointF b) {
+    const QPointF ab = b - a;
+    const double length2 = QPointF::dotProduct(ab, ab);
+    const double t = length2 > 0 ? qBound(0.0, QPointF::dotProduct(point - a, ab) / length2, 1.0) : 0.0;
+    const QPointF d = point - (a + ab * t);
+    return std::sqrt(QPointF::dotProduct(d, d));
+}
+
+static bool pathHits(const QVector<QPoint> &path, bool closed, QPointF point, double reach) {
+    const int edges = closed ? path.size() : path.size() - 1;
+    for (int k = 0; k < edges; ++k) {
+        if (segmentDistance(point, path[k], path[(k + 1) % path.size()]) <= reach) return true;
+    }
+    return path.size() == 1 && segmentDistance(point, path[0], path[0]) <= reach;
+}
+
+bool PrimitiveStore::hits(int index, QPointF point, double tolerance) const {
+    const double reach = m_width[index] / 2.0 + tolerance;
+    switch (m_kind[index]) {
+    case Line:
+        return segmentDistance(point, m_p1[index], m_p2[index]) <= reach;
+    case Circle:
+    case Arc: {
+        const QPointF d = point - m_p1[index];
+        if (qAbs(std::sqrt(QPointF::dotProduct(d, d)) - m_radius[index]) > reach) return false;
+        const double span = m_endAngle[index] - m_startAngle[index];
+        if (m_kind[index] == Circle || qAbs(span) >= 360.0) return true;
+        // 角度与绘制时一致：y 轴向上，逆时针为正
+        double angle = qRadiansToDegrees(std::atan2(-d.y(), d.x())) - m_startAngle[index];
+        angle = std::fmod(angle, 360.0);
+        if (angle < 0) angle += 360.0;
+        return span >= 0 ? angle <= span : angle >= 360.0 + span;
+    }
+    case Bezier:
+        return pathHits(bezierPolyline(pointList(index)), false, point, reach);
+    case Polygon:
+        return pathHits(pointList(index), true, point, reach);
+    case Polyline:
+        return pathHits(pointList(index), false, point, reach);
+    }
+    return false;
+}
+
+int PrimitiveStore::hitTest(QPointF point, double tolerance) const {
+    const int margin = int(std::ceil(tolerance));
+    const QRect area = QRect(point.toPoint(), QSize(1, 1)).adjusted(-margin, -margin, margin, margin);
+    const QVector<int> found = query(area);   // 别的层上的图元点不到
+    for (int k = found.size() - 1; k >= 0; --k) {
+        if (hits(found[k], point, tolerance)) return found[k];
+    }
+    return -1;
+}
+
+QVector<QPoint> PrimitiveStore::scaledPoints(int index, double scale) const {
+    QVector<QPoint> result(pointCount(index));
+    const QPoint *source = points(index);
+    for (int k = 0; k < result.size(); ++k) {
+        result[k] = (QPointF(source[k]) * scale).toPoint();
+    }
+    return result;
+}
+
+void PrimitiveStore::paint(QPainter &painter, int index, double scale) const {
+    painter.setRenderHint(QPainter::Antialiasing, m_renderer[index] == PainterAntialiased);
+    painter.setPen(QPen(QColor::fromRgba(m_color[index]), qMax(1, qRound(m_width[index] * scale)),
+                        Qt::PenStyle(m_style[index]), Qt::PenCapStyle(m_cap[index])));
+    switch (m_kind[index]) {
+    case Line:
+        painter.drawLine(QLineF(m_p1[index] * scale, m_p2[index] * scale));
+        break;
+    case Circle:
+        painter.drawEllipse(m_p1[index] * scale, m_radius[index] * scale, m_radius[index] * scale);
+        break;
+    case Arc:
+        break;   // 圆弧总是由自己的光栅化画，render() 不会交给这里
+    case Bezier: {
+        const QVector<QPoint> path = bezierPolyline(scaledPoints(index, scale));
+        painter.drawPolyline(path.constData(), path.size());
+        break;
+    }
+    case Polygon: {
+        const QVector<QPoint> path = scaledPoints(index, scale);
+        painter.drawPolygon(path.constData(), path.size());
+        break;
+    }
+    case Polyline: {
+        const QVector<QPoint> path = scaledPoints(index, scale);
+        painter.drawPolyline(path.constData(), path.size());
+        break;
+    }
+    }
+}
+
+QRect PrimitiveStore::render(QImage &image, double scale, TileRasterizer *rasterizer) const {
+    RasterBatch batch;
+    int batchStyle = -1;
+    int batchAlgorithm = -1;
+    QPainter painter;   // 连续的 QPainter 记录共用一个
+    QRect dirty;
+    auto flush = [&]() {
+        if (painter.isActive()) painter.end();
+        if (batch.isEmpty()) return;
+        const LineAlgorithm algorithm = LineAlgorithm(batchAlgorithm);
+        const Qt::PenStyle style = Qt::PenStyle(batchStyle);
+        dirty |= rasterizer ? rasterizer->draw(image, batch, algorithm, style)
+                            : drawBatch(image, batch, algorithm, style);
+        batch.clear();
+    };
+    auto addPath = [&](const QVector<QPoint> &path, QRgb color, int width) {
+        for (int k = 1; k < path.size(); ++k) {
+            batch.addLine(path[k - 1], path[k], color, width);
+        }
+    };
+
+    for (int index = 0; index < size(); ++index) {
+        if (!m_alive[index] || m_layer[index] != m_currentLayer) continue;
+        if (m_renderer[index] != Scanline && m_kind[index] != Arc) {
+            // 前面攒的一批先画完，保持加入顺序
+            if (!batch.isEmpty()) flush();
+            batchStyle = batchAlgorithm = -1;
+            if (!painter.isActive()) painter.begin(&image);
+            paint(painter, index, scale);
+            const QRect bounds = m_bounds[index];
+            dirty |= pixelBounds(bounds.left() * scale, bounds.top() * scale,
+                                 (bounds.right() + 1) * scale, (bounds.bottom() + 1) * scale);
+            continue;
+        }
+        if (m_style[index] != batchStyle || m_algorithm[index] != batchAlgorithm) {
+            flush();
+            batchStyle = m_style[index];
+            batchAlgorithm = m_algorithm[index];
+        }
+
+        const QRgb color = m_color[index];
+        const int width = qMax(1, qRound(m_width[index] * scale));
+        switch (m_kind[index]) {
+        case Line:
+            batch.addLine(m_p1[index] * scale, m_p2[index] * scale, color, width);
+            break;
+        case Circle:
+            batch.addCircle(m_p1[index] * scale, m_radius[index] * scale, color, width);
+            break;
+        case Arc:
+            batch.addArc(m_p1[index] * scale, m_radius[index] * scale, m_startAngle[index], m_endAngle[index],
+                         color, width);
+            break;
+        case Bezier:
+            addPath(bezierPolyline(scaledPoints(index, scale)), color, width);
+            break;
+        case Polygon:
+            batch.addPolygon(scaledPoints(index, scale), color, width);
+            break;
+        case Polyline:
+            addPath(scaledPoints(index, scale), color, width);
+            break;
+        }
+    }
+    flush();
+    return dirty.intersected(image.rect());
+}
+
+} // namespace Raster
@@ -0,0 +1,131 @@
+#ifndef PRIMITIVESTORE_H
+#define PRIMITIVESTORE_H
+
+#include <QImage>
+#include <QVector>
+#include <QPointF>
+#include <QPainter>
+#include "canvasraster.h"
+#include "rasterbatch.h"
+#include "spatialindex.h"
+
+namespace Raster {
+
+/**
+ * 保留模式的图元文档：每个提交到画布的图元记一条带类型的紧凑记录，
+ * 字段按列分开存放（结构数组），遍历某一列（类型、包围盒、颜色）时内存连续。
+ * 多点图元（贝塞尔控制点、多边形、自由笔迹）的顶点集中放在一个数组里，记录只存起点和个数。
+ *
+ * 删除只做标记，记录下标在 clear() 之外始终不变。每次增删都记入操作日志，
+ * revision() 是日志长度；setRevision() 可以回到任一之前的修订号（撤销）再前进（重做），
+ * 回退后再增删会丢弃后面的修订，以及只在那些修订里加入的记录。
+ * 存活的记录按包围盒登记在均匀网格里，框选、裁剪和点选只看网格给出的候选。
+ * 每条记录属于加入时的当前层（setLayer()）；查询、点选和重新光栅化都只看当前层的记录。
+ */
+class PrimitiveStore {
+public:
+    enum Kind : quint8 { Line, Circle, Arc, Bezier, Polygon, Polyline };
+    // 画上画布时走的路径，重新光栅化时照样走：自己的扫描线光栅化（按 algorithm），或 QPainter
+    enum Renderer : quint8 { Scanline, Painter, PainterAntialiased };
+
+    struct Pen {
+        QRgb color;
+        int width;
+        Qt::PenStyle style;
+        LineAlgorithm algorithm;
+        Renderer renderer = Scanline;
+        Qt::PenCapStyle cap = Qt::SquareCap;   // 只对 QPainter 有效
+    };
+
+    // 返回新记录的下标
+    int addLine(QPointF p1, QPointF p2, const Pen &pen);
+    int addCircle(QPointF center, double radius, const Pen &pen);
+    int addArc(QPointF center, double radius, double startAngle, double endAngle, const Pen &pen);
+    int addBezier(const QVector<QPoint> &controlPoints, const Pen &pen);
+    int addPolygon(const QVector<QPoint> &points, const Pen &pen);
+    int addPolyline(const QVector<QPoint> &points, const Pen &pen);   // 自由笔迹、橡皮擦轨迹
+    void remove(int index);
+    void removeAll();   // 删除所有存活的图元（可撤销）
+    void clear();       // 连同操作日志一起清空
+    void translate(QPoint delta);   // 所有记录（含已删除的）平移 delta，画布换了坐标原点时用；不记入日志
+
+    int layer() const { return m_currentLayer; }
+    void setLayer(int layer);   // 之后加入的记录属于 layer，查询也换到这一层
+
+    int revision() const { return m_revision; }
+    void setRevision(int revision);
+
+    int size() const { return m_kind.size(); }   // 记录总数，含已删除的
+    int count() const { return m_aliveCount; }
+    bool isAlive(int index) const { return m_alive[index]; }
+
+    Kind kind(int index) const { return Kind(m_kind[index]); }
+    Pen pen(int index) const;
+    QPointF p1(int index) const { return m_p1[index]; }       // Line 起点；Circle/Arc 圆心
+    QPointF p2(int index) const { return m_p2[index]; }       // Line 终点
+    double radius(int index) const { return m_radius[index]; }
+    double startAngle(int index) const { return m_startAngle[index]; }
+    double endAngle(int index) const { return m_endAngle[index]; }
+    const QPoint *points(int index) const { return m_points.constData() + m_pointOffset[index]; }
+    int pointCount(int index) const { return m_pointCount[index]; }
+    QVector<QPoint> pointList(int index) const;
+    QRect bounds(int index) const { return m_bounds[index]; }   // 影响的像素范围（含画笔宽度）
+    int layer(int index) const { return m_layer[index]; }
+
+    // 存活且包围盒与 area 相交的直线/多边形；area 为空矩形时返回全部
+    QVector<QLine> lines(const QRect &area = QRect()) const;
+    QVector<QVector<QPoint>> polygons(const QRect &area = QRect()) const;
+
+    QVector<int> query(const QRect &rect) const;          // 包围盒相交的存活记录，升序
+    QVector<int> queryOutside(const QRect &rect) const;   // 完全在 rect 外的
+    bool hits(int index, QPointF point, double tolerance) const;   // point 到图元笔画的距离不超过半个线宽 + tolerance
+    int hitTest(QPointF point, double tolerance = 2.0) const;      // 最上面（最后画）的命中记录，没有时返回 -1
+
+    /**
+     * 按加入顺序把当前层存活的图元重新光栅化到 image，坐标乘以 scale（用于按新缩放或导出尺寸重建）。
+     * 画笔样式和算法相同的连续图元合成一批；给出 rasterizer 时分块并行。
+     * 当初用 QPainter 画的记录（自由笔迹、多边形工具等）仍交给 QPainter。返回受影响区域。
+     */
+    QRect render(QImage &image, double scale = 1.0, TileRasterizer *rasterizer = nullptr) const;
+
+private:
+    int append(Kind kind, const Pen &pen, const QRect &shape);
+    int appendPoints(Kind kind, const QVector<QPoint> &points, const Pen &pen);
+    void setAlive(int index, bool alive);
+    void record(int index, bool removed);
+    QVector<int> candidates(const QRect &area) const;
+    QVector<int> onLayer(QVector<int> indices) const;   // 去掉不属于当前层的记录
+    void discardRedo();
+    QVector<QPoint> scaledPoints(int index, double scale) const;
+    void paint(QPainter &painter, int index, double scale) const;
+
+    // 每条记录一列
+    QVector<quint8> m_kind;
+    QVector<quint8> m_style;
+    QVector<quint8> m_algorithm;
+    QVector<quint8> m_renderer;
+    QVector<quint8> m_cap;
+    QVector<bool> m_alive;
+    QVector<QRgb> m_color;
+    QVector<int> m_width;
+    QVector<QPointF> m_p1;
+    QVector<QPointF> m_p2;
+    QVector<float> m_radius;
+    QVector<float> m_startAngle;
+    QVector<float> m_endAngle;
+    QVector<int> m_pointOffset;
+    QVector<int> m_pointCount;
+    QVector<QRect> m_bounds;
+    QVector<int> m_layer;
+
+    QVector<QPoint> m_points;   // 多点图元的顶点
+    QVector<int> m_journal;     // 下标 * 2 + (是否删除)
+    int m_revision = 0;         // [0, m_revision) 的日志已生效
+    int m_aliveCount = 0;
+    int m_currentLayer = 0;
+    SpatialGrid m_index;
+};
+
+} // namespace Raster
+
+#endif // PRIMITIVESTORE_H
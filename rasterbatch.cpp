@@ -0,0 +1,414 @@
+#include "rasterbatch.h"
+#include <atomic>
+#include <functional>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+namespace Raster {
+
+void RasterBatch::addLine(QPointF p1, QPointF p2, QRgb color, int width) {
+    Primitive primitive;
+    primitive.type = Primitive::Line;
+    primitive.color = color;
+    primitive.width = qMax(1, width);
+    primitive.p1 = p1;
+    primitive.p2 = p2;
+    m_primitives.append(primitive);
+}
+
+void RasterBatch::addCircle(QPointF center, double radius, QRgb color, int width) {
+    Primitive primitive;
+    primitive.type = Primitive::Circle;
+    primitive.color = color;
+    primitive.width = qMax(1, width);
+    primitive.p1 = center;
+    primitive.radius = radius;
+    m_primitives.append(primitive);
+}
+
+void RasterBatch::addArc(QPointF center, double radius, double startAngle, double endAngle, QRgb color, int width) {
+    Primitive primitive;
+    primitive.type = Primitive::Arc;
+    primitive.color = color;
+    primitive.width = qMax(1, width);
+    primitive.p1 = center;
+    primitive.radius = radius;
+    primitive.startAngle = startAngle;
+    primitive.endAngle = endAngle;
+    m_primitives.append(primitive);
+}
+
+void RasterBatch::addPolygon(const QVector<QPoint> &points, QRgb color, int width) {
+    if (points.isEmpty()) return;
+    Primitive primitive;
+    primitive.type = Primitive::Polygon;
+    primitive.color = color;
+    primitive.width = qMax(1, width);
+    primitive.pointOffset = m_points.size();
+    primitive.pointCount = points.size();
+    m_points += points;
+    m_primitives.append(primitive);
+}
+
+void RasterBatch::clear() {
+    m_primitives.resize(0);
+    m_points.resize(0);
+}
+
+// 浮点范围向外取整到像素
+static QRect pixelBounds(double left, double top, double right, double bottom) {
+    return QRect(QPoint(int(std::floor(left)), int(std::floor(top))),
+                 QPoint(int(std::ceil(right)), int(std::ceil(bottom))));
+}
+
+QRect RasterBatch::bounds(int index) const {
+    const Primitive &primitive = m_primitives[index];
+    QRect rect;
+    switch (primitive.type) {
+    case Primitive::Line:
+        rect = pixelBounds(qMin(primitive.p1.x(), primitive.p2.x()), qMin(primitive.p1.y(), primitive.p2.y()),
+                           qMax(primitive.p1.x(), primitive.p2.x()), qMax(primitive.p1.y(), primitive.p2.y()));
+        break;
+    case Primitive::Circle:
+    case Primitive::Arc: {
+        const double r = qMax(0.0, primitive.radius);
+        rect = pixelBounds(primitive.p1.x() - r, primitive.p1.y() - r, primitive.p1.x() + r, primitive.p1.y() + r);
+        break;
+    }
+    case Primitive::Polygon: {
+        const QPoint *points = m_points.constData() + primitive.pointOffset;
+        int left = points[0].x(), right = left;
+        int top = points[0].y(), bottom = top;
+        for (int i = 1; i < primitive.pointCount; ++i) {
+            left = qMin(left, points[i].x());
+            right = qMax(right, points[i].x());
+            top = qMin(top, points[i].y());
+            bottom = qMax(bottom, points[i].y());
+        }
+        rect = QRect(QPoint(left, top), QPoint(right, bottom));
+        break;
+    }
+    }
+    // 画笔方块的覆盖范围，与 SpanWriter 一致；再多留 1 像素给 Wu 的覆盖带
+    const int lo = (primitive.width - 1) / 2;
+    const int hi = primitive.width - 1 - lo;
+    return rect.adjusted(-lo - 1, -lo - 1, hi + 1, hi + 1);
+}
+
+// 直线上可能碰到 area 的步数范围 [first, last]（与 fixedLine 的步进一致，按主轴计数，共 steps + 1 步）。
+// 主轴坐标每步走 1，范围是精确的；次轴取的是直线在该列的精确值四舍五入，按多留 1 像素估计。
+// 估计偏大只会多走几步，落在 area 外的像素由写入器裁掉
+static bool lineStepRange(QPointF p1, QPointF p2, const QRect &area, int &first, int &last, int &steps) {
+    const bool steep = qAbs(toFixed(p2.y()) - toFixed(p1.y())) > qAbs(toFixed(p2.x()) - toFixed(p1.x()));
+    const double a1 = steep ? p1.y() : p1.x(), b1 = steep ? p1.x() : p1.y();
+    const double a2 = steep ? p2.y() : p2.x(), b2 = steep ? p2.x() : p2.y();
+    const int areaA0 = steep ? area.top() : area.left(), areaA1 = steep ? area.bottom() : area.right();
+    const int areaB0 = steep ? area.left() : area.top(), areaB1 = steep ? area.right() : area.bottom();
+
+    const int a0 = fixedRound(toFixed(a1));   // 第 0 步的主轴坐标
+    const int sa = a2 > a1 ? 1 : -1;
+    steps = qAbs(fixedRound(toFixed(a2)) - a0);
+    qint64 lo = sa > 0 ? areaA0 - a0 : a0 - areaA1;
+    qint64 hi = sa > 0 ? areaA1 - a0 : a0 - areaA0;
+
+    if (a1 == a2 || b1 == b2) {
+        if (b1 < areaB0 - 1 || b1 > areaB1 + 1) return false;
+    } else {
+        // 直线在次轴上进入、离开 [B0 - 1, B1 + 1] 时的主轴坐标，换成步数
+        const double g = (b2 - b1) / (a2 - a1);
+        double ka = (a1 + (areaB0 - 1 - b1) / g - a0) * sa;
+        double kb = (a1 + (areaB1 + 1 - b1) / g - a0) * sa;
+        if (ka > kb) std::swap(ka, kb);
+        lo = qMax(lo, qint64(std::floor(qBound(-1e9, ka, 1e9))) - 1);
+        hi = qMin(hi, qint64(std::ceil(qBound(-1e9, kb, 1e9))) + 1);
+    }
+    lo = qMax<qint64>(lo, 0);
+    hi = qMin<qint64>(hi, steps);
+    if (lo > hi) return false;
+    first = int(lo);
+    last = int(hi);
+    return true;
+}
+
+// 用同一个写入器画一条线；Wu 算法直接混合覆盖率，不经过写入器。
+// 两种都只走经过 clip 的那一段，分块时每块的代价与块内的长度成正比，而不是整条线
+static void rasterizeLine(QImage &image, SpanWriter &writer, QPointF p1, QPointF p2,
+                          const Primitive &primitive, const QRect &clip,
+                          LineAlgorithm algorithm, Qt::PenStyle style) {
+    switch (algorithm) {
+    case Bresenham:
+    case Midpoint: {
+        // 两种算法的整数步进结果相同，亚像素端点统一用定点中点判别式；
+        // 像素画成画笔方块，离 clip 不到一个画笔宽度的步也要走
+        int first = 0, last = 0, steps = 0;
+        const QRect reach = clip.adjusted(-primitive.width, -primitive.width, primitive.width, primitive.width);
+        const bool inside = lineStepRange(p1, p2, reach, first, last, steps);
+        // 跳过的步都画不到 clip 里；在跳过处断开写入器的段，前后的像素不会互相合并或去重
+        if (!inside || first > 0) writer.flush();
+        if (inside) {
+            drawFixedLine(writer, p1, p2, style, first, last);
+            if (last < steps) writer.flush();
+        }
+        break;
+    }
+    case Wu:
+        writer.flush();
+        drawWuLine(image, p1, p2, primitive.color, primitive.width, style, clip);
+        break;
+    }
+}
+
+// 每个图元开始前 setPen 会 flush，保证段不会跨图元合并，分块与不分块的写入序列一致
+static void rasterize(QImage &image, SpanWriter &writer, const RasterBatch &batch, int index,
+                      const QRect &clip, LineAlgorithm algorithm, Qt::PenStyle style) {
+    const Primitive &primitive = batch.at(index);
+    writer.setPen(primitive.color, primitive.width);
+
+    switch (primitive.type) {
+    case Primitive::Line:
+        rasterizeLine(image, writer, primitive.p1, primitive.p2, primitive, clip, algorithm, style);
+        break;
+    case Primitive::Circle:
+        if (fixedIsIntegral(toFixed(primitive.p1.x())) && fixedIsIntegral(toFixed(primitive.p1.y()))
+            && fixedIsIntegral(toFixed(primitive.radius))) {
+            drawBresenhamCircle(writer, primitive.p1.toPoint(), qRound(primitive.radius), style);
+        } else {
+            drawFixedArc(writer, primitive.p1, primitive.radius, 0, 0, true, style);
+        }
+        break;
+    case Primitive::Arc:
+        drawFixedArc(writer, primitive.p1, primitive.radius, primitive.startAngle, primitive.endAngle,
+                     qAbs(primitive.endAngle - primitive.startAngle) >= 360.0, style);
+        break;
+    case Primitive::Polygon: {
+        const QPoint *points = batch.points().constData() + primitive.pointOffset;
+        for (int i = 0; i < primitive.pointCount; ++i) {
+            rasterizeLine(image, writer, points[i], points[(i + 1) % primitive.pointCount],
+                          primitive, clip, algorithm, style);
+        }
+        break;
+    }
+    }
+    writer.flush();
+}
+
+void drawPrimitive(QImage &image, const RasterBatch &batch, int index, const QRect &clip,
+                   LineAlgorithm algorithm, Qt::PenStyle style) {
+    const QRect bounds = clip.intersected(image.rect());
+    if (bounds.isEmpty()) return;
+
+    SpanWriter writer(image, Qt::black);
+    writer.setClipRect(bounds);
+    rasterize(image, writer, batch, index, bounds, algorithm, style);
+}
+
+QRect drawBatch(QImage &image, const RasterBatch &batch, LineAlgorithm algorithm, Qt::PenStyle style) {
+    QRect dirty;
+    const QRect imageRect = image.rect();
+    SpanWriter writer(image, Qt::black);
+
+    for (int i = 0; i < batch.size(); ++i) {
+        const QRect bounds = batch.bounds(i).intersected(imageRect);
+        if (bounds.isEmpty()) continue;
+        rasterize(image, writer, batch, i, imageRect, algorithm, style);
+        dirty |= bounds;
+    }
+    return dirty;
+}
+
+TileRasterizer::TileRasterizer(int tileSize) :
+    m_tileSize(qMax(8, tileSize))
+{
+}
+
+TileRasterizer::~TileRasterizer() {
+    m_pool.waitForDone();
+}
+
+void TileRasterizer::setMaxThreadCount(int count) {
+    m_pool.setMaxThreadCount(qMax(1, count));
+}
+
+// 图元大约要走多少步，乘以画笔宽度估计写入的像素数
+static qint64 estimatedPixels(const RasterBatch &batch, int index) {
+    const Primitive &primitive = batch.at(index);
+    auto length = [](QPointF p1, QPointF p2) {
+        return qint64(qMax(qAbs(p2.x() - p1.x()), qAbs(p2.y() - p1.y()))) + 1;
+    };
+    qint64 steps = 0;
+    switch (primitive.type) {
+    case Primitive::Line:
+        steps = length(primitive.p1, primitive.p2);
+        break;
+    case Primitive::Circle:
+    case Primitive::Arc:
+        steps = qint64(7 * qMax(0.0, primitive.radius)) + 1;
+        break;
+    case Primitive::Polygon: {
+        const QPoint *points = batch.points().constData() + primitive.pointOffset;
+        for (int i = 0; i < primitive.pointCount; ++i) {
+            steps += length(points[i], points[(i + 1) % primitive.pointCount]);
+        }
+        break;
+    }
+    }
+    return steps * primitive.width;
+}
+
+// 线段（含画笔宽度）经过的块：逐个块行求出线段在这一行里的 x 范围，只标记这些块，
+// 而不是包围盒里的全部块。mark 可能对同一块调用多次
+template <typename Mark>
+static void forEachTileOnSegment(QPointF p1, QPointF p2, int margin, int tileSize, const QRect &imageRect, Mark mark) {
+    const double top = qMax(double(imageRect.top()), qMin(p1.y(), p2.y()) - margin);
+    const double bottom = qMin(double(imageRect.bottom()), qMax(p1.y(), p2.y()) + margin);
+    if (top > bottom) return;
+    const double dy = p2.y() - p1.y();
+    for (int ty = int(top) / tileSize; ty <= int(bottom) / tileSize; ++ty) {
+        double xa = qMin(p1.x(), p2.x()), xb = qMax(p1.x(), p2.x());
+        if (dy != 0.0) {
+            // 线段进入、离开这一行（上下各放宽 margin）时的参数
+            double ta = (ty * tileSize - margin - p1.y()) / dy;
+            double tb = ((ty + 1) * tileSize + margin - p1.y()) / dy;
+            if (ta > tb) std::swap(ta, tb);
+            ta = qBound(0.0, ta, 1.0);
+            tb = qBound(0.0, tb, 1.0);
+            const double x1 = p1.x() + (p2.x() - p1.x()) * ta;
+            const double x2 = p1.x() + (p2.x() - p1.x()) * tb;
+            xa = qMin(x1, x2);
+            xb = qMax(x1, x2);
+        }
+        const int left = int(qMax(double(imageRect.left()), std::floor(xa) - margin));
+        const int right = int(qMin(double(imageRect.right()), std::ceil(xb) + margin));
+        for (int tx = left / tileSize; tx <= right / tileSize && left <= right; ++tx) {
+            mark(tx, ty);
+        }
+    }
+}
+
+// 整批估计写入的像素数低于这个值时不分块
+static const qint64 ParallelMinPixels = 32 * 1024;
+// 圆和圆弧的包围盒跨过的块数超过这个值时单独顺序画
+static const int ArcReplayMaxTiles = 4;
+
+QRect TileRasterizer::draw(QImage &image, const RasterBatch &batch, LineAlgorithm algorithm, Qt::PenStyle style) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    const QRect imageRect = image.rect();
+    if (batch.isEmpty() || imageRect.isEmpty()) return QRect();
+
+    // 工作量太小时（例如松开鼠标时提交的一笔）线程调度比光栅化本身还贵，直接顺序画
+    qint64 pixels = 0;
+    for (int i = 0; i < batch.size(); ++i) {
+        pixels += estimatedPixels(batch, i);
+    }
+    if (pixels < ParallelMinPixels || m_pool.maxThreadCount() <= 1) {
+        return drawBatch(image, batch, algorithm, style);
+    }
+
+    // 圆和圆弧的步进不能从中间开始，跨很多块的大圆每块都要从头走一遍，不如整个顺序画：
+    // 在它前后把批次分段，各段分块并行，保持加入顺序
+    auto wideArc = [&](int index) {
+        const Primitive::Type type = batch.at(index).type;
+        if (type != Primitive::Circle && type != Primitive::Arc) return false;
+        const QRect bounds = batch.bounds(index).intersected(imageRect);
+        if (bounds.isEmpty()) return false;
+        const int tiles = (bounds.right() / m_tileSize - bounds.left() / m_tileSize + 1)
+                          * (bounds.bottom() / m_tileSize - bounds.top() / m_tileSize + 1);
+        return tiles > ArcReplayMaxTiles;
+    };
+
+    QRect dirty;
+    for (int begin = 0; begin < batch.size();) {
+        int end = begin;
+        while (end < batch.size() && !wideArc(end)) ++end;
+        dirty |= drawTiles(image, batch, begin, end, algorithm, style);
+        if (end < batch.size()) {
+            drawPrimitive(image, batch, end, imageRect, algorithm, style);
+            dirty |= batch.bounds(end).intersected(imageRect);
+        }
+        begin = end + 1;
+    }
+    return dirty;
+}
+
+QRect TileRasterizer::drawTiles(QImage &image, const RasterBatch &batch, int begin, int end,
+                                LineAlgorithm algorithm, Qt::PenStyle style) {
+    const QRect imageRect = image.rect();
+    const int tilesX = (imageRect.width() + m_tileSize - 1) / m_tileSize;
+    const int tilesY = (imageRect.height() + m_tileSize - 1) / m_tileSize;
+    m_bins.resize(tilesX * tilesY);
+    for (QVector<int> &bin : m_bins) bin.resize(0);
+
+    // 分箱：按加入顺序遍历，每个块内的下标天然保持绘制顺序。
+    // 线段和多边形的边只进它们经过的块，其余图元按包围盒
+    QRect dirty;
+    for (int i = begin; i < end; ++i) {
+        const QRect bounds = batch.bounds(i).intersected(imageRect);
+        if (bounds.isEmpty()) continue;
+        dirty |= bounds;
+        auto mark = [&](int tx, int ty) {
+            QVector<int> &bin = m_bins[ty * tilesX + tx];
+            if (bin.isEmpty() || bin.last() != i) bin.append(i);
+        };
+        const Primitive &primitive = batch.at(i);
+        const int margin = primitive.width + 1;
+        if (primitive.type == Primitive::Line) {
+            forEachTileOnSegment(primitive.p1, primitive.p2, margin, m_tileSize, imageRect, mark);
+        } else if (primitive.type == Primitive::Polygon) {
+            const QPoint *points = batch.points().constData() + primitive.pointOffset;
+            for (int k = 0; k < primitive.pointCount; ++k) {
+                forEachTileOnSegment(points[k], points[(k + 1) % primitive.pointCount], margin, m_tileSize,
+                                     imageRect, mark);
+            }
+        } else {
+            for (int ty = bounds.top() / m_tileSize; ty <= bounds.bottom() / m_tileSize; ++ty) {
+                for (int tx = bounds.left() / m_tileSize; tx <= bounds.right() / m_tileSize; ++tx) {
+                    mark(tx, ty);
+                }
+            }
+        }
+    }
+
+    QVector<int> work;
+    for (int tile = 0; tile < m_bins.size(); ++tile) {
+        if (!m_bins[tile].isEmpty()) work.append(tile);
+    }
+    if (work.size() < 2) {
+        for (int i = begin; i < end; ++i) {
+            drawPrimitive(image, batch, i, imageRect, algorithm, style);
+        }
+        return dirty;
+    }
+
+    // 在调用线程里 detach 一次，工作线程各自用不持有数据的 QImage 包装同一块缓冲
+    uchar *bits = image.bits();
+    const int width = image.width();
+    const int height = image.height();
+    const qsizetype stride = image.bytesPerLine();
+    const QImage::Format format = image.format();
+
+    std::atomic<int> next(0);
+    std::function<void()> worker = [&]() {
+        QImage view(bits, width, height, stride, format);
+        SpanWriter writer(view, Qt::black);
+        for (int k = next.fetch_add(1); k < work.size(); k = next.fetch_add(1)) {
+            const int tile = work[k];
+            const QRect tileRect = QRect((tile % tilesX) * m_tileSize, (tile / tilesX) * m_tileSize,
+                                         m_tileSize, m_tileSize).intersected(imageRect);
+            writer.setClipRect(tileRect);
+            for (int index : m_bins[tile]) {
+                rasterize(view, writer, batch, index, tileRect, algorithm, style);
+            }
+        }
+    };
+
+    const int helpers = qMin(m_pool.maxThreadCount(), int(work.size())) - 1;
+    for (int i = 0; i < helpers; ++i) {
+        m_pool.start(worker);
+    }
+    worker(); // 调用线程也参与
+    m_pool.waitForDone();
+    return dirty;
+}
+
+} // namespace Raster
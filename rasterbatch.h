@@ -0,0 +1,84 @@
+#ifndef RASTERBATCH_H
+#define RASTERBATCH_H
+
+#include <QImage>
+#include <QVector>
+#include <QPointF>
+#include <QThreadPool>
+#include "canvasraster.h"
+
+namespace Raster {
+
+// 批量图元：线段、圆、圆弧、多边形轮廓，按加入顺序光栅化。
+// 坐标是整数时走整数算法，带小数时走 24.8 定点亚像素算法
+struct Primitive {
+    enum Type { Line, Circle, Arc, Polygon };
+
+    Type type;
+    QRgb color;
+    int width;
+    QPointF p1;             // Line 起点；Circle/Arc 圆心（可为亚像素坐标）
+    QPointF p2;             // Line 终点
+    double radius = 0;
+    double startAngle = 0;  // Arc 角度（度）
+    double endAngle = 0;
+    int pointOffset = 0;    // Polygon 顶点在 RasterBatch::points() 中的位置
+    int pointCount = 0;
+};
+
+class RasterBatch {
+public:
+    void addLine(QPointF p1, QPointF p2, QRgb color, int width);
+    void addCircle(QPointF center, double radius, QRgb color, int width);
+    void addArc(QPointF center, double radius, double startAngle, double endAngle, QRgb color, int width);
+    void addPolygon(const QVector<QPoint> &points, QRgb color, int width);
+    void clear();   // 保留容量，便于每帧复用
+
+    int size() const { return m_primitives.size(); }
+    bool isEmpty() const { return m_primitives.isEmpty(); }
+    const Primitive &at(int index) const { return m_primitives[index]; }
+    const QVector<QPoint> &points() const { return m_points; }
+    QRect bounds(int index) const;   // 图元影响的像素范围（含画笔宽度）
+
+private:
+    QVector<Primitive> m_primitives;
+    QVector<QPoint> m_points;
+};
+
+// 光栅化单个图元，只写 clip 范围内的像素（clip 之外的结果与未裁剪时逐像素一致）
+void drawPrimitive(QImage &image, const RasterBatch &batch, int index, const QRect &clip,
+                   LineAlgorithm algorithm, Qt::PenStyle style);
+
+// 顺序光栅化整批图元，返回受影响区域
+QRect drawBatch(QImage &image, const RasterBatch &batch, LineAlgorithm algorithm, Qt::PenStyle style);
+
+/**
+ * 分块并行光栅化：先把图元分到它经过的 tileSize×tileSize 屏幕块（线段按实际经过的块，其余按包围盒），
+ * 每块在线程池里按加入顺序只绘制落在本块内的像素；直线只从进入本块的那一步走到离开的那一步。
+ * 工作量小的批次直接顺序画，跨很多块的圆和圆弧在批次中间单独顺序画。
+ * 块之间互不重叠，结果与 drawBatch 逐像素相同。
+ */
+class TileRasterizer {
+public:
+    explicit TileRasterizer(int tileSize = 64);
+    ~TileRasterizer();
+
+    QRect draw(QImage &image, const RasterBatch &batch, LineAlgorithm algorithm, Qt::PenStyle style);
+
+    void setMaxThreadCount(int count);
+    int maxThreadCount() const { return m_pool.maxThreadCount(); }
+    int tileSize() const { return m_tileSize; }
+
+private:
+    // 分块画第 begin..end-1 个图元
+    QRect drawTiles(QImage &image, const RasterBatch &batch, int begin, int end,
+                    LineAlgorithm algorithm, Qt::PenStyle style);
+
+    QThreadPool m_pool;
+    int m_tileSize;
+    QVector<QVector<int>> m_bins;   // 每个块内的图元下标（复用内存）
+};
+
+} // namespace Raster
+
+#endif // RASTERBATCH_H
@@ -0,0 +1,99 @@
+#include "renderthread.h"
+
+namespace Raster {
+
+RenderThread::RenderThread()
+{
+}
+
+RenderThread::~RenderThread() {
+    if (!m_thread) return;
+    // 多放一个信号量计数而不入队：渲染线程把前面的命令做完后取不到条目，就此退出
+    m_pending.release();
+    m_thread->wait();
+}
+
+void RenderThread::push(Item &item) {
+    if (!m_thread) {
+        m_thread.reset(QThread::create([this] { run(); }));
+        m_thread->start();
+    }
+    // 队列满时等渲染线程腾出位置，只有短时间内投递大量命令时才会发生
+    while (!m_queue.push(item)) {
+        QThread::yieldCurrentThread();
+    }
+    m_pending.release();
+}
+
+quint64 RenderThread::post(const QImage &base, Command command) {
+    Item item;
+    item.base = base;
+    item.command = std::move(command);
+    item.sequence = ++m_posted;
+    push(item);
+    return item.sequence;
+}
+
+void RenderThread::release() {
+    if (!m_thread) return;
+    Item item;
+    push(item);
+}
+
+bool RenderThread::takeFrame(Frame &frame) {
+    if (!(m_middle.load(std::memory_order_acquire) & FreshBit)) return false;
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+    frame = std::move(m_slots[m_front]);
+    m_slots[m_front] = Frame();
+    return true;
+}
+
+void RenderThread::waitFor(quint64 sequence) {
+    QMutexLocker locker(&m_waitMutex);
+    while (m_completed.load(std::memory_order_acquire) < sequence) {
+        m_done.wait(&m_waitMutex);
+    }
+}
+
+void RenderThread::publish(const Frame &frame) {
+    m_slots[m_back] = frame;
+    m_back = m_middle.exchange(m_back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+    // 换回来的槽要么已被界面线程取走，要么是没来得及取、已被新帧取代的旧帧
+    m_slots[m_back] = Frame();
+}
+
+void RenderThread::run() {
+    for (;;) {
+        m_pending.acquire();
+        Item item;
+        if (!m_queue.pop(item)) break;   // 析构时的叫醒
+
+        if (!item.command) {
+            // 一批结束：画布已交给界面线程，这边不再持有，界面线程改写时不必复制
+            m_image = QImage();
+            m_dirty = QRect();
+            continue;
+        }
+        if (!item.base.isNull()) {
+            m_image = item.base;
+            m_dirty = QRect();
+        }
+        item.base = QImage();
+        m_dirty |= item.command(m_image);
+        item.command = nullptr;   // 捕获的图像等数据在这里释放
+
+        Frame frame;
+        frame.image = m_image;
+        frame.dirty = m_dirty;
+        frame.sequence = item.sequence;
+        publish(frame);
+        {
+            QMutexLocker locker(&m_waitMutex);
+            m_completed.store(item.sequence, std::memory_order_release);
+            m_done.wakeAll();
+        }
+        if (m_frameReady) m_frameReady();
+    }
+}
+
+} // namespace Raster
@@ -0,0 +1,115 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QImage>
+#include <QThread>
+#include <QSemaphore>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QScopedPointer>
+#include <atomic>
+#include <functional>
+#include <utility>
+
+namespace Raster {
+
+/**
+ * 单生产者单消费者的无锁环形队列，容量为 Capacity（2 的幂）。
+ * push() 只能在一个线程里调用，pop() 只能在另一个线程里调用；队列满时 push() 返回 false，value 不动。
+ */
+template <typename T, int Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(T &value) {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == quint32(Capacity)) return false;
+        m_items[tail & (Capacity - 1)] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return false;
+        value = std::move(m_items[head & (Capacity - 1)]);
+        m_items[head & (Capacity - 1)] = T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T m_items[Capacity];
+    alignas(64) std::atomic<quint32> m_head{0};   // 消费者写
+    alignas(64) std::atomic<quint32> m_tail{0};   // 生产者写
+};
+
+/**
+ * 专门的渲染线程：界面线程把耗时的整幅改写（旋转提交、平滑缩放、曲线提交等）作为命令投进无锁队列，
+ * 渲染线程按顺序在自己持有的画布上执行，每执行完一条就发布一帧。
+ * 帧通过三缓冲交换：渲染线程写后台槽，与中间槽原子交换；界面线程需要时把中间槽换到前台，
+ * 双方各自只碰自己手里的槽，不加锁，也不会因为对方慢而等待。
+ *
+ * 一批命令的第一条带上当前画布（隐式共享，渲染线程第一次写入时才复制），后续命令接着上一条的结果做；
+ * 每帧的改动区域是这一批从开始累计的，界面线程跳过中间帧也不会漏掉改动。
+ * 命令在渲染线程上运行，只能使用按值捕获的数据。
+ */
+class RenderThread {
+public:
+    typedef std::function<QRect(QImage &)> Command;   // 改写画布，返回改动区域
+
+    struct Frame {
+        QImage image;
+        QRect dirty;            // 这一批命令到这一帧为止改动的区域
+        quint64 sequence = 0;   // 这一帧对应的最后一条命令
+    };
+
+    RenderThread();
+    ~RenderThread();   // 执行完已投递的命令后退出
+
+    // 每发布一帧在渲染线程上调用一次，通常用来把"有新帧"转给界面线程；第一次投递之前设置
+    void setFrameReady(std::function<void()> callback) { m_frameReady = std::move(callback); }
+
+    quint64 post(const QImage &base, Command command);   // base 非空时从它开始新的一批；返回命令序号
+    void release();                     // 一批结束、帧已取走后调用：渲染线程放掉对画布的引用
+    bool takeFrame(Frame &frame);       // 取最新发布的一帧，没有新帧时返回 false
+    void waitFor(quint64 sequence);     // 等到这条命令执行完并发布
+    quint64 completed() const { return m_completed.load(std::memory_order_acquire); }
+
+private:
+    struct Item {
+        QImage base;
+        Command command;        // 为空表示 release
+        quint64 sequence = 0;
+    };
+    enum { FreshBit = 4, IndexMask = 3 };
+
+    void run();
+    void push(Item &item);
+    void publish(const Frame &frame);
+
+    SpscQueue<Item, 64> m_queue;
+    QSemaphore m_pending;               // 队列里的条目数，渲染线程没事时睡在这里
+    QScopedPointer<QThread> m_thread;   // 第一次投递时才启动
+    std::function<void()> m_frameReady;
+    quint64 m_posted = 0;               // 界面线程
+
+    // 三缓冲：m_back 只归渲染线程，m_front 只归界面线程，m_middle 是两者交换的槽（带"新帧"标记）
+    Frame m_slots[3];
+    int m_back = 0;
+    int m_front = 1;
+    std::atomic<int> m_middle{2};
+
+    // 渲染线程的画布
+    QImage m_image;
+    QRect m_dirty;
+
+    std::atomic<quint64> m_completed{0};
+    QMutex m_waitMutex;                 // 只在 waitFor() 等待时使用
+    QWaitCondition m_done;
+};
+
+} // namespace Raster
+
+#endif // RENDERTHREAD_H
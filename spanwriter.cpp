@@ -0,0 +1,159 @@
+#include "spanwriter.h"
+#include <algorithm>
+
+// 非预乘 ARGB 的 SourceOver 混合
+static inline QRgb blendSourceOver(QRgb dst, QRgb src) {
+    const int sa = qAlpha(src);
+    const int da = qAlpha(dst);
+    const int oa = sa * 255 + da * (255 - sa);  // 输出 alpha ×255
+    if (oa == 0) return 0;
+
+    auto channel = [&](int s, int d) {
+        return (s * sa * 255 + d * da * (255 - sa) + oa / 2) / oa;
+    };
+    return qRgba(channel(qRed(src), qRed(dst)),
+                 channel(qGreen(src), qGreen(dst)),
+                 channel(qBlue(src), qBlue(dst)),
+                 (oa + 127) / 255);
+}
+
+SpanWriter::SpanWriter(QImage &image, const QColor &color, int width) :
+    m_image(image),
+    m_bits(image.bits()),
+    m_stride(image.bytesPerLine()),
+    m_color(color.rgba()),
+    m_opaque(color.alpha() == 255),
+    m_lo((qMax(1, width) - 1) / 2),
+    m_hi(qMax(1, width) - 1 - (qMax(1, width) - 1) / 2),
+    m_clip(image.rect())
+{
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+}
+
+SpanWriter::~SpanWriter() {
+    flush();
+#if CANVAS_PERF_COUNTERS
+    publish();
+#endif
+}
+
+void SpanWriter::setCounter(Raster::Perf::Counter counter) {
+#if CANVAS_PERF_COUNTERS
+    if (counter == m_counter) return;
+    // 还没写出的段算到新的一项里，只在换算法的交界处差几个像素
+    publish();
+    m_counter = counter;
+#else
+    Q_UNUSED(counter);
+#endif
+}
+
+#if CANVAS_PERF_COUNTERS
+void SpanWriter::publish() {
+    if (m_written == 0) return;
+    Raster::Perf::add(m_counter, m_written);
+    m_written = 0;
+}
+#endif
+
+void SpanWriter::setClipRect(const QRect &rect) {
+    flush();
+    m_clip = rect.intersected(m_image.rect());
+}
+
+void SpanWriter::setPen(QRgb color, int width) {
+    flush();
+    width = qMax(1, width);
+    m_color = color;
+    m_opaque = qAlpha(color) == 255;
+    m_lo = (width - 1) / 2;
+    m_hi = width - 1 - m_lo;
+    m_covered.clear();
+}
+
+void SpanWriter::plot(int x, int y) {
+    if (m_hasRun) {
+        // 与上一个像素重合（如圆弧八分对称的重复点、多边形相邻两边共用的顶点），跳过以免半透明色重复混合。
+        // 只看上一个像素而不看整段：分块时各块只走经过本块的那几步，结果仍与整条走完一致
+        if (x == m_lastX && y == m_lastY) return;
+        m_lastX = x;
+        m_lastY = y;
+
+        if (m_runY0 == m_runY1 && y == m_runY0) {
+            if (x == m_runX1 + 1) { m_runX1 = x; return; }
+            if (x == m_runX0 - 1) { m_runX0 = x; return; }
+        }
+        if (m_runX0 == m_runX1 && x == m_runX0) {
+            if (y == m_runY1 + 1) { m_runY1 = y; return; }
+            if (y == m_runY0 - 1) { m_runY0 = y; return; }
+        }
+        flush();
+    }
+    m_hasRun = true;
+    m_runX0 = m_runX1 = m_lastX = x;
+    m_runY0 = m_runY1 = m_lastY = y;
+}
+
+void SpanWriter::flush() {
+    if (!m_hasRun) return;
+    m_hasRun = false;
+    fillRect(m_runX0 - m_lo, m_runY0 - m_lo, m_runX1 + m_hi, m_runY1 + m_hi);
+}
+
+void SpanWriter::fillRect(int x0, int y0, int x1, int y1) {
+    y0 = qMax(y0, m_clip.top());
+    y1 = qMin(y1, m_clip.bottom());
+    for (int y = y0; y <= y1; ++y) {
+        // 不透明时重叠处写两次结果也一样
+        if (m_opaque) {
+            fillSpan(y, x0, x1);
+        } else {
+            fillUncovered(y, x0, x1);
+        }
+    }
+}
+
+void SpanWriter::fillUncovered(int y, int x0, int x1) {
+    QVector<int> &row = m_covered[y];
+    // 完全在左边的区间跳过；之后与 [x0, x1] 相交或相邻的区间之间的空隙写出，这些区间合并成一个
+    int first = 0;
+    while (first < row.size() && row[first + 1] < x0 - 1) first += 2;
+    int x = x0;   // [x0, x1] 里还没处理的部分从 x 开始
+    int lo = x0, hi = x1;
+    int last = first;
+    for (; last < row.size() && row[last] <= x1 + 1; last += 2) {
+        if (row[last] > x) fillSpan(y, x, row[last] - 1);
+        x = qMax(x, row[last + 1] + 1);
+        lo = qMin(lo, row[last]);
+        hi = qMax(hi, row[last + 1]);
+    }
+    if (x <= x1) fillSpan(y, x, x1);
+
+    if (last == first) {
+        row.insert(first, hi);
+        row.insert(first, lo);
+    } else {
+        row[first] = lo;
+        row[first + 1] = hi;
+        row.remove(first + 2, last - first - 2);
+    }
+}
+
+void SpanWriter::fillSpan(int y, int x0, int x1) {
+    if (y < m_clip.top() || y > m_clip.bottom()) return;
+    x0 = qMax(x0, m_clip.left());
+    x1 = qMin(x1, m_clip.right());
+    if (x0 > x1) return;
+#if CANVAS_PERF_COUNTERS
+    m_written += x1 - x0 + 1;
+#endif
+
+    QRgb *line = reinterpret_cast<QRgb *>(m_bits + y * m_stride);
+    if (m_opaque) {
+        std::fill(line + x0, line + x1 + 1, m_color);
+    } else {
+        for (int x = x0; x <= x1; ++x) {
+            line[x] = blendSourceOver(line[x], m_color);
+        }
+    }
+}
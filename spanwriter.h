@@ -0,0 +1,62 @@
+#ifndef SPANWRITER_H
+#define SPANWRITER_H
+
+#include <QImage>
+#include <QColor>
+#include <QRect>
+#include <QVector>
+#include <QHash>
+#include "perfcounters.h"
+
+/**
+ * 直接写入 QImage 扫描线的像素写入器。
+ * 连续的水平/竖直像素会先合并成一段（span），flush 时按行整段写入，
+ * 不再逐像素经过 QPainter 的画笔状态机。
+ * 仅支持 Format_ARGB32 / Format_RGB32，画笔宽度按 width×width 方块处理。
+ * 半透明画笔时相邻段的画笔方块互相重叠：按行记下已写过的区间，写出一段前先扣掉，
+ * 同一图元（两次 setPen 之间）里每个像素只混合一次，与 QPainter 画一整条笔画一致；
+ * 结果只取决于方块的并集，分块时各块只走一部分也与整条走完相同。
+ */
+class SpanWriter {
+public:
+    SpanWriter(QImage &image, const QColor &color, int width = 1);
+    ~SpanWriter();
+
+    void plot(int x, int y);       // 绘制一个（带画笔宽度的）像素，自动合并成段
+    void flush();                  // 写出当前累积的段；之后的像素不再与之前的合并
+    void setClipRect(const QRect &rect);
+    // 切换颜色/宽度（会先 flush），批量绘制时复用同一个写入器；之后的像素算作新的图元，重叠照常混合
+    void setPen(QRgb color, int width);
+    // 之后写出的像素记到哪一项计数，由各算法的包装函数设置；不 flush，不影响段的合并
+    void setCounter(Raster::Perf::Counter counter);
+
+    void fillSpan(int y, int x0, int x1);  // 直接填充一行 [x0, x1]，已做裁剪
+
+private:
+    void fillRect(int x0, int y0, int x1, int y1);
+    void fillUncovered(int y, int x0, int x1);   // 半透明：只写这一行里本图元还没写过的部分
+
+    QImage &m_image;
+    uchar *m_bits;    // 构造时取一次，避免每行 scanLine() 的 detach 检查
+    qsizetype m_stride;
+    QRgb m_color;
+    bool m_opaque;
+    int m_lo, m_hi;   // 画笔方块相对像素的覆盖范围 [-m_lo, m_hi]
+    QRect m_clip;
+
+    bool m_hasRun = false;
+    int m_runX0 = 0, m_runX1 = 0;
+    int m_runY0 = 0, m_runY1 = 0;
+    int m_lastX = 0, m_lastY = 0;   // 当前段里最后画的像素
+
+    // 半透明画笔本图元已写过的像素：每行按 x 排好序、互不相邻的区间，[x0, x1] 成对存放
+    QHash<int, QVector<int>> m_covered;
+
+#if CANVAS_PERF_COUNTERS
+    void publish();   // 把累计的像素数记到 m_counter
+    Raster::Perf::Counter m_counter = Raster::Perf::BresenhamPixels;
+    qint64 m_written = 0;
+#endif
+};
+
+#endif // SPANWRITER_H
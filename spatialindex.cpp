@@ -0,0 +1,157 @@
+#include "spatialindex.h"
+#include <algorithm>
+
+namespace Raster {
+
+// 覆盖格子数超过这个值的图元放进 m_large
+static const int MaxCellsPerItem = 64;
+
+SpatialGrid::SpatialGrid(int cellSize) :
+    m_cellSize(qMax(8, cellSize))
+{
+}
+
+int SpatialGrid::cellOf(int coordinate) const {
+    return coordinate >= 0 ? coordinate / m_cellSize : -((-coordinate + m_cellSize - 1) / m_cellSize);
+}
+
+QRect SpatialGrid::cellRange(const QRect &rect) const {
+    return QRect(QPoint(cellOf(rect.left()), cellOf(rect.top())), QPoint(cellOf(rect.right()), cellOf(rect.bottom())));
+}
+
+bool SpatialGrid::isLarge(const QRect &cells) const {
+    return qint64(cells.width()) * cells.height() > MaxCellsPerItem;
+}
+
+void SpatialGrid::insert(int id, const QRect &bounds) {
+    if (id < 0 || bounds.isEmpty()) return;
+    remove(id);
+    if (id >= m_bounds.size()) {
+        m_bounds.resize(id + 1);
+        m_present.resize(id + 1);
+    }
+    m_bounds[id] = bounds;
+    m_present[id] = true;
+    ++m_count;
+
+    const QRect cells = cellRange(bounds);
+    if (isLarge(cells)) {
+        m_large.append(id);
+        return;
+    }
+    for (int cellY = cells.top(); cellY <= cells.bottom(); ++cellY) {
+        for (int cellX = cells.left(); cellX <= cells.right(); ++cellX) {
+            m_cells[cellKey(cellX, cellY)].append(id);
+        }
+    }
+}
+
+void SpatialGrid::remove(int id) {
+    if (!contains(id)) return;
+    m_present[id] = false;
+    --m_count;
+
+    // 格子里的顺序无关紧要（查询结果最后统一排序），用末尾元素补位
+    auto erase = [id](QVector<int> &ids) {
+        const int position = ids.indexOf(id);
+        if (position < 0) return;
+        ids[position] = ids.last();
+        ids.removeLast();
+    };
+    const QRect cells = cellRange(m_bounds[id]);
+    if (isLarge(cells)) {
+        erase(m_large);
+        return;
+    }
+    for (int cellY = cells.top(); cellY <= cells.bottom(); ++cellY) {
+        for (int cellX = cells.left(); cellX <= cells.right(); ++cellX) {
+            auto it = m_cells.find(cellKey(cellX, cellY));
+            if (it == m_cells.end()) continue;
+            erase(it.value());
+            if (it.value().isEmpty()) m_cells.erase(it);
+        }
+    }
+}
+
+void SpatialGrid::clear() {
+    m_cells.clear();
+    m_large.clear();
+    m_bounds.clear();
+    m_present.clear();
+    m_visit.clear();
+    m_count = 0;
+}
+
+void SpatialGrid::beginVisit() const {
+    if (m_visit.size() < m_bounds.size()) m_visit.resize(m_bounds.size());
+    if (++m_stamp == 0) {
+        // 时间戳回绕时清零，避免旧标记被误认为本次已访问
+        std::fill(m_visit.begin(), m_visit.end(), 0u);
+        m_stamp = 1;
+    }
+}
+
+QVector<int> SpatialGrid::query(const QRect &rect) const {
+    QVector<int> result;
+    if (rect.isEmpty() || m_count == 0) return result;
+
+    beginVisit();
+    auto visit = [&](const QVector<int> &ids) {
+        for (int id : ids) {
+            if (m_visit[id] == m_stamp) continue;
+            m_visit[id] = m_stamp;
+            if (m_bounds[id].intersects(rect)) result.append(id);
+        }
+    };
+
+    const QRect cells = cellRange(rect);
+    if (qint64(cells.width()) * cells.height() > m_cells.size()) {
+        // 查询范围比已占用的格子还多时，直接遍历占用的格子
+        for (auto it = m_cells.cbegin(); it != m_cells.cend(); ++it) {
+            visit(it.value());
+        }
+    } else {
+        for (int cellY = cells.top(); cellY <= cells.bottom(); ++cellY) {
+            for (int cellX = cells.left(); cellX <= cells.right(); ++cellX) {
+                auto it = m_cells.constFind(cellKey(cellX, cellY));
+                if (it != m_cells.cend()) visit(it.value());
+            }
+        }
+    }
+    visit(m_large);
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+QVector<int> SpatialGrid::query(QPoint point) const {
+    return query(QRect(point, QSize(1, 1)));
+}
+
+QVector<int> SpatialGrid::queryOutside(const QRect &rect) const {
+    QVector<int> result;
+    if (m_count == 0) return result;
+
+    beginVisit();
+    auto visit = [&](const QVector<int> &ids) {
+        for (int id : ids) {
+            if (m_visit[id] == m_stamp) continue;
+            m_visit[id] = m_stamp;
+            if (!m_bounds[id].intersects(rect)) result.append(id);
+        }
+    };
+
+    // 整个落在 rect 里的格子上，图元都与 rect 相交，整格跳过
+    for (auto it = m_cells.cbegin(); it != m_cells.cend(); ++it) {
+        const int left = int(quint32(it.key() >> 32)) * m_cellSize;
+        const int top = int(quint32(it.key())) * m_cellSize;
+        if (rect.contains(QRect(left, top, m_cellSize, m_cellSize))) continue;
+        visit(it.value());
+    }
+    visit(m_large);
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+} // namespace Raster
@@ -0,0 +1,50 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QRect>
+#include <QHash>
+#include <QVector>
+
+namespace Raster {
+
+/**
+ * 按包围盒索引图元的均匀网格。坐标平面切成 cellSize×cellSize 的格子（可为负坐标），
+ * 每个格子记录包围盒覆盖到它的图元编号；只有非空的格子占内存。
+ * 覆盖格子太多的大图元单独放一张表，查询时逐个比较，避免一次插入写满成千上万个格子。
+ *
+ * 编号由调用方给出（通常是 PrimitiveStore 的记录下标），查询结果按编号升序，即绘制顺序。
+ */
+class SpatialGrid {
+public:
+    explicit SpatialGrid(int cellSize = 128);
+
+    void insert(int id, const QRect &bounds);
+    void remove(int id);
+    void clear();
+    bool contains(int id) const { return id >= 0 && id < m_present.size() && m_present[id]; }
+    int size() const { return m_count; }
+
+    QVector<int> query(const QRect &rect) const;   // 包围盒与 rect 相交的编号
+    QVector<int> query(QPoint point) const;        // 包围盒含有 point 的编号
+    QVector<int> queryOutside(const QRect &rect) const;   // 包围盒与 rect 不相交的编号
+
+private:
+    static quint64 cellKey(int cellX, int cellY) { return (quint64(quint32(cellX)) << 32) | quint32(cellY); }
+    int cellOf(int coordinate) const;              // 向下取整，负坐标也正确
+    QRect cellRange(const QRect &rect) const;      // rect 覆盖的格子范围（格子坐标）
+    bool isLarge(const QRect &cells) const;
+    void beginVisit() const;                       // 新的一次查询：换一个去重时间戳
+
+    int m_cellSize;
+    int m_count = 0;
+    QHash<quint64, QVector<int>> m_cells;
+    QVector<int> m_large;          // 覆盖格子数超过上限的图元
+    QVector<QRect> m_bounds;       // 按编号
+    QVector<bool> m_present;
+    mutable QVector<uint> m_visit; // 查询去重用的时间戳
+    mutable uint m_stamp = 0;
+};
+
+} // namespace Raster
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,353 @@
+#include "tiledcanvas.h"
+#include <QImageReader>
+#include <QImageIOHandler>
+#include <cstring>
+
+namespace Raster {
+
+/*
+ * 分块文件：开头 HeaderBytes 字节是文件头，之后按行依次存放 tilesX×tilesY 块，
+ * 每块 tileSize×tileSize 个 ARGB32 像素、逐行连续，块与块都从页边界开始。
+ * 新建时只把文件扩到最终长度、不写像素，没写过的部分是文件空洞，读出来是 0（全透明）。
+ * 网格之后是 extraTiles 个网格范围之外的块（画布往文件外面画出去的部分），
+ * 每个是块号 tileX、tileY（各 4 字节）加上整块像素；打开时读回堆上。
+ */
+struct FileHeader {
+    char magic[8];
+    quint32 tileSize;
+    quint32 width;
+    quint32 height;
+    quint32 extraTiles;   // 旧文件这里是文件头的空白，读出来是 0
+};
+static const char FileMagic[8] = { 'C', 'V', 'T', 'I', 'L', 'E', 'S', '1' };
+static const qint64 HeaderBytes = 4096;
+
+static qint64 tileBytes(int tileSize) {
+    return qint64(tileSize) * tileSize * 4;
+}
+
+// 逐行拷贝 width×rows 个像素：from/to 是左上角像素的地址，stride 是两边各自的行字节数
+static void copyRows(const uchar *from, qsizetype fromStride, uchar *to, qsizetype toStride, int width, int rows) {
+    for (int y = 0; y < rows; ++y) {
+        std::memcpy(to + y * toStride, from + y * fromStride, size_t(width) * 4);
+    }
+}
+
+TiledCanvas::TiledCanvas(int tileSize, QRgb background) :
+    m_tileSize(qMax(16, tileSize)),
+    m_background(background)
+{
+}
+
+int TiledCanvas::tileOf(int coordinate) const {
+    return coordinate >= 0 ? coordinate / m_tileSize : -((-coordinate + m_tileSize - 1) / m_tileSize);
+}
+
+QRect TiledCanvas::alignedRect(const QRect &rect) const {
+    if (rect.isEmpty()) return QRect();
+    return QRect(QPoint(tileOf(rect.left()) * m_tileSize, tileOf(rect.top()) * m_tileSize),
+                 QPoint((tileOf(rect.right()) + 1) * m_tileSize - 1, (tileOf(rect.bottom()) + 1) * m_tileSize - 1));
+}
+
+uchar *TiledCanvas::mappedTile(int tileX, int tileY) const {
+    if (!m_map || tileX < 0 || tileY < 0) return nullptr;
+    const int tileSize = m_tileSize;
+    if (tileX * tileSize >= m_mapped.width() || tileY * tileSize >= m_mapped.height()) return nullptr;
+    return m_map + HeaderBytes + (qint64(tileY) * m_mappedTilesX + tileX) * tileBytes(tileSize);
+}
+
+qint64 TiledCanvas::memoryUsage() const {
+    qint64 bytes = 0;
+    for (const QImage &tile : m_tiles) bytes += tile.sizeInBytes();
+    return bytes;
+}
+
+QRect TiledCanvas::bounds() const {
+    QRect result = isMapped() ? QRect(QPoint(0, 0), m_fileSize) : QRect();
+    for (auto it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it) {
+        const int tileX = qint32(quint32(it.key() >> 32));
+        const int tileY = qint32(quint32(it.key()));
+        result |= QRect(tileX * m_tileSize, tileY * m_tileSize, m_tileSize, m_tileSize);
+    }
+    return result;
+}
+
+QRgb TiledCanvas::pixel(QPoint point) const {
+    const int tileX = tileOf(point.x());
+    const int tileY = tileOf(point.y());
+    if (const uchar *bits = mappedTile(tileX, tileY)) {
+        const int x = point.x() - tileX * m_tileSize;
+        const int y = point.y() - tileY * m_tileSize;
+        return reinterpret_cast<const QRgb *>(bits)[y * m_tileSize + x];
+    }
+    const auto it = m_tiles.constFind(tileKey(tileX, tileY));
+    if (it == m_tiles.constEnd()) return m_background;
+    return it->pixel(point.x() - tileX * m_tileSize, point.y() - tileY * m_tileSize);
+}
+
+bool TiledCanvas::isBackground(const QImage &image, const QRect &rect) const {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (line[x] != m_background) return false;
+        }
+    }
+    return true;
+}
+
+QImage TiledCanvas::read(const QRect &rect) const {
+    QImage result(rect.size(), QImage::Format_ARGB32);
+    if (result.isNull()) return result;
+    result.fill(m_background);
+    const QRect tiles(QPoint(tileOf(rect.left()), tileOf(rect.top())),
+                      QPoint(tileOf(rect.right()), tileOf(rect.bottom())));
+    auto copyTile = [&](int tileX, int tileY, const uchar *bits, qsizetype stride) {
+        const QRect tileRect(tileX * m_tileSize, tileY * m_tileSize, m_tileSize, m_tileSize);
+        const QRect part = tileRect.intersected(rect);
+        if (part.isEmpty()) return;
+        copyRows(bits + (part.top() - tileRect.top()) * stride + (part.left() - tileRect.left()) * 4, stride,
+                 result.scanLine(part.top() - rect.top()) + (part.left() - rect.left()) * 4, result.bytesPerLine(),
+                 part.width(), part.height());
+    };
+    // 文件范围内的块：只碰 rect 覆盖到的那些，操作系统按需换入
+    if (m_map) {
+        const QRect mapped = tiles.intersected(QRect(0, 0, m_mappedTilesX, m_mapped.height() / m_tileSize));
+        for (int tileY = mapped.top(); tileY <= mapped.bottom(); ++tileY) {
+            for (int tileX = mapped.left(); tileX <= mapped.right(); ++tileX) {
+                copyTile(tileX, tileY, mappedTile(tileX, tileY), qsizetype(m_tileSize) * 4);
+            }
+        }
+    }
+    // 范围里的块号多于已分配的块时，直接遍历已分配的块
+    const bool scanAll = qint64(tiles.width()) * tiles.height() > m_tiles.size();
+    if (scanAll) {
+        for (auto it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it) {
+            copyTile(qint32(quint32(it.key() >> 32)), qint32(quint32(it.key())), it->constBits(), it->bytesPerLine());
+        }
+    } else {
+        for (int tileY = tiles.top(); tileY <= tiles.bottom(); ++tileY) {
+            for (int tileX = tiles.left(); tileX <= tiles.right(); ++tileX) {
+                const auto it = m_tiles.constFind(tileKey(tileX, tileY));
+                if (it != m_tiles.constEnd()) copyTile(tileX, tileY, it->constBits(), it->bytesPerLine());
+            }
+        }
+    }
+    return result;
+}
+
+QImage TiledCanvas::take(const QRect &rect) {
+    QImage result = read(rect);
+    for (auto it = m_tiles.begin(); it != m_tiles.end();) {
+        const int tileX = qint32(quint32(it.key() >> 32));
+        const int tileY = qint32(quint32(it.key()));
+        if (rect.contains(QRect(tileX * m_tileSize, tileY * m_tileSize, m_tileSize, m_tileSize))) {
+            it = m_tiles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return result;
+}
+
+void TiledCanvas::write(const QImage &image, QPoint origin, const QRect &source) {
+    const QRect src = source.intersected(image.rect());
+    if (src.isEmpty()) return;
+    const QImage pixels = image.format() == QImage::Format_ARGB32 ? image
+                                                                   : image.convertToFormat(QImage::Format_ARGB32);
+    const QRect target = src.translated(origin);
+    for (int tileY = tileOf(target.top()); tileY <= tileOf(target.bottom()); ++tileY) {
+        for (int tileX = tileOf(target.left()); tileX <= tileOf(target.right()); ++tileX) {
+            const QRect tileRect(tileX * m_tileSize, tileY * m_tileSize, m_tileSize, m_tileSize);
+            const QRect part = tileRect.intersected(target);
+            const QRect from = part.translated(-origin);
+            if (uchar *bits = mappedTile(tileX, tileY)) {
+                // 文件里的块直接改写映射，由操作系统写回文件
+                const qsizetype stride = qsizetype(m_tileSize) * 4;
+                copyRows(pixels.constScanLine(from.top()) + from.left() * 4, pixels.bytesPerLine(),
+                         bits + (part.top() - tileRect.top()) * stride + (part.left() - tileRect.left()) * 4, stride,
+                         part.width(), part.height());
+                continue;
+            }
+            const bool blank = isBackground(pixels, from);
+            auto it = m_tiles.find(tileKey(tileX, tileY));
+            if (it == m_tiles.end()) {
+                if (blank) continue;   // 背景写到背景上，不必分配
+                QImage tile(m_tileSize, m_tileSize, QImage::Format_ARGB32);
+                tile.fill(m_background);
+                it = m_tiles.insert(tileKey(tileX, tileY), tile);
+            }
+            QImage &tile = it.value();
+            copyRows(pixels.constScanLine(from.top()) + from.left() * 4, pixels.bytesPerLine(),
+                     tile.scanLine(part.top() - tileRect.top()) + (part.left() - tileRect.left()) * 4, tile.bytesPerLine(),
+                     part.width(), part.height());
+            // 写进去的全是背景时这块可能整块空了
+            if (blank && isBackground(tile, tile.rect())) m_tiles.erase(it);
+        }
+    }
+}
+
+void TiledCanvas::clear() {
+    m_tiles.clear();
+    closeFile();
+}
+
+void TiledCanvas::swap(TiledCanvas &other) {
+    qSwap(m_tileSize, other.m_tileSize);
+    qSwap(m_background, other.m_background);
+    m_tiles.swap(other.m_tiles);
+    m_file.swap(other.m_file);
+    qSwap(m_map, other.m_map);
+    qSwap(m_mapped, other.m_mapped);
+    qSwap(m_fileSize, other.m_fileSize);
+    qSwap(m_mappedTilesX, other.m_mappedTilesX);
+}
+
+bool TiledCanvas::mapFile(QSize size, int tileSize) {
+    const int tilesX = (size.width() + tileSize - 1) / tileSize;
+    const int tilesY = (size.height() + tileSize - 1) / tileSize;
+    const qint64 bytes = HeaderBytes + qint64(tilesX) * tilesY * tileBytes(tileSize);
+    if (m_file->size() < bytes) return false;
+    m_map = m_file->map(0, bytes);
+    if (!m_map) return false;
+    m_tiles.clear();
+    m_tileSize = tileSize;
+    m_fileSize = size;
+    m_mappedTilesX = tilesX;
+    m_mapped = QRect(0, 0, tilesX * tileSize, tilesY * tileSize);
+    return true;
+}
+
+bool TiledCanvas::createFile(const QString &fileName, QSize size) {
+    closeFile();
+    // 块要从页边界开始，边长取 32 的倍数（32×32×4 = 4096）
+    const int tileSize = qMax(32, m_tileSize & ~31);
+    if (size.isEmpty()) return false;
+    m_file.reset(new QFile(fileName));
+    FileHeader header;
+    std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+    header.tileSize = quint32(tileSize);
+    header.width = quint32(size.width());
+    header.height = quint32(size.height());
+    header.extraTiles = 0;
+    const qint64 tiles = qint64((size.width() + tileSize - 1) / tileSize) * ((size.height() + tileSize - 1) / tileSize);
+    // 只扩文件长度，不写像素：几十 GB 的画布也是瞬间建好
+    if (!m_file->open(QIODevice::ReadWrite | QIODevice::Truncate)
+        || m_file->write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || !m_file->resize(HeaderBytes + tiles * tileBytes(tileSize))
+        || !mapFile(size, tileSize)) {
+        closeFile();
+        return false;
+    }
+    return true;
+}
+
+bool TiledCanvas::openFile(const QString &fileName) {
+    closeFile();
+    m_file.reset(new QFile(fileName));
+    FileHeader header;
+    if (!m_file->open(QIODevice::ReadWrite)
+        || m_file->read(reinterpret_cast<char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || std::memcmp(header.magic, FileMagic, sizeof(FileMagic)) != 0
+        || header.tileSize < 32 || header.tileSize > 4096 || header.tileSize % 32 != 0
+        || header.width == 0 || header.height == 0 || header.width > 0x7fffffffu || header.height > 0x7fffffffu
+        || !mapFile(QSize(int(header.width), int(header.height)), int(header.tileSize))
+        || !readExtraTiles(header.extraTiles)) {
+        closeFile();
+        return false;
+    }
+    return true;
+}
+
+bool TiledCanvas::readExtraTiles(quint32 count) {
+    if (count == 0) return true;
+    const qint64 gridBytes = this->gridBytes();
+    if (m_file->size() < gridBytes + qint64(count) * (8 + tileBytes(m_tileSize)) || !m_file->seek(gridBytes)) {
+        return false;
+    }
+    for (quint32 i = 0; i < count; ++i) {
+        qint32 position[2];
+        QImage tile(m_tileSize, m_tileSize, QImage::Format_ARGB32);
+        if (m_file->read(reinterpret_cast<char *>(position), sizeof(position)) != qint64(sizeof(position))) {
+            return false;
+        }
+        for (int y = 0; y < m_tileSize; ++y) {
+            if (m_file->read(reinterpret_cast<char *>(tile.scanLine(y)), qint64(m_tileSize) * 4)
+                != qint64(m_tileSize) * 4) {
+                return false;
+            }
+        }
+        // 网格范围里的块号不该出现在这里，出现了也以映射为准
+        if (mappedTile(position[0], position[1])) continue;
+        m_tiles.insert(tileKey(position[0], position[1]), tile);
+    }
+    return true;
+}
+
+bool TiledCanvas::importImage(const QString &imageFile, const QString &fileName) {
+    const QSize size = QImageReader(imageFile).size();
+    if (!size.isValid() || !createFile(fileName, size)) return false;
+    // 支持裁剪读取的格式（如 JPEG）按块高的行带分次解码，每次只有一条行带在内存里；
+    // 其他格式每设一次裁剪框都要整幅重新解码，只解一次整幅写进去，只适合本来就放得进内存的图
+    if (!QImageReader(imageFile).supportsOption(QImageIOHandler::ClipRect)) {
+        const QImage image = QImageReader(imageFile).read();
+        if (image.isNull()) {
+            closeFile();
+            return false;
+        }
+        write(image, QPoint(0, 0), image.rect());
+        return true;
+    }
+    for (int y = 0; y < size.height(); y += m_tileSize) {
+        QImageReader reader(imageFile);
+        reader.setClipRect(QRect(0, y, size.width(), qMin(m_tileSize, size.height() - y)));
+        const QImage band = reader.read();
+        if (band.isNull()) {
+            closeFile();
+            return false;
+        }
+        write(band, QPoint(0, y), band.rect());
+    }
+    return true;
+}
+
+qint64 TiledCanvas::gridBytes() const {
+    return HeaderBytes + qint64(m_mappedTilesX) * (m_mapped.height() / m_tileSize) * tileBytes(m_tileSize);
+}
+
+bool TiledCanvas::syncFile() {
+    if (!m_map) return false;
+    const qint64 gridBytes = this->gridBytes();
+    // 上次存的文件外的块整段重写
+    if (!m_file->resize(gridBytes) || !m_file->seek(gridBytes)) return false;
+    quint32 count = 0;
+    for (auto it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it) {
+        const qint32 position[2] = { qint32(quint32(it.key() >> 32)), qint32(quint32(it.key())) };
+        const QImage &tile = it.value();
+        if (m_file->write(reinterpret_cast<const char *>(position), sizeof(position)) != qint64(sizeof(position))) {
+            return false;
+        }
+        for (int y = 0; y < m_tileSize; ++y) {
+            if (m_file->write(reinterpret_cast<const char *>(tile.constScanLine(y)), qint64(m_tileSize) * 4)
+                != qint64(m_tileSize) * 4) {
+                return false;
+            }
+        }
+        ++count;
+    }
+    reinterpret_cast<FileHeader *>(m_map)->extraTiles = count;   // 文件头也在映射里
+    return true;
+}
+
+void TiledCanvas::closeFile() {
+    if (m_file) {
+        if (m_map) m_file->unmap(m_map);
+        m_file->close();
+        m_file.reset();
+    }
+    m_map = nullptr;
+    m_mapped = QRect();
+    m_fileSize = QSize();
+    m_mappedTilesX = 0;
+}
+
+} // namespace Raster
@@ -0,0 +1,74 @@
+#ifndef TILEDCANVAS_H
+#define TILEDCANVAS_H
+
+#include <QImage>
+#include <QHash>
+#include <QFile>
+#include <QScopedPointer>
+
+namespace Raster {
+
+/**
+ * 稀疏分块存放的无界画布。坐标平面切成 tileSize×tileSize 的块（可为负坐标），
+ * 只有画过东西的块才分配；没分配的块就是背景色（默认全透明），不占内存。
+ * 块分配后位置不变，画布往任何方向扩展都只是多几个块，已有的像素不会被搬动或拷贝。
+ *
+ * 编辑时用 read()/take() 取出一片连续的窗口图像，在上面照常用 QPainter 和光栅化代码绘制，
+ * 之后 write() 写回；写回后整块回到背景色的块随即释放。
+ *
+ * 超大图（几万像素见方）可以放在映射到内存的分块文件里：文件覆盖的范围内每块直接指向映射，
+ * 打开时只建立映射，不读像素；读写哪块操作系统才换入哪几页，写入经映射落回文件。
+ * 文件之外仍按上面的方式用堆上的块，syncFile() 时接在文件末尾一并存下，下次打开再读回。文件格式见 tiledcanvas.cpp。
+ */
+class TiledCanvas {
+public:
+    explicit TiledCanvas(int tileSize = 256, QRgb background = 0);
+
+    int tileSize() const { return m_tileSize; }
+    QRgb background() const { return m_background; }
+    int tileCount() const { return m_tiles.size(); }
+    qint64 memoryUsage() const;   // 已分配的块占用的字节数
+    QRect bounds() const;         // 已分配的块的外接矩形，没有时为空矩形
+    QRect alignedRect(const QRect &rect) const;   // 向外扩到块边界
+
+    QRgb pixel(QPoint point) const;
+    QImage read(const QRect &rect) const;   // rect 内的像素（ARGB32），没分配的部分是背景色
+    QImage take(const QRect &rect);         // 同 read()，并释放完全落在 rect 里的块：调用方的图像成为那部分唯一的副本
+
+    // 把 image 中 source 范围（图像坐标）的像素写到画布 origin + source.topLeft() 处
+    void write(const QImage &image, QPoint origin, const QRect &source);
+    void clear();   // 丢弃堆上的块并关闭映射文件（文件内容保留）
+    void swap(TiledCanvas &other);   // 交换全部内容（连同映射文件），切换图层时用
+
+    bool createFile(const QString &fileName, QSize size);   // 新建全透明的分块文件并映射，原内容丢弃
+    bool openFile(const QString &fileName);                  // 映射已有的分块文件，原内容丢弃
+    bool importImage(const QString &imageFile, const QString &fileName);   // 图像按行带转存为分块文件并映射
+    bool syncFile();   // 文件范围之外的堆上块写到文件末尾（映射内的改动由操作系统写回）
+    void closeFile();
+    bool isMapped() const { return m_map != nullptr; }
+    QRect mappedRect() const { return m_mapped; }           // 文件覆盖的画布范围（按块对齐），从原点开始
+    QSize fileImageSize() const { return m_fileSize; }      // 文件记录的图像尺寸
+    qint64 mappedBytes() const { return m_file ? m_file->size() : 0; }
+
+private:
+    static quint64 tileKey(int tileX, int tileY) { return (quint64(quint32(tileX)) << 32) | quint32(tileY); }
+    int tileOf(int coordinate) const;   // 向下取整，负坐标也正确
+    bool isBackground(const QImage &image, const QRect &rect) const;
+    uchar *mappedTile(int tileX, int tileY) const;   // 映射里这一块的像素（每行 tileSize*4 字节），不在文件范围内时为 nullptr
+    bool mapFile(QSize size, int tileSize);
+    bool readExtraTiles(quint32 count);   // 打开文件时读回网格之外的块
+    qint64 gridBytes() const;             // 文件头加上网格的字节数，网格之外的块从这里开始
+
+    int m_tileSize;
+    QRgb m_background;
+    QHash<quint64, QImage> m_tiles;     // 文件范围之外的块
+    QScopedPointer<QFile> m_file;
+    uchar *m_map = nullptr;
+    QRect m_mapped;
+    QSize m_fileSize;
+    int m_mappedTilesX = 0;
+};
+
+} // namespace Raster
+
+#endif // TILEDCANVAS_H
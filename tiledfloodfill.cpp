@@ -0,0 +1,231 @@
+#include "tiledfloodfill.h"
+#include <algorithm>
+
+namespace Raster {
+
+TiledFloodFill::TiledFloodFill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity,
+                               int tolerance, ToleranceMetric metric, int tileSize) :
+    m_bits(image.bits()),
+    m_stride(image.bytesPerLine()),
+    m_width(image.width()),
+    m_height(image.height()),
+    m_oldColor(image.rect().contains(seedPoint) ? image.pixel(seedPoint) : newColor),
+    m_newColor(newColor),
+    m_matcher(m_oldColor, tolerance, metric),
+    m_keepOriginal(tolerance > 0),
+    m_reach(connectivity == EightWay ? 1 : 0),
+    m_tileSize((qMax(32, tileSize) + 31) & ~31),
+    m_tilesX((image.width() + m_tileSize - 1) / m_tileSize),
+    m_tilesY((image.height() + m_tileSize - 1) / m_tileSize)
+{
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    m_tiles.resize(m_tilesX * m_tilesY);
+
+    if (!image.rect().contains(seedPoint)) {
+        m_finished = true;
+        return;
+    }
+    if (m_matcher.matches(m_newColor)) {
+        if (tolerance <= 0) {
+            m_finished = true;
+            return;
+        }
+        m_visited.fill(0, FillScanner::visitedWords(m_width, m_height));
+    }
+    post((seedPoint.y() / m_tileSize) * m_tilesX + seedPoint.x() / m_tileSize,
+         { seedPoint.y(), seedPoint.x(), seedPoint.x() });
+}
+
+TiledFloodFill::~TiledFloodFill() {
+    if (!m_finished.load()) {
+        cancel();
+    }
+    m_pool.waitForDone();
+}
+
+void TiledFloodFill::start(int threadCount) {
+    if (m_finished.load()) return;
+
+    threadCount = qMax(1, threadCount);
+    m_pool.setMaxThreadCount(threadCount);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_workers = threadCount;
+    }
+    for (int i = 0; i < threadCount; ++i) {
+        m_pool.start([this]() { run(); });
+    }
+}
+
+void TiledFloodFill::cancel() {
+    QMutexLocker locker(&m_mutex);
+    m_cancelRequested = true;
+    m_wake.wakeAll();
+}
+
+void TiledFloodFill::waitForFinished() {
+    m_pool.waitForDone();
+}
+
+QRect TiledFloodFill::takeDirtyRect() {
+    QMutexLocker locker(&m_mutex);
+    QRect dirty = m_dirty;
+    m_dirty = QRect();
+    return dirty;
+}
+
+QRect TiledFloodFill::takeProgress(QImage &view) {
+    Q_ASSERT(view.width() == m_width && view.height() == m_height);
+    Q_ASSERT(view.format() == QImage::Format_ARGB32 || view.format() == QImage::Format_RGB32);
+    uchar *bits = view.bits();
+    const qsizetype stride = view.bytesPerLine();
+
+    QMutexLocker locker(&m_mutex);
+    QRect dirty;
+    for (Tile &tile : m_tiles) {
+        // 正在处理的块还在追加 filled；回滚后 filled 已清空
+        if (tile.state == Tile::Running) continue;
+        for (int i = tile.shown; i < tile.filled.size(); ++i) {
+            const Span &span = tile.filled[i];
+            QRgb *line = reinterpret_cast<QRgb *>(bits + span.y * stride);
+            std::fill(line + span.x0, line + span.x1 + 1, m_newColor);
+            dirty |= QRect(span.x0, span.y, span.x1 - span.x0 + 1, 1);
+        }
+        tile.shown = tile.filled.size();
+    }
+    return dirty;
+}
+
+void TiledFloodFill::post(int index, const Span &span) {
+    Tile &tile = m_tiles[index];
+    tile.inbox.append(span);
+    if (tile.state == Tile::Idle) {
+        tile.state = Tile::Queued;
+        m_ready.append(index);
+    }
+}
+
+void TiledFloodFill::run() {
+    QVector<Span> stack;
+    QVector<QPair<int, Span>> outgoing;
+
+    QMutexLocker locker(&m_mutex);
+    for (;;) {
+        while (m_ready.isEmpty() && m_running > 0 && !m_cancelRequested.load()) {
+            m_wake.wait(&m_mutex);
+        }
+        if (m_cancelRequested.load() || m_ready.isEmpty()) break;
+
+        const int index = m_ready.last();
+        m_ready.removeLast();
+        Tile &tile = m_tiles[index];
+        tile.state = Tile::Running;
+        ++m_running;
+        stack.swap(tile.inbox);
+        locker.unlock();
+
+        QRect dirty;
+        outgoing.resize(0);
+        fillTile(index, stack, outgoing, dirty);
+
+        locker.relock();
+        --m_running;
+        for (const QPair<int, Span> &item : outgoing) {
+            post(item.first, item.second);
+        }
+        tile.state = Tile::Idle;
+        if (!tile.inbox.isEmpty()) {
+            tile.state = Tile::Queued;
+            m_ready.append(index);
+        }
+        m_dirty |= dirty;
+        m_wake.wakeAll();
+    }
+
+    // 最后一个退出的线程负责收尾
+    m_wake.wakeAll();
+    if (--m_workers == 0) {
+        if (m_cancelRequested.load()) {
+            rollback();
+        }
+        m_finished = true;
+    }
+}
+
+void TiledFloodFill::fillTile(int index, QVector<Span> &stack, QVector<QPair<int, Span>> &outgoing,
+                              QRect &dirty) {
+    Tile &tile = m_tiles[index];
+    const int left0 = (index % m_tilesX) * m_tileSize;
+    const int right0 = qMin(left0 + m_tileSize, m_width) - 1;
+    FillScanner scanner(m_matcher, m_visited.isEmpty() ? nullptr : m_visited.data(), m_width);
+
+    // 把一段行区间拆到所属的块：本块的压栈，其他块的稍后统一投递
+    auto push = [&](int y, int x0, int x1) {
+        if (y < 0 || y >= m_height) return;
+        x0 = qMax(0, x0);
+        x1 = qMin(m_width - 1, x1);
+        const int rowTile = (y / m_tileSize) * m_tilesX;
+        for (int tx = x0 / m_tileSize; tx <= x1 / m_tileSize; ++tx) {
+            const Span piece = { y, qMax(x0, tx * m_tileSize), qMin(x1, (tx + 1) * m_tileSize - 1) };
+            if (rowTile + tx == index) {
+                stack.append(piece);
+            } else {
+                outgoing.append(qMakePair(rowTile + tx, piece));
+            }
+        }
+    };
+
+    int spanCount = 0;
+    while (!stack.isEmpty()) {
+        // 每处理一批段检查一次取消请求
+        if ((++spanCount & 63) == 0 && m_cancelRequested.load()) break;
+
+        const Span span = stack.last();
+        stack.removeLast();
+        QRgb *line = reinterpret_cast<QRgb *>(m_bits + span.y * m_stride);
+
+        int x = scanner.findFillable(line, span.y, span.x0, span.x1 + 1);
+        while (x <= span.x1) {
+            const int left = scanner.runStart(line, span.y, x, left0);
+            const int right = scanner.runEnd(line, span.y, x, right0 + 1) - 1;
+            if (m_keepOriginal) {
+                const int offset = tile.original.size();
+                tile.original.resize(offset + right - left + 1);
+                std::copy(line + left, line + right + 1, tile.original.begin() + offset);
+            }
+            std::fill(line + left, line + right + 1, m_newColor);
+            scanner.markFilled(span.y, left, right);
+            tile.filled.append({ span.y, left, right });
+            dirty |= QRect(left, span.y, right - left + 1, 1);
+
+            // 段贴着块的左右边界时，同一行继续到相邻块生长
+            if (left == left0) push(span.y, left - 1, left - 1);
+            if (right == right0) push(span.y, right + 1, right + 1);
+            push(span.y - 1, left - m_reach, right + m_reach);
+            push(span.y + 1, left - m_reach, right + m_reach);
+            x = scanner.findFillable(line, span.y, right + 2, span.x1 + 1);
+        }
+    }
+    stack.resize(0);
+}
+
+void TiledFloodFill::rollback() {
+    for (Tile &tile : m_tiles) {
+        const QRgb *original = tile.original.constData();
+        for (const Span &span : tile.filled) {
+            QRgb *line = reinterpret_cast<QRgb *>(m_bits + span.y * m_stride);
+            const int count = span.x1 - span.x0 + 1;
+            if (tile.original.isEmpty()) {
+                std::fill(line + span.x0, line + span.x1 + 1, m_oldColor);
+            } else {
+                std::copy(original, original + count, line + span.x0);
+                original += count;
+            }
+            m_dirty |= QRect(span.x0, span.y, count, 1);
+        }
+        tile.filled.clear();
+        tile.original.clear();
+    }
+}
+
+} // namespace Raster
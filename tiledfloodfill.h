@@ -0,0 +1,91 @@
+#ifndef TILEDFLOODFILL_H
+#define TILEDFLOODFILL_H
+
+#include <QImage>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QThread>
+#include <QPair>
+#include <atomic>
+#include "canvasraster.h"
+
+namespace Raster {
+
+/**
+ * 分块并行、可取消的泛洪填充，用于超大画布上的大片连通区域。
+ * 图像切成 tileSize×tileSize 的块（tileSize 取整到 32 的倍数，相邻块的访问标记不落在同一个字里），
+ * 每个块在工作线程里用扫描线段算法只在块内生长；
+ * 碰到块边界的段作为种子投递给相邻块，直到没有块再收到新种子为止。
+ * 每个块同一时刻只由一个线程处理，因此块内读写无需加锁；
+ * 最终填充的就是种子所在的连通区域，与 Raster::floodFill 的结果逐像素相同。
+ *
+ * start() 立即返回；界面线程轮询 takeDirtyRect() 做渐进刷新，isFinished() 判断结束。
+ * cancel() 之后工作线程尽快退出，并把已填充的段恢复成原来的像素（有容差时逐像素保存了原值）。
+ * 运行期间调用方不得重新分配或 detach 图像缓冲。
+ */
+class TiledFloodFill {
+public:
+    TiledFloodFill(QImage &image, QPoint seedPoint, QRgb newColor, Connectivity connectivity,
+                   int tolerance = 0, ToleranceMetric metric = PerChannel, int tileSize = 256);
+    ~TiledFloodFill();  // 尚未结束时先取消并等待
+
+    void start(int threadCount = QThread::idealThreadCount());
+    void cancel();
+    void waitForFinished();
+    bool isFinished() const { return m_finished.load(); }
+    bool wasCanceled() const { return m_cancelRequested.load(); }
+    QRect takeDirtyRect();   // 上次调用以来被改动的区域（线程安全）
+    // 把上次调用以来填好的段画到 view 上（与图像同尺寸的另一份拷贝），返回画了的区域。
+    // 界面显示 view 而不读正在被工作线程改写的图像；还在处理的块等下次再取
+    QRect takeProgress(QImage &view);
+
+private:
+    struct Span {
+        int y;
+        int x0, x1;
+    };
+    struct Tile {
+        enum State { Idle, Queued, Running };
+        State state = Idle;
+        QVector<Span> inbox;   // 其他块投递来的种子段
+        QVector<Span> filled;  // 已填充的段，取消时用来回滚
+        QVector<QRgb> original; // 有容差时按 filled 的顺序保存被覆盖的原像素
+        int shown = 0;          // filled 里已经由 takeProgress() 画出去的段数
+    };
+
+    void run();
+    void fillTile(int index, QVector<Span> &stack, QVector<QPair<int, Span>> &outgoing, QRect &dirty);
+    void post(int index, const Span &span);   // 调用方持有 m_mutex
+    void rollback();
+
+    uchar *m_bits;
+    qsizetype m_stride;
+    int m_width;
+    int m_height;
+    QRgb m_oldColor;
+    QRgb m_newColor;
+    ColorMatcher m_matcher;
+    bool m_keepOriginal;        // 有容差时被覆盖的像素各不相同，回滚需要原值
+    QVector<quint32> m_visited; // 新颜色也在容差内时的访问标记（每像素一位）
+    int m_reach;        // 八连通时相邻行的区间左右各多扫一列
+    int m_tileSize;
+    int m_tilesX;
+    int m_tilesY;
+
+    QVector<Tile> m_tiles;
+    QVector<int> m_ready;   // 有待处理种子的块
+    int m_running = 0;      // 正在处理的块数
+    int m_workers = 0;      // 尚未退出的工作线程数
+    QRect m_dirty;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QThreadPool m_pool;
+    std::atomic<bool> m_cancelRequested{false};
+    std::atomic<bool> m_finished{false};
+};
+
+} // namespace Raster
+
+#endif // TILEDFLOODFILL_H
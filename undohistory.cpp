@@ -0,0 +1,331 @@
+#include "undohistory.h"
+#include "lzcodec.h"
+#include "tiledcanvas.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Raster {
+
+// 最近几步保持未压缩，连续撤销时不用解压
+static const int RawSteps = 2;
+
+struct UndoHistory::TileData {
+    explicit TileData(qint64 *usage) : usage(usage) { *usage += sizeof(TileData); }
+    ~TileData() { *usage -= sizeof(TileData) + bytes.size(); }
+
+    void setBytes(const QByteArray &data, bool isCompressed) {
+        if (!isCompressed) rawSize = data.size();
+        *usage += data.size() - bytes.size();
+        bytes = data;
+        compressed = isCompressed;
+    }
+
+    qint64 *usage;
+    bool solid = false;    // 整块同一颜色时只存 color
+    QRgb color = 0;
+    bool compressed = false;
+    int rawSize = 0;
+    QByteArray bytes;      // 逐行紧排的像素，或压缩后的字节
+};
+
+UndoHistory::UndoHistory(int tileSize) :
+    m_tileSize(qMax(16, tileSize))
+{
+}
+
+UndoHistory::~UndoHistory() {
+    // 先释放所有块，它们析构时还要访问 m_usage
+    m_steps.clear();
+    m_tiles.clear();
+}
+
+QRect UndoHistory::tileRect(int tile) const {
+    return QRect((tile % m_tilesX) * m_tileSize, (tile / m_tilesX) * m_tileSize, m_tileSize, m_tileSize)
+        .intersected(QRect(QPoint(0, 0), m_size));
+}
+
+int UndoHistory::tileAt(const QRect &rect) const {
+    if (rect.left() < 0 || rect.top() < 0 || rect.left() % m_tileSize || rect.top() % m_tileSize) return -1;
+    const int tx = rect.left() / m_tileSize, ty = rect.top() / m_tileSize;
+    if (tx >= m_tilesX || rect.top() >= m_size.height()) return -1;
+    const int tile = ty * m_tilesX + tx;
+    return tileRect(tile) == rect ? tile : -1;
+}
+
+void UndoHistory::setWindow(QSize size, QPoint origin) {
+    m_size = size;
+    m_origin = origin;
+    m_tilesX = (m_size.width() + m_tileSize - 1) / m_tileSize;
+    const int tilesY = (m_size.height() + m_tileSize - 1) / m_tileSize;
+    m_tiles.clear();
+    m_tiles.resize(m_tilesX * tilesY);
+    m_pendingTiles.clear();
+    m_pendingMark.fill(false, m_tiles.size());
+}
+
+void UndoHistory::reset(const QImage &image, int tag, QPoint origin) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    m_steps.clear();
+    m_current = 0;
+    m_baseTag = tag;
+    setWindow(image.size(), origin);
+    captureAll(image);
+}
+
+void UndoHistory::captureAll(const QImage &image) {
+    for (int tile = 0; tile < m_tiles.size(); ++tile) {
+        m_tiles[tile] = capture(image, tileRect(tile));
+        compress(m_tiles[tile]);
+    }
+}
+
+void UndoHistory::setLayer(const QImage &image, int layer) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    Q_ASSERT(m_pendingTiles.isEmpty());
+    // 各层共用窗口范围，只是内容换了；已有的步骤按文档坐标记着各自的层，不受影响
+    m_layer = layer;
+    setWindow(image.size(), m_origin);
+    captureAll(image);
+}
+
+void UndoHistory::moveWindow(const QImage &image, QPoint origin) {
+    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32);
+    Q_ASSERT(m_pendingTiles.isEmpty());   // 调用方先 commit，未提交的改动跟着旧窗口一起丢了
+    // 新旧窗口重叠、块的划分也相同的地方内容没变，沿用原来的块；其余的从新窗口取
+    const QVector<TilePtr> previous = m_tiles;
+    QVector<QRect> previousRects(previous.size());
+    for (int tile = 0; tile < previous.size(); ++tile) previousRects[tile] = tileRect(tile);
+    const int previousTilesX = m_tilesX;
+    const QSize previousSize = m_size;
+    const QPoint shift = origin - m_origin;
+
+    setWindow(image.size(), origin);
+    for (int tile = 0; tile < m_tiles.size(); ++tile) {
+        const QRect rect = tileRect(tile);
+        const QRect old = rect.translated(shift);   // 同一块在旧窗口里的位置
+        if (QRect(QPoint(0, 0), previousSize).contains(old) && old.left() % m_tileSize == 0
+            && old.top() % m_tileSize == 0) {
+            const int index = (old.top() / m_tileSize) * previousTilesX + old.left() / m_tileSize;
+            if (previousRects[index] == old) {
+                m_tiles[tile] = previous[index];
+                continue;
+            }
+        }
+        m_tiles[tile] = capture(image, rect);
+        compress(m_tiles[tile]);
+    }
+}
+
+void UndoHistory::markDirty(const QRect &rect) {
+    const QRect area = rect.intersected(QRect(QPoint(0, 0), m_size));
+    if (area.isEmpty()) return;
+    for (int ty = area.top() / m_tileSize; ty <= area.bottom() / m_tileSize; ++ty) {
+        for (int tx = area.left() / m_tileSize; tx <= area.right() / m_tileSize; ++tx) {
+            const int tile = ty * m_tilesX + tx;
+            if (m_pendingMark[tile]) continue;
+            m_pendingMark[tile] = true;
+            m_pendingTiles.append(tile);
+        }
+    }
+}
+
+UndoHistory::TilePtr UndoHistory::capture(const QImage &image, const QRect &rect) {
+    TilePtr data(new TileData(&m_usage));
+
+    const QRgb first = reinterpret_cast<const QRgb *>(image.constScanLine(rect.top()))[rect.left()];
+    bool solid = true;
+    for (int y = rect.top(); solid && y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y)) + rect.left();
+        solid = std::all_of(line, line + rect.width(), [first](QRgb pixel) { return pixel == first; });
+    }
+    if (solid) {
+        data->solid = true;
+        data->color = first;
+        return data;
+    }
+
+    const int rowBytes = rect.width() * int(sizeof(QRgb));
+    QByteArray bytes(rowBytes * rect.height(), Qt::Uninitialized);
+    for (int y = 0; y < rect.height(); ++y) {
+        std::memcpy(bytes.data() + y * rowBytes, image.constScanLine(rect.top() + y) + rect.left() * sizeof(QRgb),
+                    rowBytes);
+    }
+    data->setBytes(bytes, false);
+    return data;
+}
+
+const char *UndoHistory::pixels(const TileData &data, QByteArray &scratch) const {
+    if (!data.compressed) return data.bytes.constData();
+    scratch.resize(data.rawSize);
+    const bool ok = lzDecompress(data.bytes, scratch.data(), data.rawSize);
+    Q_ASSERT(ok);
+    Q_UNUSED(ok);
+    return scratch.constData();
+}
+
+void UndoHistory::restore(uchar *bits, qsizetype stride, const QRect &rect, const TileData &data) {
+    if (data.solid) {
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            QRgb *line = reinterpret_cast<QRgb *>(bits + y * stride) + rect.left();
+            std::fill(line, line + rect.width(), data.color);
+        }
+        return;
+    }
+
+    const int rowBytes = rect.width() * int(sizeof(QRgb));
+    const char *source = pixels(data, m_scratch);
+    for (int y = 0; y < rect.height(); ++y) {
+        std::memcpy(bits + (rect.top() + y) * stride + rect.left() * sizeof(QRgb), source + y * rowBytes, rowBytes);
+    }
+}
+
+bool UndoHistory::sameContent(const TileData &a, const TileData &b) {
+    if (a.solid || b.solid) return a.solid == b.solid && a.color == b.color;
+
+    // 两块都不是纯色：解开比较原始像素
+    return a.rawSize == b.rawSize
+        && std::memcmp(pixels(a, m_scratch), pixels(b, m_compareScratch), a.rawSize) == 0;
+}
+
+void UndoHistory::compress(const TilePtr &data) {
+    if (data->solid || data->compressed) return;
+    data->setBytes(lzCompress(data->bytes.constData(), data->bytes.size()), true);
+}
+
+bool UndoHistory::commit(const QImage &image, int tag) {
+    if (image.size() != m_size) {
+        reset(image, tag, m_origin);
+        return false;
+    }
+    if (m_pendingTiles.isEmpty() && tag == this->tag()) return false;
+
+    Step step;
+    step.tag = tag;
+    step.layer = m_layer;
+    for (int tile : m_pendingTiles) {
+        m_pendingMark[tile] = false;
+        const QRect rect = tileRect(tile);
+        TilePtr after = capture(image, rect);
+        // 脏矩形往往比实际改动大，内容没变的块不记
+        if (sameContent(*m_tiles[tile], *after)) continue;
+        step.changes.append({ rect.translated(m_origin), m_tiles[tile], after });
+        step.rect |= rect.translated(m_origin);
+        m_tiles[tile] = after;
+    }
+    m_pendingTiles.clear();
+    if (step.changes.isEmpty() && tag == this->tag()) return false;
+    append(step);
+    return true;
+}
+
+void UndoHistory::commitEvent(int event, int tag) {
+    Q_ASSERT(event != 0 && m_pendingTiles.isEmpty());
+    Step step;
+    step.tag = tag;
+    step.layer = m_layer;
+    step.event = event;
+    append(step);
+}
+
+void UndoHistory::append(const Step &step) {
+    m_steps.resize(m_current);   // 新的编辑丢弃重做分支
+    m_steps.append(step);
+    ++m_current;
+
+    // 刚变"旧"的那一步压缩掉
+    const int older = m_current - 1 - RawSteps;
+    if (older >= 0) {
+        for (const Change &change : m_steps[older].changes) {
+            compress(change.before);
+            compress(change.after);
+        }
+    }
+    enforceBudget();
+}
+
+int UndoHistory::undoLayer() const {
+    if (m_current == 0 || m_steps[m_current - 1].changes.isEmpty()) return -1;
+    return m_steps[m_current - 1].layer;
+}
+
+int UndoHistory::redoLayer() const {
+    if (m_current == m_steps.size() || m_steps[m_current].changes.isEmpty()) return -1;
+    return m_steps[m_current].layer;
+}
+
+QRect UndoHistory::undo(QImage &image, TiledCanvas *document) {
+    commit(image, tag()); // 调用方需要新的 tag 时应先自己 commit
+    m_event = 0;
+    if (m_current == 0) return QRect();
+    return apply(image, document, m_steps[--m_current], false);
+}
+
+QRect UndoHistory::redo(QImage &image, TiledCanvas *document) {
+    commit(image, tag());
+    m_event = 0;
+    if (m_current == m_steps.size()) return QRect();
+    return apply(image, document, m_steps[m_current++], true);
+}
+
+QRect UndoHistory::apply(QImage &image, TiledCanvas *document, const Step &step, bool redo) {
+    m_event = step.event;
+    // 调用方应先换到这一步的层（undoLayer()/redoLayer()），否则不动像素
+    Q_ASSERT(step.changes.isEmpty() || step.layer == m_layer);
+    if (step.layer != m_layer) return QRect();
+    const QRect window(QPoint(0, 0), m_size);
+    uchar *bits = image.bits();
+    const qsizetype stride = image.bytesPerLine();
+    QRect dirty;
+    for (const Change &change : step.changes) {
+        const TilePtr &data = redo ? change.after : change.before;
+        const QRect rect = change.rect.translated(-m_origin);
+        const int tile = tileAt(rect);
+        if (tile >= 0) {
+            restore(bits, stride, rect, *data);
+            m_tiles[tile] = data;
+            dirty |= rect;
+            continue;
+        }
+
+        // 记录这一步之后窗口换过位置：块不在窗口里，解到临时图像写回文档，与窗口相交的部分再拷进窗口
+        QImage pixels(rect.size(), QImage::Format_ARGB32);
+        restore(pixels.bits(), pixels.bytesPerLine(), pixels.rect(), *data);
+        if (document) document->write(pixels, change.rect.topLeft(), pixels.rect());
+        const QRect inside = rect.intersected(window);
+        if (inside.isEmpty()) continue;
+        for (int y = inside.top(); y <= inside.bottom(); ++y) {
+            std::memcpy(bits + y * stride + inside.left() * sizeof(QRgb),
+                        pixels.constScanLine(y - rect.top()) + (inside.left() - rect.left()) * sizeof(QRgb),
+                        inside.width() * sizeof(QRgb));
+        }
+        // 窗口里相交的块只有一部分被改写，它们的当前状态重新取
+        for (int ty = inside.top() / m_tileSize; ty <= inside.bottom() / m_tileSize; ++ty) {
+            for (int tx = inside.left() / m_tileSize; tx <= inside.right() / m_tileSize; ++tx) {
+                const int index = ty * m_tilesX + tx;
+                m_tiles[index] = capture(image, tileRect(index));
+                compress(m_tiles[index]);
+            }
+        }
+        dirty |= inside;
+    }
+    return dirty;
+}
+
+void UndoHistory::setMemoryBudget(qint64 bytes) {
+    m_budget = qMax<qint64>(0, bytes);
+    enforceBudget();
+}
+
+void UndoHistory::enforceBudget() {
+    // 当前状态本身不能丢；先丢最早的撤销步骤，不够再丢最远的重做步骤
+    while (m_usage > m_budget && m_current > 0) {
+        m_baseTag = m_steps.first().tag;
+        m_steps.removeFirst();
+        --m_current;
+    }
+    while (m_usage > m_budget && m_current < m_steps.size()) {
+        m_steps.removeLast();
+    }
+}
+
+} // namespace Raster
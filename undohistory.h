@@ -0,0 +1,106 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include <QSharedPointer>
+
+namespace Raster {
+
+class TiledCanvas;
+
+/**
+ * 按块记录的撤销/重做历史。
+ * 画布切成 tileSize×tileSize 的块，历史保存"当前已提交状态"的每一块；
+ * 一步编辑只为它改过的块保存新内容，改动前的内容与上一状态共享（写时复制）。
+ * 纯色块只存一个颜色；较早的步骤用 lzCompress 压缩；总占用超过预算时丢弃最早的步骤。
+ *
+ * 用法：像素改动后 markDirty(rect)，一次操作结束时 commit(image)；
+ * undo()/redo() 直接改写图像并返回改动区域。
+ * image 是无界文档在 origin 处的一个窗口，步骤按文档坐标记录：窗口平移或改变大小时用 moveWindow()，
+ * 历史照样保留；撤销到窗口之外的块时直接写回 TiledCanvas 文档。
+ * 每个状态可以带一个整数 tag（例如图元文档的修订号），撤销/重做后用 tag() 取回当前状态的值。
+ *
+ * 多个图层共用一条历史：每一步记在当时的层 layer() 名下，换层时用 setLayer() 换掉 image 而不清空历史。
+ * 撤销/重做前用 undoLayer()/redoLayer() 看这一步属于哪一层，不是手里这层时先换过去。
+ * 不改像素的操作（如删除图层）用 commitEvent() 记成一步，撤销/重做走到它时 event() 告诉调用方去做。
+ */
+class UndoHistory {
+public:
+    explicit UndoHistory(int tileSize = 64);
+    ~UndoHistory();
+
+    void reset(const QImage &image, int tag = 0, QPoint origin = QPoint());   // 以 image 为初始状态，清空历史
+    void moveWindow(const QImage &image, QPoint origin);   // 窗口换成文档 origin 处的 image（先 commit），历史保留
+    void setLayer(const QImage &image, int layer);         // 换成 layer 层的窗口 image（先 commit），历史保留
+    int layer() const { return m_layer; }
+    void markDirty(const QRect &rect);              // rect（窗口坐标）内的像素已被改动，等待 commit
+    bool commit(const QImage &image, int tag = 0);  // 把累计的改动记成一步；像素和 tag 都没变时返回 false
+    // 先提交未记录的改动，再撤销一步；落在窗口外的块写到 document。返回窗口内的改动区域（窗口坐标）
+    QRect undo(QImage &image, TiledCanvas *document = nullptr);
+    QRect redo(QImage &image, TiledCanvas *document = nullptr);
+    // 下一次撤销/重做改的像素属于哪一层，没有要改的像素时为 -1
+    int undoLayer() const;
+    int redoLayer() const;
+    // 记一步不改像素、由调用方解释的操作，event 不能为 0；像素改动要先 commit
+    void commitEvent(int event, int tag);
+    int event() const { return m_event; }   // 上一次撤销/重做走过的那一步的 event，普通步骤为 0
+
+    bool canUndo() const { return m_current > 0; }
+    bool canRedo() const { return m_current < m_steps.size(); }
+    int tag() const { return m_current > 0 ? m_steps[m_current - 1].tag : m_baseTag; }
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const { return m_budget; }
+    qint64 memoryUsage() const { return m_usage; }
+
+private:
+    struct TileData;
+    typedef QSharedPointer<TileData> TilePtr;
+    struct Change {
+        QRect rect;         // 文档坐标
+        TilePtr before;
+        TilePtr after;
+    };
+    struct Step {
+        QVector<Change> changes;
+        QRect rect;         // 文档坐标
+        int tag;
+        int layer = 0;
+        int event = 0;
+    };
+
+    void setWindow(QSize size, QPoint origin);
+    void captureAll(const QImage &image);
+    void append(const Step &step);
+    QRect tileRect(int tile) const;                 // 窗口坐标
+    int tileAt(const QRect &rect) const;            // 恰好是窗口里一块的 rect（窗口坐标）对应的块号，否则 -1
+    TilePtr capture(const QImage &image, const QRect &rect);
+    void restore(uchar *bits, qsizetype stride, const QRect &rect, const TileData &data);
+    QRect apply(QImage &image, TiledCanvas *document, const Step &step, bool redo);
+    const char *pixels(const TileData &data, QByteArray &scratch) const;   // 压缩的块先解到 scratch
+    bool sameContent(const TileData &a, const TileData &b);
+    void compress(const TilePtr &data);
+    void enforceBudget();
+
+    int m_tileSize;
+    int m_tilesX = 0;
+    QSize m_size;                       // 窗口
+    QPoint m_origin;                    // 窗口左上角的文档坐标
+    qint64 m_budget = qint64(256) << 20;
+    qint64 m_usage = 0;                 // 块数据析构时会回写，必须先于下面的容器声明
+    QVector<TilePtr> m_tiles;           // 窗口内各块的当前已提交状态
+    QVector<int> m_pendingTiles;        // 改动过、尚未提交的块
+    QVector<bool> m_pendingMark;
+    QVector<Step> m_steps;
+    int m_current = 0;                  // [0, m_current) 可撤销，其余可重做
+    int m_baseTag = 0;                  // 最早一个状态的 tag
+    int m_layer = 0;                    // m_tiles 属于哪一层
+    int m_event = 0;
+    QByteArray m_scratch;
+    QByteArray m_compareScratch;
+};
+
+} // namespace Raster
+
+#endif // UNDOHISTORY_H
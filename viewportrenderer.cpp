@@ -0,0 +1,483 @@
+#include "viewportrenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CANVAS_VIEWPORT_SSE2
+#endif
+
+namespace Raster {
+
+// a·b/255，四舍五入
+static inline int mul255(int a, int b) {
+    const int x = a * b + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// 预乘像素叠到不透明背景上：p + bg·(1-pa)，alpha 得到 255
+static inline QRgb overBackground(const int p[4], QRgb background) {
+    const int inv = 255 - p[3];
+    return qRgb(p[2] + mul255(qRed(background), inv), p[1] + mul255(qGreen(background), inv),
+                p[0] + mul255(qBlue(background), inv));
+}
+
+static inline void unpack(QRgb value, bool premultiplied, int p[4]) {
+    const int a = qAlpha(value);
+    p[3] = a;
+    if (premultiplied) {
+        p[0] = qBlue(value);
+        p[1] = qGreen(value);
+        p[2] = qRed(value);
+    } else {
+        p[0] = mul255(qBlue(value), a);
+        p[1] = mul255(qGreen(value), a);
+        p[2] = mul255(qRed(value), a);
+    }
+}
+
+// (a·(256-w) + b·w + 128) >> 8，w 为 0..256
+static inline int lerp256(int a, int b, int w) {
+    return (a * (256 - w) + b * w + 128) >> 8;
+}
+
+// 四个取样按 fx/fy 插值；先上下再左右，与 SIMD 内核的顺序相同
+static inline void bilinear(const int t0[4], const int t1[4], const int b0[4], const int b1[4], int fx, int fy,
+                            int p[4]) {
+    for (int c = 0; c < 4; ++c) {
+        p[c] = lerp256(lerp256(t0[c], b0[c], fy), lerp256(t1[c], b1[c], fy), fx);
+    }
+}
+
+void scaleRowNearestScalar(QRgb *dst, const QRgb *src, const int *index, int count, bool premultiplied,
+                           QRgb background) {
+    for (int i = 0; i < count; ++i) {
+        int p[4];
+        unpack(src[index[i]], premultiplied, p);
+        dst[i] = overBackground(p, background);
+    }
+}
+
+void scaleRowBilinearScalar(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index,
+                            const int *weight, int count, bool premultiplied, QRgb background) {
+    for (int i = 0; i < count; ++i) {
+        const int x = index[i];
+        int t0[4], t1[4], b0[4], b1[4], p[4];
+        unpack(row0[x], premultiplied, t0);
+        unpack(row0[x + 1], premultiplied, t1);
+        unpack(row1[x], premultiplied, b0);
+        unpack(row1[x + 1], premultiplied, b1);
+        bilinear(t0, t1, b0, b1, weight[i], fy, p);
+        dst[i] = overBackground(p, background);
+    }
+}
+
+#if defined(CANVAS_VIEWPORT_SSE2)
+
+namespace {
+
+// 16 位通道上的公共运算，每 128 位两个像素
+struct Lanes {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i alpha255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    __m128i background;
+
+    explicit Lanes(QRgb bg) : background(_mm_unpacklo_epi8(_mm_set1_epi32(int(bg | 0xff000000u)), zero)) {}
+
+    __m128i mul(__m128i a, __m128i b) const {
+        const __m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), c128);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+    static __m128i alphaOf(__m128i v) {
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    __m128i premultiply(__m128i v) const {
+        return mul(_mm_or_si128(v, alpha255), alphaOf(v));
+    }
+    // 背景的 alpha 是 255，结果的 alpha 通道 pa + (255-pa) 正好是 255
+    __m128i over(__m128i p) const {
+        return _mm_add_epi16(p, mul(background, _mm_sub_epi16(c255, alphaOf(p))));
+    }
+};
+
+} // namespace
+
+template <bool Premultiplied>
+static void nearestSpan(QRgb *dst, const QRgb *src, const int *index, int count, QRgb background) {
+    const Lanes lanes(background);
+    const __m128i alphaBits = _mm_set1_epi32(int(0xff000000u));
+    const __m128i fill = _mm_set1_epi32(int(background | 0xff000000u));
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i sp = _mm_setr_epi32(int(src[index[i]]), int(src[index[i + 1]]), int(src[index[i + 2]]),
+                                          int(src[index[i + 3]]));
+        const __m128i alpha = _mm_and_si128(sp, alphaBits);
+        __m128i out;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaBits)) == 0xffff) {
+            out = sp;   // 整组不透明，预乘与否都一样
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, lanes.zero)) == 0xffff && !Premultiplied) {
+            out = fill;   // 整组全透明
+        } else {
+            __m128i lo = _mm_unpacklo_epi8(sp, lanes.zero);
+            __m128i hi = _mm_unpackhi_epi8(sp, lanes.zero);
+            if (!Premultiplied) {
+                lo = lanes.premultiply(lo);
+                hi = lanes.premultiply(hi);
+            }
+            out = _mm_packus_epi16(lanes.over(lo), lanes.over(hi));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+    scaleRowNearestScalar(dst + i, src, index + i, count - i, Premultiplied, background);
+}
+
+template <bool Premultiplied>
+static void bilinearSpan(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index,
+                         const int *weight, int count, QRgb background) {
+    const Lanes lanes(background);
+    const __m128i wy0 = _mm_set1_epi16(short(256 - fy));
+    const __m128i wy1 = _mm_set1_epi16(short(fy));
+    for (int i = 0; i < count; ++i) {
+        const int x = index[i];
+        const int fx = weight[i];
+        // 一次取相邻两列：低 64 位是左边的像素，高 64 位是右边的
+        __m128i t = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row0 + x)), lanes.zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row1 + x)), lanes.zero);
+        if (!Premultiplied) {
+            t = lanes.premultiply(t);
+            b = lanes.premultiply(b);
+        }
+        // 每项不超过 255·256，加上舍入也在 16 位无符号范围内
+        __m128i v = _mm_add_epi16(_mm_mullo_epi16(t, wy0), _mm_mullo_epi16(b, wy1));
+        v = _mm_srli_epi16(_mm_add_epi16(v, lanes.c128), 8);
+        const __m128i wx = _mm_unpacklo_epi64(_mm_set1_epi16(short(256 - fx)), _mm_set1_epi16(short(fx)));
+        v = _mm_mullo_epi16(v, wx);
+        v = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, _mm_srli_si128(v, 8)), lanes.c128), 8);
+        dst[i] = QRgb(_mm_cvtsi128_si32(_mm_packus_epi16(lanes.over(v), lanes.zero)));
+    }
+}
+
+void scaleRowNearest(QRgb *dst, const QRgb *src, const int *index, int count, bool premultiplied, QRgb background) {
+    if (premultiplied) nearestSpan<true>(dst, src, index, count, background);
+    else nearestSpan<false>(dst, src, index, count, background);
+}
+
+void scaleRowBilinear(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index, const int *weight,
+                      int count, bool premultiplied, QRgb background) {
+    if (premultiplied) bilinearSpan<true>(dst, row0, row1, fy, index, weight, count, background);
+    else bilinearSpan<false>(dst, row0, row1, fy, index, weight, count, background);
+}
+
+const char *viewportScalerKernel() {
+    return "SSE2";
+}
+
+#else
+
+void scaleRowNearest(QRgb *dst, const QRgb *src, const int *index, int count, bool premultiplied, QRgb background) {
+    scaleRowNearestScalar(dst, src, index, count, premultiplied, background);
+}
+
+void scaleRowBilinear(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index, const int *weight,
+                      int count, bool premultiplied, QRgb background) {
+    scaleRowBilinearScalar(dst, row0, row1, fy, index, weight, count, premultiplied, background);
+}
+
+const char *viewportScalerKernel() {
+    return "scalar";
+}
+
+#endif
+
+ViewportRenderer::ViewportRenderer(int tileSize) :
+    m_tileSize(qMax(16, tileSize))
+{
+}
+
+ViewportRenderer::Filter ViewportRenderer::filterFor(double scale) {
+    // 整数倍放大时每个源像素正好占整数个视口像素，最近邻既快又不发虚
+    return scale >= 1.0 && std::abs(scale - std::round(scale)) < 1e-6 ? Nearest : Bilinear;
+}
+
+void ViewportRenderer::clear() {
+    m_valid.fill(false);
+}
+
+void ViewportRenderer::buildAxis(Axis &axis, int length, double offset, int sourceLength) const {
+    const double step = 1.0 / (m_zoom * m_sourceScale);   // 每个视口像素跨过的源像素
+    axis.index.resize(length);
+    axis.weight.resize(length);
+    axis.insideBegin = axis.interiorBegin = length;
+    axis.insideEnd = axis.interiorEnd = 0;
+    for (int d = 0; d < length; ++d) {
+        const double s = (d + 0.5 - offset) * step;   // 视口像素中心对应的源坐标
+        int index, weight = 0;
+        bool inside, interior;
+        if (m_filter == Nearest) {
+            index = int(std::floor(s));
+            inside = interior = index >= 0 && index < sourceLength;
+        } else {
+            const double left = s - 0.5;
+            index = int(std::floor(left));
+            weight = int(std::lround((left - index) * 256));
+            if (weight == 256) {
+                ++index;
+                weight = 0;
+            }
+            inside = index >= -1 && index < sourceLength;
+            interior = index >= 0 && index + 1 < sourceLength;
+        }
+        axis.index[d] = index;
+        axis.weight[d] = weight;
+        // 映射是单调的，两种范围都是连续的一段
+        if (inside) {
+            axis.insideBegin = qMin(axis.insideBegin, d);
+            axis.insideEnd = d + 1;
+        }
+        if (interior) {
+            axis.interiorBegin = qMin(axis.interiorBegin, d);
+            axis.interiorEnd = d + 1;
+        }
+    }
+    if (axis.interiorBegin >= axis.interiorEnd) axis.interiorBegin = axis.interiorEnd = axis.insideBegin;
+}
+
+void ViewportRenderer::setView(const QImage &source, int sourceScale, double zoom, QPointF offset, QSize size,
+                               QRgb background) {
+    if (m_image.size() != size) {
+        m_image = QImage(size, QImage::Format_RGB32);
+        m_tilesX = (size.width() + m_tileSize - 1) / m_tileSize;
+        const int tilesY = (size.height() + m_tileSize - 1) / m_tileSize;
+        m_valid = QVector<bool>(m_tilesX * tilesY, false);
+    }
+    m_sourceId = source.cacheKey() >> 32;
+    m_sourceSize = source.size();
+    m_sourceFormat = source.format();
+    m_sourceScale = sourceScale;
+    m_zoom = zoom;
+    m_offset = offset;
+    m_background = background;
+    m_filter = filterFor(zoom * sourceScale);
+    m_premultiplied = m_sourceFormat != QImage::Format_ARGB32;
+    buildAxes();
+    clear();
+}
+
+void ViewportRenderer::buildAxes() {
+    buildAxis(m_columns, m_image.width(), m_offset.x(), m_sourceSize.width());
+    buildAxis(m_rows, m_image.height(), m_offset.y(), m_sourceSize.height());
+}
+
+void ViewportRenderer::rebase(const QRect &previous, QPointF shift) {
+    if (m_image.isNull()) return;
+    m_offset += shift;
+    m_previous = m_rebased ? QRect() : previous;   // 两次换源之间没渲染过时整体重算
+    m_rebased = true;
+}
+
+void ViewportRenderer::adoptSource(const QImage &source) {
+    m_sourceId = source.cacheKey() >> 32;
+    m_sourceSize = source.size();
+    m_sourceFormat = source.format();
+    m_premultiplied = m_sourceFormat != QImage::Format_ARGB32;
+    // 只有新旧源图像都覆盖、且离两边边缘都够远的部分沿用；原来画成背景或边缘过渡的像素按块重算
+    const QRect common = m_previous.intersected(QRect(0, 0, m_sourceSize.width() * m_sourceScale,
+                                                              m_sourceSize.height() * m_sourceScale));
+    const double margin = 2.0 * m_sourceScale;
+    const QRect inner = common.isEmpty() ? QRect()
+        : QRect(QPoint(int(std::ceil((common.left() + margin) * m_zoom + m_offset.x())),
+                       int(std::ceil((common.top() + margin) * m_zoom + m_offset.y()))),
+                QPoint(int(std::floor((common.right() + 1 - margin) * m_zoom + m_offset.x())) - 1,
+                       int(std::floor((common.bottom() + 1 - margin) * m_zoom + m_offset.y())) - 1));
+    for (int ty = 0; ty * m_tileSize < m_image.height(); ++ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            const QRect bounds = QRect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize)
+                                     .intersected(m_image.rect());
+            if (!inner.contains(bounds)) m_valid[ty * m_tilesX + tx] = false;
+        }
+    }
+}
+
+void ViewportRenderer::scroll(const QImage &source, int dx, int dy, const QRect &area) {
+    const int width = m_image.width();
+    const int height = m_image.height();
+    // 保留下来的像素整体平移，行内可能重叠，用 memmove
+    const int span = width - qAbs(dx);
+    const int fromX = qMax(-dx, 0), toX = qMax(dx, 0);
+    auto moveRow = [&](int y) {
+        std::memmove(reinterpret_cast<QRgb *>(m_image.scanLine(y)) + toX,
+                     reinterpret_cast<const QRgb *>(m_image.constScanLine(y - dy)) + fromX,
+                     size_t(span) * sizeof(QRgb));
+    };
+    if (dy > 0) {
+        for (int y = height - 1; y >= dy; --y) moveRow(y);
+    } else {
+        for (int y = 0; y < height + dy; ++y) moveRow(y);
+    }
+
+    // 新露出的左右、上下两条带
+    QRect strips[2];
+    if (dx > 0) strips[0] = QRect(0, 0, dx, height);
+    else if (dx < 0) strips[0] = QRect(width + dx, 0, -dx, height);
+    if (dy > 0) strips[1] = QRect(0, 0, width, dy);
+    else if (dy < 0) strips[1] = QRect(0, height + dy, width, -dy);
+
+    // 块的有效性：保留部分来自的旧块都有效，露出的条带这次也都画了，才算有效
+    const QRect kept = m_image.rect().intersected(m_image.rect().translated(dx, dy));
+    const QVector<bool> previous = m_valid;
+    for (int ty = 0; ty * m_tileSize < height; ++ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            const QRect bounds = QRect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize)
+                                     .intersected(m_image.rect());
+            bool valid = true;
+            const QRect from = bounds.intersected(kept).translated(-dx, -dy);
+            for (int y = from.top() / m_tileSize; valid && !from.isEmpty() && y <= from.bottom() / m_tileSize; ++y) {
+                for (int x = from.left() / m_tileSize; valid && x <= from.right() / m_tileSize; ++x) {
+                    valid = previous[y * m_tilesX + x];
+                }
+            }
+            for (const QRect &strip : strips) {
+                const QRect part = bounds.intersected(strip);
+                if (!part.isEmpty() && !area.contains(part)) valid = false;
+            }
+            m_valid[ty * m_tilesX + tx] = valid;
+        }
+    }
+    for (const QRect &strip : strips) {
+        const QRect part = strip.intersected(area);
+        if (!part.isEmpty()) renderTile(source, part);
+    }
+}
+
+const QImage &ViewportRenderer::render(const QImage &source, int sourceScale, double zoom, QPointF offset, QSize size,
+                                       QRgb background, const QRect &area) {
+    background |= 0xff000000u;
+    const QRect rect = area.intersected(QRect(QPoint(0, 0), size));
+    const bool sameScale = size == m_image.size() && sourceScale == m_sourceScale && zoom == m_zoom
+        && background == m_background;
+    const bool adopted = m_rebased && sameScale;
+    if (adopted) adoptSource(source);
+    m_rebased = false;
+
+    const bool sameSource = (source.cacheKey() >> 32) == m_sourceId && source.size() == m_sourceSize
+        && source.format() == m_sourceFormat;
+    // 只平移了整数个视口像素时挪动已有的像素，只画新露出的条带
+    const QPointF shift = offset - m_offset;
+    const QPoint delta(qRound(shift.x()), qRound(shift.y()));
+    const bool scrolled = std::abs(shift.x() - delta.x()) < 1e-6 && std::abs(shift.y() - delta.y()) < 1e-6
+        && qAbs(delta.x()) < size.width() && qAbs(delta.y()) < size.height();
+    if (!sameScale || !sameSource || (offset != m_offset && !scrolled)) {
+        setView(source, sourceScale, zoom, offset, size, background);
+    } else if (offset != m_offset) {
+        m_offset = offset;
+        buildAxes();
+        if (!delta.isNull()) scroll(source, delta.x(), delta.y(), rect);
+    } else if (adopted) {
+        buildAxes();   // 源图像的大小可能变了
+    }
+    if (rect.isEmpty()) return m_image;
+
+    for (int ty = rect.top() / m_tileSize; ty <= rect.bottom() / m_tileSize; ++ty) {
+        for (int tx = rect.left() / m_tileSize; tx <= rect.right() / m_tileSize; ++tx) {
+            const int tile = ty * m_tilesX + tx;
+            if (m_valid[tile]) continue;
+            // 调用方只保证 area 附近的源像素是最新的，只露出一部分的块只算露出的部分，下次仍然失效
+            const QRect bounds = QRect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize)
+                                     .intersected(m_image.rect());
+            const QRect part = bounds.intersected(rect);
+            renderTile(source, part);
+            m_valid[tile] = part == bounds;
+        }
+    }
+    return m_image;
+}
+
+void ViewportRenderer::invalidate(const QRect &canvasRect) {
+    if (m_image.isNull() || canvasRect.isEmpty()) return;
+    // 双线性还会取到相邻的一个源像素，两边各多算一个源像素再放宽一个视口像素
+    const double margin = m_sourceScale;
+    auto toView = [this](double canvas, double offset, int limit) {
+        return int(qBound(-1.0, canvas * m_zoom + offset, double(limit)));
+    };
+    const int left = toView(canvasRect.left() - margin, m_offset.x(), m_image.width()) - 1;
+    const int top = toView(canvasRect.top() - margin, m_offset.y(), m_image.height()) - 1;
+    const int right = toView(canvasRect.right() + 1 + margin, m_offset.x(), m_image.width()) + 1;
+    const int bottom = toView(canvasRect.bottom() + 1 + margin, m_offset.y(), m_image.height()) + 1;
+    markTiles(QRect(QPoint(left, top), QPoint(right, bottom)));
+}
+
+void ViewportRenderer::markTiles(const QRect &rect) {
+    const QRect area = rect.intersected(m_image.rect());
+    if (area.isEmpty()) return;
+    for (int ty = area.top() / m_tileSize; ty <= area.bottom() / m_tileSize; ++ty) {
+        for (int tx = area.left() / m_tileSize; tx <= area.right() / m_tileSize; ++tx) {
+            m_valid[ty * m_tilesX + tx] = false;
+        }
+    }
+}
+
+QRgb ViewportRenderer::sampleEdge(const QImage &source, int x, int y) const {
+    // 落在图外的取样当作全透明，画布边缘向背景过渡
+    const int sx = m_columns.index[x], sy = m_rows.index[y];
+    int taps[4][4];
+    for (int n = 0; n < 4; ++n) {
+        const int px = sx + (n & 1), py = sy + (n >> 1);
+        if (px < 0 || py < 0 || px >= m_sourceSize.width() || py >= m_sourceSize.height()) {
+            std::fill(taps[n], taps[n] + 4, 0);
+        } else {
+            unpack(reinterpret_cast<const QRgb *>(source.constScanLine(py))[px], m_premultiplied, taps[n]);
+        }
+    }
+    int p[4];
+    bilinear(taps[0], taps[1], taps[2], taps[3], m_columns.weight[x], m_rows.weight[y], p);
+    return overBackground(p, m_background);
+}
+
+void ViewportRenderer::renderTile(const QImage &source, const QRect &tile) {
+    const int left = tile.left();
+    const int right = tile.right() + 1;
+    // 行内按映射分成：背景 | 边缘（部分取样在图外）| 内部 | 边缘 | 背景
+    const int insideBegin = qBound(left, m_columns.insideBegin, right);
+    const int insideEnd = qBound(insideBegin, m_columns.insideEnd, right);
+    const int interiorBegin = qBound(insideBegin, m_columns.interiorBegin, insideEnd);
+    const int interiorEnd = qBound(interiorBegin, m_columns.interiorEnd, insideEnd);
+    const int *index = m_columns.index.constData();
+    const int *weight = m_columns.weight.constData();
+
+    for (int y = tile.top(); y <= tile.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(m_image.scanLine(y));
+        const int sy = m_rows.index[y];
+        if (y > tile.top() && sy == m_rows.index[y - 1] && m_rows.weight[y] == m_rows.weight[y - 1]) {
+            // 放大时连续几行取的是同一源行，直接复制上一行
+            std::memcpy(line + left, reinterpret_cast<const QRgb *>(m_image.constScanLine(y - 1)) + left,
+                        size_t(right - left) * sizeof(QRgb));
+            continue;
+        }
+        if (y < m_rows.insideBegin || y >= m_rows.insideEnd || insideBegin == insideEnd) {
+            std::fill(line + left, line + right, m_background);
+            continue;
+        }
+        std::fill(line + left, line + insideBegin, m_background);
+        std::fill(line + insideEnd, line + right, m_background);
+
+        if (m_filter == Nearest) {
+            const QRgb *row = reinterpret_cast<const QRgb *>(source.constScanLine(sy));
+            scaleRowNearest(line + insideBegin, row, index + insideBegin, insideEnd - insideBegin, m_premultiplied,
+                            m_background);
+        } else if (y >= m_rows.interiorBegin && y < m_rows.interiorEnd) {
+            const QRgb *row0 = reinterpret_cast<const QRgb *>(source.constScanLine(sy));
+            const QRgb *row1 = reinterpret_cast<const QRgb *>(source.constScanLine(sy + 1));
+            for (int x = insideBegin; x < interiorBegin; ++x) line[x] = sampleEdge(source, x, y);
+            scaleRowBilinear(line + interiorBegin, row0, row1, m_rows.weight[y], index + interiorBegin,
+                             weight + interiorBegin, interiorEnd - interiorBegin, m_premultiplied, m_background);
+            for (int x = interiorEnd; x < insideEnd; ++x) line[x] = sampleEdge(source, x, y);
+        } else {
+            for (int x = insideBegin; x < insideEnd; ++x) line[x] = sampleEdge(source, x, y);
+        }
+    }
+}
+
+} // namespace Raster
@@ -0,0 +1,105 @@
+#ifndef VIEWPORTRENDERER_H
+#define VIEWPORTRENDERER_H
+
+#include <QImage>
+#include <QVector>
+
+namespace Raster {
+
+/**
+ * 视口缩放内核：把源图像的一行采样到目标行上，再叠到不透明的背景色上，输出 RGB32。
+ * index/weight 是每个目标像素对应的源列（双线性时是左边那列）和右边那列的权重（0..256，定点 8 位）。
+ * premultiplied 为 false 时源像素是非预乘 ARGB32，采样前先预乘。
+ * 最近邻一次 4 个像素；双线性先上下再左右插值，一个像素的四个通道一起算。结果与标量实现逐像素相同。
+ */
+void scaleRowNearest(QRgb *dst, const QRgb *src, const int *index, int count, bool premultiplied, QRgb background);
+void scaleRowBilinear(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index, const int *weight,
+                      int count, bool premultiplied, QRgb background);   // 要求 index[i] + 1 也在行内
+
+// 标量参考实现，同时用于 SIMD 的尾部像素
+void scaleRowNearestScalar(QRgb *dst, const QRgb *src, const int *index, int count, bool premultiplied,
+                           QRgb background);
+void scaleRowBilinearScalar(QRgb *dst, const QRgb *row0, const QRgb *row1, int fy, const int *index,
+                            const int *weight, int count, bool premultiplied, QRgb background);
+
+// 当前编译进来的内核名称："SSE2" / "scalar"（采样是查表收集，AVX2 编译时也用 SSE2 内核）
+const char *viewportScalerKernel();
+
+/**
+ * 画布视口的缩放结果缓存。视口图像（RGB32，视口像素）按 tileSize×tileSize 分块，
+ * render() 只重算请求范围（通常是 paintEvent 露出的部分）内失效的块，代价与屏幕像素成正比，与画布大小无关；
+ * 源图像只需在请求范围对应的画布范围（多留一个源像素）内是最新的。
+ * 放大整数倍（含 1:1）时用最近邻，其余倍数用双线性。
+ *
+ * 缩放倍数、视口大小、背景色或源图像换了时整体失效；源图像原地改动后用 invalidate() 报告画布范围。
+ * 源图像用 cacheKey 的高 32 位识别：那是图像数据的序号，原地改写不变，换成另一幅图像才变。
+ * 偏移只变了整数个视口像素（平移）时已有像素整体挪过去，只重算新露出的条带，代价与露出的面积成正比。
+ */
+class ViewportRenderer {
+public:
+    enum Filter { Nearest, Bilinear };
+
+    explicit ViewportRenderer(int tileSize = 64);
+
+    static Filter filterFor(double scale);   // 每个源像素占多少视口像素
+
+    /**
+     * source 的每个像素覆盖 sourceScale×sourceScale 个画布像素（缩略图时为 2^n），
+     * 画布坐标 p 显示在视口的 p·zoom + offset 处，视口外的部分是背景色。
+     * 返回的图像由本对象持有，area（视口坐标）内保证是最新的，下一次调用前有效。
+     */
+    const QImage &render(const QImage &source, int sourceScale, double zoom, QPointF offset, QSize size,
+                         QRgb background, const QRect &area);
+    void invalidate(const QRect &canvasRect);   // 源图像在这个画布范围内的像素改了
+    void clear();
+    /**
+     * 源图像换成了内容相同、坐标平移过的另一幅（画布窗口移动）：previous 是旧源图像在新画布坐标下的范围，
+     * 偏移随之变了 shift（视口像素）。下次 render() 沿用已有像素，只重算原来在旧源图像边缘和外面的块。
+     */
+    void rebase(const QRect &previous, QPointF shift);
+
+    Filter filter() const { return m_filter; }
+    qint64 memoryUsage() const { return m_image.sizeInBytes(); }
+
+private:
+    // 一个方向上每个视口像素对应的源坐标；inside 是至少取到一个源像素的范围，interior 是取到的都在图内的范围
+    struct Axis {
+        QVector<int> index;
+        QVector<int> weight;
+        int insideBegin = 0, insideEnd = 0;
+        int interiorBegin = 0, interiorEnd = 0;
+    };
+    void setView(const QImage &source, int sourceScale, double zoom, QPointF offset, QSize size, QRgb background);
+    void buildAxis(Axis &axis, int length, double offset, int sourceLength) const;
+    void buildAxes();
+    void adoptSource(const QImage &source);
+    // 已有像素平移 (dx, dy)，新露出的条带在 area 内的部分马上画
+    void scroll(const QImage &source, int dx, int dy, const QRect &area);
+    void markTiles(const QRect &rect);
+    void renderTile(const QImage &source, const QRect &tile);
+    QRgb sampleEdge(const QImage &source, int x, int y) const;   // 双线性时部分取样落在图外的像素
+
+    int m_tileSize;
+    int m_tilesX = 0;
+    QImage m_image;
+    QVector<bool> m_valid;   // 每块是否最新
+
+    // 当前视图参数
+    qint64 m_sourceId = -1;
+    QSize m_sourceSize;
+    QImage::Format m_sourceFormat = QImage::Format_Invalid;
+    int m_sourceScale = 1;
+    double m_zoom = 0.0;
+    QPointF m_offset;
+    QRgb m_background = 0;
+    Filter m_filter = Nearest;
+    bool m_premultiplied = false;
+    Axis m_columns;
+    Axis m_rows;
+    bool m_rebased = false;   // rebase() 之后还没渲染过
+    QRect m_previous;
+};
+
+} // namespace Raster
+
+#endif // VIEWPORTRENDERER_H